@@ -0,0 +1,48 @@
+#if !defined(B9_ARRAYKERNELS_HPP_)
+#define B9_ARRAYKERNELS_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace b9 {
+
+/// Bulk operations on the elements of b9 arrays, which hold the payloads of
+/// Int48 values. Results wrap to 48 bits, like INT_ADD and INT_MUL do.
+///
+/// There is a set of kernels per instruction set. The vector sets are compiled
+/// with target attributes, so the library runs on any x86-64, and the best set
+/// the CPU supports is picked at runtime.
+struct ArrayKernels {
+  const char *name;
+
+  /// The sum of the elements.
+  std::int64_t (*sum)(const std::int64_t *data, std::size_t n);
+  /// The least element. n must not be zero.
+  std::int64_t (*min)(const std::int64_t *data, std::size_t n);
+  /// The greatest element. n must not be zero.
+  std::int64_t (*max)(const std::int64_t *data, std::size_t n);
+  /// The number of elements equal to value.
+  std::size_t (*count)(const std::int64_t *data, std::size_t n,
+                       std::int64_t value);
+
+  void (*fill)(std::int64_t *data, std::size_t n, std::int64_t value);
+  /// data[i] = data[i] + value
+  void (*addScalar)(std::int64_t *data, std::size_t n, std::int64_t value);
+  /// data[i] = data[i] * value
+  void (*mulScalar)(std::int64_t *data, std::size_t n, std::int64_t value);
+  /// data[i] = data[i] + other[i]. The arrays may be the same one.
+  void (*add)(std::int64_t *data, const std::int64_t *other, std::size_t n);
+  /// data[i] = data[i] * other[i]. The arrays may be the same one.
+  void (*mul)(std::int64_t *data, const std::int64_t *other, std::size_t n);
+};
+
+/// The best kernels this CPU supports, chosen on first use.
+const ArrayKernels &arrayKernels();
+
+/// Every set of kernels this CPU supports, scalar first.
+std::vector<const ArrayKernels *> supportedArrayKernels();
+
+}  // namespace b9
+
+#endif  // B9_ARRAYKERNELS_HPP_
@@ -0,0 +1,100 @@
+#if !defined(B9_BATCHRUNNER_HPP_)
+#define B9_BATCHRUNNER_HPP_
+
+#include <b9/VirtualMachine.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace b9 {
+
+/// Runs many independent calls of one function on a pool of worker threads.
+///
+/// Each worker owns an ExecutionContext, which it reuses for every call it
+/// makes. A batch is split into ranges of calls, which are dealt out to the
+/// workers' queues. A worker takes ranges from the back of its own queue, and
+/// once that is empty, steals from the front of the other workers' queues.
+///
+/// Workers stay attached to the VM's Safepoint for a whole batch, and poll it
+/// between calls. Compiled code only polls when Config::multithreaded is set,
+/// so a worker in a long running compiled call would hold up every other
+/// thread's collection. A VM with the JIT on must have multithreaded set.
+class BatchRunner {
+ public:
+  /// Start the workers. With threads = 0, start one per hardware thread.
+  /// Throws std::runtime_error if the VM's JIT is on but
+  /// Config::multithreaded is not.
+  explicit BatchRunner(VirtualMachine &virtualMachine, std::size_t threads = 0);
+
+  ~BatchRunner() noexcept;
+
+  BatchRunner(const BatchRunner &) = delete;
+  BatchRunner &operator=(const BatchRunner &) = delete;
+
+  std::size_t threads() const { return workers_.size(); }
+
+  /// Call a function once per tuple of arguments. args holds count tuples of
+  /// the function's nparams arguments each, back to back. The result of call i
+  /// is stored in results[i]. Calls run in no particular order. If any call
+  /// throws, the rest of the batch is abandoned, and the first exception is
+  /// rethrown here. Concurrent batches are run one after the other.
+  void run(std::size_t functionIndex, const StackElement *args,
+           std::size_t count, StackElement *results);
+
+  /// Call a function count times. args holds the arguments of every call, as
+  /// above, and is empty for a function without parameters. Returns the
+  /// results in order.
+  std::vector<StackElement> run(std::size_t functionIndex, std::size_t count,
+                                const std::vector<StackElement> &args = {});
+
+  /// Call a function once per tuple of arguments in args, taking the count
+  /// from its size. The function must have parameters.
+  std::vector<StackElement> run(std::size_t functionIndex,
+                                const std::vector<StackElement> &args);
+
+ private:
+  struct Range {
+    std::size_t begin;
+    std::size_t end;
+  };
+
+  struct Worker {
+    std::thread thread;
+    std::mutex mutex;
+    std::deque<Range> ranges;
+  };
+
+  void work(std::size_t id);
+
+  /// Take a range from the worker's own queue, or steal one.
+  bool take(std::size_t id, Range &range);
+
+  VirtualMachine &virtualMachine_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+
+  std::mutex batchMutex_;
+  std::mutex mutex_;
+  std::condition_variable start_;
+  std::condition_variable finished_;
+  std::size_t generation_ = 0;
+  std::size_t running_ = 0;
+  bool shutdown_ = false;
+
+  // The current batch.
+  std::size_t functionIndex_ = 0;
+  std::size_t nparams_ = 0;
+  const StackElement *args_ = nullptr;
+  StackElement *results_ = nullptr;
+  std::atomic<bool> failed_{false};
+  std::exception_ptr error_;
+};
+
+}  // namespace b9
+
+#endif  // B9_BATCHRUNNER_HPP_
@@ -0,0 +1,97 @@
+#if !defined(B9_CONFIG_HPP_)
+#define B9_CONFIG_HPP_
+
+#include <cstddef>
+#include <ostream>
+
+namespace b9 {
+
+/// When an ExecutionContext writes out what primitives print. Output is also
+/// written out when the context is destroyed, under every policy.
+enum class OutputFlush {
+  LINE,      //< After every line
+  SIZE,      //< Whenever the buffer fills
+  EXPLICIT,  //< Only when the context's output() is flushed
+};
+
+inline std::ostream &operator<<(std::ostream &out, OutputFlush flush) {
+  switch (flush) {
+    case OutputFlush::LINE:
+      return out << "line";
+    case OutputFlush::SIZE:
+      return out << "size";
+    case OutputFlush::EXPLICIT:
+      return out << "explicit";
+  }
+  return out;
+}
+
+/// What the barrier on stores into objects records. Om's collector traces the
+/// whole heap on every collection, and needs nothing recorded. The other modes
+/// record what a collector that traces only part of it would need, but no
+/// such collector reads it yet.
+enum class WriteBarrier {
+  NONE,      //< Record nothing
+  REMEMBER,  //< Remember objects that references are stored into
+  SNAPSHOT,  //< Remember references that are overwritten
+};
+
+inline std::ostream &operator<<(std::ostream &out, WriteBarrier barrier) {
+  switch (barrier) {
+    case WriteBarrier::NONE:
+      return out << "none";
+    case WriteBarrier::REMEMBER:
+      return out << "remember";
+    case WriteBarrier::SNAPSHOT:
+      return out << "snapshot";
+  }
+  return out;
+}
+
+struct Config {
+  std::size_t maxInlineDepth = 0;  //< The JIT's max inline depth
+  bool jit = false;                //< Enable the JIT
+  bool directCall = false;         //< Enable direct JIT to JIT calls
+  bool passParam = false;          //< Pass arguments in CPU registers
+  bool lazyVmState = false;        //< Simulate the VM state
+  bool multithreaded = false;      //< Poll for safepoints in JIT code
+  bool debug = false;              //< Enable debug code
+  bool verbose = false;            //< Enable verbose printing and tracing
+  OutputFlush outputFlush = OutputFlush::SIZE;  //< When to write output
+  std::size_t outputBufferSize = 64 * 1024;     //< Output buffer capacity
+  bool outputThread = false;  //< Write output on a background thread
+  WriteBarrier writeBarrier = WriteBarrier::NONE;  //< What stores record
+  bool profile = false;  //< Count and time what the interpreter runs
+  bool perfMap = false;  //< Write a perf map of JIT compiled functions
+  bool jitDump = false;  //< Also write a jitdump, with the compiled code
+};
+
+/// True if code compiled under one config can be called under the other.
+inline bool sameJitOptions(const Config &a, const Config &b) {
+  return a.maxInlineDepth == b.maxInlineDepth && a.directCall == b.directCall &&
+         a.passParam == b.passParam && a.lazyVmState == b.lazyVmState &&
+         a.multithreaded == b.multithreaded && a.debug == b.debug;
+}
+
+inline std::ostream &operator<<(std::ostream &out, const Config &cfg) {
+  out << std::boolalpha;
+  out << "Mode:         " << (cfg.jit ? "JIT" : "Interpreter") << std::endl
+      << "Inline depth: " << cfg.maxInlineDepth << std::endl
+      << "directcall:   " << cfg.directCall << std::endl
+      << "passparam:    " << cfg.passParam << std::endl
+      << "lazyvmstate:  " << cfg.lazyVmState << std::endl
+      << "multithreaded:" << cfg.multithreaded << std::endl
+      << "debug:        " << cfg.debug << std::endl
+      << "output:       " << cfg.outputFlush
+      << (cfg.outputThread ? ", threaded" : "") << std::endl
+      << "barrier:      " << cfg.writeBarrier << std::endl
+      << "profile:      " << cfg.profile << std::endl
+      << "perfmap:      " << cfg.perfMap << std::endl
+      << "jitdump:      " << cfg.jitDump;
+  out << std::noboolalpha;
+  return out;
+}
+
+}  // namespace b9
+
+#endif  // B9_CONFIG_HPP_
@@ -2,18 +2,130 @@
 #define B9_EXECUTIONCONTEXT_HPP_
 
 #include <b9/OperandStack.hpp>
+#include <b9/OutputBuffer.hpp>
+#include <b9/Profile.hpp>
+#include <b9/TransitionCache.hpp>
 #include <b9/VirtualMachine.hpp>
 
+#include <chrono>
+#include <condition_variable>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_set>
+#include <vector>
 
 namespace b9 {
 
+/// Thrown by the checked interpreter when an unverified function does
+/// something that would corrupt the VM.
+struct RuntimeCheckException : public std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+/// Thrown when a call needs more operand stack than is left.
+struct StackOverflowException : public std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+/// Thrown when a primitive asks to suspend a context that can't be suspended.
+struct SuspendException : public std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+class Scheduler;
+
+/// The result of an ASYNC primitive, to be delivered later, possibly by another
+/// thread. If the calling context was started by a Scheduler and can be
+/// suspended, it is suspended, and the Scheduler resumes it with the result
+/// once complete() is called. Otherwise, the calling thread blocks until then.
+class Completion {
+ public:
+  /// Deliver the primitive's result. Must be called exactly once.
+  void complete(StackElement value) const;
+
+ private:
+  friend class ExecutionContext;
+
+  struct State {
+    Scheduler *scheduler;
+    ExecutionContext *context;
+    std::mutex mutex;
+    std::condition_variable completed;
+    bool done = false;
+    StackElement value;
+  };
+
+  explicit Completion(std::shared_ptr<State> state) : state_(state) {}
+
+  std::shared_ptr<State> state_;
+};
+
+/// A thread's state for running b9 code: the operand stack, and the frames of
+/// the interpreted functions it is running.
+///
+/// Interpreted calls don't recurse on the C++ stack; each one is a Frame on
+/// the context's own frame stack. That lets a context started with start() be
+/// suspended by a primitive that returns PrimitiveStatus::PENDING, and resumed
+/// later, so one thread can multiplex many calls waiting on I/O. Compiled code
+/// can't be suspended: a primitive called while a compiled frame is anywhere
+/// on the stack can't return PENDING, and is refused with a SuspendException.
 class ExecutionContext {
  public:
+  /// The number of empty objects NEW_OBJECT allocates at a time.
+  static constexpr std::size_t ALLOCATION_BUFFER_SIZE = 64;
+
+  /// The most objects the write barrier records between collections. Past
+  /// this, it stops recording and reports an overflow instead.
+  static constexpr std::size_t STORE_BUFFER_SIZE = 4096;
+
+  /// Objects with this many slots go into dictionary mode. Their new slots
+  /// are kept in a HashMap, rather than each making a new shape.
+  static constexpr std::size_t DICTIONARY_SLOT_LIMIT = 32;
+
+  /// Objects also go into dictionary mode when they would add a slot to a
+  /// non-empty shape that already has this many children in the
+  /// TransitionCache.
+  static constexpr std::size_t SHAPE_FAN_OUT_LIMIT = 8;
+
   ExecutionContext(VirtualMachine &virtualMachine, const Config &cfg);
 
+  /// Adds the context's allocations to the VM's GcStats.
+  ~ExecutionContext() noexcept;
+
+  /// Run a function to completion. The arguments must already be pushed.
   StackElement interpret(std::size_t functionIndex);
 
+  /// Start a call that may be suspended. args holds the function's nparams
+  /// arguments. Returns true if the call ran to completion, leaving its result
+  /// in result(), or false if a primitive suspended it. The calling thread must
+  /// not already be attached to the VM's safepoint.
+  bool start(std::size_t functionIndex, const StackElement *args);
+
+  /// Continue a suspended call on the thread that started it, with value as
+  /// the result of the primitive that suspended it. Returns as start() does.
+  bool resume(StackElement value);
+
+  bool suspended() const { return suspended_; }
+
+  /// The result of the last call that start() or resume() finished.
+  StackElement result() const { return result_; }
+
+  /// True if a primitive called now may suspend the context. A primitive that
+  /// would otherwise block can check this and fall back to blocking.
+  bool canSuspend() const { return resumable_ && nativeDepth_ == 0; }
+
+  /// For the running ASYNC primitive: make a Completion, and return
+  /// PrimitiveStatus::PENDING without pushing a result. The result is pushed
+  /// once the completion is completed.
+  Completion completion();
+
+  /// The Scheduler that runs this context's suspendable calls, if any.
+  Scheduler *scheduler() const { return scheduler_; }
+
+  /// Drop all frames and operands. Must be called before reusing a context
+  /// after an exception.
   void reset();
 
   StackElement pop();
@@ -22,11 +134,117 @@ class ExecutionContext {
 
   const OperandStack &stack() const { return stack_; }
 
+  /// Where primitives print. Buffered, and written out to the VM's output as
+  /// Config::outputFlush says.
+  std::ostream &output() { return output_->stream(); }
+
+  /// What the interpreter has run, or null unless Config::profile is set.
+  const Profile *profile() const { return profile_.get(); }
+
+  /// Visit the GC roots on the operand stack. The slots of interpreted frames
+  /// of verified functions are described by the function's RefMaps, and only
+  /// those that may hold references are visited. Everything else, including
+  /// the operands and spill slots of compiled code, is scanned in full.
   template <typename VisitorT>
   void visit(VisitorT &visitor) {
-    stack_.visit(visitor);
+    StackElement *cursor = stack_.begin();
+    for (std::size_t i = 0; i < frames_.size(); i++) {
+      const Frame &frame = frames_[i];
+      StackElement *end =
+          i + 1 < frames_.size() ? frames_[i + 1].params : stack_.top();
+      OperandStack::visit(visitor, cursor, frame.params);
+      const RefMap *map = refMap(frame);
+      if (map == nullptr) {
+        OperandStack::visit(visitor, frame.params, end);
+      } else {
+        for (StackElement *slot = frame.params; slot < end; slot++) {
+          if (map->mayRef(slot - frame.params) && slot->isRef()) {
+            visitor.edge(nullptr, Om::ValueSlotHandle(slot));
+          }
+        }
+      }
+      cursor = end;
+    }
+    OperandStack::visit(visitor, cursor, stack_.top());
+    // Drop the buffered objects not handed out yet, rather than keep them
+    // alive. NEW_OBJECT allocates more when it next needs one.
+    allocationNext_ = allocationEnd_;
+    OperandStack::visit(visitor, valueRoots_.data(),
+                        valueRoots_.data() + valueRoots_.size());
+    transitions_.visit(visitor);
+    // A collection has started. What was remembered before it is stale.
+    storeBuffer_.clear();
+    remembered_.clear();
+    storeBufferOverflowed_ = false;
+    collections_++;
   }
 
+  /// What this context has allocated so far.
+  const AllocationStats &allocationStats() const { return allocation_; }
+
+  /// The collections that visited this context's roots, whichever thread or
+  /// allocation started them.
+  std::size_t collections() const { return collections_; }
+
+  /// Keeps a value of any kind alive, and up to date, across allocations in
+  /// runtime code, for values that may or may not be references. Roots must
+  /// be released in the reverse of the order they were made.
+  class ValueRoot {
+   public:
+    ValueRoot(ExecutionContext &context, StackElement value)
+        : context_(context), index_(context.valueRoots_.size()) {
+      context_.valueRoots_.push_back(value);
+    }
+
+    ~ValueRoot() noexcept { context_.valueRoots_.pop_back(); }
+
+    ValueRoot(const ValueRoot &) = delete;
+
+    ValueRoot &operator=(const ValueRoot &) = delete;
+
+    StackElement get() const { return context_.valueRoots_[index_]; }
+
+    void set(StackElement value) { context_.valueRoots_[index_] = value; }
+
+   private:
+    ExecutionContext &context_;
+    std::size_t index_;
+  };
+
+  /// Record a store of value into object, over the slot's old value, as
+  /// Config::writeBarrier says. Every store into an object goes through here.
+  /// A store into a new slot has no old value.
+  void writeBarrier(Om::Object *object, const StackElement *old,
+                    StackElement value) {
+    switch (cfg_->writeBarrier) {
+      case WriteBarrier::NONE:
+        break;
+      case WriteBarrier::REMEMBER:
+        if (value.isRef()) {
+          remember(object);
+        }
+        break;
+      case WriteBarrier::SNAPSHOT:
+        if (old != nullptr && old->isRef()) {
+          remember(old->getRef<Om::Object>());
+        }
+        break;
+    }
+  }
+
+  /// What the write barrier recorded since the last collection, in order,
+  /// each object once: the objects that references were stored into under
+  /// REMEMBER, or the overwritten references under SNAPSHOT.
+  ///
+  /// Nothing reads this yet. Om's collector traces the whole heap, and the
+  /// buffer is groundwork for a collector that traces part of it.
+  const std::vector<Om::Object *> &storeBuffer() const { return storeBuffer_; }
+
+  /// True if more than STORE_BUFFER_SIZE objects were recorded since the last
+  /// collection. The buffer is then empty, and a collector would have to scan
+  /// the whole heap rather than what was recorded.
+  bool storeBufferOverflowed() const { return storeBufferOverflowed_; }
+
   Om::RunContext &omContext() { return omContext_; }
 
   operator Om::RunContext &() { return omContext_; }
@@ -36,7 +254,76 @@ class ExecutionContext {
   VirtualMachine *virtualMachine() const { return virtualMachine_; }
 
   // Available externally for jit-to-primitive calls.
-  void doPrimitiveCall(Immediate value);
+  PrimitiveStatus doPrimitiveCall(Immediate value);
+
+  // Available externally for compiled SYSTEM_COLLECT.
+  void doSystemCollect();
+
+  /// Take an empty object from the allocation buffer. Compiled code inlines
+  /// this, and only calls out to refill the buffer. Om still allocates each
+  /// object in full. The buffer saves NEW_OBJECT the call into the runtime,
+  /// and the stop of the world, for all but one object in a batch.
+  StackElement allocateObject() {
+    if (allocationNext_ == allocationEnd_) {
+      refillAllocationBuffer();
+    }
+    allocation_.objects++;
+    allocation_.bytes += sizeof(Om::Object);
+    return *allocationNext_++;
+  }
+
+  /// Allocate a new batch of up to ALLOCATION_BUFFER_SIZE empty objects, once
+  /// the buffer is used up. Stops early if a collection runs, since the
+  /// collection empties the buffer. May collect.
+  void refillAllocationBuffer();
+
+  // Arrays hold integers only. Available externally for compiled code.
+
+  /// Allocate an array of length zeroes. May collect.
+  StackElement newArray(StackElement length);
+
+  static StackElement arrayLength(StackElement array);
+
+  /// Load an element. Unless checked, the array and index must already be
+  /// known to be good.
+  static StackElement arrayLoad(StackElement array, StackElement index,
+                                bool checked);
+
+  /// Store an element. Unless checked, the array and index must already be
+  /// known to be good.
+  static void arrayStore(StackElement array, StackElement index,
+                         StackElement value, bool checked);
+
+  /// The elements of an array, for the bulk array primitives. Throws if the
+  /// value is not an array.
+  static std::int64_t *arrayElements(StackElement array, std::size_t &length);
+
+  // HashMaps. Available externally for compiled code.
+
+  /// Allocate an empty map. May collect.
+  StackElement newMap();
+
+  /// A key's value. Throws if the key is not in the map.
+  StackElement mapGet(StackElement map, StackElement key);
+
+  /// May collect.
+  void mapSet(StackElement map, StackElement key, StackElement value);
+
+  /// 1 if the key is in the map, or else 0.
+  StackElement mapHas(StackElement map, StackElement key);
+
+  /// Remove a key. 1 if it was in the map, or else 0.
+  StackElement mapDelete(StackElement map, StackElement key);
+
+  /// Equality for JMP_EQ and JMP_NEQ. Strings are equal if their characters
+  /// are. Available externally for compiled code.
+  bool equal(StackElement left, StackElement right);
+
+  /// Ordering for JMP_LT, JMP_LE, JMP_GT and JMP_GE: negative, zero or
+  /// positive as left is less than, equal to or greater than right. Int48s
+  /// compare by value and strings by character. Throws if the operands are
+  /// not both one or the other. Available externally for compiled code.
+  int compare(StackElement left, StackElement right);
 
   friend std::ostream &operator<<(std::ostream &stream,
                                   const ExecutionContext &ec);
@@ -44,8 +331,95 @@ class ExecutionContext {
  private:
   friend class VirtualMachine;
   friend class ExecutionContextOffset;
+  friend class Scheduler;
+
+  /// An interpreted function's activation. The instruction pointer is only
+  /// up to date while the frame is not the one running, and at GC points,
+  /// where it selects the frame's RefMap.
+  struct Frame {
+    const FunctionDef *function;
+    const FunctionSummary *summary;
+    const Instruction *instructionPointer;
+    StackElement *params;
+    StackElement *locals;
+    /// The function's RefMaps, or null if it was not verified.
+    const RefMap *refMaps;
+  };
+
+  /// The map of a frame's slots at its instruction pointer, or null if there
+  /// is none, and the frame must be scanned in full.
+  static const RefMap *refMap(const Frame &frame) {
+    if (frame.refMaps == nullptr) {
+      return nullptr;
+    }
+    const RefMap &map = frame.refMaps[frame.instructionPointer -
+                                      frame.function->instructions.data()];
+    return map.present ? &map : nullptr;
+  }
 
-  void doFunctionCall(Immediate value);
+  /// Why runFrame() stopped running its frame.
+  enum class FrameExit { CALL, RETURN, SUSPEND };
+
+  /// Keeps the other threads attached to the VM parked at a safepoint for
+  /// the lifetime of the scope. Om collects whenever an allocation runs out
+  /// of space, and a collection walks every attached thread's frames, so
+  /// every allocation that may collect happens inside one. Scopes nest.
+  /// Starting a scope may wait out another thread's collection, so anything
+  /// the caller holds across it must already be rooted. If a collection runs
+  /// inside the outermost scope, the whole pause is recorded in the VM's
+  /// GcStats.
+  class StopTheWorld {
+   public:
+    explicit StopTheWorld(
+        ExecutionContext &context,
+        GcStats::Cause cause = GcStats::Cause::ALLOCATION);
+
+    ~StopTheWorld() noexcept;
+
+    StopTheWorld(const StopTheWorld &) = delete;
+
+    StopTheWorld &operator=(const StopTheWorld &) = delete;
+
+   private:
+    ExecutionContext &context_;
+    GcStats::Cause cause_;
+    std::chrono::steady_clock::time_point start_;
+    std::size_t collections_ = 0;  // the context's, once stopped
+  };
+
+  /// Call a function from the interpreter. Compiled code is run now, and its
+  /// result pushed. Otherwise a frame is pushed for the interpreter to run, and
+  /// true is returned.
+  bool enterFunction(std::size_t functionIndex);
+
+  /// Push an interpreted function's frame, checking there is room for it.
+  void pushFrame(const FunctionDef *function, const FunctionSummary &summary,
+                 const std::vector<RefMap> &refMaps);
+
+  /// Run frames until the frame stack is back down to base frames, leaving the
+  /// last result on the operand stack. Returns false if the context suspended.
+  bool runFrames(std::size_t base);
+
+  /// Run the top frame until it calls an interpreted function, returns or
+  /// suspends. In CHECKED mode, every instruction is checked before it runs.
+  /// Unverified functions are always run CHECKED. Otherwise, the stack space
+  /// for the whole frame was checked once, by pushFrame(), using the
+  /// verifier's maximum stack depth. In PROFILE mode, every instruction is
+  /// counted in the context's Profile.
+  template <bool CHECKED, bool PROFILE>
+  FrameExit runFrame();
+
+  /// Run the frames of a call started by start() or continued by resume().
+  bool runSuspendable();
+
+  /// Block until an ASYNC primitive's completion arrives, and push its result.
+  void waitForCompletion(Completion::State &completion);
+
+  /// The per instruction check of the checked interpreter. operands is the
+  /// base of the current function's operand stack, just above its locals.
+  void runtimeCheck(const FunctionDef *function,
+                    const Instruction *instructionPointer,
+                    const StackElement *operands);
 
   /// A helper for interpreter-to-jit transitions.
   Om::Value callJitFunction(JitFunction jitFunction, std::size_t argCount);
@@ -74,7 +448,7 @@ class ExecutionContext {
 
   void doIntDiv();
 
-  void doIntPushConstant(Immediate value);
+  void doIntPushConstant(std::int64_t value);
 
   void doIntNot();
 
@@ -92,21 +466,94 @@ class ExecutionContext {
 
   void doStrPushConstant(Immediate value);
 
+  void doStrConcat();
+
+  void doStrLength();
+
+  void doStrSlice();
+
+  void doNewMap();
+
+  void doMapGet();
+
+  void doMapSet();
+
+  void doMapHas();
+
+  void doMapDelete();
+
+  /// The map a value refers to. Throws if it is not a map.
+  Om::Object *checkMap(StackElement value);
+
+  /// A value as a map key. Throws if it can't be one.
+  StackElement checkKey(StackElement key);
+
+  /// Store a slot of an object in dictionary mode. Returns false if the object
+  /// is not in dictionary mode, and the slot has to be added to its shape.
+  bool storeInDictionary(Om::Object *object, Om::Id slotId, StackElement value);
+
+  /// Add a slot to an object's shape, through the TransitionCache. May
+  /// collect.
+  void addSlot(Om::RootRef<Om::Object> &object, Om::Id slotId,
+               Om::SlotDescriptor &descriptor);
+
+  /// Add an object to the store buffer, unless it is already there or the
+  /// buffer has overflowed.
+  void remember(Om::Object *object);
+
+  /// Give an object a dictionary for its new slots. May collect.
+  void enterDictionaryMode(Om::RootRef<Om::Object> &object);
+
+  /// True if a value is a string, of any kind.
+  bool isString(StackElement value);
+
+  /// Compare two strings by their characters.
+  int compareStrings(StackElement left, StackElement right);
+
   void doNewObject();
 
   void doPushFromObject(Om::Id slotId);
 
   void doPopIntoObject(Om::Id slotId);
 
-  void doCallIndirect();
+  void doNewArray();
 
-  void doSystemCollect();
+  void doArrayLength();
+
+  void doPushFromArray();
+
+  void doPopIntoArray();
+
+  void doCallIndirect();
 
   Om::RunContext omContext_;
   OperandStack stack_;
   const Config *cfg_;
   VirtualMachine *virtualMachine_;
   Instruction *programCounter_ = 0;
+  std::vector<Frame> frames_;
+  StackElement result_;
+  bool resumable_ = false;
+  bool suspended_ = false;
+  std::size_t nativeDepth_ = 0;  // compiled frames on the C++ stack
+  Scheduler *scheduler_ = nullptr;
+  std::shared_ptr<Completion::State> completion_;
+  // Behind a pointer, to keep the context standard layout for the JIT.
+  std::unique_ptr<OutputBuffer> output_;
+  std::unique_ptr<Profile> profile_;
+  std::vector<Om::Object *> storeBuffer_;
+  std::unordered_set<Om::Object *> remembered_;  // what storeBuffer_ holds
+  bool storeBufferOverflowed_ = false;
+  std::vector<StackElement> valueRoots_;  // see ValueRoot
+  TransitionCache transitions_;
+  AllocationStats allocation_;
+  std::size_t collections_ = 0;
+  std::size_t worldStops_ = 0;  // nested StopTheWorld scopes
+  // Objects are allocated ahead of time, and handed out from allocationNext_
+  // up. A collection drops the ones not handed out yet.
+  StackElement allocationBuffer_[ALLOCATION_BUFFER_SIZE];
+  StackElement *allocationNext_ = allocationBuffer_ + ALLOCATION_BUFFER_SIZE;
+  StackElement *allocationEnd_ = allocationBuffer_ + ALLOCATION_BUFFER_SIZE;
 };
 
 // static_assert(std::is_standard_layout<ExecutionContext>::value);
@@ -117,6 +564,10 @@ struct ExecutionContextOffset {
   static constexpr std::size_t STACK = offsetof(ExecutionContext, stack_);
   static constexpr std::size_t PROGRAM_COUNTER =
       offsetof(ExecutionContext, programCounter_);
+  static constexpr std::size_t ALLOCATION_NEXT =
+      offsetof(ExecutionContext, allocationNext_);
+  static constexpr std::size_t ALLOCATION_END =
+      offsetof(ExecutionContext, allocationEnd_);
 };
 
 }  // namespace b9
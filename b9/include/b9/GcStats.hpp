@@ -0,0 +1,99 @@
+#if !defined(B9_GCSTATS_HPP_)
+#define B9_GCSTATS_HPP_
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+namespace b9 {
+
+/// What ExecutionContexts have allocated. Bytes are the size of the empty
+/// objects that NEW_OBJECT made, and leave out the slot storage that is added
+/// as slots are stored into.
+struct AllocationStats {
+  std::size_t objects = 0;
+  std::size_t bytes = 0;
+  std::size_t refills = 0;  //< Batches of objects allocated out of line
+  std::size_t transitions = 0;  //< Shape transitions to add slots
+  std::size_t transitionCacheHits = 0;
+  std::size_t shapes = 0;        //< Shapes added to the TransitionCache
+  std::size_t maxFanOut = 0;     //< The most children of any one shape
+  std::size_t dictionaries = 0;  //< Objects put into dictionary mode
+
+  AllocationStats &operator+=(const AllocationStats &other) {
+    objects += other.objects;
+    bytes += other.bytes;
+    refills += other.refills;
+    transitions += other.transitions;
+    transitionCacheHits += other.transitionCacheHits;
+    shapes += other.shapes;
+    maxFanOut = std::max(maxFanOut, other.maxFanOut);
+    dictionaries += other.dictionaries;
+    return *this;
+  }
+};
+
+/// Statistics about a VirtualMachine's collections, gathered from all of its
+/// threads. Every pause that a collection ran in is timed, whether
+/// SYSTEM_COLLECT started it or an allocation that ran out of space did.
+class GcStats {
+ public:
+  using Duration = std::chrono::nanoseconds;
+
+  /// What started a collection.
+  enum class Cause {
+    SYSTEM_COLLECT,  //< The SYSTEM_COLLECT bytecode
+    ALLOCATION,      //< An allocation that ran out of space
+  };
+
+  /// A copy of the statistics at one point in time.
+  struct Snapshot {
+    /// Summed over the ExecutionContexts destroyed so far.
+    AllocationStats allocation;
+    /// Pauses that collections ran in.
+    std::size_t collections = 0;
+    /// The ones that SYSTEM_COLLECT started.
+    std::size_t systemCollections = 0;
+    Duration totalPause = Duration::zero();
+    Duration maxPause = Duration::zero();
+    Duration p50Pause = Duration::zero();
+    Duration p99Pause = Duration::zero();
+  };
+
+  Snapshot snapshot() const;
+
+  /// Add a context's allocations to the totals, once it is done.
+  void addAllocations(const AllocationStats &allocation);
+
+  /// Record a stop-the-world pause that a collection ran in, from the request
+  /// to stop the world until the other threads were released.
+  void recordPause(Duration pause, Cause cause);
+
+  /// The number of pauses recorded.
+  std::size_t pauses() const;
+
+  /// The pause that percent percent of pauses were no longer than, by nearest
+  /// rank. Zero if there were none.
+  Duration pausePercentile(double percent) const;
+
+  Duration maxPause() const;
+
+  Duration totalPause() const;
+
+ private:
+  Duration percentile(std::vector<Duration> sorted, double percent) const;
+
+  mutable std::mutex mutex_;
+  std::vector<Duration> pauses_;
+  std::size_t systemCollections_ = 0;
+  AllocationStats allocation_;
+};
+
+std::ostream &operator<<(std::ostream &out, const GcStats::Snapshot &stats);
+
+}  // namespace b9
+
+#endif  // B9_GCSTATS_HPP_
@@ -0,0 +1,69 @@
+#if !defined(B9_HASHMAP_HPP_)
+#define B9_HASHMAP_HPP_
+
+#include <b9/OperandStack.hpp>
+
+#include <OMR/Om/ObjectOperations.hpp>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace b9 {
+
+class ExecutionContext;
+
+/// Slot ids from here up are for b9's own use. Bytecode immediates can't
+/// reach them.
+constexpr Om::Id FIRST_HIDDEN_SLOT = Om::Id(1) << 32;
+
+/// The slot of a map object that holds its table.
+constexpr Om::Id MAP_TABLE_SLOT = FIRST_HIDDEN_SLOT;
+
+/// The slot of an object in dictionary mode that holds its dictionary.
+constexpr Om::Id DICTIONARY_SLOT = FIRST_HIDDEN_SLOT + 1;
+
+/// The slot of a map object that holds its values. The nodes that hold the
+/// values use the slots after it.
+constexpr Om::Id MAP_VALUES_SLOT = FIRST_HIDDEN_SLOT + 8;
+
+/// Hash maps from Int48 and string keys to any values, for code that uses
+/// dynamic keys, which would make a new object shape per key.
+///
+/// A map is an Om object with two hidden slots. One holds an Om array of keys
+/// that is the open addressed hash table. Probing is linear, and the table
+/// doubles when it is three quarters full. Deleted entries leave tombstones,
+/// which are dropped when the table is rebuilt. Om doesn't trace through
+/// arrays, so the values are kept apart, in a tree of objects whose value
+/// slots hold the values in the order of their keys' entries. The GC traces
+/// and updates them like any other slots, so values may be references.
+///
+/// String keys must be interned by the caller, so equal strings are equal
+/// values. Stores into a map's objects go through the context's write
+/// barrier, as every store into an object does.
+class HashMap {
+ public:
+  /// Allocate an empty map. May collect.
+  static Om::Object *allocate(ExecutionContext &context);
+
+  /// The map a value refers to, or null if it is not a map.
+  static Om::Object *from(Om::RunContext &cx, StackElement value);
+
+  /// Look up a key. Returns false if it is not in the map.
+  static bool get(Om::RunContext &cx, Om::Object *map, StackElement key,
+                  StackElement &value);
+
+  /// Add or replace a key's value. May collect, if the table has to grow.
+  static void set(ExecutionContext &context, Om::Object *map,
+                  StackElement key, StackElement value);
+
+  /// Remove a key. Returns false if it was not in the map.
+  static bool remove(ExecutionContext &context, Om::Object *map,
+                     StackElement key);
+
+  /// The number of keys in the map.
+  static std::size_t size(Om::RunContext &cx, Om::Object *map);
+};
+
+}  // namespace b9
+
+#endif  // B9_HASHMAP_HPP_
@@ -44,8 +44,14 @@ struct FunctionNotFoundException : public std::runtime_error {
   using std::runtime_error::runtime_error;
 };
 
+/// What a primitive did with its call. A PENDING primitive has not pushed its
+/// result: it has suspended the ExecutionContext, and the result is pushed by
+/// whoever resumes it.
+enum class PrimitiveStatus { DONE, PENDING };
+
 // Primitive Function from Interpreter call
-extern "C" typedef void(PrimitiveFunction)(ExecutionContext* context);
+extern "C" typedef PrimitiveStatus(PrimitiveFunction)(
+    ExecutionContext* context);
 
 /// An interpreter module.
 struct Module {
@@ -46,6 +46,12 @@ class OperandStack {
 
   StackElement *top() { return top_; }
 
+  /// The number of free slots left on the stack.
+  std::size_t available() const { return &stack_[SIZE] - top_; }
+
+  /// The number of elements on the stack.
+  std::size_t size() const { return top_ - &stack_[0]; }
+
   void drop() { --top_; }
 
   StackElement peek() const { return *(top_ - 1); }
@@ -62,9 +68,16 @@ class OperandStack {
 
   template <typename VisitorT>
   void visit(VisitorT &visitor) {
-    for (StackElement &element : *this) {
-      if (element.isRef()) {
-        visitor.edge(nullptr, Om::ValueSlotHandle(&element));
+    visit(visitor, begin(), end());
+  }
+
+  /// Visit every element in [first, last) that holds a reference.
+  template <typename VisitorT>
+  static void visit(VisitorT &visitor, StackElement *first,
+                    StackElement *last) {
+    for (StackElement *element = first; element < last; element++) {
+      if (element->isRef()) {
+        visitor.edge(nullptr, Om::ValueSlotHandle(element));
       }
     }
   }
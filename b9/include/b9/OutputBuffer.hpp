@@ -0,0 +1,80 @@
+#if !defined(B9_OUTPUTBUFFER_HPP_)
+#define B9_OUTPUTBUFFER_HPP_
+
+#include <b9/Config.hpp>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace b9 {
+
+/// Writes chunks of output to their streams on a background thread, in the
+/// order they were queued.
+class OutputWriter {
+ public:
+  OutputWriter();
+
+  /// Write out everything queued, then stop the thread.
+  ~OutputWriter() noexcept;
+
+  OutputWriter(const OutputWriter &) = delete;
+  OutputWriter &operator=(const OutputWriter &) = delete;
+
+  void write(std::ostream &out, std::string chunk);
+
+  /// Wait until everything queued so far has been written.
+  void drain();
+
+ private:
+  void work();
+
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::deque<std::pair<std::ostream *, std::string>> chunks_;
+  bool busy_ = false;
+  bool shutdown_ = false;
+  std::thread thread_;
+};
+
+/// Collects an ExecutionContext's output, and writes it out in chunks, as the
+/// flush policy allows. If there is a writer, chunks are handed to it rather
+/// than written by the calling thread. Whatever is left is written out when
+/// the buffer is destroyed.
+class OutputBuffer : public std::streambuf {
+ public:
+  OutputBuffer(std::ostream &out, OutputWriter *writer, OutputFlush policy,
+               std::size_t capacity);
+
+  ~OutputBuffer() noexcept override;
+
+  /// A stream that writes into this buffer.
+  std::ostream &stream() { return stream_; }
+
+  /// Write out everything buffered.
+  void flush();
+
+ protected:
+  int_type overflow(int_type c) override;
+
+  std::streamsize xsputn(const char *s, std::streamsize n) override;
+
+  int sync() override;
+
+ private:
+  std::ostream &out_;
+  OutputWriter *writer_;
+  OutputFlush policy_;
+  std::size_t capacity_;
+  std::string buffer_;
+  std::ostream stream_;
+};
+
+}  // namespace b9
+
+#endif  // B9_OUTPUTBUFFER_HPP_
@@ -0,0 +1,79 @@
+#if !defined(B9_PERFMAP_HPP_)
+#define B9_PERFMAP_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <set>
+#include <string>
+
+namespace b9 {
+
+/// Tells the Linux perf tools about JIT compiled functions, so samples in
+/// compiled code are attributed to b9 functions rather than to anonymous
+/// addresses.
+///
+/// - The perf map, /tmp/perf-<pid>.map, has a line for each function: its
+///   start address and size in hex, then its name. perf report reads it.
+/// - The jitdump, jit-<pid>.dump in the working directory, also holds a copy
+///   of each function's code. The file is mapped executable when it is
+///   opened, which is how perf record finds it. `perf inject --jit` turns it
+///   into symbols that perf annotate can disassemble.
+///
+/// Both are written as each function is added, so they are complete even if
+/// the process crashes or never stops.
+///
+/// JitBuilder doesn't say how long the code it compiles is. The code cache is
+/// filled in order, and the part past the newest function is still zeroed,
+/// so a function is taken to end at the first ZERO_RUN zero bytes after it,
+/// where another function already starts, or at the end of its mapping, up
+/// to MAX_CODE_SIZE.
+///
+/// The JIT is process wide, and so are perf's files, so there is one PerfMap
+/// for the process.
+class PerfMap {
+ public:
+  static constexpr std::size_t MAX_CODE_SIZE = 64 * 1024;
+
+  /// Zero bytes in a row, at an 8 byte boundary, that are taken to be unused
+  /// code cache rather than code.
+  static constexpr std::size_t ZERO_RUN = 64;
+
+  static PerfMap &instance();
+
+  /// /tmp/perf-<pid>.map
+  static std::string mapPath();
+
+  /// jit-<pid>.dump
+  static std::string jitDumpPath();
+
+  ~PerfMap() noexcept;
+
+  /// Record a compiled function, once its code is in place, and write it out.
+  /// If jitDump is set, it goes in the jitdump too.
+  void add(const void *code, const std::string &name, bool jitDump);
+
+ private:
+  PerfMap() = default;
+
+  /// Where the code of a function that starts at code ends.
+  std::uintptr_t codeEnd(std::uintptr_t code) const;
+
+  /// Open the jitdump and write its header, if it isn't open yet.
+  bool openJitDump();
+
+  void writeJitDump(std::uintptr_t code, std::size_t size,
+                    const std::string &name);
+
+  std::mutex mutex_;
+  std::set<std::uintptr_t> starts_;  // of the functions added so far
+  std::FILE *map_ = nullptr;
+  std::FILE *jitDump_ = nullptr;
+  void *jitDumpMarker_ = nullptr;
+  std::uint64_t codeIndex_ = 0;
+};
+
+}  // namespace b9
+
+#endif  // B9_PERFMAP_HPP_
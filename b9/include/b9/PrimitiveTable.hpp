@@ -0,0 +1,88 @@
+#if !defined(B9_PRIMITIVETABLE_HPP_)
+#define B9_PRIMITIVETABLE_HPP_
+
+#include <b9/Module.hpp>
+#include <b9/verify.hpp>
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace b9 {
+
+/// Thrown when a primitive is not found, or is registered twice.
+struct PrimitiveException : public std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+/// A function that b9 code can call with PRIMITIVE_CALL.
+struct Primitive {
+  /// Properties of a primitive that the VM may rely on.
+  enum Flag : std::uint32_t {
+    /// No side effects, and the result depends only on the arguments.
+    PURE = 1 << 0,
+    /// Never allocates, so never triggers a collection.
+    NOGC = 1 << 1,
+    /// May suspend the calling context, by returning PrimitiveStatus::PENDING.
+    /// Only ASYNC primitives may do so.
+    ASYNC = 1 << 2,
+  };
+
+  /// The most arguments a direct entry point can take.
+  static constexpr std::uint32_t MAX_DIRECT_ARITY = 7;
+
+  std::string name;
+  PrimitiveFunction *function;
+  PrimitiveSignature signature;
+  std::uint32_t flags = 0;
+
+  /// Optional. The same operation, as an extern "C" function taking the
+  /// ExecutionContext and the arity arguments as raw values, and returning the
+  /// raw result. It must not touch the operand stack. Compiled code calls it
+  /// with the arguments in registers, without writing its operand stack out to
+  /// memory, so it is only used by primitives that are also NOGC and not ASYNC.
+  void *direct = nullptr;
+
+  bool is(Flag flag) const { return (flags & flag) != 0; }
+};
+
+/// Whether compiled code that calls one primitive can call the other instead:
+/// they have the same stack effect, flags and entry points.
+inline bool sameEntryPoints(const Primitive &a, const Primitive &b) {
+  return a.signature.arity == b.signature.arity && a.flags == b.flags &&
+         a.function == b.function && a.direct == b.direct;
+}
+
+/// The primitives of a VirtualMachine, indexed in the order they were added.
+/// A module's PRIMITIVE_CALLs refer to primitives by index.
+class PrimitiveTable {
+ public:
+  /// Add a primitive, and return its index. Throws PrimitiveException if the
+  /// name is taken, or a direct entry point takes too many arguments.
+  std::size_t add(const Primitive &primitive);
+
+  /// The index of a primitive. Throws PrimitiveException if there is none.
+  std::size_t index(const std::string &name) const;
+
+  const Primitive &operator[](std::size_t index) const {
+    return primitives_[index];
+  }
+
+  std::size_t size() const { return primitives_.size(); }
+
+  const std::vector<Primitive> &primitives() const { return primitives_; }
+
+  /// The primitives' stack effects, in index order, for the verifier.
+  const std::vector<PrimitiveSignature> &signatures() const {
+    return signatures_;
+  }
+
+ private:
+  std::vector<Primitive> primitives_;
+  std::vector<PrimitiveSignature> signatures_;
+};
+
+}  // namespace b9
+
+#endif  // B9_PRIMITIVETABLE_HPP_
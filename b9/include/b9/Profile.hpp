@@ -0,0 +1,79 @@
+#if !defined(B9_PROFILE_HPP_)
+#define B9_PROFILE_HPP_
+
+#include <b9/Module.hpp>
+#include <b9/instructions.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+namespace b9 {
+
+/// What an ExecutionContext's interpreter ran, when Config::profile is set.
+///
+/// Every interpreted instruction is counted, by function and bytecode index;
+/// the counts by opcode are summed from those. Time is sampled: every
+/// SAMPLE_INTERVAL instructions, the time since the last sample is charged to
+/// the function being interpreted. Compiled code is not counted, and the time
+/// it takes is charged to whichever interpreted function takes the next
+/// sample.
+///
+/// The interpreter has a separate instantiation for profiling, so a context
+/// that isn't profiling pays nothing for it.
+class Profile {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr std::uint32_t SAMPLE_INTERVAL = 1024;
+
+  Profile();
+
+  /// The counts of a function's instructions, by bytecode index. The pointer
+  /// stays good for the life of the profile.
+  std::uint64_t *counts(const FunctionDef *function);
+
+  /// Called before each interpreted instruction.
+  void tick(const FunctionDef *function) {
+    if (--countdown_ == 0) {
+      sample(function);
+    }
+  }
+
+  /// The times an instruction was run.
+  std::uint64_t count(const FunctionDef *function, std::size_t index) const;
+
+  /// The times instructions with an opcode were run, in any function.
+  std::uint64_t count(OpCode opCode) const;
+
+  /// The time charged to a function by samples.
+  Clock::duration time(const FunctionDef *function) const;
+
+  /// The number of samples taken.
+  std::size_t samples() const { return samples_; }
+
+  /// Write the functions by sampled time, the opcodes by count, and the top
+  /// hot spots by count, each sorted from the most.
+  void report(std::ostream &out, std::size_t hotSpots = 20) const;
+
+ private:
+  struct FunctionProfile {
+    std::vector<std::uint64_t> counts;
+    Clock::duration time = Clock::duration::zero();
+    std::size_t samples = 0;
+  };
+
+  void sample(const FunctionDef *function);
+
+  std::unordered_map<const FunctionDef *, FunctionProfile> functions_;
+  std::uint32_t countdown_ = SAMPLE_INTERVAL;
+  std::size_t samples_ = 0;
+  Clock::time_point lastSample_;
+};
+
+}  // namespace b9
+
+#endif  // B9_PROFILE_HPP_
@@ -0,0 +1,102 @@
+#if !defined(B9_PROGRAM_HPP_)
+#define B9_PROGRAM_HPP_
+
+#include <b9/Config.hpp>
+#include <b9/Module.hpp>
+#include <b9/PrimitiveTable.hpp>
+#include <b9/compiler/Compiler.hpp>
+#include <b9/snapshot.hpp>
+#include <b9/verify.hpp>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace b9 {
+
+/// The immutable, shareable part of a loaded module: the module and its
+/// string constants, the verifier's results and GC maps, and compiled code.
+///
+/// Each VirtualMachine running a Program is an isolate, with its own heap and
+/// ExecutionContexts. Isolates share a Program read-only, except for the
+/// compiled code table, which is filled in under the compile mutex and
+/// published atomically. Code is compiled once, under the JIT options of the
+/// first isolate to compile it; isolates with other JIT options can't compile
+/// more of it.
+class Program {
+ public:
+  /// Verify every function of a module against a set of primitives.
+  Program(std::shared_ptr<const Module> module,
+          const std::vector<PrimitiveSignature> &primitives,
+          bool verbose = false);
+
+  /// Use the module and the verifier's results from a snapshot as is. The GC
+  /// maps and array bounds are recomputed, and are not part of the snapshot.
+  explicit Program(const Snapshot &snapshot);
+
+  const std::shared_ptr<const Module> &module() const { return module_; }
+
+  const std::vector<PrimitiveSignature> &primitives() const {
+    return primitives_;
+  }
+
+  const FunctionSummary &summary(std::size_t functionIndex) const {
+    return summaries_[functionIndex];
+  }
+
+  /// The GC maps of a function, indexed by instruction. Empty if the function
+  /// was not verified.
+  const std::vector<RefMap> &refMaps(std::size_t functionIndex) const {
+    return refMaps_[functionIndex];
+  }
+
+  /// The array accesses of a function that need no bounds check, indexed by
+  /// instruction. Empty if the function was not verified.
+  const std::vector<bool> &inBoundsAccesses(std::size_t functionIndex) const {
+    return inBoundsAccesses_[functionIndex];
+  }
+
+  Snapshot snapshot() const { return {module_, primitives_, summaries_}; }
+
+  JitFunction getJitAddress(std::size_t functionIndex) const {
+    return compiledFunctions_[functionIndex].load(std::memory_order_acquire);
+  }
+
+  void setJitAddress(std::size_t functionIndex, JitFunction value) {
+    compiledFunctions_[functionIndex].store(value, std::memory_order_release);
+  }
+
+  /// Lock the compiled code table for compiling under the given config and
+  /// primitives. Compiled code calls primitives' entry points directly, so
+  /// throws CompilationException if code has already been compiled under
+  /// different JIT options or against different primitive entry points.
+  std::unique_lock<std::mutex> lockForCompile(const Config &cfg,
+                                              const PrimitiveTable &primitives);
+
+  /// Whether the compiled code, if there is any, calls the same primitive
+  /// entry points as the given table.
+  bool compiledAgainst(const PrimitiveTable &primitives) const;
+
+  /// The config that the compiled code was generated under. Only meaningful
+  /// once some code has been published.
+  const Config &jitConfig() const { return jitConfig_; }
+
+ private:
+  void analyzeFunctions();
+
+  std::shared_ptr<const Module> module_;
+  std::vector<PrimitiveSignature> primitives_;
+  std::vector<FunctionSummary> summaries_;
+  std::vector<std::vector<RefMap>> refMaps_;
+  std::vector<std::vector<bool>> inBoundsAccesses_;
+  std::vector<std::atomic<JitFunction>> compiledFunctions_;
+  mutable std::mutex compileMutex_;
+  bool hasJitConfig_ = false;
+  Config jitConfig_;
+  std::vector<Primitive> jitPrimitives_;
+};
+
+}  // namespace b9
+
+#endif  // B9_PROGRAM_HPP_
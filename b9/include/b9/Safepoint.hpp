@@ -0,0 +1,74 @@
+#if !defined(B9_SAFEPOINT_HPP_)
+#define B9_SAFEPOINT_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+
+namespace b9 {
+
+/// Stops the world for the threads running code in one VirtualMachine.
+///
+/// A thread attaches while it runs b9 code, and polls at calls and backward
+/// jumps. A thread that needs exclusive access, for example to collect the
+/// heap, calls stop(). stop() returns once every other attached thread is
+/// parked in a poll, and the parked threads resume when resume() is called.
+/// Om may collect in any allocation, so ExecutionContext stops the world
+/// around every allocation that may collect, not just SYSTEM_COLLECT.
+class Safepoint {
+ public:
+  /// Register the calling thread as running b9 code. Waits for any pause in
+  /// progress to end.
+  void attach();
+
+  /// The calling thread is no longer running b9 code.
+  void detach();
+
+  /// True if a thread is waiting for the world to stop.
+  bool requested() const { return requested_.load(std::memory_order_relaxed); }
+
+  /// Park the calling thread if a pause is requested.
+  void poll() {
+    if (requested()) {
+      park();
+    }
+  }
+
+  /// Wait for every other attached thread to park. If another thread is
+  /// already stopping the world, park until it resumes, then try again.
+  void stop();
+
+  /// Let the parked threads go.
+  void resume();
+
+  /// Attaches the current thread for the lifetime of the scope.
+  class Scope {
+   public:
+    explicit Scope(Safepoint &safepoint) : safepoint_(safepoint) {
+      safepoint_.attach();
+    }
+
+    ~Scope() { safepoint_.detach(); }
+
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+   private:
+    Safepoint &safepoint_;
+  };
+
+ private:
+  void park();
+
+  std::atomic<bool> requested_{false};
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::size_t attached_ = 0;
+  std::size_t parked_ = 0;
+  bool stopped_ = false;
+};
+
+}  // namespace b9
+
+#endif  // B9_SAFEPOINT_HPP_
@@ -0,0 +1,85 @@
+#if !defined(B9_SCHEDULER_HPP_)
+#define B9_SCHEDULER_HPP_
+
+#include <b9/VirtualMachine.hpp>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace b9 {
+
+/// An event loop that multiplexes many calls on the thread running run().
+///
+/// Each call runs in its own ExecutionContext. When an ASYNC primitive
+/// suspends a call, the loop moves on to other calls. The primitive's
+/// Completion, which may be completed from any thread, queues the call to be
+/// resumed. Contexts are reused once their calls finish. A Scheduler must
+/// outlive the completions of its calls.
+class Scheduler {
+ public:
+  using Callback = std::function<void(StackElement result)>;
+
+  explicit Scheduler(VirtualMachine &virtualMachine);
+
+  Scheduler(const Scheduler &) = delete;
+  Scheduler &operator=(const Scheduler &) = delete;
+
+  /// Queue a call of a function. done is called with its result, on the thread
+  /// running run(). May be called from any thread.
+  void spawn(std::size_t functionIndex, std::vector<StackElement> args,
+             Callback done);
+
+  /// Run calls until none is left in flight. If a call throws, it is dropped,
+  /// and the exception is rethrown here; the other calls carry on at the next
+  /// run(). The calling thread must not be attached to the VM's safepoint.
+  void run();
+
+  /// The number of calls spawned but not yet finished.
+  std::size_t inFlight();
+
+ private:
+  friend class Completion;
+
+  struct Task {
+    std::size_t functionIndex;
+    std::vector<StackElement> args;
+    Callback done;
+  };
+
+  /// Something for run() to do: start a new task, or resume a context.
+  struct Event {
+    std::unique_ptr<Task> start;
+    ExecutionContext *context;
+    StackElement value;
+  };
+
+  /// Queue a suspended context to be resumed. Called from any thread.
+  void complete(ExecutionContext *context, StackElement value);
+
+  /// An idle context, or a new one.
+  ExecutionContext *takeContext();
+
+  /// Finish the task running in a context, and make the context idle.
+  std::unique_ptr<Task> retire(ExecutionContext *context);
+
+  VirtualMachine &virtualMachine_;
+
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::deque<Event> events_;
+  std::size_t inFlight_ = 0;
+
+  // Only used by the thread running run().
+  std::vector<std::unique_ptr<ExecutionContext>> contexts_;
+  std::vector<ExecutionContext *> idle_;
+  std::unordered_map<ExecutionContext *, std::unique_ptr<Task>> running_;
+};
+
+}  // namespace b9
+
+#endif  // B9_SCHEDULER_HPP_
@@ -0,0 +1,118 @@
+#if !defined(B9_STRINGHEAP_HPP_)
+#define B9_STRINGHEAP_HPP_
+
+#include <b9/OperandStack.hpp>
+
+#include <OMR/Om/ObjectOperations.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace b9 {
+
+class ExecutionContext;
+
+/// Thrown for a bad string operation, such as a slice out of range.
+struct StringException : public std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+/// The strings made at runtime, by STR_CONCAT and STR_SLICE.
+///
+/// A string value is one of:
+///
+/// - A Uint48 below FIRST_SYMBOL, the index of one of the module's string
+///   constants, as pushed by STR_PUSH_CONSTANT.
+/// - A Uint48 from FIRST_SYMBOL up, an interned string. Map keys are
+///   interned, since maps hash and compare keys by value. Interned strings
+///   are kept until the VM is destroyed, like constants.
+/// - A reference to a string object in the Om heap, which the GC reclaims
+///   like any other object. A string object is either a leaf or a rope:
+///   - A leaf is a range of a shared buffer, an untraced Om array of
+///     characters, as a HashMap keeps its table. Appending to a leaf that ends
+///     its buffer fills the buffer in place, and a full buffer is copied into
+///     one twice the size, so building a string up a piece at a time costs
+///     amortized O(1) per character, as in a string builder. Slicing a leaf
+///     shares its buffer.
+///   - A rope is the concatenation of two strings, made in O(1). Lengths,
+///     comparisons and slices walk the pieces rather than flattening it.
+///
+/// String objects have hidden slots, so bytecode can't see inside them.
+/// Operations that allocate may collect, and the caller must stop the world
+/// around them, as for any allocation.
+class StringHeap {
+ public:
+  using Handle = std::uint64_t;
+
+  static constexpr Handle FIRST_SYMBOL = Handle(1) << 47;
+
+  /// Use a module's string constants for the handles below FIRST_SYMBOL.
+  /// String objects and interned strings never refer to constants.
+  void setConstants(const std::vector<std::string> *constants);
+
+  /// True if a value is a string of any kind.
+  bool isString(Om::RunContext &cx, StackElement value);
+
+  /// May collect. Throws StringException if either value is not a string.
+  StackElement concat(ExecutionContext &context, StackElement left,
+                      StackElement right);
+
+  /// The characters of a string from start up to end. Throws StringException
+  /// if the range is not within the string. May collect.
+  StackElement slice(ExecutionContext &context, StackElement string,
+                     std::int64_t start, std::int64_t end);
+
+  std::size_t length(Om::RunContext &cx, StackElement string);
+
+  /// A string as one std::string.
+  std::string flatten(Om::RunContext &cx, StackElement string);
+
+  /// Compare two strings by character, like std::string::compare, without
+  /// flattening them.
+  int compare(Om::RunContext &cx, StackElement left, StackElement right);
+
+  bool equal(Om::RunContext &cx, StackElement left, StackElement right);
+
+  /// A Uint48 string with the same characters, the same one for equal
+  /// strings. Constants stand for themselves.
+  StackElement intern(Om::RunContext &cx, StackElement string);
+
+  /// The number of strings interned so far, other than constants.
+  std::size_t symbols();
+
+ private:
+  /// Walks a string's characters a leaf at a time.
+  class Cursor;
+
+  /// A Uint48 string's characters.
+  const std::string &text(Handle handle);
+
+  /// A string object, or null if the value is a Uint48 string. Throws
+  /// StringException if it is not a string.
+  Om::Object *object(Om::RunContext &cx, StackElement value);
+
+  /// A string that ropes may refer to: a leaf copy of a constant, or else the
+  /// string itself. May collect.
+  StackElement own(ExecutionContext &context, StackElement string);
+
+  /// Copy count of a string's characters, from start, to out.
+  void read(Om::RunContext &cx, StackElement string, std::size_t start,
+            std::size_t count, char *out);
+
+  /// Guards symbols_ and interned_. String objects need no lock, since they
+  /// are only made with the world stopped.
+  std::mutex mutex_;
+  std::deque<std::string> symbols_;
+  std::unordered_map<std::string, Handle> interned_;
+  const std::vector<std::string> *constants_ = nullptr;
+};
+
+}  // namespace b9
+
+#endif  // B9_STRINGHEAP_HPP_
@@ -0,0 +1,121 @@
+#if !defined(B9_TRACE_HPP_)
+#define B9_TRACE_HPP_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace b9 {
+
+/// A timeline of where a process's time goes: loading, JIT compiles, runs,
+/// collections and primitive calls. It is written out in the Chrome
+/// trace-event format, which chrome://tracing and Perfetto can open.
+///
+/// Each thread records into its own ring buffer, so recording takes no locks.
+/// A thread takes the tracer's lock only once, to register its buffer. When a
+/// buffer is full, new events overwrite its oldest ones. While tracing is off,
+/// a TraceScope costs one relaxed load.
+///
+/// There is one Tracer for the process, since what it times is spread over
+/// VMs and threads.
+class Tracer {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  /// The events kept per thread.
+  static constexpr std::size_t BUFFER_SIZE = 16 * 1024;
+
+  /// Longer names are cut short.
+  static constexpr std::size_t NAME_SIZE = 48;
+
+  static Tracer &instance();
+
+  void enable() { enabled_.store(true, std::memory_order_relaxed); }
+
+  void disable() { enabled_.store(false, std::memory_order_relaxed); }
+
+  bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+  /// Record something that took from start to end on this thread. The
+  /// category must be a string literal.
+  void record(const char *category, const char *name, Clock::time_point start,
+              Clock::time_point end);
+
+  /// Write out every thread's events as a trace-event JSON object. The other
+  /// threads must not be recording.
+  void write(std::ostream &out);
+
+  /// Drop every thread's events. The other threads must not be recording.
+  void clear();
+
+ private:
+  struct Event {
+    const char *category;
+    char name[NAME_SIZE];
+    Clock::time_point start;
+    Clock::duration duration;
+  };
+
+  struct ThreadBuffer {
+    std::uint32_t thread;
+    /// The number of events recorded. The newest is at (count - 1) modulo
+    /// BUFFER_SIZE.
+    std::atomic<std::size_t> count{0};
+    std::array<Event, BUFFER_SIZE> events;
+  };
+
+  Tracer();
+
+  /// The calling thread's buffer, registered on first use.
+  ThreadBuffer &buffer();
+
+  static thread_local ThreadBuffer *threadBuffer_;
+
+  std::atomic<bool> enabled_{false};
+  const Clock::time_point epoch_;
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<ThreadBuffer>> buffers_;
+};
+
+/// Records an event from its construction to its destruction, if tracing was
+/// on when it was constructed. The name must outlive the scope.
+class TraceScope {
+ public:
+  TraceScope(const char *category, const char *name) {
+    if (Tracer::instance().enabled()) {
+      category_ = category;
+      name_ = name;
+      start_ = Tracer::Clock::now();
+    }
+  }
+
+  TraceScope(const char *category, const std::string &name)
+      : TraceScope(category, name.c_str()) {}
+
+  TraceScope(const TraceScope &) = delete;
+
+  TraceScope &operator=(const TraceScope &) = delete;
+
+  ~TraceScope() noexcept {
+    if (name_ != nullptr) {
+      Tracer::instance().record(category_, name_, start_,
+                                Tracer::Clock::now());
+    }
+  }
+
+ private:
+  const char *category_ = nullptr;
+  const char *name_ = nullptr;
+  Tracer::Clock::time_point start_;
+};
+
+}  // namespace b9
+
+#endif  // B9_TRACE_HPP_
@@ -0,0 +1,104 @@
+#if !defined(B9_TRANSITIONCACHE_HPP_)
+#define B9_TRANSITIONCACHE_HPP_
+
+#include <b9/OperandStack.hpp>
+
+#include <OMR/Om/ObjectOperations.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace b9 {
+
+/// A context's cache of the shape transitions that add one slot, from the
+/// parent shape and the slot's id to the child shape and the new slot's
+/// descriptor.
+///
+/// Om finds a transition by hashing the new slots into the parent's transition
+/// table, and then the slot has to be looked up in the child. A hit here does
+/// neither. The cache also counts each shape's fan-out, the number of slots
+/// added to it, so objects that are built with their keys in many orders can
+/// go into dictionary mode instead of growing the shape tree.
+///
+/// Shapes are Om cells, which a collection may move. The cache holds them as
+/// roots, which its context visits, and rebuilds its index after a collection.
+class TransitionCache {
+ public:
+  /// Once the cache holds this many transitions, it starts over.
+  static constexpr std::size_t CAPACITY = 4096;
+
+  struct Transition {
+    StackElement parent;
+    StackElement child;
+    Om::Id slotId;
+    Om::SlotDescriptor descriptor;
+  };
+
+  /// The transition that adds slotId to parent, or null if it is not cached.
+  /// The pointer is good until the next insert.
+  const Transition *lookup(Om::ObjectMap *parent, Om::Id slotId);
+
+  /// Record a transition that Om made.
+  void insert(Om::ObjectMap *parent, Om::Id slotId, Om::ObjectMap *child,
+              Om::SlotDescriptor descriptor);
+
+  /// The number of different slots that have been added to a shape.
+  std::size_t fanOut(Om::ObjectMap *parent);
+
+  /// True if the shape is the child of a cached transition, so that it has
+  /// at least one slot.
+  bool isChild(Om::ObjectMap *shape);
+
+  /// The largest fan-out of any shape so far.
+  std::size_t maxFanOut() const { return maxFanOut_; }
+
+  /// The number of transitions cached, which is the number of shapes in the
+  /// part of the shape tree that this context has built.
+  std::size_t size() const { return transitions_.size(); }
+
+  void clear();
+
+  template <typename VisitorT>
+  void visit(VisitorT &visitor) {
+    for (Transition &transition : transitions_) {
+      visitor.edge(nullptr, Om::ValueSlotHandle(&transition.parent));
+      visitor.edge(nullptr, Om::ValueSlotHandle(&transition.child));
+    }
+    // The shapes may move, which would leave the index stale.
+    stale_ = true;
+  }
+
+ private:
+  struct Key {
+    Om::ObjectMap *parent;
+    Om::Id slotId;
+
+    bool operator==(const Key &other) const {
+      return parent == other.parent && slotId == other.slotId;
+    }
+  };
+
+  struct KeyHash {
+    std::size_t operator()(const Key &key) const {
+      return std::hash<std::uintptr_t>()(std::uintptr_t(key.parent)) * 31 +
+             std::hash<Om::Id>()(key.slotId);
+    }
+  };
+
+  /// Rebuild the index, and the fan-out counts, from the transitions.
+  void reindex();
+
+  std::vector<Transition> transitions_;
+  std::unordered_map<Key, std::size_t, KeyHash> index_;
+  std::unordered_map<Om::ObjectMap *, std::size_t> fanOut_;
+  std::unordered_set<Om::ObjectMap *> children_;
+  std::size_t maxFanOut_ = 0;
+  bool stale_ = false;
+};
+
+}  // namespace b9
+
+#endif  // B9_TRANSITIONCACHE_HPP_
@@ -1,10 +1,19 @@
 #ifndef B9_VIRTUALMACHINE_HPP_
 #define B9_VIRTUALMACHINE_HPP_
 
+#include <b9/Config.hpp>
+#include <b9/GcStats.hpp>
 #include <b9/Module.hpp>
+#include <b9/Program.hpp>
 #include <b9/OperandStack.hpp>
+#include <b9/OutputBuffer.hpp>
+#include <b9/PrimitiveTable.hpp>
+#include <b9/Safepoint.hpp>
+#include <b9/StringHeap.hpp>
 #include <b9/compiler/Compiler.hpp>
 #include <b9/instructions.hpp>
+#include <b9/snapshot.hpp>
+#include <b9/verify.hpp>
 
 #include <OMR/Om/Context.inl.hpp>
 #include <OMR/Om/MemorySystem.hpp>
@@ -25,6 +34,13 @@ extern "C" {
 b9::PrimitiveFunction b9_prim_print_string;
 b9::PrimitiveFunction b9_prim_print_number;
 b9::PrimitiveFunction b9_prim_print_stack;
+b9::PrimitiveFunction b9_prim_yield;
+
+// Direct entry points, for compiled code.
+OMR::Om::RawValue b9_prim_print_string_direct(b9::ExecutionContext *context,
+                                              OMR::Om::RawValue value);
+OMR::Om::RawValue b9_prim_print_number_direct(b9::ExecutionContext *context,
+                                              OMR::Om::RawValue number);
 }
 
 namespace b9 {
@@ -35,46 +51,68 @@ class Compiler;
 class ExecutionContext;
 class VirtualMachine;
 
-struct Config {
-  std::size_t maxInlineDepth = 0;  //< The JIT's max inline depth
-  bool jit = false;                //< Enable the JIT
-  bool directCall = false;         //< Enable direct JIT to JIT calls
-  bool passParam = false;          //< Pass arguments in CPU registers
-  bool lazyVmState = false;        //< Simulate the VM state
-  bool debug = false;              //< Enable debug code
-  bool verbose = false;            //< Enable verbose printing and tracing
-};
-
-inline std::ostream &operator<<(std::ostream &out, const Config &cfg) {
-  out << std::boolalpha;
-  out << "Mode:         " << (cfg.jit ? "JIT" : "Interpreter") << std::endl
-      << "Inline depth: " << cfg.maxInlineDepth << std::endl
-      << "directcall:   " << cfg.directCall << std::endl
-      << "passparam:    " << cfg.passParam << std::endl
-      << "lazyvmstate:  " << cfg.lazyVmState << std::endl
-      << "debug:        " << cfg.debug;
-  out << std::noboolalpha;
-  return out;
-}
-
 struct BadFunctionCallException : public std::runtime_error {
   using std::runtime_error::runtime_error;
 };
 
 extern "C" typedef Om::RawValue (*JitFunction)(void *executionContext, ...);
 
+/// Add the bulk array primitives: array_sum, array_min, array_max,
+/// array_count, array_fill, array_copy, array_add_scalar, array_mul_scalar,
+/// array_add and array_mul.
+void addArrayPrimitives(PrimitiveTable &primitives);
+
+/// A VirtualMachine may be shared by many threads. Each thread runs code
+/// through its own ExecutionContext, and so has its own operand stack and
+/// Om::RunContext. The loaded Program, which holds the module, the verifier's
+/// results, and the compiled code, is shared.
+///
+/// A VirtualMachine is also an isolate: it has its own heap, but several VMs
+/// can run one Program. Starting another isolate for a program costs a heap,
+/// not a reload and recompile.
+///
+/// load() must finish before any thread calls run(). Compiled code is
+/// published atomically, so generateAllCode() may run while other threads are
+/// running. Explicit collections stop the world at a Safepoint. JIT code only
+/// polls for safepoints when Config::multithreaded is set.
 class VirtualMachine {
  public:
   VirtualMachine(Om::ProcessRuntime &runtime, const Config &cfg);
 
   ~VirtualMachine() noexcept;
 
-  /// Load a module into the VM.
+  /// Load a module into the VM. Every function is verified as it is loaded.
+  /// Functions that fail verification are run by the checked interpreter, and
+  /// are never compiled.
   void load(std::shared_ptr<const Module> module);
 
+  /// Load a module from a snapshot. The snapshot's verification results are
+  /// reused if they were made against the same primitives as this VM's.
+  void load(const Snapshot &snapshot);
+
+  /// Run a program that is already loaded, possibly by another isolate.
+  void load(std::shared_ptr<Program> program);
+
+  const std::shared_ptr<Program> &program() const { return program_; }
+
+  /// Capture the loaded module, and the results of verifying it.
+  Snapshot snapshot() const;
+
+  /// Run a function in a new ExecutionContext on the calling thread.
   StackElement run(const std::size_t index,
                    const std::vector<StackElement> &usrArgs);
 
+  /// Run a function in an existing ExecutionContext, which must belong to this
+  /// VM and to the calling thread.
+  StackElement run(ExecutionContext &context, const std::size_t index,
+                   const std::vector<StackElement> &usrArgs);
+
+  /// Run a function on a thread that is already attached to the safepoint.
+  /// args must hold the function's nparams arguments. Unlike run(), the
+  /// argument count is not checked.
+  StackElement runAttached(ExecutionContext &context, const std::size_t index,
+                           const StackElement *args);
+
   StackElement run(const std::string &name,
                    const std::vector<StackElement> &usrArgs);
 
@@ -82,6 +120,23 @@ class VirtualMachine {
 
   PrimitiveFunction *getPrimitive(std::size_t index);
 
+  /// Add a primitive after the built in ones, and return its index. Register
+  /// primitives before loading the modules that call them, since functions are
+  /// verified against the primitives present when they are loaded, and before
+  /// any thread runs code.
+  std::size_t registerPrimitive(const Primitive &primitive);
+
+  const PrimitiveTable &primitives() const { return primitives_; }
+
+  const std::vector<PrimitiveSignature> &primitiveSignatures() const {
+    return primitives_.signatures();
+  }
+
+  /// The verifier's summary of a loaded function.
+  const FunctionSummary &summary(std::size_t functionIndex) const {
+    return program_->summary(functionIndex);
+  }
+
   JitFunction getJitAddress(std::size_t functionIndex);
 
   void setJitAddress(std::size_t functionIndex, JitFunction value);
@@ -92,9 +147,10 @@ class VirtualMachine {
 
   void generateAllCode();
 
-  const std::string &getString(int index);
+  /// The strings made at runtime.
+  StringHeap &strings() { return strings_; }
 
-  const std::shared_ptr<const Module> &module() { return module_; }
+  const std::shared_ptr<const Module> &module() { return program_->module(); }
 
   Om::MemorySystem &memoryManager() { return memoryManager_; }
 
@@ -104,15 +160,30 @@ class VirtualMachine {
 
   const Config &config() { return cfg_; }
 
- private:
-  static constexpr PrimitiveFunction *const primitives_[] = {
-      b9_prim_print_string, b9_prim_print_number, b9_prim_print_stack};
+  Safepoint &safepoint() { return safepoint_; }
+
+  GcStats &gcStats() { return gcStats_; }
+
+  /// Where ExecutionContexts write what primitives print. Set it before making
+  /// any ExecutionContext.
+  void setOutput(std::ostream &out) { output_ = &out; }
 
+  std::ostream &output() { return *output_; }
+
+  /// The background output thread, if Config::outputThread is set.
+  OutputWriter *outputWriter() { return outputWriter_.get(); }
+
+ private:
   Config cfg_;
+  PrimitiveTable primitives_;
   Om::MemorySystem memoryManager_;
   std::shared_ptr<Compiler> compiler_;
-  std::shared_ptr<const Module> module_;
-  std::vector<JitFunction> compiledFunctions_;
+  std::shared_ptr<Program> program_;
+  Safepoint safepoint_;
+  GcStats gcStats_;
+  StringHeap strings_;
+  std::ostream *output_;
+  std::unique_ptr<OutputWriter> outputWriter_;
 };
 
 }  // namespace b9
@@ -129,6 +200,45 @@ Om::RawValue interpret(ExecutionContext *context,
                        const std::size_t functionIndex);
 
 void primitive_call(ExecutionContext *context, Immediate value);
+
+void safepoint_poll(ExecutionContext *context);
+
+void system_collect(ExecutionContext *context);
+
+void refill_allocation_buffer(ExecutionContext *context);
+
+Om::RawValue array_new(ExecutionContext *context, Om::RawValue length);
+
+Om::RawValue array_length(Om::RawValue array);
+
+Om::RawValue array_load(Om::RawValue array, Om::RawValue index);
+
+Om::RawValue array_load_unchecked(Om::RawValue array, Om::RawValue index);
+
+void array_store(Om::RawValue array, Om::RawValue index, Om::RawValue value);
+
+void array_store_unchecked(Om::RawValue array, Om::RawValue index,
+                           Om::RawValue value);
+
+Om::RawValue map_new(ExecutionContext *context);
+
+Om::RawValue map_get(ExecutionContext *context, Om::RawValue map,
+                     Om::RawValue key);
+
+void map_set(ExecutionContext *context, Om::RawValue map, Om::RawValue key,
+             Om::RawValue value);
+
+Om::RawValue map_has(ExecutionContext *context, Om::RawValue map,
+                     Om::RawValue key);
+
+Om::RawValue map_delete(ExecutionContext *context, Om::RawValue map,
+                        Om::RawValue key);
+
+std::int32_t values_equal(ExecutionContext *context, Om::RawValue left,
+                          Om::RawValue right);
+
+std::int64_t values_compare(ExecutionContext *context, Om::RawValue left,
+                            Om::RawValue right);
 }
 
 #endif  // B9_VIRTUALMACHINE_HPP_
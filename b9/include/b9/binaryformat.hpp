@@ -1,6 +1,78 @@
-#if !defined(B9_BINARY_HPP_)
+#if !defined(B9_BINARYFORMAT_HPP_)
 #define B9_BINARYFORMAT_HPP_
 
 #include <b9/instructions.hpp>
 
+#include <array>
+#include <cstdint>
+
+namespace b9 {
+
+/// Section codes of the binary module format.
+enum class SectionCode : std::uint32_t {
+  /// Functions, one 32bit RawInstruction per instruction slot.
+  FUNCTION = 1,
+  /// The string constant table.
+  STRING = 2,
+  /// Functions, encoded as an opcode byte followed by a varint immediate. The
+  /// immediate is omitted for opcodes that take none. A wide instruction is
+  /// encoded once, with its full 48bit immediate, and expanded back into two
+  /// instruction slots when loaded.
+  COMPACT_FUNCTION = 3,
+  /// A CRC-32 of every byte of the module that precedes this section. When
+  /// present, it must be the last section.
+  CHECKSUM = 4,
+};
+
+/// The longest encoding of a 64bit varint.
+static constexpr std::size_t MAX_VARINT_BYTES = 10;
+
+/// Map signed integers onto unsigned integers, so that small negative values
+/// get a short varint encoding.
+constexpr std::uint64_t zigzagEncode(std::int64_t value) {
+  return (std::uint64_t(value) << 1) ^ std::uint64_t(value >> 63);
+}
+
+constexpr std::int64_t zigzagDecode(std::uint64_t value) {
+  return std::int64_t(value >> 1) ^ -std::int64_t(value & 1);
+}
+
+/// Encode an unsigned LEB128 varint into buffer. Returns the number of bytes
+/// written, at most MAX_VARINT_BYTES.
+inline std::size_t encodeVarint(std::uint64_t value, std::uint8_t *buffer) {
+  std::size_t count = 0;
+  while (value >= 0x80) {
+    buffer[count++] = std::uint8_t(value | 0x80);
+    value >>= 7;
+  }
+  buffer[count++] = std::uint8_t(value);
+  return count;
+}
+
+/// Update a running CRC-32 (IEEE 802.3) with size bytes of data. Start with a
+/// crc of 0.
+inline std::uint32_t crc32(std::uint32_t crc, const void *data,
+                           std::size_t size) {
+  static const std::array<std::uint32_t, 256> table = [] {
+    std::array<std::uint32_t, 256> t;
+    for (std::uint32_t i = 0; i < 256; i++) {
+      std::uint32_t c = i;
+      for (int k = 0; k < 8; k++) {
+        c = (c & 1) ? 0xEDB8'8320 ^ (c >> 1) : c >> 1;
+      }
+      t[i] = c;
+    }
+    return t;
+  }();
+
+  auto bytes = static_cast<const std::uint8_t *>(data);
+  crc = ~crc;
+  for (std::size_t i = 0; i < size; i++) {
+    crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+}  // namespace b9
+
 #endif  // B9_BINARYFORMAT_HPP_
@@ -69,17 +69,75 @@ class MethodBuilder : public TR::MethodBuilder {
 
   void storeParam(TR::IlBuilder *b, std::size_t index, TR::IlValue *value);
 
-  void interpreterCall(TR::BytecodeBuilder *builder, std::size_t target);
+  static bool isBackwardJump(Instruction instruction);
 
-  void directCall(TR::BytecodeBuilder *builder, std::size_t target);
+  /// The GC map at an instruction of the function being compiled, or null if
+  /// there is none, and every slot must be taken to hold a reference.
+  const RefMap *refMap(const FunctionDef *function, std::size_t index);
 
-  void passParamCall(TR::BytecodeBuilder *builder, std::size_t target);
+  /// True if the array access at an instruction of the function being compiled
+  /// was found to be in bounds, and needs no checks.
+  bool inBounds(const FunctionDef *function, std::size_t index);
+
+  /// True if any operand under the top count operands may hold a reference.
+  bool operandsMayRef(const RefMap *map, std::size_t count);
+
+  /// Before a GC point: copy the locals, and the params passed natively, that
+  /// may hold references to their home slots on the operand stack, where the
+  /// GC can see them.
+  void spillRefs(TR::IlBuilder *b, const RefMap *map);
+
+  /// After a GC point: reload what spillRefs() saved, since the GC may have
+  /// moved the objects.
+  void reloadRefs(TR::IlBuilder *b, const RefMap *map);
+
+  /// Park at a safepoint if another thread is stopping the world.
+  void safepointPoll(TR::BytecodeBuilder *builder, const RefMap *map);
+
+  void systemCollect(TR::BytecodeBuilder *builder, const RefMap *map);
+
+  /// Take an object from the context's allocation buffer, calling out only to
+  /// refill it.
+  void newObject(TR::BytecodeBuilder *builder, const RefMap *map);
+
+  /// Allocate an array through the runtime. May collect.
+  void newArray(TR::BytecodeBuilder *builder, const RefMap *map);
+
+  /// Allocate a map through the runtime. May collect.
+  void newMap(TR::BytecodeBuilder *builder, const RefMap *map);
+
+  /// Set a key in a map through the runtime. May collect, when the map grows.
+  void mapSet(TR::BytecodeBuilder *builder, const RefMap *map);
+
+  /// Pop two values and compare them as JMP_EQ does, giving an Int32 that is
+  /// non-zero if they are equal. Equal strings may be different values, so two
+  /// different values, neither of them an Int48, call out to compare them.
+  TR::IlValue *popEqual(TR::BytecodeBuilder *builder);
+
+  /// Pop two values for an ordering jump, giving a left and right Int64 that
+  /// compare as the values do. Anything but two Int48s calls out to compare
+  /// them as the interpreter does.
+  void popCompare(TR::BytecodeBuilder *builder, TR::IlValue *&left,
+                  TR::IlValue *&right);
+
+  /// Call a primitive as directly as its flags allow.
+  void primitiveCall(TR::BytecodeBuilder *builder, std::size_t index,
+                     const RefMap *map);
+
+  void interpreterCall(TR::BytecodeBuilder *builder, std::size_t target,
+                       const RefMap *map);
+
+  void directCall(TR::BytecodeBuilder *builder, std::size_t target,
+                  const RefMap *map);
+
+  void passParamCall(TR::BytecodeBuilder *builder, std::size_t target,
+                     const RefMap *map);
 
   // Bytecode Handlers
 
   void handle_bc_function_call(TR::BytecodeBuilder *builder,
                                TR::BytecodeBuilder *nextBuilder,
-                               std::size_t target);
+                               std::size_t target, const RefMap *map);
 
   void handle_bc_push_constant(TR::BytecodeBuilder *builder,
                                TR::BytecodeBuilder *nextBuilder);
@@ -151,6 +209,7 @@ class MethodBuilder : public TR::MethodBuilder {
   const std::size_t functionIndex_;
   std::vector<std::string> params_;
   std::vector<std::string> locals_;
+  std::vector<std::string> primitives_;
   int32_t maxInlineDepth_;
   int32_t firstArgumentIndex = 0;
 };
@@ -9,6 +9,9 @@
 #include <ilgen/VirtualMachineRegisterInStruct.hpp>
 #include <ilgen/VirtualMachineState.hpp>
 
+#include <algorithm>
+#include <cstdint>
+
 namespace b9 {
 
 /// An interface to working with the state of the B9 execution context.
@@ -108,15 +111,19 @@ class ActiveState : public State {
 /// Lazy VM state that only commits state on demand.
 /// Simulates all state of the virtual machine state while compiled code is
 /// running. It simulates the stack and the pointer to the top of the stack.
+/// The simulated stack is sized to the function's maximum stack depth.
 class ModelState : public State {
  public:
-  ModelState(TR::MethodBuilder *b, const GlobalTypes &types)
+  ModelState(TR::MethodBuilder *b, const GlobalTypes &types,
+             std::uint32_t maxStackDepth)
       : stack_(nullptr), stackTop_(nullptr) {
     stackTop_ = new TR::VirtualMachineRegisterInStruct(
         b, "b9::OperandStack", "stack", "top_", "stackTop");
 
-    stack_ = new TR::VirtualMachineOperandStack(b, 64, types.stackElement,
-                                                stackTop_, true, 0);
+    // The model can't be empty, even for a function that never pushes.
+    stack_ = new TR::VirtualMachineOperandStack(
+        b, std::max<std::uint32_t>(maxStackDepth, 1), types.stackElement,
+        stackTop_, true, 0);
   }
 
   ModelState(const ModelState &other)
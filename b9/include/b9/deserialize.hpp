@@ -2,9 +2,12 @@
 #define B9_DESERIALIZE_HPP_
 
 #include <b9/Module.hpp>
+#include <b9/binaryformat.hpp>
 #include <b9/instructions.hpp>
 
 #include <string.h>
+#include <cstdint>
+#include <functional>
 #include <iostream>
 #include <memory>
 #include <vector>
@@ -30,7 +33,7 @@ bool readNumber(std::istream &in, Number &out, long bytes = sizeof(Number)) {
   return readBytes(in, buffer, bytes);
 }
 
-void readString(std::istream &in, std::string &toRead) {
+inline void readString(std::istream &in, std::string &toRead) {
   uint32_t length;
   if (!readNumber(in, length, sizeof(length))) {
     throw DeserializeException{"Error reading string length"};
@@ -44,21 +47,125 @@ void readString(std::istream &in, std::string &toRead) {
   }
 }
 
+// Readers for the body of one section, with the stream just past its section
+// code. They don't see the rest of the module, so they can't check its
+// checksum. Read whole modules with deserialize() or a ModuleParser.
+
 void readStringSection(std::istream &in, std::vector<std::string> &strings);
 
 bool readInstructions(std::istream &in, std::vector<Instruction> &instructions);
 
+bool readCompactInstructions(std::istream &in,
+                             std::vector<Instruction> &instructions);
+
 void readFunctionData(std::istream &in, FunctionDef &functionSpec);
 
-void readFunction(std::istream &in, FunctionDef &functionDef);
+void readFunction(std::istream &in, FunctionDef &functionDef,
+                  bool compact = false);
 
-void readFunctionSection(std::istream &in, std::vector<FunctionDef> &functions);
+void readFunctionSection(std::istream &in, std::vector<FunctionDef> &functions,
+                         bool compact = false);
 
-void readSection(std::istream &in, std::shared_ptr<Module> &module);
+/// Read a whole module, and check its checksum, if it has one. Throws
+/// DeserializeException on malformed input.
+std::shared_ptr<Module> deserialize(std::istream &in);
 
-void readHeader(std::istream &in, char *buffer);
+/// An incremental, push-style module parser. Input is fed in chunks of any
+/// size, as it arrives from a pipe or socket. Each function is handed to the
+/// function callback as soon as its END_SECTION instruction has been read, so
+/// callers can start working on early functions while later ones are still in
+/// flight. Partial fields are staged in a small fixed-size buffer; the parser
+/// never buffers more input than the field it is currently decoding.
+class ModuleParser {
+ public:
+  /// Called once per completed function. The reference is only valid for the
+  /// duration of the call.
+  using FunctionCallback =
+      std::function<void(std::size_t index, const FunctionDef &function)>;
+
+  explicit ModuleParser(FunctionCallback onFunction = nullptr);
+
+  /// Consume the next chunk of input. Throws DeserializeException on
+  /// malformed input.
+  void feed(const char *data, std::size_t size);
+
+  /// Signal the end of input and take the completed module. Throws
+  /// DeserializeException if the input ended part way through a section.
+  std::shared_ptr<Module> finish();
+
+  /// True if the input seen so far ends on a section boundary.
+  bool atBoundary() const {
+    return (state_ == State::SECTION_CODE || state_ == State::DONE) &&
+           scratchSize_ == 0;
+  }
 
-std::shared_ptr<Module> deserialize(std::istream &in);
+  /// True if the module carried a checksum section, and it matched.
+  bool checksumVerified() const { return state_ == State::DONE; }
+
+ private:
+  enum class State {
+    HEADER,
+    SECTION_CODE,
+    FUNCTION_COUNT,
+    FUNCTION_NAME_LENGTH,
+    FUNCTION_NAME,
+    FUNCTION_NPARAMS,
+    FUNCTION_NLOCALS,
+    INSTRUCTION,
+    COMPACT_OPCODE,
+    COMPACT_IMMEDIATE,
+    STRING_COUNT,
+    STRING_LENGTH,
+    STRING_DATA,
+    CHECKSUM,
+    DONE,
+  };
+
+  /// Run the state machine over the input.
+  void consume(const char *data, const char *end);
+
+  /// Stage up to `bytes` bytes of input in the scratch buffer. Returns true
+  /// once the scratch buffer holds the whole field.
+  bool fill(const char *&data, const char *end, std::size_t bytes);
+
+  template <typename Number>
+  bool readField(const char *&data, const char *end, Number &out) {
+    static_assert(sizeof(Number) <= SCRATCH_SIZE, "field too large");
+    if (!fill(data, end, sizeof(Number))) {
+      return false;
+    }
+    memcpy(&out, scratch_, sizeof(Number));
+    scratchSize_ = 0;
+    return true;
+  }
+
+  /// Append up to `remaining_` bytes of input to `toRead`.
+  bool readChars(const char *&data, const char *end, std::string &toRead);
+
+  void nextFunction();
+
+  void endInstruction();
+
+  void nextString();
+
+  static constexpr std::size_t SCRATCH_SIZE = 8;
+
+  FunctionCallback onFunction_;
+  std::shared_ptr<Module> module_;
+  State state_ = State::HEADER;
+  std::uint32_t itemsRemaining_ = 0;
+  std::uint32_t remaining_ = 0;
+  bool compact_ = false;
+  OpCode opCode_ = OpCode::END_SECTION;
+  std::uint64_t varint_ = 0;
+  unsigned varintShift_ = 0;
+  std::uint32_t crc_ = 0;
+  std::uint32_t sectionCrc_ = 0;
+  const char *unhashed_ = nullptr;
+  bool sawInput_ = false;
+  std::size_t scratchSize_ = 0;
+  char scratch_[SCRATCH_SIZE];
+};
 
 }  // namespace b9
 
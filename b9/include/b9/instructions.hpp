@@ -1,6 +1,7 @@
 #ifndef B9_INSTRUCTIONS_HPP_
 #define B9_INSTRUCTIONS_HPP_
 
+#include <cstddef>
 #include <cstdint>
 #include <ostream>
 
@@ -81,6 +82,45 @@ enum class OpCode : RawOpCode {
   CALL_INDIRECT = 0x23,
 
   SYSTEM_COLLECT = 0x24,
+
+  // Wide ByteCodes
+
+  // Push a 48bit constant. Takes two instruction slots, both carrying this
+  // opcode. The first holds the low 24 bits, the second the high 24 bits.
+  INT_PUSH_CONSTANT_WIDE = 0x25,
+
+  // Array ByteCodes. Arrays hold Int48s.
+
+  // Allocate an array of zeros ( length -- array )
+  NEW_ARRAY = 0x26,
+  // Get the length of an array ( array -- length )
+  ARRAY_LENGTH = 0x27,
+  // Get an element ( array index -- value )
+  PUSH_FROM_ARRAY = 0x28,
+  // Set an element ( array index value -- )
+  POP_INTO_ARRAY = 0x29,
+
+  // Runtime String ByteCodes.
+
+  // Concatenate two strings ( left right -- string )
+  STR_CONCAT = 0x2A,
+  // Get the length of a string ( string -- length )
+  STR_LENGTH = 0x2B,
+  // Get the characters from start up to end ( string start end -- string )
+  STR_SLICE = 0x2C,
+
+  // HashMap ByteCodes. Keys are Int48s or strings, and so are values.
+
+  // Allocate an empty map ( -- map )
+  NEW_MAP = 0x2D,
+  // Get a key's value ( map key -- value )
+  MAP_GET = 0x2E,
+  // Set a key's value ( map key value -- )
+  MAP_SET = 0x2F,
+  // Check for a key ( map key -- found )
+  MAP_HAS = 0x30,
+  // Remove a key ( map key -- found )
+  MAP_DELETE = 0x31,
 };
 
 inline const char *toString(OpCode bc) {
@@ -143,6 +183,32 @@ inline const char *toString(OpCode bc) {
       return "call_indirect";
     case OpCode::SYSTEM_COLLECT:
       return "system_collect";
+    case OpCode::INT_PUSH_CONSTANT_WIDE:
+      return "int_push_constant_wide";
+    case OpCode::NEW_ARRAY:
+      return "new_array";
+    case OpCode::ARRAY_LENGTH:
+      return "array_length";
+    case OpCode::PUSH_FROM_ARRAY:
+      return "push_from_array";
+    case OpCode::POP_INTO_ARRAY:
+      return "pop_into_array";
+    case OpCode::STR_CONCAT:
+      return "str_concat";
+    case OpCode::STR_LENGTH:
+      return "str_length";
+    case OpCode::STR_SLICE:
+      return "str_slice";
+    case OpCode::NEW_MAP:
+      return "new_map";
+    case OpCode::MAP_GET:
+      return "map_get";
+    case OpCode::MAP_SET:
+      return "map_set";
+    case OpCode::MAP_HAS:
+      return "map_has";
+    case OpCode::MAP_DELETE:
+      return "map_delete";
     default:
       return "UNKNOWN_BYTECODE";
   }
@@ -232,12 +298,10 @@ class Instruction {
 /// END_SECTION should be the last element in every functions opcode array.
 static constexpr Instruction END_SECTION{OpCode::END_SECTION, 0};
 
-/// Print an Instruction.
-inline std::ostream &operator<<(std::ostream &out, Instruction i) {
-  out << "(" << i.opCode();
-
-  switch (i.opCode()) {
-    // 0 immediate
+/// True if the OpCode makes use of its immediate. Unknown OpCodes are assumed
+/// to carry an immediate.
+inline bool hasImmediate(OpCode op) {
+  switch (op) {
     case OpCode::END_SECTION:
     case OpCode::DUPLICATE:
     case OpCode::FUNCTION_RETURN:
@@ -250,28 +314,55 @@ inline std::ostream &operator<<(std::ostream &out, Instruction i) {
     case OpCode::NEW_OBJECT:
     case OpCode::CALL_INDIRECT:
     case OpCode::SYSTEM_COLLECT:
-      break;
-    // 1 immediate
-    case OpCode::FUNCTION_CALL:
-    case OpCode::PRIMITIVE_CALL:
-    case OpCode::JMP:
-    case OpCode::PUSH_FROM_LOCAL:
-    case OpCode::POP_INTO_LOCAL:
-    case OpCode::PUSH_FROM_PARAM:
-    case OpCode::POP_INTO_PARAM:
-    case OpCode::INT_PUSH_CONSTANT:
-    case OpCode::JMP_EQ:
-    case OpCode::JMP_NEQ:
-    case OpCode::JMP_GT:
-    case OpCode::JMP_GE:
-    case OpCode::JMP_LT:
-    case OpCode::JMP_LE:
-    case OpCode::STR_PUSH_CONSTANT:
-    case OpCode::PUSH_FROM_OBJECT:
-    case OpCode::POP_INTO_OBJECT:
+    case OpCode::NEW_ARRAY:
+    case OpCode::ARRAY_LENGTH:
+    case OpCode::PUSH_FROM_ARRAY:
+    case OpCode::POP_INTO_ARRAY:
+    case OpCode::STR_CONCAT:
+    case OpCode::STR_LENGTH:
+    case OpCode::STR_SLICE:
+    case OpCode::NEW_MAP:
+    case OpCode::MAP_GET:
+    case OpCode::MAP_SET:
+    case OpCode::MAP_HAS:
+    case OpCode::MAP_DELETE:
+      return false;
     default:
-      out << " " << i.immediate();
-      break;
+      return true;
+  }
+}
+
+/// The number of instruction slots taken up by an instruction.
+inline std::size_t slotCount(OpCode op) {
+  return op == OpCode::INT_PUSH_CONSTANT_WIDE ? 2 : 1;
+}
+
+/// The range of a wide immediate, which is split over two instruction slots.
+static constexpr std::int64_t WIDE_IMMEDIATE_MIN = -(std::int64_t(1) << 47);
+static constexpr std::int64_t WIDE_IMMEDIATE_MAX = (std::int64_t(1) << 47) - 1;
+
+/// The range of an immediate encoded in a single instruction.
+static constexpr std::int64_t IMMEDIATE_MIN = -(std::int64_t(1) << 23);
+static constexpr std::int64_t IMMEDIATE_MAX = (std::int64_t(1) << 23) - 1;
+
+/// Decode a 48bit immediate from the two slots of a wide instruction.
+constexpr std::int64_t wideImmediate(Instruction low, Instruction high) {
+  return std::int64_t(high.immediate()) * (std::int64_t(1) << 24) +
+         (low.raw() & 0x00FF'FFFF);
+}
+
+/// Encode a 48bit immediate into the two slots of a wide instruction.
+inline void setWideImmediate(OpCode op, std::int64_t value, Instruction &low,
+                             Instruction &high) {
+  low.set(op, Immediate(value & 0x00FF'FFFF));
+  high.set(op, Immediate((value >> 24) & 0x00FF'FFFF));
+}
+
+/// Print an Instruction.
+inline std::ostream &operator<<(std::ostream &out, Instruction i) {
+  out << "(" << i.opCode();
+  if (hasImmediate(i.opCode())) {
+    out << " " << i.immediate();
   }
   return out << ")";
 }
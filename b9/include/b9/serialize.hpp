@@ -2,6 +2,7 @@
 #define B9_SERIALIZE_HPP_
 
 #include <b9/Module.hpp>
+#include <b9/binaryformat.hpp>
 #include <fstream>
 #include <iostream>
 
@@ -11,6 +12,12 @@ struct SerializeException : public std::runtime_error {
   using std::runtime_error::runtime_error;
 };
 
+/// The on-disk instruction encoding of a module's functions.
+enum class InstructionEncoding {
+  FIXED,    //< One 32bit RawInstruction per instruction slot.
+  COMPACT,  //< An opcode byte and a varint immediate.
+};
+
 template <typename Number>
 bool writeNumber(std::ostream &out, const Number &n) {
   const long bytes = sizeof(Number);
@@ -36,18 +43,28 @@ void writeStringSection(std::ostream &out,
 bool writeInstructions(std::ostream &out,
                        const std::vector<Instruction> &instructions);
 
+bool writeCompactInstructions(std::ostream &out,
+                              const std::vector<Instruction> &instructions);
+
 void writeFunctionData(std::ostream &out, const FunctionDef &functionDef);
 
-void writeFunction(std::ostream &out, const FunctionDef &functionDef);
+void writeFunction(std::ostream &out, const FunctionDef &functionDef,
+                   InstructionEncoding encoding = InstructionEncoding::FIXED);
+
+void writeFunctionSection(
+    std::ostream &out, const std::vector<FunctionDef> &functions,
+    InstructionEncoding encoding = InstructionEncoding::FIXED);
 
-void writeFunctionSection(std::ostream &out,
-                          const std::vector<FunctionDef> &functions);
+void writeSections(std::ostream &out, const Module &module,
+                   InstructionEncoding encoding = InstructionEncoding::FIXED);
 
-void writeSections(std::ostream &out, const Module &module);
+void writeChecksumSection(std::ostream &out, std::uint32_t checksum);
 
 void writeHeader(std::ostream &out);
 
-void serialize(std::ostream &out, const Module &module);
+/// Write a complete module, followed by a checksum section covering it.
+void serialize(std::ostream &out, const Module &module,
+               InstructionEncoding encoding = InstructionEncoding::FIXED);
 
 }  // namespace b9
 
@@ -0,0 +1,48 @@
+#ifndef B9_SNAPSHOT_HPP_
+#define B9_SNAPSHOT_HPP_
+
+#include <b9/Module.hpp>
+#include <b9/verify.hpp>
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace b9 {
+
+struct SnapshotException : public std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+/// The state of a VM after a module is loaded: the module itself, and the
+/// verifier's results. Restoring a snapshot skips deserializing through a
+/// stream and verifying the module.
+struct Snapshot {
+  std::shared_ptr<const Module> module;
+  /// The primitives the module was verified against.
+  std::vector<PrimitiveSignature> primitives;
+  std::vector<FunctionSummary> summaries;
+};
+
+/// Snapshot format:
+///   Magic("b9snapsh") Version(uint32)
+///   ModuleSize(uint32) Module(serialized module)
+///   PrimitiveCount(uint32) *Arity(uint32)
+///   FunctionCount(uint32) *(Verified(uint32) MaxStackDepth(uint32))
+///   Checksum(uint32, a CRC-32 of everything before it)
+static constexpr std::uint32_t SNAPSHOT_VERSION = 1;
+
+void writeSnapshot(std::ostream &out, const Snapshot &snapshot);
+
+/// Read a snapshot out of memory. Throws SnapshotException if the snapshot is
+/// corrupt or was written by a different version of b9.
+Snapshot readSnapshot(const char *data, std::size_t size);
+
+/// Map a snapshot file into memory, and read it.
+Snapshot mapSnapshot(const char *path);
+
+}  // namespace b9
+
+#endif  // B9_SNAPSHOT_HPP_
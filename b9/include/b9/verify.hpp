@@ -0,0 +1,94 @@
+#ifndef B9_VERIFY_HPP_
+#define B9_VERIFY_HPP_
+
+#include <b9/Module.hpp>
+#include <b9/instructions.hpp>
+
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+namespace b9 {
+
+/// Thrown when a function fails verification.
+struct VerifyException : public std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+/// The stack effect of a primitive, as seen by the verifier. A primitive pops
+/// its arguments and pushes exactly one result.
+struct PrimitiveSignature {
+  std::uint32_t arity;
+};
+
+/// The number of operands an instruction pops, and the number of results it
+/// pushes.
+struct StackEffect {
+  std::uint32_t pops;
+  std::uint32_t pushes;
+};
+
+/// Facts about a function established by the verifier.
+struct FunctionSummary {
+  bool verified = false;
+  /// The deepest the operand stack gets, not counting locals. A frame needs
+  /// nlocals + maxStackDepth free slots on the operand stack.
+  std::uint32_t maxStackDepth = 0;
+};
+
+/// The frame slots that may hold references at one point in a function. Slots
+/// are numbered params first, then locals, then operands from the bottom of
+/// the function's operand stack.
+struct RefMap {
+  /// False if the point is not a GC point, and has no map.
+  bool present = false;
+  std::vector<bool> slots;
+
+  /// Slots past the end of the map are not the function's to describe, and
+  /// may hold anything.
+  bool mayRef(std::size_t slot) const {
+    return slot >= slots.size() || slots[slot];
+  }
+};
+
+/// Check the operands of the instruction at index. Returns nullptr if the
+/// instruction is well formed, otherwise a description of the problem. This is
+/// the check performed per instruction by the checked interpreter.
+const char *checkInstruction(const Module &module, const FunctionDef &function,
+                             std::size_t index,
+                             const std::vector<PrimitiveSignature> &primitives);
+
+/// The stack effect of a well formed instruction.
+StackEffect stackEffect(const Module &module, Instruction instruction,
+                        const std::vector<PrimitiveSignature> &primitives);
+
+/// Verify a single function: every instruction is well formed, every jump
+/// lands on an instruction, the stack depth agrees where control flow merges,
+/// and the stack never underflows. Throws VerifyException on failure. Also
+/// computes the function's maximum stack depth.
+FunctionSummary verifyFunction(
+    const Module &module, std::size_t functionIndex,
+    const std::vector<PrimitiveSignature> &primitives);
+
+/// Find the slots that may hold references at each GC point of a verified
+/// function, as the state just before the instruction there runs. The GC
+/// points are the entry, calls and the instructions they return to,
+/// allocations and collections, and backward jumps and their targets. The
+/// results of calls are always taken to be possible references. Entry i of the
+/// result is the map for instruction i.
+std::vector<RefMap> computeRefMaps(
+    const Module &module, std::size_t functionIndex,
+    const std::vector<PrimitiveSignature> &primitives);
+
+/// Find the array accesses of a verified function that can't be out of bounds:
+/// those whose index is known to be non-negative and less than the array's
+/// length, from a compare that guards the access. Loops that count an index
+/// from zero up to an array's length are the usual case. Entry i of the result
+/// is true if instruction i is such an access.
+std::vector<bool> findInBoundsAccesses(
+    const Module &module, std::size_t functionIndex,
+    const std::vector<PrimitiveSignature> &primitives);
+
+}  // namespace b9
+
+#endif  // B9_VERIFY_HPP_
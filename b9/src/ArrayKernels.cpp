@@ -0,0 +1,314 @@
+#include <b9/ArrayKernels.hpp>
+
+#include <cstring>
+
+namespace b9 {
+
+namespace {
+
+/// Wrap to 48 bits, keeping the sign, as Om does for Int48 values.
+std::int64_t wrap48(std::uint64_t x) { return std::int64_t(x << 16) >> 16; }
+
+// The scalar kernels. They also finish off what is left over after the vector
+// kernels' last whole vector.
+
+std::int64_t sumScalar(const std::int64_t *data, std::size_t n) {
+  std::uint64_t sum = 0;
+  for (std::size_t i = 0; i < n; i++) {
+    sum += data[i];
+  }
+  return wrap48(sum);
+}
+
+std::int64_t minScalar(const std::int64_t *data, std::size_t n) {
+  std::int64_t min = data[0];
+  for (std::size_t i = 1; i < n; i++) {
+    min = data[i] < min ? data[i] : min;
+  }
+  return min;
+}
+
+std::int64_t maxScalar(const std::int64_t *data, std::size_t n) {
+  std::int64_t max = data[0];
+  for (std::size_t i = 1; i < n; i++) {
+    max = data[i] > max ? data[i] : max;
+  }
+  return max;
+}
+
+std::size_t countScalar(const std::int64_t *data, std::size_t n,
+                        std::int64_t value) {
+  std::size_t count = 0;
+  for (std::size_t i = 0; i < n; i++) {
+    count += data[i] == value;
+  }
+  return count;
+}
+
+void fillScalar(std::int64_t *data, std::size_t n, std::int64_t value) {
+  for (std::size_t i = 0; i < n; i++) {
+    data[i] = value;
+  }
+}
+
+void addScalarScalar(std::int64_t *data, std::size_t n, std::int64_t value) {
+  for (std::size_t i = 0; i < n; i++) {
+    data[i] = wrap48(std::uint64_t(data[i]) + value);
+  }
+}
+
+void mulScalarScalar(std::int64_t *data, std::size_t n, std::int64_t value) {
+  for (std::size_t i = 0; i < n; i++) {
+    data[i] = wrap48(std::uint64_t(data[i]) * value);
+  }
+}
+
+void addScalar(std::int64_t *data, const std::int64_t *other, std::size_t n) {
+  for (std::size_t i = 0; i < n; i++) {
+    data[i] = wrap48(std::uint64_t(data[i]) + other[i]);
+  }
+}
+
+void mulScalar(std::int64_t *data, const std::int64_t *other, std::size_t n) {
+  for (std::size_t i = 0; i < n; i++) {
+    data[i] = wrap48(std::uint64_t(data[i]) * other[i]);
+  }
+}
+
+const ArrayKernels scalarKernels = {
+    "scalar",    sumScalar,       minScalar,       maxScalar, countScalar,
+    fillScalar,  addScalarScalar, mulScalarScalar, addScalar, mulScalar};
+
+#if defined(__x86_64__) && defined(__GNUC__)
+
+// The vector kernels are written once, over GCC vector types of any width,
+// and inlined into wrappers compiled for each instruction set. V is a vector
+// of signed lanes, and U the same of unsigned ones, for arithmetic that wraps.
+
+#define B9_KERNEL inline __attribute__((always_inline))
+
+// The kernels are always inlined, so no vector is passed by value between
+// functions compiled for different instruction sets.
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+typedef std::int64_t Int64x2 __attribute__((vector_size(16)));
+typedef std::uint64_t Uint64x2 __attribute__((vector_size(16)));
+typedef std::int64_t Int64x4 __attribute__((vector_size(32)));
+typedef std::uint64_t Uint64x4 __attribute__((vector_size(32)));
+
+template <typename V>
+constexpr std::size_t lanes() {
+  return sizeof(V) / sizeof(std::int64_t);
+}
+
+template <typename V>
+B9_KERNEL V load(const std::int64_t *data) {
+  V v;
+  std::memcpy(&v, data, sizeof(V));
+  return v;
+}
+
+template <typename V>
+B9_KERNEL void store(std::int64_t *data, V v) {
+  std::memcpy(data, &v, sizeof(V));
+}
+
+template <typename V, typename U>
+B9_KERNEL V wrap48(U x) {
+  return V(x << 16) >> 16;
+}
+
+template <typename V, typename U>
+B9_KERNEL std::int64_t sumVector(const std::int64_t *data, std::size_t n) {
+  U sum = {};
+  std::size_t i = 0;
+  for (; i + lanes<V>() <= n; i += lanes<V>()) {
+    sum += load<U>(data + i);
+  }
+  std::uint64_t total = sumScalar(data + i, n - i);
+  for (std::size_t lane = 0; lane < lanes<V>(); lane++) {
+    total += sum[lane];
+  }
+  return wrap48(total);
+}
+
+template <typename V>
+B9_KERNEL std::int64_t minVector(const std::int64_t *data, std::size_t n) {
+  if (n < lanes<V>()) {
+    return minScalar(data, n);
+  }
+  V min = load<V>(data);
+  std::size_t i = lanes<V>();
+  for (; i + lanes<V>() <= n; i += lanes<V>()) {
+    V v = load<V>(data + i);
+    min = v < min ? v : min;
+  }
+  std::int64_t result = i < n ? minScalar(data + i, n - i) : min[0];
+  for (std::size_t lane = 0; lane < lanes<V>(); lane++) {
+    result = min[lane] < result ? min[lane] : result;
+  }
+  return result;
+}
+
+template <typename V>
+B9_KERNEL std::int64_t maxVector(const std::int64_t *data, std::size_t n) {
+  if (n < lanes<V>()) {
+    return maxScalar(data, n);
+  }
+  V max = load<V>(data);
+  std::size_t i = lanes<V>();
+  for (; i + lanes<V>() <= n; i += lanes<V>()) {
+    V v = load<V>(data + i);
+    max = v > max ? v : max;
+  }
+  std::int64_t result = i < n ? maxScalar(data + i, n - i) : max[0];
+  for (std::size_t lane = 0; lane < lanes<V>(); lane++) {
+    result = max[lane] > result ? max[lane] : result;
+  }
+  return result;
+}
+
+template <typename V>
+B9_KERNEL std::size_t countVector(const std::int64_t *data, std::size_t n,
+                                  std::int64_t value) {
+  // A true comparison is -1 in every bit of its lane.
+  V counts = {};
+  const V values = V{} + value;
+  std::size_t i = 0;
+  for (; i + lanes<V>() <= n; i += lanes<V>()) {
+    counts -= load<V>(data + i) == values;
+  }
+  std::size_t count = countScalar(data + i, n - i, value);
+  for (std::size_t lane = 0; lane < lanes<V>(); lane++) {
+    count += counts[lane];
+  }
+  return count;
+}
+
+template <typename V>
+B9_KERNEL void fillVector(std::int64_t *data, std::size_t n,
+                          std::int64_t value) {
+  const V values = V{} + value;
+  std::size_t i = 0;
+  for (; i + lanes<V>() <= n; i += lanes<V>()) {
+    store(data + i, values);
+  }
+  fillScalar(data + i, n - i, value);
+}
+
+template <typename V, typename U>
+B9_KERNEL void addScalarVector(std::int64_t *data, std::size_t n,
+                               std::int64_t value) {
+  const U values = U{} + std::uint64_t(value);
+  std::size_t i = 0;
+  for (; i + lanes<V>() <= n; i += lanes<V>()) {
+    store(data + i, wrap48<V>(load<U>(data + i) + values));
+  }
+  addScalarScalar(data + i, n - i, value);
+}
+
+template <typename V, typename U>
+B9_KERNEL void mulScalarVector(std::int64_t *data, std::size_t n,
+                               std::int64_t value) {
+  const U values = U{} + std::uint64_t(value);
+  std::size_t i = 0;
+  for (; i + lanes<V>() <= n; i += lanes<V>()) {
+    store(data + i, wrap48<V>(load<U>(data + i) * values));
+  }
+  mulScalarScalar(data + i, n - i, value);
+}
+
+template <typename V, typename U>
+B9_KERNEL void addVector(std::int64_t *data, const std::int64_t *other,
+                         std::size_t n) {
+  std::size_t i = 0;
+  for (; i + lanes<V>() <= n; i += lanes<V>()) {
+    store(data + i, wrap48<V>(load<U>(data + i) + load<U>(other + i)));
+  }
+  addScalar(data + i, other + i, n - i);
+}
+
+template <typename V, typename U>
+B9_KERNEL void mulVector(std::int64_t *data, const std::int64_t *other,
+                         std::size_t n) {
+  std::size_t i = 0;
+  for (; i + lanes<V>() <= n; i += lanes<V>()) {
+    store(data + i, wrap48<V>(load<U>(data + i) * load<U>(other + i)));
+  }
+  mulScalar(data + i, other + i, n - i);
+}
+
+/// Define the kernels for one instruction set, and their ArrayKernels.
+#define B9_DEFINE_KERNELS(NAME, TARGET, V, U)                                  \
+  __attribute__((target(TARGET))) std::int64_t sum_##NAME(                     \
+      const std::int64_t *data, std::size_t n) {                               \
+    return sumVector<V, U>(data, n);                                           \
+  }                                                                            \
+  __attribute__((target(TARGET))) std::int64_t min_##NAME(                     \
+      const std::int64_t *data, std::size_t n) {                               \
+    return minVector<V>(data, n);                                              \
+  }                                                                            \
+  __attribute__((target(TARGET))) std::int64_t max_##NAME(                     \
+      const std::int64_t *data, std::size_t n) {                               \
+    return maxVector<V>(data, n);                                              \
+  }                                                                            \
+  __attribute__((target(TARGET))) std::size_t count_##NAME(                    \
+      const std::int64_t *data, std::size_t n, std::int64_t value) {           \
+    return countVector<V>(data, n, value);                                     \
+  }                                                                            \
+  __attribute__((target(TARGET))) void fill_##NAME(                            \
+      std::int64_t *data, std::size_t n, std::int64_t value) {                 \
+    fillVector<V>(data, n, value);                                             \
+  }                                                                            \
+  __attribute__((target(TARGET))) void addScalar_##NAME(                       \
+      std::int64_t *data, std::size_t n, std::int64_t value) {                 \
+    addScalarVector<V, U>(data, n, value);                                     \
+  }                                                                            \
+  __attribute__((target(TARGET))) void mulScalar_##NAME(                       \
+      std::int64_t *data, std::size_t n, std::int64_t value) {                 \
+    mulScalarVector<V, U>(data, n, value);                                     \
+  }                                                                            \
+  __attribute__((target(TARGET))) void add_##NAME(                             \
+      std::int64_t *data, const std::int64_t *other, std::size_t n) {          \
+    addVector<V, U>(data, other, n);                                           \
+  }                                                                            \
+  __attribute__((target(TARGET))) void mul_##NAME(                             \
+      std::int64_t *data, const std::int64_t *other, std::size_t n) {          \
+    mulVector<V, U>(data, other, n);                                           \
+  }                                                                            \
+  const ArrayKernels NAME##Kernels = {                                         \
+      #NAME,        sum_##NAME,       min_##NAME,       max_##NAME,            \
+      count_##NAME, fill_##NAME,      addScalar_##NAME, mulScalar_##NAME,      \
+      add_##NAME,   mul_##NAME};
+
+// SSE4.2 for the 64 bit compares.
+B9_DEFINE_KERNELS(sse42, "sse4.2", Int64x2, Uint64x2)
+B9_DEFINE_KERNELS(avx2, "avx2", Int64x4, Uint64x4)
+
+#undef B9_DEFINE_KERNELS
+#undef B9_KERNEL
+
+#endif  // defined(__x86_64__) && defined(__GNUC__)
+
+}  // namespace
+
+const ArrayKernels &arrayKernels() {
+  static const ArrayKernels &best = *supportedArrayKernels().back();
+  return best;
+}
+
+std::vector<const ArrayKernels *> supportedArrayKernels() {
+  std::vector<const ArrayKernels *> supported = {&scalarKernels};
+#if defined(__x86_64__) && defined(__GNUC__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.2")) {
+    supported.push_back(&sse42Kernels);
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    supported.push_back(&avx2Kernels);
+  }
+#endif
+  return supported;
+}
+
+}  // namespace b9
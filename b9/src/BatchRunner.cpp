@@ -0,0 +1,185 @@
+#include <b9/BatchRunner.hpp>
+#include <b9/ExecutionContext.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace b9 {
+
+namespace {
+
+/// Ranges per worker. More ranges balance better, fewer cost less locking.
+constexpr std::size_t RANGES_PER_WORKER = 8;
+
+}  // namespace
+
+BatchRunner::BatchRunner(VirtualMachine &virtualMachine, std::size_t threads)
+    : virtualMachine_(virtualMachine) {
+  const Config &cfg = virtualMachine.config();
+  if (cfg.jit && !cfg.multithreaded) {
+    throw std::runtime_error{
+        "A BatchRunner needs multithreaded set for compiled code to poll"};
+  }
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for (std::size_t i = 0; i < threads; i++) {
+    workers_.emplace_back(new Worker());
+  }
+  for (std::size_t i = 0; i < threads; i++) {
+    workers_[i]->thread = std::thread([this, i] { work(i); });
+  }
+}
+
+BatchRunner::~BatchRunner() noexcept {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    shutdown_ = true;
+  }
+  start_.notify_all();
+  for (auto &worker : workers_) {
+    worker->thread.join();
+  }
+}
+
+void BatchRunner::run(std::size_t functionIndex, const StackElement *args,
+                      std::size_t count, StackElement *results) {
+  if (count == 0) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> batchLock(batchMutex_);
+  std::unique_lock<std::mutex> lock(mutex_);
+  functionIndex_ = functionIndex;
+  nparams_ = virtualMachine_.getFunction(functionIndex)->nparams;
+  args_ = args;
+  results_ = results;
+  failed_ = false;
+  error_ = nullptr;
+
+  // Deal out contiguous blocks of ranges, so each worker starts on its own
+  // part of the batch.
+  const std::size_t rangeCount =
+      std::min(count, workers_.size() * RANGES_PER_WORKER);
+  for (std::size_t i = 0; i < rangeCount; i++) {
+    Range range{count * i / rangeCount, count * (i + 1) / rangeCount};
+    auto &worker = *workers_[i * workers_.size() / rangeCount];
+    std::lock_guard<std::mutex> workerLock(worker.mutex);
+    worker.ranges.push_back(range);
+  }
+
+  running_ = workers_.size();
+  generation_++;
+  start_.notify_all();
+  finished_.wait(lock, [this] { return running_ == 0; });
+
+  if (error_) {
+    std::rethrow_exception(error_);
+  }
+}
+
+std::vector<StackElement> BatchRunner::run(
+    std::size_t functionIndex, std::size_t count,
+    const std::vector<StackElement> &args) {
+  const std::size_t nparams =
+      virtualMachine_.getFunction(functionIndex)->nparams;
+  if (args.size() != count * nparams) {
+    throw BadFunctionCallException{
+        "Batch arguments are not one argument tuple per call"};
+  }
+  std::vector<StackElement> results(count);
+  run(functionIndex, args.data(), count, results.data());
+  return results;
+}
+
+std::vector<StackElement> BatchRunner::run(
+    std::size_t functionIndex, const std::vector<StackElement> &args) {
+  const std::size_t nparams =
+      virtualMachine_.getFunction(functionIndex)->nparams;
+  if (nparams == 0) {
+    throw BadFunctionCallException{
+        "A batch of a function without parameters needs a call count"};
+  }
+  if (args.size() % nparams != 0) {
+    throw BadFunctionCallException{
+        "Batch arguments are not a whole number of argument tuples"};
+  }
+  return run(functionIndex, args.size() / nparams, args);
+}
+
+void BatchRunner::work(std::size_t id) {
+  ExecutionContext context(virtualMachine_, virtualMachine_.config());
+  std::size_t generation = 0;
+
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      start_.wait(lock,
+                  [&] { return shutdown_ || generation != generation_; });
+      if (shutdown_) {
+        return;
+      }
+      generation = generation_;
+    }
+
+    {
+      Safepoint::Scope attached(virtualMachine_.safepoint());
+      Range range;
+      while (!failed_ && take(id, range)) {
+        for (std::size_t i = range.begin; i < range.end && !failed_; i++) {
+          // Let another worker's collection go ahead between calls.
+          virtualMachine_.safepoint().poll();
+          try {
+            results_[i] = virtualMachine_.runAttached(
+                context, functionIndex_, args_ + i * nparams_);
+          } catch (...) {
+            context.reset();
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!error_) {
+              error_ = std::current_exception();
+            }
+            failed_ = true;
+          }
+        }
+      }
+    }
+
+    context.output().flush();
+
+    // Drop whatever is left of an abandoned batch.
+    {
+      std::lock_guard<std::mutex> lock(workers_[id]->mutex);
+      workers_[id]->ranges.clear();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (--running_ == 0) {
+      finished_.notify_all();
+    }
+  }
+}
+
+bool BatchRunner::take(std::size_t id, Range &range) {
+  {
+    auto &own = *workers_[id];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (!own.ranges.empty()) {
+      range = own.ranges.back();
+      own.ranges.pop_back();
+      return true;
+    }
+  }
+
+  for (std::size_t i = 1; i < workers_.size(); i++) {
+    auto &victim = *workers_[(id + i) % workers_.size()];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.ranges.empty()) {
+      range = victim.ranges.front();
+      victim.ranges.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace b9
@@ -1,5 +1,7 @@
 #include "b9/compiler/Compiler.hpp"
 #include "b9/ExecutionContext.hpp"
+#include "b9/PerfMap.hpp"
+#include "b9/Trace.hpp"
 #include "b9/VirtualMachine.hpp"
 #include "b9/compiler/GlobalTypes.hpp"
 #include "b9/compiler/MethodBuilder.hpp"
@@ -15,6 +17,7 @@
 #include <cstring>
 #include <iostream>
 #include <sstream>
+#include <string>
 #include <vector>
 
 namespace b9 {
@@ -51,6 +54,10 @@ GlobalTypes::GlobalTypes(TR::TypeDictionary &td) {
   executionContext = td.DefineStruct(ec);
   // td.DefineField(ec, "omContext", ???, ExecutionContextOffset::OM_CONTEXT);
   td.DefineField(ec, "stack_", operandStack, ExecutionContextOffset::STACK);
+  td.DefineField(ec, "allocationNext_", stackElementPtr,
+                 ExecutionContextOffset::ALLOCATION_NEXT);
+  td.DefineField(ec, "allocationEnd_", stackElementPtr,
+                 ExecutionContextOffset::ALLOCATION_END);
   // td.DefineField(ec, "programCounter", ???,
   // ExecutionContextOffset::PROGRAM_COUNTER);
   td.CloseStruct(ec);
@@ -66,6 +73,7 @@ Compiler::Compiler(VirtualMachine &virtualMachine, const Config &cfg)
 
 JitFunction Compiler::generateCode(const std::size_t functionIndex) {
   const FunctionDef *function = virtualMachine_.getFunction(functionIndex);
+  TraceScope trace("jit", function->name);
   MethodBuilder methodBuilder(virtualMachine_, functionIndex);
 
   if (cfg_.verbose)
@@ -85,6 +93,10 @@ JitFunction Compiler::generateCode(const std::size_t functionIndex) {
     std::cout << "Compilation completed with return code: " << rc
               << ", code address: " << static_cast<void *>(result) << std::endl;
 
+  if (cfg_.perfMap || cfg_.jitDump) {
+    PerfMap::instance().add(result, function->name, cfg_.jitDump);
+  }
+
   return (JitFunction)result;
 }
 
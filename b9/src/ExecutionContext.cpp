@@ -1,6 +1,10 @@
 #include <b9/ExecutionContext.hpp>
+#include <b9/HashMap.hpp>
+#include <b9/Scheduler.hpp>
+#include <b9/Trace.hpp>
 #include <b9/VirtualMachine.hpp>
 #include <b9/compiler/Compiler.hpp>
+#include <b9/verify.hpp>
 
 #include <omrgc.h>
 #include "Jit.hpp"
@@ -12,7 +16,9 @@
 #include <OMR/Om/Value.hpp>
 
 #include <sys/time.h>
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -26,21 +32,36 @@ ExecutionContext::ExecutionContext(VirtualMachine &virtualMachine,
                                    const Config &cfg)
     : omContext_(virtualMachine.memoryManager()),
       virtualMachine_(&virtualMachine),
-      cfg_(&cfg) {
+      cfg_(&cfg),
+      output_(new OutputBuffer(virtualMachine.output(),
+                               virtualMachine.outputWriter(), cfg.outputFlush,
+                               cfg.outputBufferSize)),
+      profile_(cfg.profile ? new Profile() : nullptr) {
   omContext().userMarkingFns().push_back(
       [this](Om::MarkingVisitor &v) { this->visit(v); });
 }
 
+ExecutionContext::~ExecutionContext() noexcept {
+  virtualMachine_->gcStats().addAllocations(allocation_);
+}
+
 void ExecutionContext::reset() {
   stack_.reset();
   programCounter_ = 0;
+  frames_.clear();
+  resumable_ = false;
+  suspended_ = false;
+  nativeDepth_ = 0;
+  completion_ = nullptr;
 }
 
 Om::Value ExecutionContext::callJitFunction(JitFunction jitFunction,
                                             std::size_t nparams) {
   Om::RawValue result = 0;
 
-  if (cfg_->passParam) {
+  // Call with the convention the code was compiled for, which may have been by
+  // another isolate.
+  if (virtualMachine_->program()->jitConfig().passParam) {
     if (cfg_->verbose) {
       std::cout << "Int: transition to Jit(PP): " << (void *)jitFunction
                 << std::endl;
@@ -80,9 +101,63 @@ Om::Value ExecutionContext::callJitFunction(JitFunction jitFunction,
 }
 
 StackElement ExecutionContext::interpret(const std::size_t functionIndex) {
+  const std::size_t base = frames_.size();
+  if (enterFunction(functionIndex)) {
+    // Nothing below a nested interpreter can suspend, so this runs to the end.
+    runFrames(base);
+  }
+  return pop();
+}
+
+bool ExecutionContext::start(const std::size_t functionIndex,
+                             const StackElement *args) {
+  assert(frames_.empty() && !suspended_);
+  auto paramsCount = virtualMachine_->getFunction(functionIndex)->nparams;
+
+  // The arguments are roots once they are on the stack.
+  Safepoint::Scope attached(virtualMachine_->safepoint());
+
+  // In the same order as VirtualMachine::run.
+  for (std::size_t i = 0; i < paramsCount; i++) {
+    push(args[paramsCount - i - 1]);
+  }
+
+  if (!enterFunction(functionIndex)) {
+    result_ = pop();
+    return true;
+  }
+  return runSuspendable();
+}
+
+bool ExecutionContext::resume(StackElement value) {
+  assert(suspended_);
+  Safepoint::Scope attached(virtualMachine_->safepoint());
+  suspended_ = false;
+  push(value);
+  return runSuspendable();
+}
+
+bool ExecutionContext::runSuspendable() {
+  bool finished;
+  resumable_ = true;
+  try {
+    finished = runFrames(0);
+  } catch (...) {
+    resumable_ = false;
+    throw;
+  }
+  resumable_ = false;
+
+  if (!finished) {
+    suspended_ = true;
+    return false;
+  }
+  result_ = pop();
+  return true;
+}
+
+bool ExecutionContext::enterFunction(const std::size_t functionIndex) {
   auto function = virtualMachine_->getFunction(functionIndex);
-  auto paramsCount = function->nparams;
-  auto localsCount = function->nlocals;
   auto jitFunction = virtualMachine_->getJitAddress(functionIndex);
 
   if (cfg_->debug) {
@@ -91,30 +166,112 @@ StackElement ExecutionContext::interpret(const std::size_t functionIndex) {
   }
 
   if (jitFunction) {
-    return callJitFunction(jitFunction, paramsCount);
+    nativeDepth_++;
+    auto result = callJitFunction(jitFunction, function->nparams);
+    nativeDepth_--;
+    push(result);
+    return false;
   }
 
   // interpret the method otherwise
-  const Instruction *instructionPointer = function->instructions.data();
+  pushFrame(function, virtualMachine_->summary(functionIndex),
+            virtualMachine_->program()->refMaps(functionIndex));
+  return true;
+}
 
-  StackElement *params = stack_.top() - paramsCount;
+void ExecutionContext::pushFrame(const FunctionDef *function,
+                                 const FunctionSummary &summary,
+                                 const std::vector<RefMap> &refMaps) {
+  auto paramsCount = function->nparams;
+  auto localsCount = function->nlocals;
 
+  if (!summary.verified) {
+    if (stack_.size() < paramsCount) {
+      throw RuntimeCheckException{function->name + ": missing arguments"};
+    }
+    if (stack_.available() < localsCount) {
+      throw RuntimeCheckException{function->name + ": operand stack overflow"};
+    }
+  } else if (stack_.available() < localsCount + summary.maxStackDepth) {
+    throw StackOverflowException{function->name};
+  }
+
+  Frame frame;
+  frame.function = function;
+  frame.summary = &summary;
+  frame.instructionPointer = function->instructions.data();
+  frame.params = stack_.top() - paramsCount;
   stack_.pushn(localsCount);  // make room for locals in the stack
-  StackElement *locals = stack_.top() - localsCount;
+  frame.locals = stack_.top() - localsCount;
+  frame.refMaps = refMaps.empty() ? nullptr : refMaps.data();
+  frames_.push_back(frame);
+
+  virtualMachine_->safepoint().poll();
+}
+
+bool ExecutionContext::runFrames(const std::size_t base) {
+  while (frames_.size() > base) {
+    const bool verified = frames_.back().summary->verified;
+    FrameExit exit;
+    if (profile_ == nullptr) {
+      exit = verified ? runFrame<false, false>() : runFrame<true, false>();
+    } else {
+      exit = verified ? runFrame<false, true>() : runFrame<true, true>();
+    }
+    if (exit == FrameExit::SUSPEND) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <bool CHECKED, bool PROFILE>
+ExecutionContext::FrameExit ExecutionContext::runFrame() {
+  // Compiled code called from this frame may run a nested interpreter, which
+  // can grow frames_, so only the locals below are kept across instructions.
+  const Frame &frame = frames_.back();
+  const FunctionDef *function = frame.function;
+  const Instruction *instructionPointer = frame.instructionPointer;
+  StackElement *params = frame.params;
+  StackElement *locals = frame.locals;
+
+  Safepoint &safepoint = virtualMachine_->safepoint();
+  std::uint64_t *counts = PROFILE ? profile_->counts(function) : nullptr;
 
   while (*instructionPointer != END_SECTION) {
+    if (CHECKED) {
+      runtimeCheck(function, instructionPointer, locals + function->nlocals);
+    }
+    if (PROFILE) {
+      counts[instructionPointer - function->instructions.data()]++;
+      profile_->tick(function);
+    }
+    const Instruction *current = instructionPointer;
     switch (instructionPointer->opCode()) {
       case OpCode::FUNCTION_CALL:
-        doFunctionCall(instructionPointer->immediate());
+        frames_.back().instructionPointer = instructionPointer + 1;
+        if (enterFunction(instructionPointer->immediate())) {
+          programCounter_++;
+          return FrameExit::CALL;
+        }
         break;
       case OpCode::FUNCTION_RETURN: {
         auto result = stack_.pop();
         stack_.restore(params);
-        return result;
-        break;
+        frames_.pop_back();
+        push(result);
+        programCounter_++;
+        return FrameExit::RETURN;
       }
       case OpCode::PRIMITIVE_CALL:
-        doPrimitiveCall(instructionPointer->immediate());
+        // The primitive may collect, or wait for its completion while others
+        // do. Its arguments are covered by the map of the instruction after.
+        frames_.back().instructionPointer = instructionPointer + 1;
+        if (doPrimitiveCall(instructionPointer->immediate()) ==
+            PrimitiveStatus::PENDING) {
+          programCounter_++;
+          return FrameExit::SUSPEND;
+        }
         break;
       case OpCode::JMP:
         instructionPointer += instructionPointer->immediate();
@@ -152,6 +309,11 @@ StackElement ExecutionContext::interpret(const std::size_t functionIndex) {
       case OpCode::INT_PUSH_CONSTANT:
         doIntPushConstant(instructionPointer->immediate());
         break;
+      case OpCode::INT_PUSH_CONSTANT_WIDE:
+        doIntPushConstant(
+            wideImmediate(instructionPointer[0], instructionPointer[1]));
+        instructionPointer++;
+        break;
       case OpCode::INT_NOT:
         doIntNot();
         break;
@@ -177,47 +339,168 @@ StackElement ExecutionContext::interpret(const std::size_t functionIndex) {
         doStrPushConstant(instructionPointer->immediate());
         break;
       case OpCode::NEW_OBJECT:
+        frames_.back().instructionPointer = instructionPointer;
         doNewObject();
         break;
       case OpCode::PUSH_FROM_OBJECT:
         doPushFromObject(Om::Id(instructionPointer->immediate()));
         break;
       case OpCode::POP_INTO_OBJECT:
+        frames_.back().instructionPointer = instructionPointer;
         doPopIntoObject(Om::Id(instructionPointer->immediate()));
         break;
+      case OpCode::NEW_ARRAY:
+        frames_.back().instructionPointer = instructionPointer;
+        doNewArray();
+        break;
+      case OpCode::ARRAY_LENGTH:
+        doArrayLength();
+        break;
+      case OpCode::PUSH_FROM_ARRAY:
+        doPushFromArray();
+        break;
+      case OpCode::POP_INTO_ARRAY:
+        doPopIntoArray();
+        break;
+      case OpCode::STR_CONCAT:
+        frames_.back().instructionPointer = instructionPointer;
+        doStrConcat();
+        break;
+      case OpCode::STR_LENGTH:
+        doStrLength();
+        break;
+      case OpCode::STR_SLICE:
+        frames_.back().instructionPointer = instructionPointer;
+        doStrSlice();
+        break;
+      case OpCode::NEW_MAP:
+        frames_.back().instructionPointer = instructionPointer;
+        doNewMap();
+        break;
+      case OpCode::MAP_GET:
+        doMapGet();
+        break;
+      case OpCode::MAP_SET:
+        frames_.back().instructionPointer = instructionPointer;
+        doMapSet();
+        break;
+      case OpCode::MAP_HAS:
+        doMapHas();
+        break;
+      case OpCode::MAP_DELETE:
+        doMapDelete();
+        break;
       case OpCode::CALL_INDIRECT:
         doCallIndirect();
         break;
       case OpCode::SYSTEM_COLLECT:
+        frames_.back().instructionPointer = instructionPointer;
         doSystemCollect();
         break;
       default:
         assert(false);
         break;
     }
+    if (instructionPointer < current) {
+      // A backward jump. The target has a map.
+      frames_.back().instructionPointer = instructionPointer + 1;
+      safepoint.poll();
+    }
     instructionPointer++;
     programCounter_++;
   }
   throw std::runtime_error("Reached end of function");
 }
 
-void ExecutionContext::push(StackElement value) { stack_.push(value); }
+void ExecutionContext::runtimeCheck(const FunctionDef *function,
+                                    const Instruction *instructionPointer,
+                                    const StackElement *operands) {
+  const auto &module = *virtualMachine_->module();
+  const auto &primitives = virtualMachine_->primitiveSignatures();
+  const std::size_t index = instructionPointer - function->instructions.data();
 
-StackElement ExecutionContext::pop() { return stack_.pop(); }
+  const char *error =
+      b9::checkInstruction(module, *function, index, primitives);
+  if (error == nullptr) {
+    auto effect = stackEffect(module, *instructionPointer, primitives);
+    if (std::size_t(stack_.top() - operands) < effect.pops) {
+      error = "operand stack underflow";
+    } else if (stack_.available() + effect.pops < effect.pushes) {
+      error = "operand stack overflow";
+    }
+  }
 
-void ExecutionContext::doFunctionCall(Immediate value) {
-  auto f = virtualMachine_->getFunction((std::size_t)value);
-  auto result = interpret(value);
-  push(result);
+  if (error) {
+    std::stringstream ss;
+    ss << function->name << "@" << index << ": " << error;
+    throw RuntimeCheckException{ss.str()};
+  }
 }
 
+void ExecutionContext::push(StackElement value) { stack_.push(value); }
+
+StackElement ExecutionContext::pop() { return stack_.pop(); }
+
 void ExecutionContext::doFunctionReturn(StackElement returnVal) {
   // TODO
 }
 
-void ExecutionContext::doPrimitiveCall(Immediate value) {
-  PrimitiveFunction *primitive = virtualMachine_->getPrimitive(value);
-  (*primitive)(this);
+PrimitiveStatus ExecutionContext::doPrimitiveCall(Immediate value) {
+  const Primitive &primitive = virtualMachine_->primitives()[value];
+  PrimitiveStatus status;
+  {
+    TraceScope trace("primitive", primitive.name);
+    status = (*primitive.function)(this);
+  }
+  auto completion = std::move(completion_);
+
+  if (status == PrimitiveStatus::DONE) {
+    return status;
+  }
+  if (!primitive.is(Primitive::ASYNC)) {
+    throw SuspendException{"Primitive is not async: " + primitive.name};
+  }
+  if (completion && completion->scheduler == nullptr) {
+    waitForCompletion(*completion);
+    return PrimitiveStatus::DONE;
+  }
+  if (!canSuspend()) {
+    throw SuspendException{nativeDepth_ != 0
+                               ? "Cannot suspend a context in compiled code"
+                               : "Cannot suspend a context not started by "
+                                 "ExecutionContext::start"};
+  }
+  return status;
+}
+
+Completion ExecutionContext::completion() {
+  completion_ = std::make_shared<Completion::State>();
+  completion_->scheduler = canSuspend() ? scheduler_ : nullptr;
+  completion_->context = this;
+  return Completion{completion_};
+}
+
+void ExecutionContext::waitForCompletion(Completion::State &completion) {
+  // Other threads may stop the world while this one waits.
+  Safepoint &safepoint = virtualMachine_->safepoint();
+  safepoint.detach();
+  {
+    std::unique_lock<std::mutex> lock(completion.mutex);
+    completion.completed.wait(lock, [&] { return completion.done; });
+  }
+  safepoint.attach();
+  push(completion.value);
+}
+
+void Completion::complete(StackElement value) const {
+  if (state_->scheduler) {
+    state_->scheduler->complete(state_->context, value);
+    return;
+  }
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  state_->value = value;
+  state_->done = true;
+  state_->completed.notify_all();
 }
 
 Immediate ExecutionContext::doJmp(Immediate offset) { return offset; }
@@ -266,8 +549,8 @@ void ExecutionContext::doIntDiv() {
   push({Om::AS_INT48, left / right});
 }
 
-void ExecutionContext::doIntPushConstant(Immediate value) {
-  stack_.push({Om::AS_INT48, static_cast<std::int64_t>(value)});
+void ExecutionContext::doIntPushConstant(std::int64_t value) {
+  stack_.push({Om::AS_INT48, value});
 }
 
 void ExecutionContext::doIntNot() {
@@ -276,10 +559,26 @@ void ExecutionContext::doIntNot() {
   push({Om::AS_INT48, !(x.getInt48())});
 }
 
+bool ExecutionContext::isString(StackElement value) {
+  return virtualMachine_->strings().isString(*this, value);
+}
+
+int ExecutionContext::compareStrings(StackElement left, StackElement right) {
+  return virtualMachine_->strings().compare(*this, left, right);
+}
+
+bool ExecutionContext::equal(StackElement left, StackElement right) {
+  // Equal strings may be different values.
+  if (left != right && isString(left) && isString(right)) {
+    return virtualMachine_->strings().equal(*this, left, right);
+  }
+  return left == right;
+}
+
 Immediate ExecutionContext::doJmpEq(Immediate delta) {
   auto right = stack_.pop();
   auto left = stack_.pop();
-  if (left == right) {
+  if (equal(left, right)) {
     return delta;
   }
   return 0;
@@ -288,30 +587,30 @@ Immediate ExecutionContext::doJmpEq(Immediate delta) {
 Immediate ExecutionContext::doJmpNeq(Immediate delta) {
   auto right = stack_.pop();
   auto left = stack_.pop();
-  if (left != right) {
+  if (!equal(left, right)) {
     return delta;
   }
   return 0;
 }
 
+int ExecutionContext::compare(StackElement left, StackElement right) {
+  if (right.isInt48() && left.isInt48()) {
+    return (left.getInt48() > right.getInt48()) -
+           (left.getInt48() < right.getInt48());
+  }
+  if (isString(right) && isString(left)) {
+    return compareStrings(left, right);
+  }
+  throw std::runtime_error("Operands for comparison not of same type.");
+}
+
+// ( left right -- )
 Immediate ExecutionContext::doJmpGt(Immediate delta) {
   auto right = stack_.pop();
   auto left = stack_.pop();
-
-  if (right.isInt48() && left.isInt48()) {
-    if (left.getInt48() > right.getInt48()) {
-      return delta;
-    }
-  } else if (right.isUint48() && left.isUint48()) {
-    const auto &strRight = virtualMachine_->getString(right.getUint48());
-    const auto &strLeft = virtualMachine_->getString(left.getUint48());
-    if (strLeft > strRight) {
-      return delta;
-    }
-  } else {
-    throw std::runtime_error("Operands for comparison not of same type.");
+  if (compare(left, right) > 0) {
+    return delta;
   }
-
   return 0;
 }
 
@@ -319,21 +618,9 @@ Immediate ExecutionContext::doJmpGt(Immediate delta) {
 Immediate ExecutionContext::doJmpGe(Immediate delta) {
   auto right = stack_.pop();
   auto left = stack_.pop();
-
-  if (right.isInt48() && left.isInt48()) {
-    if (left.getInt48() >= right.getInt48()) {
-      return delta;
-    }
-  } else if (right.isUint48() && left.isUint48()) {
-    const auto &strRight = virtualMachine_->getString(right.getUint48());
-    const auto &strLeft = virtualMachine_->getString(left.getUint48());
-    if (strLeft >= strRight) {
-      return delta;
-    }
-  } else {
-    throw std::runtime_error("Operands for comparison not of same type.");
+  if (compare(left, right) >= 0) {
+    return delta;
   }
-
   return 0;
 }
 
@@ -341,21 +628,9 @@ Immediate ExecutionContext::doJmpGe(Immediate delta) {
 Immediate ExecutionContext::doJmpLt(Immediate delta) {
   auto right = stack_.pop();
   auto left = stack_.pop();
-
-  if (right.isInt48() && left.isInt48()) {
-    if (left.getInt48() < right.getInt48()) {
-      return delta;
-    }
-  } else if (right.isUint48() && left.isUint48()) {
-    const auto &strRight = virtualMachine_->getString(right.getUint48());
-    const auto &strLeft = virtualMachine_->getString(left.getUint48());
-    if (strLeft < strRight) {
-      return delta;
-    }
-  } else {
-    throw std::runtime_error("Operands for comparison not of same type.");
+  if (compare(left, right) < 0) {
+    return delta;
   }
-
   return 0;
 }
 
@@ -363,21 +638,9 @@ Immediate ExecutionContext::doJmpLt(Immediate delta) {
 Immediate ExecutionContext::doJmpLe(Immediate delta) {
   auto right = stack_.pop();
   auto left = stack_.pop();
-
-  if (right.isInt48() && left.isInt48()) {
-    if (left.getInt48() <= right.getInt48()) {
-      return delta;
-    }
-  } else if (right.isUint48() && left.isUint48()) {
-    const auto &strRight = virtualMachine_->getString(right.getUint48());
-    const auto &strLeft = virtualMachine_->getString(left.getUint48());
-    if (strLeft <= strRight) {
-      return delta;
-    }
-  } else {
-    throw std::runtime_error("Operands for comparison not of same type.");
+  if (compare(left, right) <= 0) {
+    return delta;
   }
-
   return 0;
 }
 
@@ -387,10 +650,83 @@ void ExecutionContext::doStrPushConstant(Immediate param) {
   stack_.push({Om::AS_UINT48, static_cast<std::uint64_t>(param)});
 }
 
+// ( left right -- string )
+void ExecutionContext::doStrConcat() {
+  // Stop before popping, since stopping may wait out another collection.
+  StopTheWorld stopped(*this);
+  auto right = stack_.pop();
+  auto left = stack_.pop();
+  if (!isString(left) || !isString(right)) {
+    throw std::runtime_error("Operands for concatenation are not strings.");
+  }
+  stack_.push(virtualMachine_->strings().concat(*this, left, right));
+}
+
+// ( string -- length )
+void ExecutionContext::doStrLength() {
+  auto string = stack_.pop();
+  if (!isString(string)) {
+    throw std::runtime_error("Taking the length of a non-string value.");
+  }
+  auto length = virtualMachine_->strings().length(*this, string);
+  stack_.push({Om::AS_INT48, std::int64_t(length)});
+}
+
+// ( string start end -- string )
+void ExecutionContext::doStrSlice() {
+  StopTheWorld stopped(*this);
+  auto end = stack_.pop();
+  auto start = stack_.pop();
+  auto string = stack_.pop();
+  if (!isString(string) || !start.isInt48() || !end.isInt48()) {
+    throw std::runtime_error("Operands for slice are not a string and ints.");
+  }
+  stack_.push(virtualMachine_->strings().slice(*this, string, start.getInt48(),
+                                               end.getInt48()));
+}
+
 // ( -- object )
-void ExecutionContext::doNewObject() {
-  auto ref = Om::allocateEmptyObject(*this);
-  stack_.push(Om::Value{Om::AS_REF, ref});
+void ExecutionContext::doNewObject() { stack_.push(allocateObject()); }
+
+ExecutionContext::StopTheWorld::StopTheWorld(ExecutionContext &context,
+                                             GcStats::Cause cause)
+    : context_(context), cause_(cause) {
+  if (context_.worldStops_++ == 0) {
+    start_ = std::chrono::steady_clock::now();
+    context_.virtualMachine_->safepoint().stop();
+    // Collections run while waiting to stop are the other thread's pause.
+    collections_ = context_.collections_;
+  }
+}
+
+ExecutionContext::StopTheWorld::~StopTheWorld() noexcept {
+  if (--context_.worldStops_ == 0) {
+    context_.virtualMachine_->safepoint().resume();
+    if (context_.collections_ != collections_) {
+      auto end = std::chrono::steady_clock::now();
+      context_.virtualMachine_->gcStats().recordPause(end - start_, cause_);
+      if (Tracer::instance().enabled()) {
+        Tracer::instance().record("gc", "pause", start_, end);
+      }
+    }
+  }
+}
+
+void ExecutionContext::refillAllocationBuffer() {
+  assert(allocationNext_ == allocationEnd_);
+  StopTheWorld stopped(*this);
+  allocation_.refills++;
+  // Fill from the top down, so that the filled part is always valid. A
+  // collection drops what was filled, so stop after one, with the object
+  // allocated after it.
+  while (allocationNext_ != allocationBuffer_) {
+    const std::size_t collections = collections_;
+    auto ref = Om::allocateEmptyObject(*this);
+    *--allocationNext_ = Om::Value{Om::AS_REF, ref};
+    if (collections_ != collections) {
+      break;
+    }
+  }
 }
 
 // ( object -- value )
@@ -406,9 +742,20 @@ void ExecutionContext::doPushFromObject(Om::Id slotId) {
     Om::Value result;
     result = Om::getValue(*this, obj, descriptor);
     stack_.push(result);
-  } else {
-    throw std::runtime_error("Accessing an object's field that doesn't exist.");
+    return;
   }
+
+  // An object in dictionary mode may have it in its dictionary.
+  if (Om::lookupSlot(*this, obj, DICTIONARY_SLOT, descriptor)) {
+    auto dictionary =
+        Om::getValue(*this, obj, descriptor).getRef<Om::Object>();
+    StackElement result;
+    if (HashMap::get(*this, dictionary, {Om::AS_INT48, slotId}, result)) {
+      stack_.push(result);
+      return;
+    }
+  }
+  throw std::runtime_error("Accessing an object's field that doesn't exist.");
 }
 
 // ( object value -- )
@@ -417,27 +764,312 @@ void ExecutionContext::doPopIntoObject(Om::Id slotId) {
     throw std::runtime_error("Accessing non-object as an object");
   }
 
-  std::size_t offset = 0;
   auto object = stack_.pop().getRef<Om::Object>();
 
   Om::SlotDescriptor descriptor;
   bool found = Om::lookupSlot(*this, object, slotId, descriptor);
+  StackElement old;
 
-  if (!found) {
-    static constexpr Om::SlotType type(Om::Id(0), Om::CoreType::VALUE);
+  if (found) {
+    old = Om::getValue(*this, object, descriptor);
+  } else {
+    if (storeInDictionary(object, slotId, stack_.peek())) {
+      stack_.drop();
+      return;
+    }
 
     Om::RootRef<Om::Object> root(*this, object);
-    auto map = Om::transitionLayout(*this, root, {{type, slotId}});
-    assert(map != nullptr);
+    Om::ObjectMap *shape = object->layout();
+    if (transitions_.isChild(shape) &&
+        transitions_.lookup(shape, slotId) == nullptr &&
+        transitions_.fanOut(shape) >= SHAPE_FAN_OUT_LIMIT) {
+      // Objects get their slots in too many orders here. Rather than make yet
+      // another shape, keep the rest of this one's slots in a dictionary. The
+      // empty shape is left out, since every kind of object starts there.
+      enterDictionaryMode(root);
+      storeInDictionary(root.get(), slotId, stack_.peek());
+      stack_.drop();
+      return;
+    }
 
-    // TODO: Get the descriptor fast after a single-slot transition.
-    Om::lookupSlot(*this, object, slotId, descriptor);
+    addSlot(root, slotId, descriptor);
+    Om::SlotDescriptor dictionary;
+    if (descriptor.offset() >= DICTIONARY_SLOT_LIMIT * sizeof(Om::Value) &&
+        !Om::lookupSlot(*this, root.get(), DICTIONARY_SLOT, dictionary)) {
+      enterDictionaryMode(root);
+      Om::lookupSlot(*this, root.get(), slotId, descriptor);
+    }
     object = root.get();
   }
 
   auto val = pop();
+  writeBarrier(object, found ? &old : nullptr, val);
   Om::setValue(*this, object, descriptor, val);
-  // TODO: Write barrier the object on store.
+}
+
+void ExecutionContext::remember(Om::Object *object) {
+  if (storeBufferOverflowed_ || remembered_.count(object) != 0) {
+    return;
+  }
+  if (storeBuffer_.size() == STORE_BUFFER_SIZE) {
+    // Too many to track one at a time.
+    storeBuffer_.clear();
+    remembered_.clear();
+    storeBufferOverflowed_ = true;
+    return;
+  }
+  remembered_.insert(object);
+  storeBuffer_.push_back(object);
+}
+
+namespace {
+
+/// The elements of an array, which hold the payloads of Int48 values.
+std::int64_t *elements(Om::Array *array) {
+  return static_cast<std::int64_t *>(array->data());
+}
+
+std::int64_t length(Om::Array *array) {
+  return array->sizeInBytes() / sizeof(std::int64_t);
+}
+
+Om::Array *checkArray(StackElement value) {
+  if (!value.isRef() || value.getRef<Om::Cell>()->map()->kind() !=
+                            Om::MapKind::ARRAY_MAP) {
+    throw std::runtime_error("Accessing non-array value as an array.");
+  }
+  return value.getRef<Om::Array>();
+}
+
+std::int64_t checkIndex(Om::Array *array, StackElement index) {
+  if (!index.isInt48() || index.getInt48() < 0 ||
+      index.getInt48() >= length(array)) {
+    throw std::runtime_error("Array index out of bounds.");
+  }
+  return index.getInt48();
+}
+
+}  // namespace
+
+StackElement ExecutionContext::newArray(StackElement length) {
+  if (!length.isInt48() || length.getInt48() < 0) {
+    throw std::runtime_error("Negative array length.");
+  }
+  const std::size_t size = length.getInt48() * sizeof(std::int64_t);
+  StopTheWorld stopped(*this);
+  auto array = Om::allocateArray(*this, size);
+  std::memset(array->data(), 0, size);
+  allocation_.objects++;
+  allocation_.bytes += size;
+  return {Om::AS_REF, array};
+}
+
+StackElement ExecutionContext::arrayLength(StackElement array) {
+  return {Om::AS_INT48, length(checkArray(array))};
+}
+
+StackElement ExecutionContext::arrayLoad(StackElement array,
+                                         StackElement index, bool checked) {
+  if (!checked) {
+    return {Om::AS_INT48,
+            elements(array.getRef<Om::Array>())[index.getInt48()]};
+  }
+  auto checkedArray = checkArray(array);
+  return {Om::AS_INT48,
+          elements(checkedArray)[checkIndex(checkedArray, index)]};
+}
+
+void ExecutionContext::arrayStore(StackElement array, StackElement index,
+                                  StackElement value, bool checked) {
+  // Om doesn't trace through arrays, so they can't hold references.
+  if (!value.isInt48()) {
+    throw std::runtime_error("Storing a non-integer into an array.");
+  }
+  if (!checked) {
+    elements(array.getRef<Om::Array>())[index.getInt48()] = value.getInt48();
+    return;
+  }
+  auto checkedArray = checkArray(array);
+  elements(checkedArray)[checkIndex(checkedArray, index)] = value.getInt48();
+}
+
+std::int64_t *ExecutionContext::arrayElements(StackElement array,
+                                              std::size_t &length) {
+  auto checkedArray = checkArray(array);
+  length = b9::length(checkedArray);
+  return elements(checkedArray);
+}
+
+// ( length -- array )
+void ExecutionContext::doNewArray() {
+  // The length stays on the stack until the array exists.
+  auto array = newArray(stack_.peek());
+  stack_.drop();
+  stack_.push(array);
+}
+
+// ( array -- length )
+void ExecutionContext::doArrayLength() {
+  stack_.push(arrayLength(stack_.pop()));
+}
+
+// ( array index -- value )
+void ExecutionContext::doPushFromArray() {
+  auto index = stack_.pop();
+  auto array = stack_.pop();
+  stack_.push(arrayLoad(array, index, true));
+}
+
+// ( array index value -- )
+void ExecutionContext::doPopIntoArray() {
+  auto value = stack_.pop();
+  auto index = stack_.pop();
+  auto array = stack_.pop();
+  arrayStore(array, index, value, true);
+}
+
+bool ExecutionContext::storeInDictionary(Om::Object *object, Om::Id slotId,
+                                         StackElement value) {
+  Om::SlotDescriptor descriptor;
+  if (!Om::lookupSlot(*this, object, DICTIONARY_SLOT, descriptor)) {
+    return false;
+  }
+  auto dictionary =
+      Om::getValue(*this, object, descriptor).getRef<Om::Object>();
+  // Stopping may wait out another thread's collection, which moves objects.
+  Om::RootRef<Om::Object> root(*this, dictionary);
+  ValueRoot rootedValue(*this, value);
+  StopTheWorld stopped(*this);
+  HashMap::set(*this, root.get(), {Om::AS_INT48, slotId}, rootedValue.get());
+  return true;
+}
+
+void ExecutionContext::addSlot(Om::RootRef<Om::Object> &object, Om::Id slotId,
+                               Om::SlotDescriptor &descriptor) {
+  static constexpr Om::SlotType type(Om::Id(0), Om::CoreType::VALUE);
+
+  allocation_.transitions++;
+  Om::ObjectMap *parent = object.get()->layout();
+  const TransitionCache::Transition *cached =
+      transitions_.lookup(parent, slotId);
+  if (cached != nullptr) {
+    object.get()->layout(cached->child.getRef<Om::ObjectMap>());
+    descriptor = cached->descriptor;
+    allocation_.transitionCacheHits++;
+    return;
+  }
+
+  const std::size_t collections = collections_;
+  StopTheWorld stopped(*this);
+  auto map = Om::transitionLayout(*this, object, {{type, slotId}});
+  assert(map != nullptr);
+  Om::lookupSlot(*this, object.get(), slotId, descriptor);
+
+  // If the transition collected, the parent may have moved.
+  if (collections == collections_) {
+    transitions_.insert(parent, slotId, map, descriptor);
+    allocation_.shapes++;
+    allocation_.maxFanOut =
+        std::max(allocation_.maxFanOut, transitions_.maxFanOut());
+  }
+}
+
+void ExecutionContext::enterDictionaryMode(Om::RootRef<Om::Object> &object) {
+  StopTheWorld stopped(*this);
+  Om::RootRef<Om::Object> dictionary(*this, HashMap::allocate(*this));
+  Om::SlotDescriptor descriptor;
+  addSlot(object, DICTIONARY_SLOT, descriptor);
+  allocation_.dictionaries++;
+
+  StackElement value{Om::AS_REF, dictionary.get()};
+  writeBarrier(object.get(), nullptr, value);
+  Om::setValue(*this, object.get(), descriptor, value);
+}
+
+Om::Object *ExecutionContext::checkMap(StackElement value) {
+  auto map = HashMap::from(*this, value);
+  if (map == nullptr) {
+    throw std::runtime_error("Accessing non-map value as a map.");
+  }
+  return map;
+}
+
+StackElement ExecutionContext::checkKey(StackElement key) {
+  if (isString(key)) {
+    return virtualMachine_->strings().intern(*this, key);
+  }
+  if (!key.isInt48()) {
+    throw std::runtime_error("Map key is not an integer or a string.");
+  }
+  return key;
+}
+
+StackElement ExecutionContext::newMap() {
+  StopTheWorld stopped(*this);
+  allocation_.objects++;
+  return {Om::AS_REF, HashMap::allocate(*this)};
+}
+
+StackElement ExecutionContext::mapGet(StackElement map, StackElement key) {
+  StackElement value;
+  if (!HashMap::get(*this, checkMap(map), checkKey(key), value)) {
+    throw std::runtime_error("Key not found in map.");
+  }
+  return value;
+}
+
+void ExecutionContext::mapSet(StackElement map, StackElement key,
+                              StackElement value) {
+  // Stopping may wait out another thread's collection, which moves a string
+  // key, so it is interned first. Interning doesn't allocate in the heap.
+  key = checkKey(key);
+  Om::RootRef<Om::Object> root(*this, checkMap(map));
+  ValueRoot rootedValue(*this, value);
+  StopTheWorld stopped(*this);
+  HashMap::set(*this, root.get(), key, rootedValue.get());
+}
+
+StackElement ExecutionContext::mapHas(StackElement map, StackElement key) {
+  StackElement value;
+  bool found = HashMap::get(*this, checkMap(map), checkKey(key), value);
+  return {Om::AS_INT48, found};
+}
+
+StackElement ExecutionContext::mapDelete(StackElement map, StackElement key) {
+  bool found = HashMap::remove(*this, checkMap(map), checkKey(key));
+  return {Om::AS_INT48, found};
+}
+
+// ( -- map )
+void ExecutionContext::doNewMap() { stack_.push(newMap()); }
+
+// ( map key -- value )
+void ExecutionContext::doMapGet() {
+  auto key = stack_.pop();
+  auto map = stack_.pop();
+  stack_.push(mapGet(map, key));
+}
+
+// ( map key value -- )
+void ExecutionContext::doMapSet() {
+  auto value = stack_.pop();
+  auto key = stack_.pop();
+  auto map = stack_.pop();
+  mapSet(map, key, value);
+}
+
+// ( map key -- found )
+void ExecutionContext::doMapHas() {
+  auto key = stack_.pop();
+  auto map = stack_.pop();
+  stack_.push(mapHas(map, key));
+}
+
+// ( map key -- found )
+void ExecutionContext::doMapDelete() {
+  auto key = stack_.pop();
+  auto map = stack_.pop();
+  stack_.push(mapDelete(map, key));
 }
 
 void ExecutionContext::doCallIndirect() {
@@ -445,7 +1077,8 @@ void ExecutionContext::doCallIndirect() {
 }
 
 void ExecutionContext::doSystemCollect() {
-  std::cout << "SYSTEM COLLECT!!!" << std::endl;
+  TraceScope trace("gc", "system_collect");
+  StopTheWorld stopped(*this, GcStats::Cause::SYSTEM_COLLECT);
   OMR_GC_SystemCollect(omContext_.vmContext(), 0);
 }
 
@@ -0,0 +1,105 @@
+#include <b9/GcStats.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace b9 {
+
+void GcStats::recordPause(Duration pause, Cause cause) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  pauses_.push_back(pause);
+  if (cause == Cause::SYSTEM_COLLECT) {
+    systemCollections_++;
+  }
+}
+
+std::size_t GcStats::pauses() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return pauses_.size();
+}
+
+GcStats::Duration GcStats::pausePercentile(double percent) const {
+  std::vector<Duration> pauses;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pauses = pauses_;
+  }
+  std::sort(pauses.begin(), pauses.end());
+  return percentile(pauses, percent);
+}
+
+GcStats::Duration GcStats::percentile(std::vector<Duration> sorted,
+                                      double percent) const {
+  if (sorted.empty()) {
+    return Duration::zero();
+  }
+  auto rank = std::size_t(std::ceil(percent / 100 * sorted.size()));
+  return sorted[std::min(std::max<std::size_t>(rank, 1), sorted.size()) - 1];
+}
+
+GcStats::Duration GcStats::maxPause() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (pauses_.empty()) {
+    return Duration::zero();
+  }
+  return *std::max_element(pauses_.begin(), pauses_.end());
+}
+
+GcStats::Duration GcStats::totalPause() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Duration total = Duration::zero();
+  for (auto pause : pauses_) {
+    total += pause;
+  }
+  return total;
+}
+
+GcStats::Snapshot GcStats::snapshot() const {
+  Snapshot snapshot;
+  std::vector<Duration> pauses;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    snapshot.allocation = allocation_;
+    pauses = pauses_;
+    snapshot.systemCollections = systemCollections_;
+  }
+  std::sort(pauses.begin(), pauses.end());
+  snapshot.collections = pauses.size();
+  snapshot.totalPause =
+      std::accumulate(pauses.begin(), pauses.end(), Duration::zero());
+  if (!pauses.empty()) {
+    snapshot.maxPause = pauses.back();
+  }
+  snapshot.p50Pause = percentile(pauses, 50);
+  snapshot.p99Pause = percentile(pauses, 99);
+  return snapshot;
+}
+
+void GcStats::addAllocations(const AllocationStats &allocation) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  allocation_ += allocation;
+}
+
+std::ostream &operator<<(std::ostream &out, const GcStats::Snapshot &stats) {
+  auto us = [](GcStats::Duration d) {
+    return std::chrono::duration<double, std::micro>(d).count();
+  };
+  return out << "objects:      " << stats.allocation.objects << " ("
+             << stats.allocation.refills << " refills)" << std::endl
+             << "bytes:        " << stats.allocation.bytes << std::endl
+             << "transitions:  " << stats.allocation.transitions << " ("
+             << stats.allocation.transitionCacheHits << " cached)"
+             << std::endl
+             << "shape tree:   " << stats.allocation.shapes
+             << " shapes, max fan-out " << stats.allocation.maxFanOut
+             << std::endl
+             << "dictionaries: " << stats.allocation.dictionaries << std::endl
+             << "collections:  " << stats.collections << " ("
+             << stats.systemCollections << " system)" << std::endl
+             << "pauses (us):  total " << us(stats.totalPause) << ", max "
+             << us(stats.maxPause) << ", p50 " << us(stats.p50Pause)
+             << ", p99 " << us(stats.p99Pause);
+}
+
+}  // namespace b9
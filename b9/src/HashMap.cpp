@@ -0,0 +1,316 @@
+#include <b9/HashMap.hpp>
+
+#include <b9/ExecutionContext.hpp>
+
+#include <OMR/Om/ArrayOperations.hpp>
+#include <OMR/Om/RootRef.hpp>
+#include <OMR/Om/ShapeOperations.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
+namespace b9 {
+
+namespace {
+
+// A table is an array of words: the count of keys, the count of used entries,
+// which includes tombstones, then the keys.
+constexpr std::size_t COUNT = 0;
+constexpr std::size_t USED = 1;
+constexpr std::size_t HEADER = 2;
+
+constexpr std::size_t INITIAL_CAPACITY = 8;
+
+// Keys are encoded as a payload, a kind bit and a present bit, so that no key
+// is an empty entry or a tombstone.
+constexpr std::uint64_t EMPTY = 0;
+constexpr std::uint64_t TOMBSTONE = 1;
+constexpr std::uint64_t PAYLOAD_MASK = (std::uint64_t(1) << 48) - 1;
+constexpr std::uint64_t STRING_KEY = std::uint64_t(1) << 48;
+constexpr std::uint64_t PRESENT = std::uint64_t(1) << 49;
+
+// Values are kept in a tree of nodes, objects with FANOUT value slots. The
+// slots of a leaf hold the values of consecutive entries, and the slots of the
+// nodes above hold their children.
+constexpr std::size_t FANOUT = 16;
+constexpr Om::Id FIRST_VALUE_SLOT = MAP_VALUES_SLOT + 1;
+
+constexpr Om::SlotType VALUE_TYPE(Om::Id(0), Om::CoreType::VALUE);
+
+std::uint64_t encodeKey(StackElement key) {
+  if (key.isInt48()) {
+    return (std::uint64_t(key.getInt48()) & PAYLOAD_MASK) | PRESENT;
+  }
+  assert(key.isUint48());
+  return (key.getUint48() & PAYLOAD_MASK) | STRING_KEY | PRESENT;
+}
+
+std::uint64_t hash(std::uint64_t key) {
+  // The finalizer of splitmix64.
+  key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9;
+  key = (key ^ (key >> 27)) * 0x94d049bb133111eb;
+  return key ^ (key >> 31);
+}
+
+std::uint64_t *words(Om::Array *table) {
+  return static_cast<std::uint64_t *>(table->data());
+}
+
+std::size_t capacity(Om::Array *table) {
+  return table->sizeInBytes() / sizeof(std::uint64_t) - HEADER;
+}
+
+Om::Array *allocateTable(Om::RunContext &cx, std::size_t capacity) {
+  const std::size_t size = (HEADER + capacity) * sizeof(std::uint64_t);
+  Om::Array *table = Om::allocateArray(cx, size);
+  std::memset(table->data(), 0, size);
+  return table;
+}
+
+StackElement getSlot(Om::RunContext &cx, Om::Object *object, Om::Id id) {
+  Om::SlotDescriptor descriptor;
+  bool found = Om::lookupSlot(cx, object, id, descriptor);
+  assert(found);
+  (void)found;
+  return Om::getValue(cx, object, descriptor);
+}
+
+/// Store into one of an object's hidden slots, through the write barrier. A
+/// new object's slots have no old value.
+void setSlot(ExecutionContext &context, Om::Object *object, Om::Id id,
+             StackElement value, bool fresh) {
+  Om::SlotDescriptor descriptor;
+  bool found = Om::lookupSlot(context, object, id, descriptor);
+  assert(found);
+  (void)found;
+  StackElement old;
+  if (!fresh) {
+    old = Om::getValue(context, object, descriptor);
+  }
+  context.writeBarrier(object, fresh ? nullptr : &old, value);
+  Om::setValue(context, object, descriptor, value);
+}
+
+Om::Array *tableOf(Om::RunContext &cx, Om::Object *map) {
+  return getSlot(cx, map, MAP_TABLE_SLOT).getRef<Om::Array>();
+}
+
+Om::Object *valuesOf(Om::RunContext &cx, Om::Object *map) {
+  return getSlot(cx, map, MAP_VALUES_SLOT).getRef<Om::Object>();
+}
+
+/// The entries each child of the root of a capacity's value tree covers.
+std::size_t childSpan(std::size_t capacity) {
+  std::size_t span = 1;
+  while (span * FANOUT < capacity) {
+    span *= FANOUT;
+  }
+  return span;
+}
+
+/// A node for the first entries of a value tree, whose children each cover
+/// span entries, and the nodes under it. Its leaves' slots hold Int48 0. May
+/// collect.
+Om::Object *allocateNode(ExecutionContext &context, std::size_t span,
+                         std::size_t entries) {
+  Om::RunContext &cx = context;
+  Om::RootRef<Om::Object> node(cx, Om::allocateEmptyObject(cx));
+  Om::transitionLayout(
+      cx, node,
+      {{VALUE_TYPE, FIRST_VALUE_SLOT + 0}, {VALUE_TYPE, FIRST_VALUE_SLOT + 1},
+       {VALUE_TYPE, FIRST_VALUE_SLOT + 2}, {VALUE_TYPE, FIRST_VALUE_SLOT + 3},
+       {VALUE_TYPE, FIRST_VALUE_SLOT + 4}, {VALUE_TYPE, FIRST_VALUE_SLOT + 5},
+       {VALUE_TYPE, FIRST_VALUE_SLOT + 6}, {VALUE_TYPE, FIRST_VALUE_SLOT + 7},
+       {VALUE_TYPE, FIRST_VALUE_SLOT + 8}, {VALUE_TYPE, FIRST_VALUE_SLOT + 9},
+       {VALUE_TYPE, FIRST_VALUE_SLOT + 10}, {VALUE_TYPE, FIRST_VALUE_SLOT + 11},
+       {VALUE_TYPE, FIRST_VALUE_SLOT + 12}, {VALUE_TYPE, FIRST_VALUE_SLOT + 13},
+       {VALUE_TYPE, FIRST_VALUE_SLOT + 14},
+       {VALUE_TYPE, FIRST_VALUE_SLOT + 15}});
+  // The slots are filled before the children are allocated, since that may
+  // collect.
+  for (std::size_t i = 0; i < FANOUT; i++) {
+    setSlot(context, node.get(), FIRST_VALUE_SLOT + i, {Om::AS_INT48, 0},
+            true);
+  }
+  for (std::size_t i = 0; span > 1 && i * span < entries; i++) {
+    const std::size_t covered = std::min(span, entries - i * span);
+    StackElement child{Om::AS_REF,
+                       allocateNode(context, span / FANOUT, covered)};
+    setSlot(context, node.get(), FIRST_VALUE_SLOT + i, child, false);
+  }
+  return node.get();
+}
+
+/// The leaf of a value tree that holds an entry's value. index becomes the
+/// value's slot in the leaf.
+Om::Object *leafOf(Om::RunContext &cx, Om::Object *values,
+                   std::size_t capacity, std::size_t &index) {
+  for (std::size_t span = childSpan(capacity); span > 1; span /= FANOUT) {
+    values = getSlot(cx, values, FIRST_VALUE_SLOT + index / span)
+                 .getRef<Om::Object>();
+    index %= span;
+  }
+  return values;
+}
+
+StackElement getEntryValue(Om::RunContext &cx, Om::Object *values,
+                           std::size_t capacity, std::size_t index) {
+  Om::Object *leaf = leafOf(cx, values, capacity, index);
+  return getSlot(cx, leaf, FIRST_VALUE_SLOT + index);
+}
+
+void setEntryValue(ExecutionContext &context, Om::Object *values,
+                   std::size_t capacity, std::size_t index,
+                   StackElement value) {
+  Om::Object *leaf = leafOf(context, values, capacity, index);
+  setSlot(context, leaf, FIRST_VALUE_SLOT + index, value, false);
+}
+
+/// The entry holding a key, or the entry to put it in: the first tombstone on
+/// its probe sequence, if any, or else the empty entry that ends it. The table
+/// always has an empty entry.
+std::size_t find(Om::Array *table, std::uint64_t key) {
+  const std::size_t mask = capacity(table) - 1;
+  const std::uint64_t *keys = words(table) + HEADER;
+  std::size_t tombstone = SIZE_MAX;
+  for (std::size_t i = hash(key) & mask;; i = (i + 1) & mask) {
+    if (keys[i] == key) {
+      return i;
+    }
+    if (keys[i] == EMPTY) {
+      return tombstone != SIZE_MAX ? tombstone : i;
+    }
+    if (keys[i] == TOMBSTONE && tombstone == SIZE_MAX) {
+      tombstone = i;
+    }
+  }
+}
+
+}  // namespace
+
+Om::Object *HashMap::allocate(ExecutionContext &context) {
+  Om::RunContext &cx = context;
+  Om::RootRef<Om::Object> map(cx, Om::allocateEmptyObject(cx));
+  Om::transitionLayout(cx, map,
+                       {{VALUE_TYPE, MAP_TABLE_SLOT},
+                        {VALUE_TYPE, MAP_VALUES_SLOT}});
+  // The slots are filled before the allocations, which may collect, and each
+  // allocation is stored before the next.
+  setSlot(context, map.get(), MAP_TABLE_SLOT, {Om::AS_INT48, 0}, true);
+  setSlot(context, map.get(), MAP_VALUES_SLOT, {Om::AS_INT48, 0}, true);
+  Om::Array *table = allocateTable(cx, INITIAL_CAPACITY);
+  setSlot(context, map.get(), MAP_TABLE_SLOT, {Om::AS_REF, table}, false);
+  Om::Object *values = allocateNode(context, childSpan(INITIAL_CAPACITY),
+                                      INITIAL_CAPACITY);
+  setSlot(context, map.get(), MAP_VALUES_SLOT, {Om::AS_REF, values}, false);
+  return map.get();
+}
+
+Om::Object *HashMap::from(Om::RunContext &cx, StackElement value) {
+  if (!value.isRef() || value.getRef<Om::Cell>()->map()->kind() !=
+                            Om::MapKind::OBJECT_MAP) {
+    return nullptr;
+  }
+  Om::Object *object = value.getRef<Om::Object>();
+  Om::SlotDescriptor descriptor;
+  if (!Om::lookupSlot(cx, object, MAP_TABLE_SLOT, descriptor)) {
+    return nullptr;
+  }
+  return object;
+}
+
+bool HashMap::get(Om::RunContext &cx, Om::Object *map, StackElement key,
+                  StackElement &value) {
+  const std::uint64_t encoded = encodeKey(key);
+  Om::Array *table = tableOf(cx, map);
+  const std::size_t entry = find(table, encoded);
+  if (words(table)[HEADER + entry] != encoded) {
+    return false;
+  }
+  value = getEntryValue(cx, valuesOf(cx, map), capacity(table), entry);
+  return true;
+}
+
+void HashMap::set(ExecutionContext &context, Om::Object *map,
+                  StackElement key, StackElement value) {
+  Om::RunContext &cx = context;
+  const std::uint64_t encoded = encodeKey(key);
+  Om::Array *table = tableOf(cx, map);
+  std::size_t entry = find(table, encoded);
+  if (words(table)[HEADER + entry] == encoded) {
+    setEntryValue(context, valuesOf(cx, map), capacity(table), entry, value);
+    return;
+  }
+
+  // Rebuild the table once it would be three quarters full, doubling it if
+  // that is keys rather than tombstones.
+  std::uint64_t *header = words(table);
+  const std::size_t oldCapacity = capacity(table);
+  if (header[HEADER + entry] == EMPTY &&
+      4 * (header[USED] + 1) > 3 * oldCapacity) {
+    const std::size_t newCapacity = 4 * (header[COUNT] + 1) > 3 * oldCapacity / 2
+                                        ? 2 * oldCapacity
+                                        : oldCapacity;
+    // The allocations may collect, which moves the map, the value and the
+    // new values.
+    Om::RootRef<Om::Object> root(cx, map);
+    ExecutionContext::ValueRoot rootedValue(context, value);
+    Om::RootRef<Om::Object> newValues(
+        cx, allocateNode(context, childSpan(newCapacity), newCapacity));
+    Om::Array *newTable = allocateTable(cx, newCapacity);
+    map = root.get();
+    value = rootedValue.get();
+    table = tableOf(cx, map);
+    Om::Object *values = valuesOf(cx, map);
+
+    const std::uint64_t *keys = words(table) + HEADER;
+    for (std::size_t i = 0; i < oldCapacity; i++) {
+      if (keys[i] != EMPTY && keys[i] != TOMBSTONE) {
+        const std::size_t moved = find(newTable, keys[i]);
+        words(newTable)[HEADER + moved] = keys[i];
+        setEntryValue(context, newValues.get(), newCapacity, moved,
+                      getEntryValue(cx, values, oldCapacity, i));
+      }
+    }
+    words(newTable)[COUNT] = words(table)[COUNT];
+    words(newTable)[USED] = words(table)[COUNT];
+    setSlot(context, map, MAP_TABLE_SLOT, {Om::AS_REF, newTable}, false);
+    setSlot(context, map, MAP_VALUES_SLOT, {Om::AS_REF, newValues.get()},
+            false);
+    table = newTable;
+    entry = find(table, encoded);
+  }
+
+  header = words(table);
+  if (header[HEADER + entry] == EMPTY) {
+    header[USED]++;
+  }
+  header[COUNT]++;
+  header[HEADER + entry] = encoded;
+  setEntryValue(context, valuesOf(cx, map), capacity(table), entry, value);
+}
+
+bool HashMap::remove(ExecutionContext &context, Om::Object *map,
+                     StackElement key) {
+  Om::RunContext &cx = context;
+  const std::uint64_t encoded = encodeKey(key);
+  Om::Array *table = tableOf(cx, map);
+  const std::size_t entry = find(table, encoded);
+  if (words(table)[HEADER + entry] != encoded) {
+    return false;
+  }
+  words(table)[HEADER + entry] = TOMBSTONE;
+  words(table)[COUNT]--;
+  // Let the value be collected.
+  setEntryValue(context, valuesOf(cx, map), capacity(table), entry,
+                {Om::AS_INT48, 0});
+  return true;
+}
+
+std::size_t HashMap::size(Om::RunContext &cx, Om::Object *map) {
+  return words(tableOf(cx, map))[COUNT];
+}
+
+}  // namespace b9
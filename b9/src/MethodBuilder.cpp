@@ -98,6 +98,13 @@ void MethodBuilder::defineLocals() {
   // Address of the current stack top
   DefineLocal("stackTop", globalTypes().stackElementPtr);
 
+  // Home slots on the operand stack, where references held in locals are
+  // spilled for the GC.
+  DefineLocal("homes", globalTypes().stackElementPtr);
+
+  // The result of the last JMP_EQ or JMP_NEQ comparison.
+  DefineLocal("equal", Int32);
+
   locals_.resize(function->nlocals);
 
   for (std::size_t i = 0; i < function->nlocals; i++) {
@@ -123,12 +130,86 @@ void MethodBuilder::defineFunctions() {
     functionIndex++;
   }
 
+  // Primitives are called through their own entry points. The names must stay
+  // put once defined, so make them all first.
+  const auto &primitives = virtualMachine_.primitives();
+  for (std::size_t i = 0; i < primitives.size(); i++) {
+    primitives_.push_back("primitive_" + std::to_string(i));
+  }
+  for (std::size_t i = 0; i < primitives.size(); i++) {
+    const auto &primitive = primitives[i];
+    const char *name = primitives_[i].c_str();
+    if (primitive.direct) {
+      DefineFunction(name, (char *)__FILE__, name, primitive.direct, Int64,
+                     primitive.signature.arity + 1,
+                     globalTypes().executionContextPtr,
+                     globalTypes().stackElement, globalTypes().stackElement,
+                     globalTypes().stackElement, globalTypes().stackElement,
+                     globalTypes().stackElement, globalTypes().stackElement,
+                     globalTypes().stackElement);
+    } else {
+      DefineFunction(name, (char *)__FILE__, name, (void *)primitive.function,
+                     Int32, 1, globalTypes().executionContextPtr);
+    }
+  }
+
   DefineFunction((char *)"interpret", (char *)__FILE__, "interpret",
                  (void *)&interpret, Int64, 2,
                  globalTypes().executionContextPtr, globalTypes().size);
   DefineFunction((char *)"primitive_call", (char *)__FILE__, "primitive_call",
                  (void *)&primitive_call, NoType, 2,
                  globalTypes().executionContextPtr, Int32);
+  DefineFunction((char *)"safepoint_poll", (char *)__FILE__, "safepoint_poll",
+                 (void *)&safepoint_poll, NoType, 1,
+                 globalTypes().executionContextPtr);
+  DefineFunction((char *)"system_collect", (char *)__FILE__, "system_collect",
+                 (void *)&system_collect, NoType, 1,
+                 globalTypes().executionContextPtr);
+  DefineFunction((char *)"refill_allocation_buffer", (char *)__FILE__,
+                 "refill_allocation_buffer", (void *)&refill_allocation_buffer,
+                 NoType, 1, globalTypes().executionContextPtr);
+  DefineFunction((char *)"array_new", (char *)__FILE__, "array_new",
+                 (void *)&array_new, Int64, 2,
+                 globalTypes().executionContextPtr, globalTypes().stackElement);
+  DefineFunction((char *)"array_length", (char *)__FILE__, "array_length",
+                 (void *)&array_length, Int64, 1, globalTypes().stackElement);
+  DefineFunction((char *)"array_load", (char *)__FILE__, "array_load",
+                 (void *)&array_load, Int64, 2, globalTypes().stackElement,
+                 globalTypes().stackElement);
+  DefineFunction((char *)"array_load_unchecked", (char *)__FILE__,
+                 "array_load_unchecked", (void *)&array_load_unchecked, Int64,
+                 2, globalTypes().stackElement, globalTypes().stackElement);
+  DefineFunction((char *)"array_store", (char *)__FILE__, "array_store",
+                 (void *)&array_store, NoType, 3, globalTypes().stackElement,
+                 globalTypes().stackElement, globalTypes().stackElement);
+  DefineFunction((char *)"array_store_unchecked", (char *)__FILE__,
+                 "array_store_unchecked", (void *)&array_store_unchecked,
+                 NoType, 3, globalTypes().stackElement,
+                 globalTypes().stackElement, globalTypes().stackElement);
+  DefineFunction((char *)"map_new", (char *)__FILE__, "map_new",
+                 (void *)&map_new, Int64, 1, globalTypes().executionContextPtr);
+  DefineFunction((char *)"map_get", (char *)__FILE__, "map_get",
+                 (void *)&map_get, Int64, 3, globalTypes().executionContextPtr,
+                 globalTypes().stackElement, globalTypes().stackElement);
+  DefineFunction((char *)"map_set", (char *)__FILE__, "map_set",
+                 (void *)&map_set, NoType, 4, globalTypes().executionContextPtr,
+                 globalTypes().stackElement, globalTypes().stackElement,
+                 globalTypes().stackElement);
+  DefineFunction((char *)"map_has", (char *)__FILE__, "map_has",
+                 (void *)&map_has, Int64, 3, globalTypes().executionContextPtr,
+                 globalTypes().stackElement, globalTypes().stackElement);
+  DefineFunction((char *)"map_delete", (char *)__FILE__, "map_delete",
+                 (void *)&map_delete, Int64, 3,
+                 globalTypes().executionContextPtr, globalTypes().stackElement,
+                 globalTypes().stackElement);
+  DefineFunction((char *)"values_equal", (char *)__FILE__, "values_equal",
+                 (void *)&values_equal, Int32, 3,
+                 globalTypes().executionContextPtr, globalTypes().stackElement,
+                 globalTypes().stackElement);
+  DefineFunction((char *)"values_compare", (char *)__FILE__, "values_compare",
+                 (void *)&values_compare, Int64, 3,
+                 globalTypes().executionContextPtr, globalTypes().stackElement,
+                 globalTypes().stackElement);
   DefineFunction((char *)"trace", (char *)__FILE__, "trace", (void *)&trace,
                  NoType, 2, globalTypes().addressPtr, globalTypes().addressPtr);
   DefineFunction((char *)"print_stack", (char *)__FILE__, "print_stack",
@@ -202,13 +283,6 @@ bool MethodBuilder::buildIL() {
   Store("stack", stack);
 
   TR::IlValue *stackTop = LoadIndirect("b9::OperandStack", "top_", stack);
-  Store("stackTop", stackTop);
-
-  if (cfg_.lazyVmState) {
-    setVMState(new ModelState(this, globalTypes()));
-  } else {
-    setVMState(new ActiveState(this, globalTypes()));
-  }
 
   /// When this function exits, we reset the stack top to the beginning of
   /// entry. The calling convention is callee-cleanup, so at exit we pop all
@@ -224,6 +298,27 @@ bool MethodBuilder::buildIL() {
     Store("stackBase", stackTop);
   }
 
+  /// Reserve zeroed home slots for the locals, and the native params, above
+  /// the args. They are freed with the args at exit.
+  std::size_t homeCount =
+      function->nlocals + (cfg_.passParam ? function->nparams : 0);
+  Store("homes", stackTop);
+  for (std::size_t i = 0; i < homeCount; i++) {
+    StoreAt(IndexAt(globalTypes().stackElementPtr, stackTop, ConstInt32(i)),
+            ConstInteger(globalTypes().stackElement, 0));
+  }
+  stackTop = IndexAt(globalTypes().stackElementPtr, stackTop,
+                     ConstInt32(homeCount));
+  StoreIndirect("b9::OperandStack", "top_", stack, stackTop);
+  Store("stackTop", stackTop);
+
+  if (cfg_.lazyVmState) {
+    auto maxStackDepth = virtualMachine_.summary(functionIndex_).maxStackDepth;
+    setVMState(new ModelState(this, globalTypes(), maxStackDepth));
+  } else {
+    setVMState(new ActiveState(this, globalTypes()));
+  }
+
   return inlineProgramIntoBuilder(functionIndex_, true);
 }
 
@@ -304,6 +399,12 @@ bool MethodBuilder::generateILForBytecode(
     state(builder)->Commit(builder);
   }
 
+  const RefMap *map = refMap(function, instructionIndex);
+
+  if (cfg_.multithreaded && isBackwardJump(instruction)) {
+    safepointPoll(builder, map);
+  }
+
   switch (instruction.opCode()) {
     case OpCode::PUSH_FROM_LOCAL:
       pushValue(builder, loadLocal(builder, instruction.immediate()));
@@ -396,6 +497,15 @@ bool MethodBuilder::generateILForBytecode(
       if (nextBytecodeBuilder)
         builder->AddFallThroughBuilder(nextBytecodeBuilder);
     } break;
+    case OpCode::INT_PUSH_CONSTANT_WIDE: {
+      auto constvalue =
+          wideImmediate(instruction, program[instructionIndex + 1]);
+      pushInt48(builder, builder->ConstInt64(constvalue));
+      // The second slot only holds immediate bits, skip over it.
+      if (instructionIndex + 2 < program.size())
+        builder->AddFallThroughBuilder(
+            bytecodeBuilderTable[instructionIndex + 2]);
+    } break;
     case OpCode::STR_PUSH_CONSTANT: {
       int index = instruction.immediate();
       /// TODO: Box/unbox here.
@@ -404,17 +514,82 @@ bool MethodBuilder::generateILForBytecode(
         builder->AddFallThroughBuilder(nextBytecodeBuilder);
     } break;
     case OpCode::PRIMITIVE_CALL: {
-      state(builder)->Commit(builder);
-      TR::IlValue *result =
-          builder->Call("primitive_call", 2, builder->Load("executionContext"),
-                        builder->ConstInt32(instruction.immediate()));
-      state(builder)->Reload(builder);
+      primitiveCall(builder, instruction.immediate(), map);
       if (nextBytecodeBuilder)
         builder->AddFallThroughBuilder(nextBytecodeBuilder);
     } break;
     case OpCode::FUNCTION_CALL: {
       handle_bc_function_call(builder, nextBytecodeBuilder,
-                              instruction.immediate());
+                              instruction.immediate(), map);
+    } break;
+    case OpCode::NEW_OBJECT:
+      newObject(builder, map);
+      if (nextBytecodeBuilder)
+        builder->AddFallThroughBuilder(nextBytecodeBuilder);
+      break;
+    case OpCode::SYSTEM_COLLECT:
+      systemCollect(builder, map);
+      if (nextBytecodeBuilder)
+        builder->AddFallThroughBuilder(nextBytecodeBuilder);
+      break;
+    case OpCode::NEW_ARRAY:
+      newArray(builder, map);
+      if (nextBytecodeBuilder)
+        builder->AddFallThroughBuilder(nextBytecodeBuilder);
+      break;
+    case OpCode::ARRAY_LENGTH:
+      pushValue(builder, builder->Call("array_length", 1, popValue(builder)));
+      if (nextBytecodeBuilder)
+        builder->AddFallThroughBuilder(nextBytecodeBuilder);
+      break;
+    case OpCode::PUSH_FROM_ARRAY: {
+      auto index = popValue(builder);
+      auto array = popValue(builder);
+      const char *load = inBounds(function, instructionIndex)
+                             ? "array_load_unchecked"
+                             : "array_load";
+      pushValue(builder, builder->Call(load, 2, array, index));
+      if (nextBytecodeBuilder)
+        builder->AddFallThroughBuilder(nextBytecodeBuilder);
+    } break;
+    case OpCode::POP_INTO_ARRAY: {
+      auto value = popValue(builder);
+      auto index = popValue(builder);
+      auto array = popValue(builder);
+      const char *store = inBounds(function, instructionIndex)
+                              ? "array_store_unchecked"
+                              : "array_store";
+      builder->Call(store, 3, array, index, value);
+      if (nextBytecodeBuilder)
+        builder->AddFallThroughBuilder(nextBytecodeBuilder);
+    } break;
+    case OpCode::NEW_MAP:
+      newMap(builder, map);
+      if (nextBytecodeBuilder)
+        builder->AddFallThroughBuilder(nextBytecodeBuilder);
+      break;
+    case OpCode::MAP_SET:
+      mapSet(builder, map);
+      if (nextBytecodeBuilder)
+        builder->AddFallThroughBuilder(nextBytecodeBuilder);
+      break;
+    case OpCode::MAP_GET:
+    case OpCode::MAP_HAS:
+    case OpCode::MAP_DELETE: {
+      // These never collect, so the stack can stay in registers.
+      auto key = popValue(builder);
+      auto object = popValue(builder);
+      const char *name = "map_get";
+      if (instruction.opCode() == OpCode::MAP_HAS) {
+        name = "map_has";
+      } else if (instruction.opCode() == OpCode::MAP_DELETE) {
+        name = "map_delete";
+      }
+      pushValue(builder, builder->Call(name, 3,
+                                       builder->Load("executionContext"),
+                                       object, key));
+      if (nextBytecodeBuilder)
+        builder->AddFallThroughBuilder(nextBytecodeBuilder);
     } break;
     default:
       if (cfg_.debug) {
@@ -427,8 +602,266 @@ bool MethodBuilder::generateILForBytecode(
   return handled;
 }
 
+bool MethodBuilder::isBackwardJump(Instruction instruction) {
+  switch (instruction.opCode()) {
+    case OpCode::JMP:
+    case OpCode::JMP_EQ:
+    case OpCode::JMP_NEQ:
+    case OpCode::JMP_GT:
+    case OpCode::JMP_GE:
+    case OpCode::JMP_LT:
+    case OpCode::JMP_LE:
+      return instruction.immediate() < 0;
+    default:
+      return false;
+  }
+}
+
+const RefMap *MethodBuilder::refMap(const FunctionDef *function,
+                                    std::size_t index) {
+  if (function != virtualMachine_.getFunction(functionIndex_)) {
+    return nullptr;
+  }
+  const auto &maps = virtualMachine_.program()->refMaps(functionIndex_);
+  if (maps.empty() || !maps[index].present) {
+    return nullptr;
+  }
+  return &maps[index];
+}
+
+bool MethodBuilder::inBounds(const FunctionDef *function,
+                             std::size_t index) {
+  if (function != virtualMachine_.getFunction(functionIndex_)) {
+    return false;
+  }
+  const auto &inBounds =
+      virtualMachine_.program()->inBoundsAccesses(functionIndex_);
+  return !inBounds.empty() && inBounds[index];
+}
+
+bool MethodBuilder::operandsMayRef(const RefMap *map, std::size_t count) {
+  if (map == nullptr) {
+    return true;
+  }
+  const FunctionDef *function = virtualMachine_.getFunction(functionIndex_);
+  const std::size_t base = function->nparams + function->nlocals;
+  for (std::size_t slot = base; slot + count < map->slots.size(); slot++) {
+    if (map->slots[slot]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void MethodBuilder::spillRefs(TR::IlBuilder *b, const RefMap *map) {
+  const FunctionDef *function = virtualMachine_.getFunction(functionIndex_);
+  TR::IlValue *homes = b->Load("homes");
+  for (std::size_t i = 0; i < function->nlocals; i++) {
+    if (map == nullptr || map->mayRef(function->nparams + i)) {
+      b->StoreAt(
+          b->IndexAt(globalTypes().stackElementPtr, homes, b->ConstInt32(i)),
+          loadLocal(b, i));
+    }
+  }
+  if (cfg_.passParam) {
+    for (std::size_t i = 0; i < function->nparams; i++) {
+      if (map == nullptr || map->mayRef(i)) {
+        b->StoreAt(b->IndexAt(globalTypes().stackElementPtr, homes,
+                              b->ConstInt32(function->nlocals + i)),
+                   loadParam(b, i));
+      }
+    }
+  }
+}
+
+void MethodBuilder::reloadRefs(TR::IlBuilder *b, const RefMap *map) {
+  const FunctionDef *function = virtualMachine_.getFunction(functionIndex_);
+  TR::IlValue *homes = b->Load("homes");
+  for (std::size_t i = 0; i < function->nlocals; i++) {
+    if (map == nullptr || map->mayRef(function->nparams + i)) {
+      TR::IlValue *home =
+          b->IndexAt(globalTypes().stackElementPtr, homes, b->ConstInt32(i));
+      storeLocal(b, i, b->LoadAt(globalTypes().stackElementPtr, home));
+    }
+  }
+  if (cfg_.passParam) {
+    for (std::size_t i = 0; i < function->nparams; i++) {
+      if (map == nullptr || map->mayRef(i)) {
+        TR::IlValue *home =
+            b->IndexAt(globalTypes().stackElementPtr, homes,
+                       b->ConstInt32(function->nlocals + i));
+        storeParam(b, i, b->LoadAt(globalTypes().stackElementPtr, home));
+      }
+    }
+  }
+}
+
+void MethodBuilder::safepointPoll(TR::BytecodeBuilder *b, const RefMap *map) {
+  // The operand stack must be in memory, where a collection can see it.
+  state(b)->Commit(b);
+  spillRefs(b, map);
+  b->Call("safepoint_poll", 1, b->Load("executionContext"));
+  reloadRefs(b, map);
+  state(b)->Reload(b);
+}
+
+void MethodBuilder::systemCollect(TR::BytecodeBuilder *b, const RefMap *map) {
+  state(b)->Commit(b);
+  spillRefs(b, map);
+  b->Call("system_collect", 1, b->Load("executionContext"));
+  reloadRefs(b, map);
+  state(b)->Reload(b);
+}
+
+void MethodBuilder::newObject(TR::BytecodeBuilder *b, const RefMap *map) {
+  // Only a refill can collect, but the operands can't be committed on one
+  // path alone.
+  const bool commit = operandsMayRef(map, 0);
+  if (commit) {
+    state(b)->Commit(b);
+  }
+
+  TR::IlValue *context = b->Load("executionContext");
+  TR::IlValue *next =
+      b->LoadIndirect("b9::ExecutionContext", "allocationNext_", context);
+  TR::IlValue *end =
+      b->LoadIndirect("b9::ExecutionContext", "allocationEnd_", context);
+
+  TR::IlBuilder *refill = nullptr;
+  b->IfThen(&refill, b->EqualTo(next, end));
+  spillRefs(refill, map);
+  refill->Call("refill_allocation_buffer", 1, context);
+  reloadRefs(refill, map);
+
+  if (commit) {
+    state(b)->Reload(b);
+  }
+
+  next = b->LoadIndirect("b9::ExecutionContext", "allocationNext_", context);
+  TR::IlValue *object = b->LoadAt(globalTypes().stackElementPtr, next);
+  b->StoreIndirect(
+      "b9::ExecutionContext", "allocationNext_", context,
+      b->IndexAt(globalTypes().stackElementPtr, next, b->ConstInt32(1)));
+  state(b)->pushValue(b, object);
+}
+
+void MethodBuilder::newArray(TR::BytecodeBuilder *b, const RefMap *map) {
+  TR::IlValue *length = popValue(b);
+  state(b)->Commit(b);
+  spillRefs(b, map);
+  TR::IlValue *array =
+      b->Call("array_new", 2, b->Load("executionContext"), length);
+  reloadRefs(b, map);
+  state(b)->Reload(b);
+  pushValue(b, array);
+}
+
+void MethodBuilder::newMap(TR::BytecodeBuilder *b, const RefMap *map) {
+  state(b)->Commit(b);
+  spillRefs(b, map);
+  TR::IlValue *object = b->Call("map_new", 1, b->Load("executionContext"));
+  reloadRefs(b, map);
+  state(b)->Reload(b);
+  pushValue(b, object);
+}
+
+void MethodBuilder::mapSet(TR::BytecodeBuilder *b, const RefMap *map) {
+  TR::IlValue *value = popValue(b);
+  TR::IlValue *key = popValue(b);
+  TR::IlValue *object = popValue(b);
+  state(b)->Commit(b);
+  spillRefs(b, map);
+  b->Call("map_set", 4, b->Load("executionContext"), object, key, value);
+  reloadRefs(b, map);
+  state(b)->Reload(b);
+}
+
+TR::IlValue *MethodBuilder::popEqual(TR::BytecodeBuilder *b) {
+  // An Int48 is its box tag, with the payload in the low 48 bits.
+  static const Om::RawValue payloadMask = (Om::RawValue(1) << 48) - 1;
+  static const Om::RawValue intTag = Om::Value(Om::AS_INT48, 0).raw();
+
+  TR::IlValue *right = popValue(b);
+  TR::IlValue *left = popValue(b);
+  TR::IlValue *tagMask = b->ConstInt64(~payloadMask);
+  TR::IlValue *tag = b->ConstInt64(intTag);
+  b->Store("equal", b->EqualTo(left, right));
+
+  // Strings, Uint48s or references, are equal if their characters are. Only
+  // different values that may both be strings are compared out of line.
+  TR::IlBuilder *strings = nullptr;
+  b->IfThen(&strings,
+            b->And(b->NotEqualTo(left, right),
+                   b->And(b->NotEqualTo(b->And(left, tagMask), tag),
+                          b->NotEqualTo(b->And(right, tagMask), tag))));
+  strings->Store("equal", strings->Call("values_equal", 3,
+                                        strings->Load("executionContext"),
+                                        left, right));
+  return b->Load("equal");
+}
+
+void MethodBuilder::popCompare(TR::BytecodeBuilder *b, TR::IlValue *&left,
+                               TR::IlValue *&right) {
+  static const Om::RawValue payloadMask = (Om::RawValue(1) << 48) - 1;
+  static const Om::RawValue intTag = Om::Value(Om::AS_INT48, 0).raw();
+
+  TR::IlValue *rightValue = popValue(b);
+  TR::IlValue *leftValue = popValue(b);
+  TR::IlValue *tagMask = b->ConstInt64(~payloadMask);
+  TR::IlValue *tag = b->ConstInt64(intTag);
+
+  // Two Int48s compare by payload. Anything else is compared out of line, as
+  // the interpreter does, and its order is compared with 0.
+  TR::IlBuilder *ints = nullptr;
+  TR::IlBuilder *others = nullptr;
+  b->IfThenElse(&ints, &others,
+                b->And(b->EqualTo(b->And(leftValue, tagMask), tag),
+                       b->EqualTo(b->And(rightValue, tagMask), tag)));
+  ints->Store("compareLeft", OMR::Om::ValueBuilder::getInt48(ints, leftValue));
+  ints->Store("compareRight",
+              OMR::Om::ValueBuilder::getInt48(ints, rightValue));
+  others->Store("compareLeft",
+                others->Call("values_compare", 3,
+                             others->Load("executionContext"), leftValue,
+                             rightValue));
+  others->Store("compareRight", others->ConstInt64(0));
+  left = b->Load("compareLeft");
+  right = b->Load("compareRight");
+}
+
+void MethodBuilder::primitiveCall(TR::BytecodeBuilder *b, std::size_t index,
+                                  const RefMap *map) {
+  const auto &primitive = virtualMachine_.primitives()[index];
+  const char *name = primitives_[index].c_str();
+
+  if (primitive.is(Primitive::ASYNC)) {
+    // Suspension and completions are handled by the trampoline.
+    state(b)->Commit(b);
+    spillRefs(b, map);
+    b->Call("primitive_call", 2, b->Load("executionContext"),
+            b->ConstInt32(index));
+    reloadRefs(b, map);
+    state(b)->Reload(b);
+  } else if (primitive.direct && primitive.is(Primitive::NOGC)) {
+    // The primitive can't see the operand stack or collect, so the stack can
+    // stay in registers.
+    std::vector<TR::IlValue *> args(primitive.signature.arity + 1);
+    for (std::size_t i = primitive.signature.arity; i >= 1; --i) {
+      args.at(i) = state(b)->popValue(b);
+    }
+    args.at(0) = b->Load("executionContext");
+    state(b)->pushValue(b, b->Call(name, args.size(), args.data()));
+  } else {
+    state(b)->Commit(b);
+    spillRefs(b, map);
+    b->Call(name, 1, b->Load("executionContext"));
+    reloadRefs(b, map);
+    state(b)->Reload(b);
+  }
+}
+
 void MethodBuilder::interpreterCall(TR::BytecodeBuilder *b,
-                                    std::size_t target) {
+                                    std::size_t target, const RefMap *map) {
   const auto &callee = virtualMachine_.module()->functions[target];
 
   if (cfg_.verbose) {
@@ -436,14 +869,17 @@ void MethodBuilder::interpreterCall(TR::BytecodeBuilder *b,
   }
 
   state(b)->Commit(b);
+  spillRefs(b, map);
   TR::IlValue *result = b->Call("interpret", 2, b->Load("executionContext"),
                                 b->ConstInt64(target));
+  reloadRefs(b, map);
   state(b)->adjust(b, -callee.nparams);
   state(b)->Reload(b);
   state(b)->pushValue(b, result);
 }
 
-void MethodBuilder::directCall(TR::BytecodeBuilder *b, std::size_t target) {
+void MethodBuilder::directCall(TR::BytecodeBuilder *b, std::size_t target,
+                               const RefMap *map) {
   const auto &callee = virtualMachine_.module()->functions[target];
 
   if (cfg_.verbose) {
@@ -453,14 +889,17 @@ void MethodBuilder::directCall(TR::BytecodeBuilder *b, std::size_t target) {
   assert(virtualMachine_.getJitAddress(target) || target == functionIndex_);
 
   state(b)->Commit(b);
+  spillRefs(b, map);
   auto result = b->Call(callee.name.c_str(), 2, b->Load("executionContext"),
                         b->ConstInt64(target));
+  reloadRefs(b, map);
   state(b)->adjust(b, -callee.nparams);
   state(b)->Reload(b);
   state(b)->pushValue(b, result);
 }
 
-void MethodBuilder::passParamCall(TR::BytecodeBuilder *b, std::size_t target) {
+void MethodBuilder::passParamCall(TR::BytecodeBuilder *b, std::size_t target,
+                                  const RefMap *map) {
   const auto &callee = virtualMachine_.module()->functions[target];
 
   if (cfg_.verbose) {
@@ -478,24 +917,36 @@ void MethodBuilder::passParamCall(TR::BytecodeBuilder *b, std::size_t target) {
   }
   params.at(0) = b->Load("executionContext");
 
+  // The operands left under the args only need to be in memory if the callee
+  // could collect while they hold references.
+  const bool commit = operandsMayRef(map, callee.nparams);
+  if (commit) {
+    state(b)->Commit(b);
+  }
+  spillRefs(b, map);
   auto result = b->Call(callee.name.c_str(), params.size(), params.data());
+  reloadRefs(b, map);
+  if (commit) {
+    state(b)->Reload(b);
+  }
   state(b)->pushValue(b, result);
 }
 
 void MethodBuilder::handle_bc_function_call(TR::BytecodeBuilder *builder,
                                             TR::BytecodeBuilder *nextBuilder,
-                                            std::size_t target) {
+                                            std::size_t target,
+                                            const RefMap *map) {
   bool interpret = cfg_.debug || (!virtualMachine_.getJitAddress(target) &&
                                   target != functionIndex_);
 
   if (interpret) {
-    interpreterCall(builder, target);
+    interpreterCall(builder, target, map);
   } else if (cfg_.passParam) {
-    passParamCall(builder, target);
+    passParamCall(builder, target, map);
   } else if (cfg_.directCall) {
-    directCall(builder, target);
+    directCall(builder, target, map);
   } else {
-    interpreterCall(builder, target);
+    interpreterCall(builder, target, map);
   }
 
   if (nextBuilder) builder->AddFallThroughBuilder(nextBuilder);
@@ -527,10 +978,7 @@ void MethodBuilder::handle_bc_jmp_eq(
   int next_bc_index = bytecodeIndex + delta;
   TR::BytecodeBuilder *jumpTo = bytecodeBuilderTable[next_bc_index];
 
-  TR::IlValue *right = popInt48(builder);
-  TR::IlValue *left = popInt48(builder);
-
-  builder->IfCmpEqual(jumpTo, left, right);
+  builder->IfCmpNotEqual(jumpTo, popEqual(builder), builder->ConstInt32(0));
   builder->AddFallThroughBuilder(nextBuilder);
 }
 
@@ -544,10 +992,7 @@ void MethodBuilder::handle_bc_jmp_neq(
   int next_bc_index = bytecodeIndex + delta;
   TR::BytecodeBuilder *jumpTo = bytecodeBuilderTable[next_bc_index];
 
-  TR::IlValue *right = popValue(builder);
-  TR::IlValue *left = popValue(builder);
-
-  builder->IfCmpNotEqual(jumpTo, left, right);
+  builder->IfCmpEqual(jumpTo, popEqual(builder), builder->ConstInt32(0));
   builder->AddFallThroughBuilder(nextBuilder);
 }
 
@@ -561,8 +1006,9 @@ void MethodBuilder::handle_bc_jmp_lt(
   int next_bc_index = bytecodeIndex + delta;
   TR::BytecodeBuilder *jumpTo = bytecodeBuilderTable[next_bc_index];
 
-  TR::IlValue *right = popValue(builder);
-  TR::IlValue *left = popValue(builder);
+  TR::IlValue *left = nullptr;
+  TR::IlValue *right = nullptr;
+  popCompare(builder, left, right);
 
   builder->IfCmpLessThan(jumpTo, left, right);
   builder->AddFallThroughBuilder(nextBuilder);
@@ -578,8 +1024,9 @@ void MethodBuilder::handle_bc_jmp_le(
   int next_bc_index = bytecodeIndex + delta;
   TR::BytecodeBuilder *jumpTo = bytecodeBuilderTable[next_bc_index];
 
-  TR::IlValue *right = popInt48(builder);
-  TR::IlValue *left = popInt48(builder);
+  TR::IlValue *left = nullptr;
+  TR::IlValue *right = nullptr;
+  popCompare(builder, left, right);
 
   builder->IfCmpLessOrEqual(jumpTo, left, right);
   builder->AddFallThroughBuilder(nextBuilder);
@@ -595,8 +1042,9 @@ void MethodBuilder::handle_bc_jmp_gt(
   int next_bc_index = bytecodeIndex + delta;
   TR::BytecodeBuilder *jumpTo = bytecodeBuilderTable[next_bc_index];
 
-  TR::IlValue *right = popInt48(builder);
-  TR::IlValue *left = popInt48(builder);
+  TR::IlValue *left = nullptr;
+  TR::IlValue *right = nullptr;
+  popCompare(builder, left, right);
 
   builder->IfCmpGreaterThan(jumpTo, left, right);
   builder->AddFallThroughBuilder(nextBuilder);
@@ -612,8 +1060,9 @@ void MethodBuilder::handle_bc_jmp_ge(
   int next_bc_index = bytecodeIndex + delta;
   TR::BytecodeBuilder *jumpTo = bytecodeBuilderTable[next_bc_index];
 
-  TR::IlValue *right = popInt48(builder);
-  TR::IlValue *left = popInt48(builder);
+  TR::IlValue *left = nullptr;
+  TR::IlValue *right = nullptr;
+  popCompare(builder, left, right);
 
   builder->IfCmpGreaterOrEqual(jumpTo, left, right);
   builder->AddFallThroughBuilder(nextBuilder);
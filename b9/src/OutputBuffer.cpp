@@ -0,0 +1,115 @@
+#include <b9/OutputBuffer.hpp>
+
+#include <cstring>
+
+namespace b9 {
+
+OutputWriter::OutputWriter() : thread_([this] { work(); }) {}
+
+OutputWriter::~OutputWriter() noexcept {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    shutdown_ = true;
+  }
+  changed_.notify_all();
+  thread_.join();
+}
+
+void OutputWriter::write(std::ostream &out, std::string chunk) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  chunks_.emplace_back(&out, std::move(chunk));
+  changed_.notify_all();
+}
+
+void OutputWriter::drain() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  changed_.wait(lock, [this] { return chunks_.empty() && !busy_; });
+}
+
+void OutputWriter::work() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    changed_.wait(lock, [this] { return shutdown_ || !chunks_.empty(); });
+    if (chunks_.empty()) {
+      return;  // shut down, with nothing left to write
+    }
+    auto chunk = std::move(chunks_.front());
+    chunks_.pop_front();
+    busy_ = true;
+
+    lock.unlock();
+    chunk.first->write(chunk.second.data(), chunk.second.size());
+    chunk.first->flush();
+    lock.lock();
+
+    busy_ = false;
+    changed_.notify_all();
+  }
+}
+
+OutputBuffer::OutputBuffer(std::ostream &out, OutputWriter *writer,
+                           OutputFlush policy, std::size_t capacity)
+    : out_(out),
+      writer_(writer),
+      policy_(policy),
+      capacity_(capacity),
+      stream_(this) {
+  buffer_.reserve(capacity_);
+}
+
+OutputBuffer::~OutputBuffer() noexcept {
+  flush();
+  if (writer_) {
+    writer_->drain();
+  }
+}
+
+void OutputBuffer::flush() {
+  if (buffer_.empty()) {
+    return;
+  }
+  if (writer_) {
+    std::string chunk;
+    chunk.reserve(capacity_);
+    chunk.swap(buffer_);
+    writer_->write(out_, std::move(chunk));
+  } else {
+    out_.write(buffer_.data(), buffer_.size());
+    out_.flush();
+    buffer_.clear();
+  }
+}
+
+OutputBuffer::int_type OutputBuffer::overflow(int_type c) {
+  if (!traits_type::eq_int_type(c, traits_type::eof())) {
+    char ch = traits_type::to_char_type(c);
+    xsputn(&ch, 1);
+  }
+  return traits_type::not_eof(c);
+}
+
+std::streamsize OutputBuffer::xsputn(const char *s, std::streamsize n) {
+  buffer_.append(s, n);
+  switch (policy_) {
+    case OutputFlush::LINE:
+      if (std::memchr(s, '\n', n) != nullptr || buffer_.size() >= capacity_) {
+        flush();
+      }
+      break;
+    case OutputFlush::SIZE:
+      if (buffer_.size() >= capacity_) {
+        flush();
+      }
+      break;
+    case OutputFlush::EXPLICIT:
+      break;
+  }
+  return n;
+}
+
+int OutputBuffer::sync() {
+  flush();
+  return 0;
+}
+
+}  // namespace b9
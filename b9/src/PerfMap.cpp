@@ -0,0 +1,216 @@
+#include <b9/PerfMap.hpp>
+
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace b9 {
+
+namespace {
+
+// The jitdump format, from perf's jitdump-specification.txt.
+
+constexpr std::uint32_t JITDUMP_MAGIC = 0x4A695444;
+constexpr std::uint32_t JITDUMP_VERSION = 1;
+constexpr std::uint32_t JIT_CODE_LOAD = 0;
+
+struct JitDumpHeader {
+  std::uint32_t magic;
+  std::uint32_t version;
+  std::uint32_t totalSize;
+  std::uint32_t elfMach;
+  std::uint32_t pad1;
+  std::uint32_t pid;
+  std::uint64_t timestamp;
+  std::uint64_t flags;
+};
+
+struct JitDumpRecordHeader {
+  std::uint32_t id;
+  std::uint32_t totalSize;
+  std::uint64_t timestamp;
+};
+
+/// Followed by the name, null terminated, then the code.
+struct JitCodeLoad {
+  JitDumpRecordHeader header;
+  std::uint32_t pid;
+  std::uint32_t tid;
+  std::uint64_t vma;
+  std::uint64_t codeAddress;
+  std::uint64_t codeSize;
+  std::uint64_t codeIndex;
+};
+
+#if defined(__x86_64__)
+constexpr std::uint32_t ELF_MACHINE = EM_X86_64;
+#elif defined(__aarch64__)
+constexpr std::uint32_t ELF_MACHINE = EM_AARCH64;
+#elif defined(__powerpc64__)
+constexpr std::uint32_t ELF_MACHINE = EM_PPC64;
+#elif defined(__s390x__)
+constexpr std::uint32_t ELF_MACHINE = EM_S390;
+#else
+constexpr std::uint32_t ELF_MACHINE = EM_NONE;
+#endif
+
+/// The clock perf record -k mono uses.
+std::uint64_t timestamp() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return std::uint64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+/// The end of the mapping that holds an address, or the address itself if it
+/// isn't mapped.
+std::uintptr_t mappingEnd(std::uintptr_t address) {
+  std::ifstream maps("/proc/self/maps");
+  std::string line;
+  while (std::getline(maps, line)) {
+    std::istringstream range(line);
+    std::uintptr_t start, end;
+    char dash;
+    if (range >> std::hex >> start >> dash >> end && start <= address &&
+        address < end) {
+      return end;
+    }
+  }
+  return address;
+}
+
+}  // namespace
+
+PerfMap &PerfMap::instance() {
+  static PerfMap perfMap;
+  return perfMap;
+}
+
+std::string PerfMap::mapPath() {
+  return "/tmp/perf-" + std::to_string(getpid()) + ".map";
+}
+
+std::string PerfMap::jitDumpPath() {
+  return "jit-" + std::to_string(getpid()) + ".dump";
+}
+
+PerfMap::~PerfMap() noexcept {
+  if (map_ != nullptr) {
+    std::fclose(map_);
+  }
+  if (jitDumpMarker_ != nullptr) {
+    munmap(jitDumpMarker_, sysconf(_SC_PAGESIZE));
+  }
+  if (jitDump_ != nullptr) {
+    std::fclose(jitDump_);
+  }
+}
+
+void PerfMap::add(const void *code, const std::string &name, bool jitDump) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const std::uintptr_t start = std::uintptr_t(code);
+  const std::size_t size = codeEnd(start) - start;
+  starts_.insert(start);
+
+  if (map_ == nullptr) {
+    std::string path = mapPath();
+    map_ = std::fopen(path.c_str(), "a");
+    if (map_ == nullptr) {
+      std::cerr << "Failed to open " << path << std::endl;
+    }
+  }
+  if (map_ != nullptr) {
+    std::fprintf(map_, "%lx %zx %s\n", (unsigned long)start, size,
+                 name.c_str());
+    std::fflush(map_);
+  }
+
+  // The jitdump has to be mapped while perf record is watching, before the
+  // code runs.
+  if (jitDump && openJitDump()) {
+    writeJitDump(start, size, name);
+    std::fflush(jitDump_);
+  }
+}
+
+std::uintptr_t PerfMap::codeEnd(std::uintptr_t code) const {
+  std::uintptr_t end = std::min(mappingEnd(code), code + MAX_CODE_SIZE);
+  auto next = starts_.upper_bound(code);
+  if (next != starts_.end()) {
+    end = std::min(end, *next);
+  }
+
+  // Nothing has been compiled past the newest function yet, so its code is
+  // followed by zeroed code cache.
+  const std::size_t word = sizeof(std::uint64_t);
+  std::uintptr_t run = (code + word - 1) & ~(word - 1);
+  std::size_t zeros = 0;
+  for (std::uintptr_t at = run; at + word <= end; at += word) {
+    if (*reinterpret_cast<const std::uint64_t *>(at) != 0) {
+      run = at + word;
+      zeros = 0;
+    } else if ((zeros += word) == ZERO_RUN) {
+      return run;
+    }
+  }
+  return end;
+}
+
+bool PerfMap::openJitDump() {
+  if (jitDump_ != nullptr) {
+    return true;
+  }
+
+  std::string path = jitDumpPath();
+  jitDump_ = std::fopen(path.c_str(), "w+");
+  if (jitDump_ == nullptr) {
+    std::cerr << "Failed to open " << path << std::endl;
+    return false;
+  }
+
+  JitDumpHeader header = {};
+  header.magic = JITDUMP_MAGIC;
+  header.version = JITDUMP_VERSION;
+  header.totalSize = sizeof(JitDumpHeader);
+  header.elfMach = ELF_MACHINE;
+  header.pid = getpid();
+  header.timestamp = timestamp();
+  std::fwrite(&header, sizeof(header), 1, jitDump_);
+  std::fflush(jitDump_);
+
+  // perf record sees this mapping, and so finds the file.
+  void *marker = mmap(nullptr, sysconf(_SC_PAGESIZE), PROT_READ | PROT_EXEC,
+                      MAP_PRIVATE, fileno(jitDump_), 0);
+  if (marker == MAP_FAILED) {
+    std::cerr << "Failed to map " << path << std::endl;
+    std::fclose(jitDump_);
+    jitDump_ = nullptr;
+    return false;
+  }
+  jitDumpMarker_ = marker;
+  return true;
+}
+
+void PerfMap::writeJitDump(std::uintptr_t code, std::size_t size,
+                           const std::string &name) {
+  JitCodeLoad record = {};
+  record.header.id = JIT_CODE_LOAD;
+  record.header.totalSize = sizeof(record) + name.size() + 1 + size;
+  record.header.timestamp = timestamp();
+  record.pid = getpid();
+  record.tid = syscall(SYS_gettid);
+  record.vma = code;
+  record.codeAddress = code;
+  record.codeSize = size;
+  record.codeIndex = codeIndex_++;
+  std::fwrite(&record, sizeof(record), 1, jitDump_);
+  std::fwrite(name.c_str(), name.size() + 1, 1, jitDump_);
+  std::fwrite(reinterpret_cast<const void *>(code), size, 1, jitDump_);
+}
+
+}  // namespace b9
@@ -0,0 +1,31 @@
+#include <b9/PrimitiveTable.hpp>
+
+namespace b9 {
+
+std::size_t PrimitiveTable::add(const Primitive &primitive) {
+  for (const auto &existing : primitives_) {
+    if (existing.name == primitive.name) {
+      throw PrimitiveException{"Primitive already registered: " +
+                               primitive.name};
+    }
+  }
+  if (primitive.direct &&
+      primitive.signature.arity > Primitive::MAX_DIRECT_ARITY) {
+    throw PrimitiveException{"Too many arguments for a direct primitive: " +
+                             primitive.name};
+  }
+  primitives_.push_back(primitive);
+  signatures_.push_back(primitive.signature);
+  return primitives_.size() - 1;
+}
+
+std::size_t PrimitiveTable::index(const std::string &name) const {
+  for (std::size_t i = 0; i < primitives_.size(); i++) {
+    if (primitives_[i].name == name) {
+      return i;
+    }
+  }
+  throw PrimitiveException{"Primitive not found: " + name};
+}
+
+}  // namespace b9
@@ -0,0 +1,127 @@
+#include <b9/Profile.hpp>
+
+#include <algorithm>
+#include <array>
+#include <iomanip>
+#include <tuple>
+
+namespace b9 {
+
+Profile::Profile() : lastSample_(Clock::now()) {}
+
+std::uint64_t *Profile::counts(const FunctionDef *function) {
+  auto &profile = functions_[function];
+  if (profile.counts.empty()) {
+    profile.counts.resize(function->instructions.size());
+  }
+  return profile.counts.data();
+}
+
+void Profile::sample(const FunctionDef *function) {
+  const Clock::time_point now = Clock::now();
+  auto &profile = functions_[function];
+  profile.time += now - lastSample_;
+  profile.samples++;
+  samples_++;
+  lastSample_ = now;
+  countdown_ = SAMPLE_INTERVAL;
+}
+
+std::uint64_t Profile::count(const FunctionDef *function,
+                             std::size_t index) const {
+  auto found = functions_.find(function);
+  if (found == functions_.end() || index >= found->second.counts.size()) {
+    return 0;
+  }
+  return found->second.counts[index];
+}
+
+std::uint64_t Profile::count(OpCode opCode) const {
+  std::uint64_t total = 0;
+  for (const auto &entry : functions_) {
+    const auto &instructions = entry.first->instructions;
+    const auto &counts = entry.second.counts;
+    for (std::size_t i = 0; i < counts.size(); i++) {
+      if (instructions[i].opCode() == opCode) {
+        total += counts[i];
+      }
+    }
+  }
+  return total;
+}
+
+Profile::Clock::duration Profile::time(const FunctionDef *function) const {
+  auto found = functions_.find(function);
+  if (found == functions_.end()) {
+    return Clock::duration::zero();
+  }
+  return found->second.time;
+}
+
+void Profile::report(std::ostream &out, std::size_t hotSpots) const {
+  auto ms = [](Clock::duration d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+  };
+
+  // Functions, by sampled time, then by instructions run.
+  std::vector<std::tuple<Clock::duration, std::uint64_t, const FunctionDef *>>
+      functions;
+  std::uint64_t instructions = 0;
+  std::array<std::uint64_t, 256> opCodes{};
+  std::vector<std::tuple<std::uint64_t, const FunctionDef *, std::size_t>>
+      spots;
+  for (const auto &entry : functions_) {
+    const FunctionDef *function = entry.first;
+    const auto &counts = entry.second.counts;
+    std::uint64_t total = 0;
+    for (std::size_t i = 0; i < counts.size(); i++) {
+      if (counts[i] != 0) {
+        total += counts[i];
+        opCodes[RawOpCode(function->instructions[i].opCode())] += counts[i];
+        spots.emplace_back(counts[i], function, i);
+      }
+    }
+    instructions += total;
+    functions.emplace_back(entry.second.time, total, function);
+  }
+  std::sort(functions.rbegin(), functions.rend());
+  std::sort(spots.rbegin(), spots.rend());
+
+  const std::ios::fmtflags flags = out.flags();
+  const std::streamsize precision = out.precision();
+  out << "Profile: " << instructions << " instructions, " << samples_
+      << " samples" << std::endl
+      << std::endl
+      << "Functions:" << std::endl;
+  for (const auto &function : functions) {
+    out << std::setw(12) << std::fixed << std::setprecision(3)
+        << ms(std::get<0>(function)) << " ms " << std::setw(14)
+        << std::get<1>(function) << "  " << std::get<2>(function)->name
+        << std::endl;
+  }
+
+  std::vector<std::pair<std::uint64_t, RawOpCode>> byOpCode;
+  for (std::size_t op = 0; op < opCodes.size(); op++) {
+    if (opCodes[op] != 0) {
+      byOpCode.emplace_back(opCodes[op], RawOpCode(op));
+    }
+  }
+  std::sort(byOpCode.rbegin(), byOpCode.rend());
+  out << std::endl << "Opcodes:" << std::endl;
+  for (const auto &op : byOpCode) {
+    out << std::setw(14) << op.first << "  " << OpCode(op.second) << std::endl;
+  }
+
+  out << std::endl << "Hot spots:" << std::endl;
+  for (std::size_t i = 0; i < spots.size() && i < hotSpots; i++) {
+    const FunctionDef *function = std::get<1>(spots[i]);
+    const std::size_t index = std::get<2>(spots[i]);
+    out << std::setw(14) << std::get<0>(spots[i]) << "  " << function->name
+        << " " << index << "  " << function->instructions[index]
+        << std::endl;
+  }
+  out.flags(flags);
+  out.precision(precision);
+}
+
+}  // namespace b9
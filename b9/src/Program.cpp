@@ -0,0 +1,83 @@
+#include <b9/Program.hpp>
+
+#include <algorithm>
+#include <iostream>
+
+namespace b9 {
+
+Program::Program(std::shared_ptr<const Module> module,
+                 const std::vector<PrimitiveSignature> &primitives,
+                 bool verbose)
+    : module_(module),
+      primitives_(primitives),
+      compiledFunctions_(module->functions.size()) {
+  summaries_.reserve(module_->functions.size());
+  for (std::size_t i = 0; i < module_->functions.size(); i++) {
+    try {
+      summaries_.push_back(verifyFunction(*module_, i, primitives_));
+    } catch (const VerifyException &e) {
+      if (verbose) {
+        std::cerr << "Warning: Failed to verify " << e.what() << std::endl;
+      }
+      summaries_.emplace_back();
+    }
+  }
+  analyzeFunctions();
+}
+
+Program::Program(const Snapshot &snapshot)
+    : module_(snapshot.module),
+      primitives_(snapshot.primitives),
+      summaries_(snapshot.summaries),
+      compiledFunctions_(snapshot.module->functions.size()) {
+  analyzeFunctions();
+}
+
+void Program::analyzeFunctions() {
+  refMaps_.resize(module_->functions.size());
+  inBoundsAccesses_.resize(module_->functions.size());
+  for (std::size_t i = 0; i < module_->functions.size(); i++) {
+    if (summaries_[i].verified) {
+      refMaps_[i] = b9::computeRefMaps(*module_, i, primitives_);
+      inBoundsAccesses_[i] = findInBoundsAccesses(*module_, i, primitives_);
+    }
+  }
+}
+
+namespace {
+
+bool sameEntryPoints(const std::vector<Primitive> &a,
+                     const std::vector<Primitive> &b) {
+  return a.size() == b.size() &&
+         std::equal(a.begin(), a.end(), b.begin(),
+                    [](const Primitive &x, const Primitive &y) {
+                      return sameEntryPoints(x, y);
+                    });
+}
+
+}  // namespace
+
+std::unique_lock<std::mutex> Program::lockForCompile(
+    const Config &cfg, const PrimitiveTable &primitives) {
+  std::unique_lock<std::mutex> lock(compileMutex_);
+  if (!hasJitConfig_) {
+    jitConfig_ = cfg;
+    jitPrimitives_ = primitives.primitives();
+    hasJitConfig_ = true;
+  } else if (!sameJitOptions(jitConfig_, cfg)) {
+    throw CompilationException{
+        "Program was compiled with different JIT options"};
+  } else if (!sameEntryPoints(jitPrimitives_, primitives.primitives())) {
+    throw CompilationException{
+        "Program was compiled against different primitives"};
+  }
+  return lock;
+}
+
+bool Program::compiledAgainst(const PrimitiveTable &primitives) const {
+  std::lock_guard<std::mutex> lock(compileMutex_);
+  return !hasJitConfig_ ||
+         sameEntryPoints(jitPrimitives_, primitives.primitives());
+}
+
+}  // namespace b9
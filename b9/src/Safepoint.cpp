@@ -0,0 +1,50 @@
+#include <b9/Safepoint.hpp>
+
+namespace b9 {
+
+void Safepoint::attach() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  changed_.wait(lock, [this] { return !stopped_; });
+  attached_++;
+}
+
+void Safepoint::detach() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  attached_--;
+  changed_.notify_all();
+}
+
+void Safepoint::park() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!stopped_) {
+    return;
+  }
+  parked_++;
+  changed_.notify_all();
+  changed_.wait(lock, [this] { return !stopped_; });
+  parked_--;
+}
+
+void Safepoint::stop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (stopped_) {
+    // Someone else is stopping the world. Count as parked so they can proceed.
+    parked_++;
+    changed_.notify_all();
+    changed_.wait(lock, [this] { return !stopped_; });
+    parked_--;
+  }
+  stopped_ = true;
+  requested_.store(true, std::memory_order_relaxed);
+  // The calling thread is attached, but will not park.
+  changed_.wait(lock, [this] { return parked_ + 1 >= attached_; });
+}
+
+void Safepoint::resume() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  stopped_ = false;
+  requested_.store(false, std::memory_order_relaxed);
+  changed_.notify_all();
+}
+
+}  // namespace b9
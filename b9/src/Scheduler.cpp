@@ -0,0 +1,118 @@
+#include <b9/ExecutionContext.hpp>
+#include <b9/Scheduler.hpp>
+
+#include <sstream>
+
+namespace b9 {
+
+Scheduler::Scheduler(VirtualMachine &virtualMachine)
+    : virtualMachine_(virtualMachine) {}
+
+void Scheduler::spawn(std::size_t functionIndex,
+                      std::vector<StackElement> args, Callback done) {
+  auto function = virtualMachine_.getFunction(functionIndex);
+  if (args.size() != function->nparams) {
+    std::stringstream ss;
+    ss << function->name << " - Got " << args.size()
+       << " arguments, expected " << function->nparams;
+    throw BadFunctionCallException{ss.str()};
+  }
+
+  Event event;
+  event.start.reset(new Task{functionIndex, std::move(args), std::move(done)});
+  event.context = nullptr;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  events_.push_back(std::move(event));
+  inFlight_++;
+  changed_.notify_all();
+}
+
+void Scheduler::run() {
+  while (true) {
+    Event event;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      changed_.wait(lock,
+                    [this] { return !events_.empty() || inFlight_ == 0; });
+      if (events_.empty()) {
+        break;
+      }
+      event = std::move(events_.front());
+      events_.pop_front();
+    }
+
+    ExecutionContext *context = event.context;
+    bool start = event.start != nullptr;
+    if (start) {
+      context = takeContext();
+      running_[context] = std::move(event.start);
+    }
+
+    bool finished;
+    try {
+      if (start) {
+        const Task &task = *running_[context];
+        finished = context->start(task.functionIndex, task.args.data());
+      } else {
+        finished = context->resume(event.value);
+      }
+    } catch (...) {
+      retire(context);
+      throw;
+    }
+
+    if (finished) {
+      StackElement result = context->result();
+      auto task = retire(context);
+      if (task->done) {
+        task->done(result);
+      }
+    }
+  }
+
+  for (auto &context : contexts_) {
+    context->output().flush();
+  }
+}
+
+std::size_t Scheduler::inFlight() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return inFlight_;
+}
+
+void Scheduler::complete(ExecutionContext *context, StackElement value) {
+  Event event;
+  event.context = context;
+  event.value = value;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  events_.push_back(std::move(event));
+  changed_.notify_all();
+}
+
+ExecutionContext *Scheduler::takeContext() {
+  if (!idle_.empty()) {
+    auto context = idle_.back();
+    idle_.pop_back();
+    return context;
+  }
+  contexts_.emplace_back(
+      new ExecutionContext(virtualMachine_, virtualMachine_.config()));
+  auto context = contexts_.back().get();
+  context->scheduler_ = this;
+  return context;
+}
+
+std::unique_ptr<Scheduler::Task> Scheduler::retire(ExecutionContext *context) {
+  auto task = std::move(running_[context]);
+  running_.erase(context);
+  context->reset();
+  idle_.push_back(context);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  inFlight_--;
+  return task;
+}
+
+}  // namespace b9
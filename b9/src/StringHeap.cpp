@@ -0,0 +1,451 @@
+#include <b9/StringHeap.hpp>
+
+#include <b9/ExecutionContext.hpp>
+#include <b9/HashMap.hpp>
+
+#include <OMR/Om/ArrayOperations.hpp>
+#include <OMR/Om/RootRef.hpp>
+#include <OMR/Om/ShapeOperations.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace b9 {
+
+namespace {
+
+// The hidden slots of string objects, after the ones maps and dictionaries
+// use. Every string object has a length. A leaf has a buffer and an offset
+// into it, and a rope has a depth and its two halves.
+constexpr Om::Id LENGTH_SLOT = FIRST_HIDDEN_SLOT + 2;
+constexpr Om::Id BUFFER_SLOT = FIRST_HIDDEN_SLOT + 3;
+constexpr Om::Id OFFSET_SLOT = FIRST_HIDDEN_SLOT + 4;
+constexpr Om::Id DEPTH_SLOT = FIRST_HIDDEN_SLOT + 5;
+constexpr Om::Id LEFT_SLOT = FIRST_HIDDEN_SLOT + 6;
+constexpr Om::Id RIGHT_SLOT = FIRST_HIDDEN_SLOT + 7;
+
+// A buffer is an array of the count of characters used, then the characters.
+constexpr std::size_t HEADER = sizeof(std::uint64_t);
+
+/// Strings up to this long are copied when concatenated, rather than roped.
+constexpr std::size_t SHORT_STRING = 32;
+
+/// Ropes any deeper are flattened, to bound the cost of walking them.
+constexpr std::size_t MAX_ROPE_DEPTH = 48;
+
+Om::Value getSlot(Om::RunContext &cx, Om::Object *string, Om::Id id) {
+  Om::SlotDescriptor descriptor;
+  bool found = Om::lookupSlot(cx, string, id, descriptor);
+  assert(found);
+  (void)found;
+  return Om::getValue(cx, string, descriptor);
+}
+
+void setSlot(ExecutionContext &context, Om::Object *string, Om::Id id,
+             StackElement value) {
+  Om::SlotDescriptor descriptor;
+  bool found = Om::lookupSlot(context.omContext(), string, id, descriptor);
+  assert(found);
+  (void)found;
+  context.writeBarrier(string, nullptr, value);
+  Om::setValue(context.omContext(), string, descriptor, value);
+}
+
+bool isLeaf(Om::RunContext &cx, Om::Object *string) {
+  Om::SlotDescriptor descriptor;
+  return Om::lookupSlot(cx, string, BUFFER_SLOT, descriptor);
+}
+
+std::uint64_t &used(Om::Array *buffer) {
+  return *static_cast<std::uint64_t *>(buffer->data());
+}
+
+char *characters(Om::Array *buffer) {
+  return static_cast<char *>(buffer->data()) + HEADER;
+}
+
+std::size_t capacity(Om::Array *buffer) {
+  return buffer->sizeInBytes() - HEADER;
+}
+
+Om::Array *bufferOf(Om::RunContext &cx, Om::Object *leaf) {
+  return getSlot(cx, leaf, BUFFER_SLOT).getRef<Om::Array>();
+}
+
+std::size_t offsetOf(Om::RunContext &cx, Om::Object *leaf) {
+  return getSlot(cx, leaf, OFFSET_SLOT).getInt48();
+}
+
+/// A leaf with uninitialized slots. May collect.
+Om::Object *allocateLeaf(Om::RunContext &cx) {
+  static constexpr Om::SlotType type(Om::Id(0), Om::CoreType::VALUE);
+
+  Om::RootRef<Om::Object> leaf(cx, Om::allocateEmptyObject(cx));
+  Om::transitionLayout(
+      cx, leaf,
+      {{type, LENGTH_SLOT}, {type, BUFFER_SLOT}, {type, OFFSET_SLOT}});
+  return leaf.get();
+}
+
+/// A rope with uninitialized slots. May collect.
+Om::Object *allocateRope(Om::RunContext &cx) {
+  static constexpr Om::SlotType type(Om::Id(0), Om::CoreType::VALUE);
+
+  Om::RootRef<Om::Object> rope(cx, Om::allocateEmptyObject(cx));
+  Om::transitionLayout(cx, rope,
+                       {{type, LENGTH_SLOT},
+                        {type, DEPTH_SLOT},
+                        {type, LEFT_SLOT},
+                        {type, RIGHT_SLOT}});
+  return rope.get();
+}
+
+void initLeaf(ExecutionContext &context, Om::Object *leaf, Om::Array *buffer,
+              std::size_t offset, std::size_t length) {
+  setSlot(context, leaf, LENGTH_SLOT, {Om::AS_INT48, std::int64_t(length)});
+  setSlot(context, leaf, BUFFER_SLOT, {Om::AS_REF, buffer});
+  setSlot(context, leaf, OFFSET_SLOT, {Om::AS_INT48, std::int64_t(offset)});
+}
+
+/// A leaf of length characters, in a new buffer with room for capacity. fill
+/// writes the characters once everything is allocated, so it must read any
+/// string it copies from a root. May collect.
+template <typename FillT>
+StackElement newLeaf(ExecutionContext &context, std::size_t length,
+                     std::size_t capacity, FillT fill) {
+  Om::RunContext &cx = context.omContext();
+  Om::RootRef<Om::Object> leaf(cx, allocateLeaf(cx));
+  Om::Array *buffer = Om::allocateArray(cx, HEADER + capacity);
+  fill(characters(buffer));
+  used(buffer) = length;
+  initLeaf(context, leaf.get(), buffer, 0, length);
+  return {Om::AS_REF, leaf.get()};
+}
+
+}  // namespace
+
+class StringHeap::Cursor {
+ public:
+  Cursor(StringHeap &heap, Om::RunContext &cx, StackElement string)
+      : heap_(heap), cx_(cx) {
+    pending_.push_back(string);
+  }
+
+  /// Move to the next non-empty piece. Returns false at the end.
+  bool next() {
+    while (!pending_.empty()) {
+      StackElement piece = pending_.back();
+      pending_.pop_back();
+      Om::Object *string = heap_.object(cx_, piece);
+      if (string == nullptr) {
+        const std::string &text = heap_.text(piece.getUint48());
+        data_ = text.data();
+        size_ = text.size();
+      } else if (isLeaf(cx_, string)) {
+        data_ = characters(bufferOf(cx_, string)) + offsetOf(cx_, string);
+        size_ = getSlot(cx_, string, LENGTH_SLOT).getInt48();
+      } else {
+        pending_.push_back(getSlot(cx_, string, RIGHT_SLOT));
+        pending_.push_back(getSlot(cx_, string, LEFT_SLOT));
+        continue;
+      }
+      if (size_ != 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  const char *data() const { return data_; }
+
+  std::size_t size() const { return size_; }
+
+  void advance(std::size_t count) {
+    data_ += count;
+    size_ -= count;
+  }
+
+ private:
+  StringHeap &heap_;
+  Om::RunContext &cx_;
+  std::vector<StackElement> pending_;
+  const char *data_ = nullptr;
+  std::size_t size_ = 0;
+};
+
+void StringHeap::setConstants(const std::vector<std::string> *constants) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  constants_ = constants;
+  // Interned constants are indexes into the old constants. Symbols stay.
+  for (auto i = interned_.begin(); i != interned_.end();) {
+    if (i->second < FIRST_SYMBOL) {
+      i = interned_.erase(i);
+    } else {
+      ++i;
+    }
+  }
+}
+
+bool StringHeap::isString(Om::RunContext &cx, StackElement value) {
+  if (value.isUint48()) {
+    const Handle handle = value.getUint48();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (handle < FIRST_SYMBOL) {
+      return constants_ != nullptr && handle < constants_->size();
+    }
+    return handle - FIRST_SYMBOL < symbols_.size();
+  }
+  if (!value.isRef() || value.getRef<Om::Cell>()->map()->kind() !=
+                            Om::MapKind::OBJECT_MAP) {
+    return false;
+  }
+  Om::SlotDescriptor descriptor;
+  return Om::lookupSlot(cx, value.getRef<Om::Object>(), LENGTH_SLOT,
+                        descriptor);
+}
+
+StackElement StringHeap::concat(ExecutionContext &context, StackElement left,
+                                StackElement right) {
+  Om::RunContext &cx = context.omContext();
+  const std::size_t leftLength = length(cx, left);
+  const std::size_t rightLength = length(cx, right);
+  const std::size_t total = leftLength + rightLength;
+
+  if (rightLength == 0) {
+    return left;
+  }
+  if (leftLength == 0) {
+    return right;
+  }
+
+  ExecutionContext::ValueRoot leftRoot(context, left);
+  ExecutionContext::ValueRoot rightRoot(context, right);
+  auto copyBoth = [&](char *out) {
+    read(cx, leftRoot.get(), 0, leftLength, out);
+    read(cx, rightRoot.get(), 0, rightLength, out + leftLength);
+  };
+
+  // Append in place to a leaf that ends its buffer, like a string builder.
+  Om::Object *leftObject = object(cx, left);
+  if (leftObject != nullptr && isLeaf(cx, leftObject)) {
+    Om::Array *buffer = bufferOf(cx, leftObject);
+    const std::size_t offset = offsetOf(cx, leftObject);
+    if (offset + leftLength == used(buffer)) {
+      if (rightLength > capacity(buffer) - used(buffer)) {
+        // The buffer is full, so move on to one twice the size.
+        return newLeaf(context, total, 2 * total, copyBoth);
+      }
+      Om::Object *leaf = allocateLeaf(cx);
+      // The collection may have moved the buffer.
+      buffer = bufferOf(cx, leftRoot.get().getRef<Om::Object>());
+      read(cx, rightRoot.get(), 0, rightLength,
+           characters(buffer) + used(buffer));
+      used(buffer) += rightLength;
+      initLeaf(context, leaf, buffer, offset, total);
+      return {Om::AS_REF, leaf};
+    }
+  }
+
+  if (total <= SHORT_STRING) {
+    return newLeaf(context, total, total, copyBoth);
+  }
+
+  auto depth = [&](StackElement string) -> std::size_t {
+    Om::Object *rope = object(cx, string);
+    if (rope == nullptr || isLeaf(cx, rope)) {
+      return 0;
+    }
+    return getSlot(cx, rope, DEPTH_SLOT).getInt48();
+  };
+  const std::size_t ropeDepth = 1 + std::max(depth(left), depth(right));
+  if (ropeDepth > MAX_ROPE_DEPTH) {
+    return newLeaf(context, total, total, copyBoth);
+  }
+
+  leftRoot.set(own(context, leftRoot.get()));
+  rightRoot.set(own(context, rightRoot.get()));
+  Om::Object *rope = allocateRope(cx);
+  setSlot(context, rope, LENGTH_SLOT, {Om::AS_INT48, std::int64_t(total)});
+  setSlot(context, rope, DEPTH_SLOT,
+          {Om::AS_INT48, std::int64_t(ropeDepth)});
+  setSlot(context, rope, LEFT_SLOT, leftRoot.get());
+  setSlot(context, rope, RIGHT_SLOT, rightRoot.get());
+  return {Om::AS_REF, rope};
+}
+
+StackElement StringHeap::slice(ExecutionContext &context, StackElement string,
+                               std::int64_t start, std::int64_t end) {
+  Om::RunContext &cx = context.omContext();
+  const std::size_t length = this->length(cx, string);
+  if (start < 0 || end < start || std::size_t(end) > length) {
+    throw StringException{"String slice out of range."};
+  }
+  const std::size_t count = end - start;
+  if (count == length) {
+    return string;
+  }
+
+  // Narrow down to the piece that holds the whole slice.
+  std::size_t offset = start;
+  for (Om::Object *rope = object(cx, string);
+       rope != nullptr && !isLeaf(cx, rope); rope = object(cx, string)) {
+    StackElement left = getSlot(cx, rope, LEFT_SLOT);
+    const std::size_t leftLength = this->length(cx, left);
+    if (offset + count <= leftLength) {
+      string = left;
+    } else if (offset >= leftLength) {
+      string = getSlot(cx, rope, RIGHT_SLOT);
+      offset -= leftLength;
+    } else {
+      break;
+    }
+  }
+
+  ExecutionContext::ValueRoot root(context, string);
+  Om::Object *piece = object(cx, string);
+  if (piece != nullptr && isLeaf(cx, piece)) {
+    Om::Object *leaf = allocateLeaf(cx);
+    // The collection may have moved the piece.
+    piece = root.get().getRef<Om::Object>();
+    initLeaf(context, leaf, bufferOf(cx, piece), offsetOf(cx, piece) + offset,
+             count);
+    return {Om::AS_REF, leaf};
+  }
+
+  // The slice spans pieces, or is of a Uint48 string, so copy it.
+  return newLeaf(context, count, count, [&](char *out) {
+    read(cx, root.get(), offset, count, out);
+  });
+}
+
+std::size_t StringHeap::length(Om::RunContext &cx, StackElement string) {
+  Om::Object *stringObject = object(cx, string);
+  if (stringObject == nullptr) {
+    return text(string.getUint48()).size();
+  }
+  return getSlot(cx, stringObject, LENGTH_SLOT).getInt48();
+}
+
+std::string StringHeap::flatten(Om::RunContext &cx, StackElement string) {
+  std::string out(length(cx, string), '\0');
+  read(cx, string, 0, out.size(), &out[0]);
+  return out;
+}
+
+int StringHeap::compare(Om::RunContext &cx, StackElement left,
+                        StackElement right) {
+  // Check both are strings.
+  length(cx, left);
+  length(cx, right);
+  Cursor leftCursor(*this, cx, left);
+  Cursor rightCursor(*this, cx, right);
+  bool leftMore = leftCursor.next();
+  bool rightMore = rightCursor.next();
+  while (leftMore && rightMore) {
+    const std::size_t count = std::min(leftCursor.size(), rightCursor.size());
+    const int result = std::char_traits<char>::compare(
+        leftCursor.data(), rightCursor.data(), count);
+    if (result != 0) {
+      return result;
+    }
+    leftCursor.advance(count);
+    rightCursor.advance(count);
+    if (leftCursor.size() == 0) {
+      leftMore = leftCursor.next();
+    }
+    if (rightCursor.size() == 0) {
+      rightMore = rightCursor.next();
+    }
+  }
+  return int(leftMore) - int(rightMore);
+}
+
+bool StringHeap::equal(Om::RunContext &cx, StackElement left,
+                       StackElement right) {
+  if (left == right) {
+    return true;
+  }
+  if (length(cx, left) != length(cx, right)) {
+    return false;
+  }
+  return compare(cx, left, right) == 0;
+}
+
+StackElement StringHeap::intern(Om::RunContext &cx, StackElement string) {
+  std::string characters = flatten(cx, string);
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto found = interned_.find(characters);
+  if (found != interned_.end()) {
+    return {Om::AS_UINT48, found->second};
+  }
+  Handle handle;
+  if (string.isUint48()) {
+    handle = string.getUint48();
+  } else {
+    handle = FIRST_SYMBOL + symbols_.size();
+    symbols_.push_back(characters);
+  }
+  interned_.emplace(std::move(characters), handle);
+  return {Om::AS_UINT48, handle};
+}
+
+std::size_t StringHeap::symbols() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return symbols_.size();
+}
+
+const std::string &StringHeap::text(Handle handle) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (handle < FIRST_SYMBOL) {
+    if (constants_ == nullptr || handle >= constants_->size()) {
+      throw StringException{"Not a string."};
+    }
+    return (*constants_)[handle];
+  }
+  if (handle - FIRST_SYMBOL >= symbols_.size()) {
+    throw StringException{"Not a string."};
+  }
+  // Symbols are never removed, and a deque doesn't move its elements.
+  return symbols_[handle - FIRST_SYMBOL];
+}
+
+Om::Object *StringHeap::object(Om::RunContext &cx, StackElement value) {
+  if (value.isUint48()) {
+    return nullptr;
+  }
+  if (!isString(cx, value)) {
+    throw StringException{"Not a string."};
+  }
+  return value.getRef<Om::Object>();
+}
+
+StackElement StringHeap::own(ExecutionContext &context, StackElement string) {
+  if (!string.isUint48() || string.getUint48() >= FIRST_SYMBOL) {
+    return string;
+  }
+  const std::string &constant = text(string.getUint48());
+  return newLeaf(context, constant.size(), constant.size(), [&](char *out) {
+    std::memcpy(out, constant.data(), constant.size());
+  });
+}
+
+void StringHeap::read(Om::RunContext &cx, StackElement string,
+                      std::size_t start, std::size_t count, char *out) {
+  Cursor cursor(*this, cx, string);
+  while (count != 0 && cursor.next()) {
+    if (start >= cursor.size()) {
+      start -= cursor.size();
+      continue;
+    }
+    const std::size_t n = std::min(count, cursor.size() - start);
+    std::memcpy(out, cursor.data() + start, n);
+    out += n;
+    count -= n;
+    start = 0;
+  }
+}
+
+}  // namespace b9
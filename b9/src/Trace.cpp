@@ -0,0 +1,104 @@
+#include <b9/Trace.hpp>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+
+namespace b9 {
+
+namespace {
+
+/// Write a string as a JSON string.
+void writeString(std::ostream &out, const char *string) {
+  out << '"';
+  for (const char *c = string; *c != '\0'; c++) {
+    if (*c == '"' || *c == '\\') {
+      out << '\\' << *c;
+    } else if (static_cast<unsigned char>(*c) < 0x20) {
+      char escape[8];
+      std::snprintf(escape, sizeof(escape), "\\u%04x", *c);
+      out << escape;
+    } else {
+      out << *c;
+    }
+  }
+  out << '"';
+}
+
+}  // namespace
+
+thread_local Tracer::ThreadBuffer *Tracer::threadBuffer_ = nullptr;
+
+Tracer &Tracer::instance() {
+  static Tracer tracer;
+  return tracer;
+}
+
+Tracer::Tracer() : epoch_(Clock::now()) {}
+
+Tracer::ThreadBuffer &Tracer::buffer() {
+  if (threadBuffer_ == nullptr) {
+    std::unique_ptr<ThreadBuffer> buffer(new ThreadBuffer());
+    buffer->thread = std::uint32_t(syscall(SYS_gettid));
+    threadBuffer_ = buffer.get();
+    std::lock_guard<std::mutex> lock(mutex_);
+    buffers_.push_back(std::move(buffer));
+  }
+  return *threadBuffer_;
+}
+
+void Tracer::record(const char *category, const char *name,
+                    Clock::time_point start, Clock::time_point end) {
+  ThreadBuffer &buffer = this->buffer();
+  const std::size_t count = buffer.count.load(std::memory_order_relaxed);
+  Event &event = buffer.events[count % BUFFER_SIZE];
+  event.category = category;
+  std::strncpy(event.name, name, NAME_SIZE - 1);
+  event.name[NAME_SIZE - 1] = '\0';
+  event.start = start;
+  event.duration = end - start;
+  buffer.count.store(count + 1, std::memory_order_release);
+}
+
+void Tracer::write(std::ostream &out) {
+  auto us = [](Clock::duration d) {
+    return std::chrono::duration<double, std::micro>(d).count();
+  };
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  const std::ios::fmtflags flags = out.flags();
+  const std::streamsize precision = out.precision();
+  const int pid = getpid();
+  bool first = true;
+  out << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+  for (const auto &buffer : buffers_) {
+    const std::size_t count = buffer->count.load(std::memory_order_acquire);
+    const std::size_t oldest = count > BUFFER_SIZE ? count - BUFFER_SIZE : 0;
+    for (std::size_t i = oldest; i < count; i++) {
+      const Event &event = buffer->events[i % BUFFER_SIZE];
+      out << (first ? "\n" : ",\n") << "{\"name\":";
+      writeString(out, event.name);
+      out << ",\"cat\":";
+      writeString(out, event.category);
+      out << ",\"ph\":\"X\",\"ts\":" << us(event.start - epoch_)
+          << ",\"dur\":" << us(event.duration) << ",\"pid\":" << pid
+          << ",\"tid\":" << buffer->thread << "}";
+      first = false;
+    }
+  }
+  out << "\n],\"displayTimeUnit\":\"ms\"}" << std::endl;
+  out.flags(flags);
+  out.precision(precision);
+}
+
+void Tracer::clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto &buffer : buffers_) {
+    buffer->count.store(0, std::memory_order_relaxed);
+  }
+}
+
+}  // namespace b9
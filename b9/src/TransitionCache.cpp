@@ -0,0 +1,76 @@
+#include <b9/TransitionCache.hpp>
+
+#include <algorithm>
+
+namespace b9 {
+
+const TransitionCache::Transition *TransitionCache::lookup(
+    Om::ObjectMap *parent, Om::Id slotId) {
+  if (stale_) {
+    reindex();
+  }
+  auto found = index_.find({parent, slotId});
+  if (found == index_.end()) {
+    return nullptr;
+  }
+  return &transitions_[found->second];
+}
+
+void TransitionCache::insert(Om::ObjectMap *parent, Om::Id slotId,
+                             Om::ObjectMap *child,
+                             Om::SlotDescriptor descriptor) {
+  if (stale_) {
+    reindex();
+  }
+  if (transitions_.size() == CAPACITY) {
+    clear();
+  }
+  auto inserted = index_.emplace(Key{parent, slotId}, transitions_.size());
+  if (!inserted.second) {
+    return;
+  }
+  transitions_.push_back({{Om::AS_REF, parent},
+                          {Om::AS_REF, child},
+                          slotId,
+                          descriptor});
+  maxFanOut_ = std::max(maxFanOut_, ++fanOut_[parent]);
+  children_.insert(child);
+}
+
+std::size_t TransitionCache::fanOut(Om::ObjectMap *parent) {
+  if (stale_) {
+    reindex();
+  }
+  auto found = fanOut_.find(parent);
+  return found == fanOut_.end() ? 0 : found->second;
+}
+
+bool TransitionCache::isChild(Om::ObjectMap *shape) {
+  if (stale_) {
+    reindex();
+  }
+  return children_.count(shape) != 0;
+}
+
+void TransitionCache::clear() {
+  transitions_.clear();
+  index_.clear();
+  fanOut_.clear();
+  children_.clear();
+  stale_ = false;
+}
+
+void TransitionCache::reindex() {
+  index_.clear();
+  fanOut_.clear();
+  children_.clear();
+  for (std::size_t i = 0; i < transitions_.size(); i++) {
+    auto parent = transitions_[i].parent.getRef<Om::ObjectMap>();
+    index_.emplace(Key{parent, transitions_[i].slotId}, i);
+    fanOut_[parent]++;
+    children_.insert(transitions_[i].child.getRef<Om::ObjectMap>());
+  }
+  stale_ = false;
+}
+
+}  // namespace b9
@@ -1,4 +1,5 @@
 #include <b9/ExecutionContext.hpp>
+#include <b9/Trace.hpp>
 #include <b9/VirtualMachine.hpp>
 #include <b9/compiler/Compiler.hpp>
 
@@ -13,67 +14,148 @@
 #include <Jit.hpp>
 
 #include <sys/time.h>
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <mutex>
 #include <sstream>
 #include <string>
 
 namespace b9 {
 
-constexpr PrimitiveFunction *const VirtualMachine::primitives_[3];
+
+namespace {
+
+bool sameSignatures(const std::vector<PrimitiveSignature> &a,
+                    const std::vector<PrimitiveSignature> &b) {
+  return a.size() == b.size() &&
+         std::equal(a.begin(), a.end(), b.begin(),
+                    [](PrimitiveSignature x, PrimitiveSignature y) {
+                      return x.arity == y.arity;
+                    });
+}
+
+// The JIT is process wide, but every isolate with the JIT enabled needs it.
+std::mutex jitMutex;
+std::size_t jitUsers = 0;
+
+void acquireJit() {
+  std::lock_guard<std::mutex> lock(jitMutex);
+  if (jitUsers == 0 && !initializeJit()) {
+    throw std::runtime_error{"Failed to init JIT"};
+  }
+  jitUsers++;
+}
+
+void releaseJit() {
+  std::lock_guard<std::mutex> lock(jitMutex);
+  if (--jitUsers == 0) {
+    shutdownJit();
+  }
+}
+
+}  // namespace
 
 VirtualMachine::VirtualMachine(Om::ProcessRuntime &runtime, const Config &cfg)
-    : cfg_{cfg}, memoryManager_(runtime), compiler_{nullptr} {
+    : cfg_{cfg},
+      memoryManager_(runtime),
+      compiler_{nullptr},
+      output_(&std::cout) {
   if (cfg_.verbose) std::cout << "VM initializing..." << std::endl;
 
-  if (cfg_.jit) {
-    auto ok = initializeJit();
-    if (!ok) {
-      throw std::runtime_error{"Failed to init JIT"};
-    }
+  if (cfg_.outputThread) {
+    outputWriter_.reset(new OutputWriter());
+  }
 
+  // The built in primitives, in the order the frontend numbers them.
+  primitives_.add({"print_string", b9_prim_print_string, {1}, Primitive::NOGC,
+                   (void *)&b9_prim_print_string_direct});
+  primitives_.add({"print_number", b9_prim_print_number, {1}, Primitive::NOGC,
+                   (void *)&b9_prim_print_number_direct});
+  primitives_.add({"print_stack", b9_prim_print_stack, {0}, Primitive::NOGC});
+  primitives_.add({"yield", b9_prim_yield, {0}, Primitive::ASYNC});
+  addArrayPrimitives(primitives_);
+
+  if (cfg_.jit) {
+    acquireJit();
     compiler_ = std::make_shared<Compiler>(*this, cfg_);
   }
 }
 
 VirtualMachine::~VirtualMachine() noexcept {
   if (cfg_.jit) {
-    shutdownJit();
+    compiler_ = nullptr;
+    releaseJit();
   }
 }
 
 void VirtualMachine::load(std::shared_ptr<const Module> module) {
-  module_ = module;
-  compiledFunctions_.reserve(getFunctionCount());
+  TraceScope trace("vm", "load");
+  program_ = std::make_shared<Program>(module, primitiveSignatures(),
+                                       cfg_.verbose);
+  strings_.setConstants(&program_->module()->strings);
+}
+
+void VirtualMachine::load(const Snapshot &snapshot) {
+  TraceScope trace("vm", "load snapshot");
+  if (!sameSignatures(snapshot.primitives, primitiveSignatures())) {
+    load(snapshot.module);
+    return;
+  }
+
+  program_ = std::make_shared<Program>(snapshot);
+  strings_.setConstants(&program_->module()->strings);
+}
+
+void VirtualMachine::load(std::shared_ptr<Program> program) {
+  // The program's verified summaries let the fast interpreter skip stack
+  // checks, and its compiled code calls primitives directly, so both are only
+  // good for the primitives they were made with.
+  if (!sameSignatures(program->primitives(), primitiveSignatures())) {
+    throw std::runtime_error{"Program was loaded with different primitives"};
+  }
+  if (!program->compiledAgainst(primitives_)) {
+    throw std::runtime_error{
+        "Program was compiled against different primitives"};
+  }
+  program_ = program;
+  strings_.setConstants(&program_->module()->strings);
 }
 
+Snapshot VirtualMachine::snapshot() const { return program_->snapshot(); }
+
 /// OpCode Interpreter
 
 JitFunction VirtualMachine::getJitAddress(std::size_t functionIndex) {
-  if (functionIndex >= compiledFunctions_.size()) {
-    return nullptr;
-  }
-  return compiledFunctions_[functionIndex];
+  return program_->getJitAddress(functionIndex);
 }
 
 void VirtualMachine::setJitAddress(std::size_t functionIndex,
                                    JitFunction value) {
-  compiledFunctions_[functionIndex] = value;
+  program_->setJitAddress(functionIndex, value);
 }
 
 PrimitiveFunction *VirtualMachine::getPrimitive(std::size_t index) {
-  return primitives_[index];
+  return primitives_[index].function;
+}
+
+std::size_t VirtualMachine::registerPrimitive(const Primitive &primitive) {
+  return primitives_.add(primitive);
 }
 
 const FunctionDef *VirtualMachine::getFunction(std::size_t index) {
-  return &module_->functions[index];
+  return &module()->functions[index];
 }
 
 JitFunction VirtualMachine::generateCode(const std::size_t functionIndex) {
+  if (!summary(functionIndex).verified) {
+    return nullptr;
+  }
   try {
+    auto lock = program_->lockForCompile(cfg_, primitives_);
     return compiler_->generateCode(functionIndex);
   } catch (const CompilationException &e) {
     auto f = getFunction(functionIndex);
@@ -83,39 +165,51 @@ JitFunction VirtualMachine::generateCode(const std::size_t functionIndex) {
   }
 }
 
-const std::string &VirtualMachine::getString(int index) {
-  return module_->strings[index];
-}
-
 std::size_t VirtualMachine::getFunctionCount() {
-  return module_->functions.size();
+  return module()->functions.size();
 }
 
 void VirtualMachine::generateAllCode() {
   assert(cfg_.jit);
+  auto lock = program_->lockForCompile(cfg_, primitives_);
   auto functionIndex = 0;  // 0 index for <script>
 
   while (functionIndex < getFunctionCount()) {
+    // Another isolate running the same program may have compiled it already.
+    if (getJitAddress(functionIndex) != nullptr) {
+      ++functionIndex;
+      continue;
+    }
     if (cfg_.debug)
       std::cout << "\nJitting function: " << getFunction(functionIndex)->name
                 << " of index: " << functionIndex << std::endl;
-    auto func = compiler_->generateCode(functionIndex);
-    compiledFunctions_.push_back(func);
+    // Unverified functions stay in the checked interpreter.
+    JitFunction func = nullptr;
+    if (summary(functionIndex).verified) {
+      func = compiler_->generateCode(functionIndex);
+    }
+    setJitAddress(functionIndex, func);
     ++functionIndex;
   }
 }
 
 StackElement VirtualMachine::run(const std::string &name,
                                  const std::vector<StackElement> &usrArgs) {
-  return run(module_->getFunctionIndex(name), usrArgs);
+  return run(module()->getFunctionIndex(name), usrArgs);
 }
 
 StackElement VirtualMachine::run(const std::size_t functionIndex,
                                  const std::vector<StackElement> &usrArgs) {
+  ExecutionContext executionContext(*this, cfg_);
+  return run(executionContext, functionIndex, usrArgs);
+}
+
+StackElement VirtualMachine::run(ExecutionContext &executionContext,
+                                 const std::size_t functionIndex,
+                                 const std::vector<StackElement> &usrArgs) {
   auto function = getFunction(functionIndex);
   auto paramsCount = function->nparams;
-
-  ExecutionContext *executionContext = new ExecutionContext(*this, cfg_);
+  TraceScope trace("run", function->name);
 
   if (cfg_.verbose) {
     std::cout << "+++++++++++++++++++++++" << std::endl;
@@ -131,14 +225,25 @@ StackElement VirtualMachine::run(const std::size_t functionIndex,
     throw BadFunctionCallException{message};
   }
 
+  // The arguments are roots once they are on the stack, so the thread must be
+  // attached before pushing them.
+  Safepoint::Scope attached(safepoint_);
+  return runAttached(executionContext, functionIndex, usrArgs.data());
+}
+
+StackElement VirtualMachine::runAttached(ExecutionContext &executionContext,
+                                         const std::size_t functionIndex,
+                                         const StackElement *args) {
+  auto paramsCount = getFunction(functionIndex)->nparams;
+
   // push user defined arguments to send to the program
   for (std::size_t i = 0; i < paramsCount; i++) {
     auto idx = paramsCount - i - 1;
-    auto arg = usrArgs[idx];
-    executionContext->push(arg);
+    auto arg = args[idx];
+    executionContext.push(arg);
   }
 
-  StackElement result = executionContext->interpret(functionIndex);
+  StackElement result = executionContext.interpret(functionIndex);
 
   return result;
 }
@@ -161,4 +266,98 @@ void primitive_call(ExecutionContext *context, Immediate value) {
   context->doPrimitiveCall(value);
 }
 
+// For safepoint polls at backward jumps in JIT code
+void safepoint_poll(ExecutionContext *context) {
+  context->virtualMachine()->safepoint().poll();
+}
+
+// For SYSTEM_COLLECT in JIT code
+void system_collect(ExecutionContext *context) { context->doSystemCollect(); }
+
+// For NEW_OBJECT in JIT code, once the allocation buffer is used up
+void refill_allocation_buffer(ExecutionContext *context) {
+  context->refillAllocationBuffer();
+}
+
+// For the array bytecodes in JIT code. The unchecked accesses are the ones the
+// verifier found to be in bounds.
+Om::RawValue array_new(ExecutionContext *context, Om::RawValue length) {
+  return context->newArray(Om::Value(Om::AS_RAW, length)).raw();
+}
+
+Om::RawValue array_length(Om::RawValue array) {
+  return ExecutionContext::arrayLength(Om::Value(Om::AS_RAW, array)).raw();
+}
+
+Om::RawValue array_load(Om::RawValue array, Om::RawValue index) {
+  return ExecutionContext::arrayLoad(Om::Value(Om::AS_RAW, array),
+                                     Om::Value(Om::AS_RAW, index), true)
+      .raw();
+}
+
+Om::RawValue array_load_unchecked(Om::RawValue array, Om::RawValue index) {
+  return ExecutionContext::arrayLoad(Om::Value(Om::AS_RAW, array),
+                                     Om::Value(Om::AS_RAW, index), false)
+      .raw();
+}
+
+void array_store(Om::RawValue array, Om::RawValue index, Om::RawValue value) {
+  ExecutionContext::arrayStore(Om::Value(Om::AS_RAW, array),
+                               Om::Value(Om::AS_RAW, index),
+                               Om::Value(Om::AS_RAW, value), true);
+}
+
+void array_store_unchecked(Om::RawValue array, Om::RawValue index,
+                           Om::RawValue value) {
+  ExecutionContext::arrayStore(Om::Value(Om::AS_RAW, array),
+                               Om::Value(Om::AS_RAW, index),
+                               Om::Value(Om::AS_RAW, value), false);
+}
+
+// For the map bytecodes in JIT code
+Om::RawValue map_new(ExecutionContext *context) {
+  return context->newMap().raw();
+}
+
+Om::RawValue map_get(ExecutionContext *context, Om::RawValue map,
+                     Om::RawValue key) {
+  return context
+      ->mapGet(Om::Value(Om::AS_RAW, map), Om::Value(Om::AS_RAW, key))
+      .raw();
+}
+
+void map_set(ExecutionContext *context, Om::RawValue map, Om::RawValue key,
+             Om::RawValue value) {
+  context->mapSet(Om::Value(Om::AS_RAW, map), Om::Value(Om::AS_RAW, key),
+                  Om::Value(Om::AS_RAW, value));
+}
+
+Om::RawValue map_has(ExecutionContext *context, Om::RawValue map,
+                     Om::RawValue key) {
+  return context
+      ->mapHas(Om::Value(Om::AS_RAW, map), Om::Value(Om::AS_RAW, key))
+      .raw();
+}
+
+Om::RawValue map_delete(ExecutionContext *context, Om::RawValue map,
+                        Om::RawValue key) {
+  return context
+      ->mapDelete(Om::Value(Om::AS_RAW, map), Om::Value(Om::AS_RAW, key))
+      .raw();
+}
+
+// For JMP_EQ and JMP_NEQ on two different strings in JIT code
+std::int32_t values_equal(ExecutionContext *context, Om::RawValue left,
+                          Om::RawValue right) {
+  return context->equal(Om::Value(Om::AS_RAW, left),
+                        Om::Value(Om::AS_RAW, right));
+}
+
+// For JMP_LT, JMP_LE, JMP_GT and JMP_GE on anything but two Int48s in JIT code
+std::int64_t values_compare(ExecutionContext *context, Om::RawValue left,
+                            Om::RawValue right) {
+  return context->compare(Om::Value(Om::AS_RAW, left),
+                          Om::Value(Om::AS_RAW, right));
+}
+
 }  // extern "C"
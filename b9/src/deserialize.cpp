@@ -1,4 +1,5 @@
 #include <string.h>
+#include <algorithm>
 #include <cstring>
 #include <iostream>
 #include <memory>
@@ -34,6 +35,62 @@ bool readInstructions(std::istream &in,
   return true;
 }
 
+namespace {
+
+/// Append a decoded compact instruction, expanding wide instructions back into
+/// two instruction slots.
+void appendCompactInstruction(std::vector<Instruction> &instructions,
+                              OpCode op, std::int64_t immediate) {
+  if (op == OpCode::INT_PUSH_CONSTANT_WIDE) {
+    if (immediate < WIDE_IMMEDIATE_MIN || WIDE_IMMEDIATE_MAX < immediate) {
+      throw DeserializeException{"Wide immediate out of range"};
+    }
+    Instruction low, high;
+    setWideImmediate(op, immediate, low, high);
+    instructions.push_back(low);
+    instructions.push_back(high);
+  } else {
+    if (immediate < IMMEDIATE_MIN || IMMEDIATE_MAX < immediate) {
+      throw DeserializeException{"Immediate out of range"};
+    }
+    instructions.emplace_back(op, Immediate(immediate));
+  }
+}
+
+bool readVarint(std::istream &in, std::uint64_t &value) {
+  value = 0;
+  for (std::size_t i = 0; i < MAX_VARINT_BYTES; i++) {
+    auto byte = in.get();
+    if (byte == std::istream::traits_type::eof()) {
+      return false;
+    }
+    value |= std::uint64_t(byte & 0x7F) << (7 * i);
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  throw DeserializeException{"Malformed varint"};
+}
+
+}  // namespace
+
+bool readCompactInstructions(std::istream &in,
+                             std::vector<Instruction> &instructions) {
+  do {
+    auto op = in.get();
+    if (op == std::istream::traits_type::eof()) {
+      return false;
+    }
+    std::uint64_t immediate = 0;
+    if (hasImmediate(OpCode(op)) && !readVarint(in, immediate)) {
+      return false;
+    }
+    appendCompactInstruction(instructions, OpCode(op),
+                             zigzagDecode(immediate));
+  } while (instructions.back() != END_SECTION);
+  return true;
+}
+
 void readFunctionData(std::istream &in, FunctionDef &functionDef) {
   readString(in, functionDef.name);
   bool ok = readNumber(in, functionDef.nparams) &&
@@ -43,63 +100,274 @@ void readFunctionData(std::istream &in, FunctionDef &functionDef) {
   }
 }
 
-void readFunction(std::istream &in, FunctionDef &functionDef) {
+void readFunction(std::istream &in, FunctionDef &functionDef, bool compact) {
   readFunctionData(in, functionDef);
-  if (!readInstructions(in, functionDef.instructions)) {
+  bool ok = compact ? readCompactInstructions(in, functionDef.instructions)
+                    : readInstructions(in, functionDef.instructions);
+  if (!ok) {
     throw DeserializeException{"Error reading instructions"};
   }
 }
 
-void readFunctionSection(std::istream &in,
-                         std::vector<FunctionDef> &functions) {
+void readFunctionSection(std::istream &in, std::vector<FunctionDef> &functions,
+                         bool compact) {
   uint32_t functionCount;
   if (!readNumber(in, functionCount)) {
     throw DeserializeException{"Error reading function count"};
   }
   for (uint32_t i = 0; i < functionCount; i++) {
     functions.emplace_back(FunctionDef{"", std::vector<Instruction>{}, 0, 0});
-    readFunction(in, functions.back());
+    readFunction(in, functions.back(), compact);
   }
 }
 
-void readSection(std::istream &in, std::shared_ptr<Module> &module) {
-  uint32_t sectionCode;
-  if (!readNumber(in, sectionCode)) {
-    throw DeserializeException{"Error reading section code"};
-  }
+std::shared_ptr<Module> deserialize(std::istream &in) {
+  ModuleParser parser;
+  char buffer[4096];
+  do {
+    in.read(buffer, sizeof(buffer));
+    parser.feed(buffer, in.gcount());
+  } while (in.good());
+  return parser.finish();
+}
+
+// ModuleParser
+
+namespace {
 
-  switch (sectionCode) {
-    case 1:
-      return readFunctionSection(in, module->functions);
-    case 2:
-      return readStringSection(in, module->strings);
-    default:
-      throw DeserializeException{"Invalid Section Code"};
+const char MAGIC[] = {'b', '9', 'm', 'o', 'd', 'u', 'l', 'e'};
+
+}  // namespace
+
+ModuleParser::ModuleParser(FunctionCallback onFunction)
+    : onFunction_(onFunction), module_(std::make_shared<Module>()) {}
+
+bool ModuleParser::fill(const char *&data, const char *end,
+                        std::size_t bytes) {
+  std::size_t count = std::min<std::size_t>(bytes - scratchSize_, end - data);
+  memcpy(&scratch_[scratchSize_], data, count);
+  scratchSize_ += count;
+  data += count;
+  return scratchSize_ == bytes;
+}
+
+bool ModuleParser::readChars(const char *&data, const char *end,
+                             std::string &toRead) {
+  std::size_t count = std::min<std::size_t>(remaining_, end - data);
+  toRead.append(data, count);
+  remaining_ -= count;
+  data += count;
+  return remaining_ == 0;
+}
+
+void ModuleParser::nextFunction() {
+  state_ = itemsRemaining_ == 0 ? State::SECTION_CODE
+                                : State::FUNCTION_NAME_LENGTH;
+}
+
+void ModuleParser::endInstruction() {
+  auto &function = module_->functions.back();
+  if (function.instructions.back() != END_SECTION) {
+    state_ = compact_ ? State::COMPACT_OPCODE : State::INSTRUCTION;
+    return;
+  }
+  if (onFunction_) {
+    onFunction_(module_->functions.size() - 1, function);
   }
+  --itemsRemaining_;
+  nextFunction();
 }
 
-void readHeader(std::istream &in) {
-  if (in.peek() == std::istream::traits_type::eof()) {
-    throw DeserializeException{"Empty Input File"};
+void ModuleParser::nextString() {
+  state_ = itemsRemaining_ == 0 ? State::SECTION_CODE : State::STRING_LENGTH;
+}
+
+void ModuleParser::feed(const char *data, std::size_t size) {
+  if (size != 0) {
+    sawInput_ = true;
   }
+  unhashed_ = data;
+  consume(data, data + size);
+  crc_ = crc32(crc_, unhashed_, data + size - unhashed_);
+}
 
-  const char magic[] = {'b', '9', 'm', 'o', 'd', 'u', 'l', 'e'};
-  const std::size_t bytes = sizeof(magic);
+void ModuleParser::consume(const char *data, const char *end) {
+  while (data != end) {
+    switch (state_) {
+      case State::HEADER:
+        if (!fill(data, end, sizeof(MAGIC))) {
+          return;
+        }
+        if (strncmp(MAGIC, scratch_, sizeof(MAGIC)) != 0) {
+          throw DeserializeException{"Corrupt Header"};
+        }
+        scratchSize_ = 0;
+        state_ = State::SECTION_CODE;
+        break;
 
-  char buffer[bytes];
-  bool ok = readBytes(in, buffer, bytes);
-  if (!ok || strncmp(magic, buffer, bytes) != 0) {
-    throw DeserializeException{"Corrupt Header"};
+      case State::SECTION_CODE: {
+        if (scratchSize_ == 0) {
+          // Snapshot the checksum of everything before this section.
+          crc_ = crc32(crc_, unhashed_, data - unhashed_);
+          unhashed_ = data;
+          sectionCrc_ = crc_;
+        }
+        std::uint32_t sectionCode;
+        if (!readField(data, end, sectionCode)) {
+          return;
+        }
+        switch (SectionCode(sectionCode)) {
+          case SectionCode::FUNCTION:
+            compact_ = false;
+            state_ = State::FUNCTION_COUNT;
+            break;
+          case SectionCode::COMPACT_FUNCTION:
+            compact_ = true;
+            state_ = State::FUNCTION_COUNT;
+            break;
+          case SectionCode::STRING:
+            state_ = State::STRING_COUNT;
+            break;
+          case SectionCode::CHECKSUM:
+            state_ = State::CHECKSUM;
+            break;
+          default:
+            throw DeserializeException{"Invalid Section Code"};
+        }
+      } break;
+
+      case State::FUNCTION_COUNT:
+        if (!readField(data, end, itemsRemaining_)) {
+          return;
+        }
+        nextFunction();
+        break;
+
+      case State::FUNCTION_NAME_LENGTH:
+        if (!readField(data, end, remaining_)) {
+          return;
+        }
+        module_->functions.emplace_back(
+            FunctionDef{"", std::vector<Instruction>{}, 0, 0});
+        state_ = State::FUNCTION_NAME;
+        break;
+
+      case State::FUNCTION_NAME:
+        if (!readChars(data, end, module_->functions.back().name)) {
+          return;
+        }
+        state_ = State::FUNCTION_NPARAMS;
+        break;
+
+      case State::FUNCTION_NPARAMS:
+        if (!readField(data, end, module_->functions.back().nparams)) {
+          return;
+        }
+        state_ = State::FUNCTION_NLOCALS;
+        break;
+
+      case State::FUNCTION_NLOCALS:
+        if (!readField(data, end, module_->functions.back().nlocals)) {
+          return;
+        }
+        state_ = compact_ ? State::COMPACT_OPCODE : State::INSTRUCTION;
+        break;
+
+      case State::INSTRUCTION: {
+        RawInstruction instruction;
+        if (!readField(data, end, instruction)) {
+          return;
+        }
+        module_->functions.back().instructions.emplace_back(instruction);
+        endInstruction();
+      } break;
+
+      case State::COMPACT_OPCODE:
+        opCode_ = OpCode(*data++);
+        if (hasImmediate(opCode_)) {
+          varint_ = 0;
+          varintShift_ = 0;
+          state_ = State::COMPACT_IMMEDIATE;
+        } else {
+          appendCompactInstruction(module_->functions.back().instructions,
+                                   opCode_, 0);
+          endInstruction();
+        }
+        break;
+
+      case State::COMPACT_IMMEDIATE: {
+        if (varintShift_ >= 7 * MAX_VARINT_BYTES) {
+          throw DeserializeException{"Malformed varint"};
+        }
+        std::uint8_t byte = *data++;
+        varint_ |= std::uint64_t(byte & 0x7F) << varintShift_;
+        varintShift_ += 7;
+        if ((byte & 0x80) == 0) {
+          appendCompactInstruction(module_->functions.back().instructions,
+                                   opCode_, zigzagDecode(varint_));
+          endInstruction();
+        }
+      } break;
+
+      case State::STRING_COUNT:
+        if (!readField(data, end, itemsRemaining_)) {
+          return;
+        }
+        nextString();
+        break;
+
+      case State::STRING_LENGTH:
+        if (!readField(data, end, remaining_)) {
+          return;
+        }
+        module_->strings.emplace_back();
+        state_ = State::STRING_DATA;
+        break;
+
+      case State::STRING_DATA:
+        if (!readChars(data, end, module_->strings.back())) {
+          return;
+        }
+        --itemsRemaining_;
+        nextString();
+        break;
+
+      case State::CHECKSUM: {
+        std::uint32_t checksum;
+        if (!readField(data, end, checksum)) {
+          return;
+        }
+        if (checksum != sectionCrc_) {
+          throw DeserializeException{"Checksum mismatch"};
+        }
+        state_ = State::DONE;
+      } break;
+
+      case State::DONE:
+        throw DeserializeException{"Data after checksum section"};
+    }
+  }
+
+  // Zero length names and strings complete without consuming any input.
+  if (state_ == State::FUNCTION_NAME && remaining_ == 0) {
+    state_ = State::FUNCTION_NPARAMS;
+  } else if (state_ == State::STRING_DATA && remaining_ == 0) {
+    --itemsRemaining_;
+    nextString();
   }
 }
 
-std::shared_ptr<Module> deserialize(std::istream &in) {
-  auto module = std::make_shared<Module>();
-  readHeader(in);
-  while (in.peek() != std::istream::traits_type::eof()) {
-    readSection(in, module);
+std::shared_ptr<Module> ModuleParser::finish() {
+  if (!sawInput_) {
+    throw DeserializeException{"Empty Input File"};
+  }
+  if (state_ == State::HEADER) {
+    throw DeserializeException{"Corrupt Header"};
+  }
+  if (!atBoundary()) {
+    throw DeserializeException{"Unexpected end of module"};
   }
-  return module;
+  return std::move(module_);
 }
 
 }  // namespace b9
@@ -1,29 +1,223 @@
+#include <b9/ArrayKernels.hpp>
 #include <b9/ExecutionContext.hpp>
 
+#include <cstring>
 #include <iostream>
+#include <stdexcept>
 
 using namespace b9;
 
 /// ( number -- 0 )
-extern "C" void b9_prim_print_number(ExecutionContext *context) {
+extern "C" Om::RawValue b9_prim_print_number_direct(ExecutionContext *context,
+                                                    Om::RawValue number) {
+  context->output() << Om::Value(Om::AS_RAW, number) << '\n';
+  return Om::Value(Om::AS_INT48, 0).raw();
+}
+
+extern "C" PrimitiveStatus b9_prim_print_number(ExecutionContext *context) {
   auto number = context->pop();
   assert(number.isInt48());
-  std::cout << number << std::endl;
-  context->push(Om::Value(Om::AS_INT48, 0));
+  auto result = b9_prim_print_number_direct(context, number.raw());
+  context->push(Om::Value(Om::AS_RAW, result));
+  return PrimitiveStatus::DONE;
 }
 
 /// ( string -- 0 )
-extern "C" void b9_prim_print_string(ExecutionContext *context) {
+extern "C" Om::RawValue b9_prim_print_string_direct(ExecutionContext *context,
+                                                    Om::RawValue value) {
+  context->output() << context->virtualMachine()->strings().flatten(
+                           *context, Om::Value(Om::AS_RAW, value))
+                    << '\n';
+  return Om::Value(Om::AS_INT48, 0).raw();
+}
+
+extern "C" PrimitiveStatus b9_prim_print_string(ExecutionContext *context) {
   auto value = context->pop();
-  assert(value.isUint48());
-  auto string = context->virtualMachine()->getString(value.getUint48());
-  std::cout << string << std::endl;
-  context->push({Om::AS_INT48, 0});
+  auto result = b9_prim_print_string_direct(context, value.raw());
+  context->push(Om::Value(Om::AS_RAW, result));
+  return PrimitiveStatus::DONE;
 }
 
-extern "C" void b9_prim_print_stack(ExecutionContext *context) {
-  std::cout << "----------stack begin\n";
-  printStack(std::cout, context->stack());
-  std::cout << "----------stack end" << std::endl;
+extern "C" PrimitiveStatus b9_prim_print_stack(ExecutionContext *context) {
+  auto &out = context->output();
+  out << "----------stack begin\n";
+  printStack(out, context->stack());
+  out << "----------stack end\n";
   context->push(Om::Value(Om::AS_INT48, 0));
+  return PrimitiveStatus::DONE;
+}
+
+/// ( -- value )
+/// Suspend the context. The value is supplied by whoever resumes it. Under a
+/// Scheduler, the context is resumed with 0 once other ready calls have run.
+extern "C" PrimitiveStatus b9_prim_yield(ExecutionContext *context) {
+  if (context->scheduler() && context->canSuspend()) {
+    context->completion().complete({Om::AS_INT48, 0});
+  }
+  return PrimitiveStatus::PENDING;
+}
+
+//
+// Bulk array primitives. Each runs one of the ArrayKernels over a whole
+// array, so a loop over the elements runs as native, vector code. They never
+// allocate, so compiled code calls their direct entry points.
+//
+
+namespace {
+
+using Om::RawValue;
+
+std::int64_t *elements(RawValue array, std::size_t &length) {
+  return ExecutionContext::arrayElements(Om::Value(Om::AS_RAW, array), length);
+}
+
+std::int64_t integer(RawValue value) {
+  Om::Value number(Om::AS_RAW, value);
+  if (!number.isInt48()) {
+    throw std::runtime_error("Array operand is not an integer.");
+  }
+  return number.getInt48();
+}
+
+std::size_t sameLength(std::size_t length, std::size_t other) {
+  if (length != other) {
+    throw std::runtime_error("Array lengths differ.");
+  }
+  return length;
+}
+
+RawValue int48(std::int64_t value) {
+  return Om::Value(Om::AS_INT48, value).raw();
+}
+
+/// ( array -- sum )
+RawValue arraySum(ExecutionContext *context, RawValue array) {
+  std::size_t length;
+  auto data = elements(array, length);
+  return int48(arrayKernels().sum(data, length));
+}
+
+/// ( array -- min )
+RawValue arrayMin(ExecutionContext *context, RawValue array) {
+  std::size_t length;
+  auto data = elements(array, length);
+  if (length == 0) {
+    throw std::runtime_error("No minimum of an empty array.");
+  }
+  return int48(arrayKernels().min(data, length));
+}
+
+/// ( array -- max )
+RawValue arrayMax(ExecutionContext *context, RawValue array) {
+  std::size_t length;
+  auto data = elements(array, length);
+  if (length == 0) {
+    throw std::runtime_error("No maximum of an empty array.");
+  }
+  return int48(arrayKernels().max(data, length));
 }
+
+/// ( array value -- count )
+RawValue arrayCount(ExecutionContext *context, RawValue array,
+                    RawValue value) {
+  std::size_t length;
+  auto data = elements(array, length);
+  return int48(arrayKernels().count(data, length, integer(value)));
+}
+
+/// ( array value -- array )
+RawValue arrayFill(ExecutionContext *context, RawValue array, RawValue value) {
+  std::size_t length;
+  auto data = elements(array, length);
+  arrayKernels().fill(data, length, integer(value));
+  return array;
+}
+
+/// ( to from -- to )
+RawValue arrayCopy(ExecutionContext *context, RawValue to, RawValue from) {
+  std::size_t length, fromLength;
+  auto data = elements(to, length);
+  auto other = elements(from, fromLength);
+  std::memmove(data, other,
+               sameLength(length, fromLength) * sizeof(std::int64_t));
+  return to;
+}
+
+/// ( array value -- array )
+RawValue arrayAddScalar(ExecutionContext *context, RawValue array,
+                        RawValue value) {
+  std::size_t length;
+  auto data = elements(array, length);
+  arrayKernels().addScalar(data, length, integer(value));
+  return array;
+}
+
+/// ( array value -- array )
+RawValue arrayMulScalar(ExecutionContext *context, RawValue array,
+                        RawValue value) {
+  std::size_t length;
+  auto data = elements(array, length);
+  arrayKernels().mulScalar(data, length, integer(value));
+  return array;
+}
+
+/// ( array other -- array )
+RawValue arrayAdd(ExecutionContext *context, RawValue array, RawValue other) {
+  std::size_t length, otherLength;
+  auto data = elements(array, length);
+  auto otherData = elements(other, otherLength);
+  arrayKernels().add(data, otherData, sameLength(length, otherLength));
+  return array;
+}
+
+/// ( array other -- array )
+RawValue arrayMul(ExecutionContext *context, RawValue array, RawValue other) {
+  std::size_t length, otherLength;
+  auto data = elements(array, length);
+  auto otherData = elements(other, otherLength);
+  arrayKernels().mul(data, otherData, sameLength(length, otherLength));
+  return array;
+}
+
+/// The interpreter's entry point for a direct primitive of one argument.
+template <RawValue (*direct)(ExecutionContext *, RawValue)>
+PrimitiveStatus unary(ExecutionContext *context) {
+  auto value = context->pop();
+  context->push(Om::Value(Om::AS_RAW, direct(context, value.raw())));
+  return PrimitiveStatus::DONE;
+}
+
+/// The interpreter's entry point for a direct primitive of two arguments.
+template <RawValue (*direct)(ExecutionContext *, RawValue, RawValue)>
+PrimitiveStatus binary(ExecutionContext *context) {
+  auto right = context->pop();
+  auto left = context->pop();
+  context->push(
+      Om::Value(Om::AS_RAW, direct(context, left.raw(), right.raw())));
+  return PrimitiveStatus::DONE;
+}
+
+}  // namespace
+
+namespace b9 {
+
+void addArrayPrimitives(PrimitiveTable &primitives) {
+  const auto NOGC = Primitive::NOGC;
+  primitives.add({"array_sum", unary<arraySum>, {1}, NOGC, (void *)&arraySum});
+  primitives.add({"array_min", unary<arrayMin>, {1}, NOGC, (void *)&arrayMin});
+  primitives.add({"array_max", unary<arrayMax>, {1}, NOGC, (void *)&arrayMax});
+  primitives.add(
+      {"array_count", binary<arrayCount>, {2}, NOGC, (void *)&arrayCount});
+  primitives.add(
+      {"array_fill", binary<arrayFill>, {2}, NOGC, (void *)&arrayFill});
+  primitives.add(
+      {"array_copy", binary<arrayCopy>, {2}, NOGC, (void *)&arrayCopy});
+  primitives.add({"array_add_scalar", binary<arrayAddScalar>, {2}, NOGC,
+                  (void *)&arrayAddScalar});
+  primitives.add({"array_mul_scalar", binary<arrayMulScalar>, {2}, NOGC,
+                  (void *)&arrayMulScalar});
+  primitives.add({"array_add", binary<arrayAdd>, {2}, NOGC, (void *)&arrayAdd});
+  primitives.add({"array_mul", binary<arrayMul>, {2}, NOGC, (void *)&arrayMul});
+}
+
+}  // namespace b9
@@ -2,9 +2,11 @@
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <sstream>
 #include <vector>
 
 #include <b9/Module.hpp>
+#include <b9/binaryformat.hpp>
 #include <b9/instructions.hpp>
 #include <b9/serialize.hpp>
 
@@ -31,6 +33,35 @@ bool writeInstructions(std::ostream &out,
   return true;
 }
 
+bool writeCompactInstructions(std::ostream &out,
+                              const std::vector<Instruction> &instructions) {
+  for (std::size_t i = 0; i < instructions.size(); i++) {
+    const Instruction instruction = instructions[i];
+    const OpCode op = instruction.opCode();
+
+    std::uint8_t buffer[1 + MAX_VARINT_BYTES];
+    std::size_t count = 0;
+    buffer[count++] = RawOpCode(op);
+
+    if (op == OpCode::INT_PUSH_CONSTANT_WIDE) {
+      if (i + 1 >= instructions.size()) {
+        throw SerializeException{"Truncated wide instruction"};
+      }
+      auto value = wideImmediate(instruction, instructions[++i]);
+      count += encodeVarint(zigzagEncode(value), &buffer[count]);
+    } else if (hasImmediate(op)) {
+      count += encodeVarint(zigzagEncode(instruction.immediate()),
+                            &buffer[count]);
+    }
+
+    out.write(reinterpret_cast<const char *>(buffer), count);
+    if (!out.good()) {
+      return false;
+    }
+  }
+  return true;
+}
+
 void writeFunctionData(std::ostream &out, const FunctionDef &functionDef) {
   writeString(out, functionDef.name);
   bool ok = writeNumber(out, functionDef.nparams) &&
@@ -40,35 +71,43 @@ void writeFunctionData(std::ostream &out, const FunctionDef &functionDef) {
   }
 }
 
-void writeFunction(std::ostream &out, const FunctionDef &functionDef) {
+void writeFunction(std::ostream &out, const FunctionDef &functionDef,
+                   InstructionEncoding encoding) {
   writeFunctionData(out, functionDef);
-  if (!writeInstructions(out, functionDef.instructions)) {
+  bool ok = encoding == InstructionEncoding::COMPACT
+                ? writeCompactInstructions(out, functionDef.instructions)
+                : writeInstructions(out, functionDef.instructions);
+  if (!ok) {
     throw SerializeException("Error writing instructions");
   }
 }
 
 void writeFunctionSection(std::ostream &out,
-                          const std::vector<FunctionDef> &functions) {
+                          const std::vector<FunctionDef> &functions,
+                          InstructionEncoding encoding) {
   uint32_t functionCount = functions.size();
   if (!writeNumber(out, functionCount)) {
     throw SerializeException("Error writing function count");
   }
-  for (auto function : functions) {
-    writeFunction(out, function);
+  for (const auto &function : functions) {
+    writeFunction(out, function, encoding);
   }
 }
 
-void writeSections(std::ostream &out, const Module &module) {
+void writeSections(std::ostream &out, const Module &module,
+                   InstructionEncoding encoding) {
   if (module.functions.size() != 0) {
-    uint32_t sectionCode = 1;
+    auto sectionCode = encoding == InstructionEncoding::COMPACT
+                           ? SectionCode::COMPACT_FUNCTION
+                           : SectionCode::FUNCTION;
     if (!writeNumber(out, sectionCode)) {
       throw SerializeException("Error writing function section code");
     }
-    writeFunctionSection(out, module.functions);
+    writeFunctionSection(out, module.functions, encoding);
   }
 
   if (module.strings.size() != 0) {
-    uint32_t sectionCode = 2;
+    auto sectionCode = SectionCode::STRING;
     if (!writeNumber(out, sectionCode)) {
       throw SerializeException("Error writing string section code");
     }
@@ -76,6 +115,14 @@ void writeSections(std::ostream &out, const Module &module) {
   }
 }
 
+void writeChecksumSection(std::ostream &out, std::uint32_t checksum) {
+  bool ok = writeNumber(out, SectionCode::CHECKSUM) &&
+            writeNumber(out, checksum);
+  if (!ok) {
+    throw SerializeException("Error writing checksum section");
+  }
+}
+
 void writeHeader(std::ostream &out) {
   const char header[] = {'b', '9', 'm', 'o', 'd', 'u', 'l', 'e'};
   uint32_t length = 8;
@@ -85,9 +132,18 @@ void writeHeader(std::ostream &out) {
   }
 }
 
-void serialize(std::ostream &out, const Module &module) {
-  writeHeader(out);
-  writeSections(out, module);
+void serialize(std::ostream &out, const Module &module,
+               InstructionEncoding encoding) {
+  std::ostringstream buffer(std::ios::out | std::ios::binary);
+  writeHeader(buffer);
+  writeSections(buffer, module, encoding);
+
+  const std::string bytes = buffer.str();
+  out.write(bytes.data(), bytes.size());
+  if (!out.good()) {
+    throw SerializeException("Error writing module");
+  }
+  writeChecksumSection(out, crc32(0, bytes.data(), bytes.size()));
 }
 
 }  // namespace b9
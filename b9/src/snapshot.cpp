@@ -0,0 +1,158 @@
+#include <b9/binaryformat.hpp>
+#include <b9/deserialize.hpp>
+#include <b9/serialize.hpp>
+#include <b9/snapshot.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstring>
+#include <sstream>
+#include <string>
+
+namespace b9 {
+
+namespace {
+
+const char SNAPSHOT_MAGIC[] = {'b', '9', 's', 'n', 'a', 'p', 's', 'h'};
+
+/// A cursor over an in-memory snapshot.
+class SnapshotReader {
+ public:
+  SnapshotReader(const char *data, std::size_t size)
+      : data_(data), end_(data + size) {}
+
+  const char *read(std::size_t bytes) {
+    if (std::size_t(end_ - data_) < bytes) {
+      throw SnapshotException{"Truncated snapshot"};
+    }
+    const char *result = data_;
+    data_ += bytes;
+    return result;
+  }
+
+  std::uint32_t readUint32() {
+    std::uint32_t value;
+    std::memcpy(&value, read(sizeof(value)), sizeof(value));
+    return value;
+  }
+
+  bool atEnd() const { return data_ == end_; }
+
+ private:
+  const char *data_;
+  const char *end_;
+};
+
+}  // namespace
+
+void writeSnapshot(std::ostream &out, const Snapshot &snapshot) {
+  std::ostringstream module(std::ios::out | std::ios::binary);
+  serialize(module, *snapshot.module);
+  const std::string moduleBytes = module.str();
+
+  std::ostringstream buffer(std::ios::out | std::ios::binary);
+  buffer.write(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+  writeNumber(buffer, SNAPSHOT_VERSION);
+  writeNumber(buffer, std::uint32_t(moduleBytes.size()));
+  buffer.write(moduleBytes.data(), moduleBytes.size());
+
+  writeNumber(buffer, std::uint32_t(snapshot.primitives.size()));
+  for (const auto &primitive : snapshot.primitives) {
+    writeNumber(buffer, primitive.arity);
+  }
+
+  writeNumber(buffer, std::uint32_t(snapshot.summaries.size()));
+  for (const auto &summary : snapshot.summaries) {
+    writeNumber(buffer, std::uint32_t(summary.verified));
+    writeNumber(buffer, summary.maxStackDepth);
+  }
+
+  const std::string bytes = buffer.str();
+  out.write(bytes.data(), bytes.size());
+  writeNumber(out, crc32(0, bytes.data(), bytes.size()));
+  if (!out.good()) {
+    throw SerializeException{"Error writing snapshot"};
+  }
+}
+
+Snapshot readSnapshot(const char *data, std::size_t size) {
+  if (size < sizeof(SNAPSHOT_MAGIC) + sizeof(std::uint32_t)) {
+    throw SnapshotException{"Truncated snapshot"};
+  }
+  std::uint32_t checksum;
+  std::memcpy(&checksum, data + size - sizeof(checksum), sizeof(checksum));
+  size -= sizeof(checksum);
+  if (crc32(0, data, size) != checksum) {
+    throw SnapshotException{"Snapshot checksum mismatch"};
+  }
+
+  SnapshotReader reader(data, size);
+  if (std::memcmp(reader.read(sizeof(SNAPSHOT_MAGIC)), SNAPSHOT_MAGIC,
+                  sizeof(SNAPSHOT_MAGIC)) != 0) {
+    throw SnapshotException{"Not a snapshot"};
+  }
+  if (reader.readUint32() != SNAPSHOT_VERSION) {
+    throw SnapshotException{"Unsupported snapshot version"};
+  }
+
+  Snapshot snapshot;
+
+  std::uint32_t moduleSize = reader.readUint32();
+  ModuleParser parser;
+  parser.feed(reader.read(moduleSize), moduleSize);
+  snapshot.module = parser.finish();
+
+  std::uint32_t primitiveCount = reader.readUint32();
+  for (std::uint32_t i = 0; i < primitiveCount; i++) {
+    snapshot.primitives.push_back({reader.readUint32()});
+  }
+
+  std::uint32_t functionCount = reader.readUint32();
+  if (functionCount != snapshot.module->functions.size()) {
+    throw SnapshotException{"Snapshot function count mismatch"};
+  }
+  for (std::uint32_t i = 0; i < functionCount; i++) {
+    FunctionSummary summary;
+    summary.verified = reader.readUint32() != 0;
+    summary.maxStackDepth = reader.readUint32();
+    snapshot.summaries.push_back(summary);
+  }
+
+  if (!reader.atEnd()) {
+    throw SnapshotException{"Data after snapshot"};
+  }
+  return snapshot;
+}
+
+Snapshot mapSnapshot(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    throw SnapshotException{std::string("Unable to open snapshot ") + path};
+  }
+
+  struct stat info;
+  if (fstat(fd, &info) == -1 || info.st_size == 0) {
+    close(fd);
+    throw SnapshotException{std::string("Unable to read snapshot ") + path};
+  }
+
+  std::size_t size = info.st_size;
+  void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    throw SnapshotException{std::string("Unable to map snapshot ") + path};
+  }
+
+  try {
+    Snapshot snapshot = readSnapshot(static_cast<const char *>(data), size);
+    munmap(data, size);
+    return snapshot;
+  } catch (...) {
+    munmap(data, size);
+    throw;
+  }
+}
+
+}  // namespace b9
@@ -0,0 +1,664 @@
+#include <b9/Module.hpp>
+#include <b9/instructions.hpp>
+#include <b9/verify.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <set>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace b9 {
+
+namespace {
+
+bool inRange(Immediate value, std::size_t size) {
+  return value >= 0 && std::size_t(value) < size;
+}
+
+bool isJump(OpCode op) {
+  switch (op) {
+    case OpCode::JMP:
+    case OpCode::JMP_EQ:
+    case OpCode::JMP_NEQ:
+    case OpCode::JMP_GT:
+    case OpCode::JMP_GE:
+    case OpCode::JMP_LT:
+    case OpCode::JMP_LE:
+      return true;
+    default:
+      return false;
+  }
+}
+
+std::size_t jumpTarget(std::size_t index, Instruction instruction) {
+  return index + instruction.immediate() + 1;
+}
+
+/// True if the VM may collect, or park at a safepoint, while the instruction
+/// runs.
+bool isGcPoint(OpCode op) {
+  switch (op) {
+    case OpCode::FUNCTION_CALL:
+    case OpCode::PRIMITIVE_CALL:
+    case OpCode::NEW_OBJECT:
+    case OpCode::POP_INTO_OBJECT:
+    case OpCode::SYSTEM_COLLECT:
+    case OpCode::NEW_ARRAY:
+    case OpCode::NEW_MAP:
+    case OpCode::MAP_SET:
+    case OpCode::STR_CONCAT:
+    case OpCode::STR_SLICE:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool isCall(OpCode op) {
+  return op == OpCode::FUNCTION_CALL || op == OpCode::PRIMITIVE_CALL;
+}
+
+/// What the bounds analysis knows about an operand.
+struct BoundsValue {
+  std::int64_t source = -1;    //< The frame slot it was pushed from
+  std::int64_t lengthOf = -1;  //< The slot of the array it's the length of
+  std::int64_t constant = -1;  //< Its value, if a non-negative immediate
+  bool nonNegative = false;
+
+  bool operator==(const BoundsValue &other) const {
+    return source == other.source && lengthOf == other.lengthOf &&
+           constant == other.constant && nonNegative == other.nonNegative;
+  }
+};
+
+/// What the bounds analysis knows before an instruction.
+struct BoundsState {
+  std::vector<bool> nonNegative;  //< Per frame slot
+  std::vector<BoundsValue> operands;
+  /// Pairs of frame slots (index, array) where index < the array's length.
+  std::set<std::pair<std::int64_t, std::int64_t>> below;
+
+  /// True if the slot is known to be below some array's length.
+  bool belowSomeLength(std::int64_t slot) const {
+    for (const auto &fact : below) {
+      if (fact.first == slot) return true;
+    }
+    return false;
+  }
+
+  /// Forget what is known about a frame slot that is being written.
+  void kill(std::int64_t slot) {
+    for (auto &operand : operands) {
+      if (operand.source == slot) operand.source = -1;
+      if (operand.lengthOf == slot) operand.lengthOf = -1;
+    }
+    for (auto it = below.begin(); it != below.end();) {
+      if (it->first == slot || it->second == slot) {
+        it = below.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  /// Keep only what is also known in other. Returns true if anything changed.
+  bool meet(const BoundsState &other) {
+    bool changed = false;
+    for (std::size_t i = 0; i < nonNegative.size(); i++) {
+      if (nonNegative[i] && !other.nonNegative[i]) {
+        nonNegative[i] = false;
+        changed = true;
+      }
+    }
+    for (std::size_t i = 0; i < operands.size(); i++) {
+      BoundsValue &mine = operands[i];
+      const BoundsValue &theirs = other.operands[i];
+      BoundsValue met;
+      met.source = mine.source == theirs.source ? mine.source : -1;
+      met.lengthOf = mine.lengthOf == theirs.lengthOf ? mine.lengthOf : -1;
+      met.constant = mine.constant == theirs.constant ? mine.constant : -1;
+      met.nonNegative = mine.nonNegative && theirs.nonNegative;
+      if (!(met == mine)) {
+        mine = met;
+        changed = true;
+      }
+    }
+    for (auto it = below.begin(); it != below.end();) {
+      if (other.below.count(*it) == 0) {
+        it = below.erase(it);
+        changed = true;
+      } else {
+        ++it;
+      }
+    }
+    return changed;
+  }
+};
+
+/// True if an array access is in bounds. Its index is depth operands down,
+/// with the array just under it.
+bool accessInBounds(const BoundsState &state, std::size_t depth) {
+  const auto &operands = state.operands;
+  const BoundsValue &index = operands[operands.size() - depth];
+  const BoundsValue &array = operands[operands.size() - depth - 1];
+  return index.nonNegative && index.source != -1 && array.source != -1 &&
+         state.below.count({index.source, array.source}) != 0;
+}
+
+[[noreturn]] void fail(const FunctionDef &function, std::size_t index,
+                       const char *message) {
+  std::stringstream ss;
+  ss << function.name << "@" << index << ": " << message;
+  throw VerifyException{ss.str()};
+}
+
+}  // namespace
+
+const char *checkInstruction(const Module &module, const FunctionDef &function,
+                             std::size_t index,
+                             const std::vector<PrimitiveSignature> &primitives) {
+  const auto &instructions = function.instructions;
+  const Instruction instruction = instructions[index];
+  const Immediate immediate = instruction.immediate();
+
+  switch (instruction.opCode()) {
+    case OpCode::END_SECTION:
+      if (index + 1 != instructions.size()) {
+        return "end_section before the end of the function";
+      }
+      return nullptr;
+    case OpCode::FUNCTION_CALL:
+      if (!inRange(immediate, module.functions.size())) {
+        return "call to a function that does not exist";
+      }
+      return nullptr;
+    case OpCode::PRIMITIVE_CALL:
+      if (!inRange(immediate, primitives.size())) {
+        return "call to a primitive that does not exist";
+      }
+      return nullptr;
+    case OpCode::JMP:
+    case OpCode::JMP_EQ:
+    case OpCode::JMP_NEQ:
+    case OpCode::JMP_GT:
+    case OpCode::JMP_GE:
+    case OpCode::JMP_LT:
+    case OpCode::JMP_LE: {
+      // Jumping to the END_SECTION would run off the end of the function.
+      auto target = std::int64_t(index) + immediate + 1;
+      if (target < 0 || std::size_t(target) + 1 >= instructions.size()) {
+        return "jump target out of range";
+      }
+      return nullptr;
+    }
+    case OpCode::PUSH_FROM_LOCAL:
+    case OpCode::POP_INTO_LOCAL:
+      if (!inRange(immediate, function.nlocals)) {
+        return "local index out of range";
+      }
+      return nullptr;
+    case OpCode::PUSH_FROM_PARAM:
+    case OpCode::POP_INTO_PARAM:
+      if (!inRange(immediate, function.nparams)) {
+        return "param index out of range";
+      }
+      return nullptr;
+    case OpCode::STR_PUSH_CONSTANT:
+      if (!inRange(immediate, module.strings.size())) {
+        return "string index out of range";
+      }
+      return nullptr;
+    case OpCode::PUSH_FROM_OBJECT:
+    case OpCode::POP_INTO_OBJECT:
+      if (immediate < 0) {
+        return "negative slot id";
+      }
+      return nullptr;
+    case OpCode::INT_PUSH_CONSTANT_WIDE:
+      if (index + 2 >= instructions.size() ||
+          instructions[index + 1].opCode() != OpCode::INT_PUSH_CONSTANT_WIDE) {
+        return "truncated wide instruction";
+      }
+      return nullptr;
+    case OpCode::CALL_INDIRECT:
+      return "call_indirect is not supported";
+    case OpCode::FUNCTION_RETURN:
+    case OpCode::DUPLICATE:
+    case OpCode::DROP:
+    case OpCode::INT_ADD:
+    case OpCode::INT_SUB:
+    case OpCode::INT_MUL:
+    case OpCode::INT_DIV:
+    case OpCode::INT_PUSH_CONSTANT:
+    case OpCode::INT_NOT:
+    case OpCode::NEW_OBJECT:
+    case OpCode::SYSTEM_COLLECT:
+    case OpCode::NEW_ARRAY:
+    case OpCode::ARRAY_LENGTH:
+    case OpCode::PUSH_FROM_ARRAY:
+    case OpCode::POP_INTO_ARRAY:
+    case OpCode::STR_CONCAT:
+    case OpCode::STR_LENGTH:
+    case OpCode::STR_SLICE:
+    case OpCode::NEW_MAP:
+    case OpCode::MAP_GET:
+    case OpCode::MAP_SET:
+    case OpCode::MAP_HAS:
+    case OpCode::MAP_DELETE:
+      return nullptr;
+    default:
+      return "unknown opcode";
+  }
+}
+
+StackEffect stackEffect(const Module &module, Instruction instruction,
+                        const std::vector<PrimitiveSignature> &primitives) {
+  switch (instruction.opCode()) {
+    case OpCode::FUNCTION_CALL:
+      return {module.functions[instruction.immediate()].nparams, 1};
+    case OpCode::PRIMITIVE_CALL:
+      return {primitives[instruction.immediate()].arity, 1};
+    case OpCode::FUNCTION_RETURN:
+    case OpCode::DROP:
+    case OpCode::POP_INTO_LOCAL:
+    case OpCode::POP_INTO_PARAM:
+      return {1, 0};
+    case OpCode::DUPLICATE:
+      return {1, 2};
+    case OpCode::PUSH_FROM_LOCAL:
+    case OpCode::PUSH_FROM_PARAM:
+    case OpCode::INT_PUSH_CONSTANT:
+    case OpCode::INT_PUSH_CONSTANT_WIDE:
+    case OpCode::STR_PUSH_CONSTANT:
+    case OpCode::NEW_OBJECT:
+    case OpCode::NEW_MAP:
+      return {0, 1};
+    case OpCode::INT_ADD:
+    case OpCode::INT_SUB:
+    case OpCode::INT_MUL:
+    case OpCode::INT_DIV:
+      return {2, 1};
+    case OpCode::INT_NOT:
+    case OpCode::PUSH_FROM_OBJECT:
+    case OpCode::NEW_ARRAY:
+    case OpCode::ARRAY_LENGTH:
+    case OpCode::STR_LENGTH:
+      return {1, 1};
+    case OpCode::PUSH_FROM_ARRAY:
+    case OpCode::STR_CONCAT:
+    case OpCode::MAP_GET:
+    case OpCode::MAP_HAS:
+    case OpCode::MAP_DELETE:
+      return {2, 1};
+    case OpCode::POP_INTO_ARRAY:
+    case OpCode::MAP_SET:
+      return {3, 0};
+    case OpCode::STR_SLICE:
+      return {3, 1};
+    case OpCode::JMP_EQ:
+    case OpCode::JMP_NEQ:
+    case OpCode::JMP_GT:
+    case OpCode::JMP_GE:
+    case OpCode::JMP_LT:
+    case OpCode::JMP_LE:
+    case OpCode::POP_INTO_OBJECT:
+      return {2, 0};
+    default:
+      return {0, 0};
+  }
+}
+
+FunctionSummary verifyFunction(
+    const Module &module, std::size_t functionIndex,
+    const std::vector<PrimitiveSignature> &primitives) {
+  const FunctionDef &function = module.functions[functionIndex];
+  const auto &instructions = function.instructions;
+
+  if (instructions.empty() || instructions.back() != END_SECTION) {
+    fail(function, instructions.size(), "missing end_section");
+  }
+
+  // Check every instruction's operands, and note where instructions start.
+  // The second slot of a wide instruction is not a valid jump target.
+  std::vector<bool> isStart(instructions.size(), false);
+  for (std::size_t i = 0; i < instructions.size();
+       i += slotCount(instructions[i].opCode())) {
+    const char *error = checkInstruction(module, function, i, primitives);
+    if (error) {
+      fail(function, i, error);
+    }
+    isStart[i] = true;
+  }
+
+  // Propagate the stack depth along control flow. Each instruction is visited
+  // once, when its depth first becomes known.
+  std::vector<std::int64_t> depth(instructions.size(), -1);
+  std::vector<std::size_t> worklist;
+
+  auto flowTo = [&](std::size_t from, std::size_t to, std::int64_t d) {
+    if (!isStart[to]) {
+      fail(function, from, "jump into the middle of an instruction");
+    }
+    if (depth[to] == -1) {
+      depth[to] = d;
+      worklist.push_back(to);
+    } else if (depth[to] != d) {
+      fail(function, to, "inconsistent stack depth");
+    }
+  };
+
+  std::int64_t maxDepth = 0;
+  depth[0] = 0;
+  worklist.push_back(0);
+
+  while (!worklist.empty()) {
+    std::size_t i = worklist.back();
+    worklist.pop_back();
+
+    const Instruction instruction = instructions[i];
+    const OpCode op = instruction.opCode();
+
+    if (op == OpCode::END_SECTION) {
+      fail(function, i, "control reaches the end of the function");
+    }
+
+    const StackEffect effect = stackEffect(module, instruction, primitives);
+    if (depth[i] < effect.pops) {
+      fail(function, i, "operand stack underflow");
+    }
+    const std::int64_t next = depth[i] - effect.pops + effect.pushes;
+    maxDepth = std::max(maxDepth, next);
+
+    if (op == OpCode::FUNCTION_RETURN) {
+      continue;
+    }
+    if (isJump(op)) {
+      flowTo(i, jumpTarget(i, instruction), next);
+    }
+    if (op != OpCode::JMP) {
+      flowTo(i, i + slotCount(op), next);
+    }
+  }
+
+  FunctionSummary summary;
+  summary.verified = true;
+  summary.maxStackDepth = maxDepth;
+  return summary;
+}
+
+std::vector<RefMap> computeRefMaps(
+    const Module &module, std::size_t functionIndex,
+    const std::vector<PrimitiveSignature> &primitives) {
+  const FunctionDef &function = module.functions[functionIndex];
+  const auto &instructions = function.instructions;
+  const std::size_t frameSlots = function.nparams + function.nlocals;
+
+  // The state before each instruction: whether each slot may hold a reference.
+  // Params may be anything, locals start out as zero. States only grow, so
+  // propagating until nothing changes terminates.
+  std::vector<std::vector<bool>> states(instructions.size());
+  std::vector<bool> reached(instructions.size(), false);
+  std::vector<std::size_t> worklist;
+
+  auto flowTo = [&](std::size_t to, const std::vector<bool> &state) {
+    if (!reached[to]) {
+      reached[to] = true;
+      states[to] = state;
+      worklist.push_back(to);
+      return;
+    }
+    bool changed = false;
+    for (std::size_t slot = 0; slot < state.size(); slot++) {
+      if (state[slot] && !states[to][slot]) {
+        states[to][slot] = true;
+        changed = true;
+      }
+    }
+    if (changed) {
+      worklist.push_back(to);
+    }
+  };
+
+  std::vector<bool> entry(frameSlots, false);
+  std::fill(entry.begin(), entry.begin() + function.nparams, true);
+  flowTo(0, entry);
+
+  while (!worklist.empty()) {
+    std::size_t i = worklist.back();
+    worklist.pop_back();
+
+    const Instruction instruction = instructions[i];
+    const OpCode op = instruction.opCode();
+    const Immediate immediate = instruction.immediate();
+    std::vector<bool> state = states[i];
+
+    switch (op) {
+      case OpCode::PUSH_FROM_PARAM:
+        state.push_back(state[immediate]);
+        break;
+      case OpCode::PUSH_FROM_LOCAL:
+        state.push_back(state[function.nparams + immediate]);
+        break;
+      case OpCode::POP_INTO_PARAM:
+        state[immediate] = state.back();
+        state.pop_back();
+        break;
+      case OpCode::POP_INTO_LOCAL:
+        state[function.nparams + immediate] = state.back();
+        state.pop_back();
+        break;
+      case OpCode::DUPLICATE:
+        state.push_back(state.back());
+        break;
+      default: {
+        const StackEffect effect = stackEffect(module, instruction, primitives);
+        state.resize(state.size() - effect.pops);
+        const bool result = isCall(op) || op == OpCode::NEW_OBJECT ||
+                            op == OpCode::PUSH_FROM_OBJECT ||
+                            op == OpCode::NEW_ARRAY || op == OpCode::NEW_MAP ||
+                            op == OpCode::MAP_GET || op == OpCode::STR_CONCAT ||
+                            op == OpCode::STR_SLICE;
+        state.resize(state.size() + effect.pushes, result);
+      } break;
+    }
+
+    if (op == OpCode::FUNCTION_RETURN) {
+      continue;
+    }
+    if (isJump(op)) {
+      flowTo(jumpTarget(i, instruction), state);
+    }
+    if (op != OpCode::JMP) {
+      flowTo(i + slotCount(op), state);
+    }
+  }
+
+  std::vector<bool> isPoint(instructions.size(), false);
+  isPoint[0] = true;
+  for (std::size_t i = 0; i < instructions.size();
+       i += slotCount(instructions[i].opCode())) {
+    const Instruction instruction = instructions[i];
+    const OpCode op = instruction.opCode();
+    if (isGcPoint(op)) {
+      isPoint[i] = true;
+    }
+    if (isCall(op)) {
+      isPoint[i + 1] = true;
+    }
+    if (isJump(op) && instruction.immediate() < 0) {
+      isPoint[i] = true;
+      isPoint[jumpTarget(i, instruction)] = true;
+    }
+  }
+
+  std::vector<RefMap> maps(instructions.size());
+  for (std::size_t i = 0; i < instructions.size(); i++) {
+    if (isPoint[i] && reached[i]) {
+      maps[i].present = true;
+      maps[i].slots = std::move(states[i]);
+    }
+  }
+  return maps;
+}
+
+std::vector<bool> findInBoundsAccesses(
+    const Module &module, std::size_t functionIndex,
+    const std::vector<PrimitiveSignature> &primitives) {
+  const FunctionDef &function = module.functions[functionIndex];
+  const auto &instructions = function.instructions;
+
+  // The known facts only shrink as states meet, so this terminates.
+  std::vector<BoundsState> states(instructions.size());
+  std::vector<bool> reached(instructions.size(), false);
+  std::vector<std::size_t> worklist;
+
+  auto flowTo = [&](std::size_t to, const BoundsState &state) {
+    if (!reached[to]) {
+      reached[to] = true;
+      states[to] = state;
+      worklist.push_back(to);
+    } else if (states[to].meet(state)) {
+      worklist.push_back(to);
+    }
+  };
+
+  // Locals start out as zero.
+  BoundsState entry;
+  entry.nonNegative.resize(function.nparams + function.nlocals, false);
+  std::fill(entry.nonNegative.begin() + function.nparams,
+            entry.nonNegative.end(), true);
+  flowTo(0, entry);
+
+  while (!worklist.empty()) {
+    std::size_t i = worklist.back();
+    worklist.pop_back();
+
+    const Instruction instruction = instructions[i];
+    const OpCode op = instruction.opCode();
+    const Immediate immediate = instruction.immediate();
+    BoundsState state = states[i];
+    auto &operands = state.operands;
+    // A compare adds a fact on one side of the branch only.
+    BoundsState taken;
+
+    auto pop = [&] {
+      BoundsValue value = operands.back();
+      operands.pop_back();
+      return value;
+    };
+
+    switch (op) {
+      case OpCode::PUSH_FROM_PARAM:
+      case OpCode::PUSH_FROM_LOCAL: {
+        BoundsValue value;
+        value.source = op == OpCode::PUSH_FROM_PARAM
+                           ? immediate
+                           : function.nparams + immediate;
+        value.nonNegative = state.nonNegative[value.source];
+        operands.push_back(value);
+      } break;
+      case OpCode::POP_INTO_PARAM:
+      case OpCode::POP_INTO_LOCAL: {
+        const std::int64_t slot = op == OpCode::POP_INTO_PARAM
+                                      ? immediate
+                                      : function.nparams + immediate;
+        BoundsValue value = pop();
+        state.kill(slot);
+        state.nonNegative[slot] = value.nonNegative;
+      } break;
+      case OpCode::DUPLICATE:
+        operands.push_back(operands.back());
+        break;
+      case OpCode::INT_PUSH_CONSTANT: {
+        BoundsValue value;
+        value.nonNegative = immediate >= 0;
+        value.constant = immediate >= 0 ? immediate : -1;
+        operands.push_back(value);
+      } break;
+      case OpCode::INT_PUSH_CONSTANT_WIDE: {
+        BoundsValue value;
+        value.nonNegative =
+            wideImmediate(instruction, instructions[i + 1]) >= 0;
+        operands.push_back(value);
+      } break;
+      case OpCode::INT_ADD: {
+        // Int48 arithmetic wraps. Stepping an index that is below an array's
+        // length by an immediate can't, since no array is that long.
+        BoundsValue right = pop();
+        BoundsValue left = pop();
+        BoundsValue value;
+        value.nonNegative = left.nonNegative && right.constant != -1 &&
+                            left.source != -1 &&
+                            state.belowSomeLength(left.source);
+        operands.push_back(value);
+      } break;
+      case OpCode::ARRAY_LENGTH: {
+        BoundsValue array = pop();
+        BoundsValue value;
+        value.lengthOf = array.source;
+        value.nonNegative = true;
+        operands.push_back(value);
+      } break;
+      case OpCode::JMP_LT:
+      case OpCode::JMP_GE:
+      case OpCode::JMP_GT:
+      case OpCode::JMP_LE: {
+        BoundsValue right = pop();
+        BoundsValue left = pop();
+        taken = state;
+        // index < length when JMP_LT is taken, or JMP_GE falls through.
+        if (left.source != -1 && right.lengthOf != -1) {
+          auto fact = std::make_pair(left.source, right.lengthOf);
+          if (op == OpCode::JMP_LT) taken.below.insert(fact);
+          if (op == OpCode::JMP_GE) state.below.insert(fact);
+        }
+        // length > index when JMP_GT is taken, or JMP_LE falls through.
+        if (left.lengthOf != -1 && right.source != -1) {
+          auto fact = std::make_pair(right.source, left.lengthOf);
+          if (op == OpCode::JMP_GT) taken.below.insert(fact);
+          if (op == OpCode::JMP_LE) state.below.insert(fact);
+        }
+      } break;
+      default: {
+        // Calls can't change this frame's slots, or the length of an array, so
+        // the facts about them survive.
+        const StackEffect effect = stackEffect(module, instruction, primitives);
+        operands.resize(operands.size() - effect.pops);
+        operands.resize(operands.size() + effect.pushes);
+        if (isJump(op)) {
+          taken = state;
+        }
+      } break;
+    }
+
+    if (op == OpCode::FUNCTION_RETURN) {
+      continue;
+    }
+    if (isJump(op)) {
+      flowTo(jumpTarget(i, instruction), taken);
+    }
+    if (op != OpCode::JMP) {
+      flowTo(i + slotCount(op), state);
+    }
+  }
+
+  std::vector<bool> inBounds(instructions.size(), false);
+  for (std::size_t i = 0; i < instructions.size(); i++) {
+    if (!reached[i]) {
+      continue;
+    }
+    const OpCode op = instructions[i].opCode();
+    if (op == OpCode::PUSH_FROM_ARRAY) {
+      inBounds[i] = accessInBounds(states[i], 1);
+    } else if (op == OpCode::POP_INTO_ARRAY) {
+      // The value to store is on top.
+      inBounds[i] = accessInBounds(states[i], 2);
+    }
+  }
+  return inBounds;
+}
+
+}  // namespace b9
@@ -0,0 +1,119 @@
+#include <b9/BatchRunner.hpp>
+#include <b9/ExecutionContext.hpp>
+#include <b9/deserialize.hpp>
+
+#include <OMR/Om/Runtime.hpp>
+
+#include <strings.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+/// Usage string, printed when run with -help.
+static const char* usage =
+    "Usage: b9batchbench [<option>...] [<module>]\n"
+    "   Or: b9batchbench -help\n"
+    "Options:\n"
+    "  -jit:          Enable the jit\n"
+    "  -calls <n>:    Calls per batch (default: 100000)\n"
+    "  -threads <n>:  Largest pool to measure (default: hardware threads)\n"
+    "  -help:         Print this help message\n"
+    "The module defaults to batch.b9mod, and must define fib(a).";
+
+struct BenchConfig {
+  b9::Config b9;
+  const char* moduleName = "batch.b9mod";
+  std::size_t calls = 100000;
+  std::size_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+};
+
+static bool parseArguments(BenchConfig& cfg, const int argc, char* argv[]) {
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+
+    if (strcasecmp(arg, "-help") == 0) {
+      std::cout << usage << std::endl;
+      exit(EXIT_SUCCESS);
+    } else if (strcasecmp(arg, "-jit") == 0) {
+      cfg.b9.jit = true;
+    } else if (strcasecmp(arg, "-calls") == 0 && i + 1 < argc) {
+      cfg.calls = atol(argv[++i]);
+    } else if (strcasecmp(arg, "-threads") == 0 && i + 1 < argc) {
+      cfg.maxThreads = std::max(1, atoi(argv[++i]));
+    } else if (arg[0] == '-') {
+      std::cerr << "Unrecognized option: " << arg << std::endl;
+      return false;
+    } else {
+      cfg.moduleName = arg;
+    }
+  }
+  return true;
+}
+
+/// Time one batch of calls on a pool of the given size. Returns calls/second.
+static double measure(b9::VirtualMachine& vm, std::size_t threads,
+                      std::size_t function,
+                      const std::vector<b9::StackElement>& args) {
+  b9::BatchRunner runner(vm, threads);
+
+  // Warm up the workers before timing.
+  runner.run(function, args);
+
+  auto start = std::chrono::steady_clock::now();
+  runner.run(function, args);
+  auto end = std::chrono::steady_clock::now();
+
+  std::chrono::duration<double> seconds = end - start;
+  return args.size() / seconds.count();
+}
+
+int main(int argc, char* argv[]) {
+  Om::ProcessRuntime runtime;
+  BenchConfig cfg;
+  cfg.b9.multithreaded = true;
+
+  if (!parseArguments(cfg, argc, argv)) {
+    std::cerr << usage << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  b9::VirtualMachine vm{runtime, cfg.b9};
+  std::ifstream file(cfg.moduleName, std::ios_base::in | std::ios_base::binary);
+  vm.load(b9::deserialize(file));
+  if (cfg.b9.jit) {
+    vm.generateAllCode();
+  }
+
+  auto function = vm.module()->getFunctionIndex("fib");
+
+  // Mix short and long calls, so that the load is uneven across workers.
+  std::vector<b9::StackElement> args;
+  for (std::size_t i = 0; i < cfg.calls; i++) {
+    args.push_back({Om::AS_INT48, std::int64_t(10 + i % 11)});
+  }
+
+  // Powers of two, finishing on maxThreads.
+  std::vector<std::size_t> poolSizes;
+  for (std::size_t threads = 1; threads < cfg.maxThreads; threads *= 2) {
+    poolSizes.push_back(threads);
+  }
+  poolSizes.push_back(cfg.maxThreads);
+
+  std::cout << "threads  calls/s      speedup" << std::endl;
+  double baseline = 0;
+  for (auto threads : poolSizes) {
+    double rate = measure(vm, threads, function, args);
+    if (threads == 1) {
+      baseline = rate;
+    }
+    std::printf("%-8zu %-12.0f %.2fx\n", threads, rate, rate / baseline);
+  }
+
+  exit(EXIT_SUCCESS);
+}
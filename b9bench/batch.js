@@ -0,0 +1,8 @@
+// The work function for the batch benchmark. Each call is independent.
+function fib(a) {
+    if (a < 3) {
+        return 1;
+    } else {
+        return fib(a - 1) + fib(a - 2);
+    }
+}
@@ -0,0 +1,114 @@
+#include <b9/ExecutionContext.hpp>
+#include <b9/deserialize.hpp>
+
+#include <OMR/Om/Runtime.hpp>
+
+#include <strings.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+/// Usage string, printed when run with -help.
+static const char* usage =
+    "Usage: b9printbench [<option>...] [<module>]\n"
+    "   Or: b9printbench -help\n"
+    "Options:\n"
+    "  -jit:          Enable the jit\n"
+    "  -count <n>:    Numbers to print (default: 1000000)\n"
+    "  -out <f>:      Where to print (default: /dev/null)\n"
+    "  -help:         Print this help message\n"
+    "The module defaults to print.b9mod, and must define printNumbers(n).";
+
+struct BenchConfig {
+  b9::Config b9;
+  const char* moduleName = "print.b9mod";
+  const char* outName = "/dev/null";
+  std::int64_t count = 1000000;
+};
+
+static bool parseArguments(BenchConfig& cfg, const int argc, char* argv[]) {
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+
+    if (strcasecmp(arg, "-help") == 0) {
+      std::cout << usage << std::endl;
+      exit(EXIT_SUCCESS);
+    } else if (strcasecmp(arg, "-jit") == 0) {
+      cfg.b9.jit = true;
+    } else if (strcasecmp(arg, "-count") == 0 && i + 1 < argc) {
+      cfg.count = atol(argv[++i]);
+    } else if (strcasecmp(arg, "-out") == 0 && i + 1 < argc) {
+      cfg.outName = argv[++i];
+    } else if (arg[0] == '-') {
+      std::cerr << "Unrecognized option: " << arg << std::endl;
+      return false;
+    } else {
+      cfg.moduleName = arg;
+    }
+  }
+  return true;
+}
+
+/// Print the numbers under one output config. Returns lines/second.
+static double measure(Om::ProcessRuntime& runtime, const BenchConfig& bench,
+                      b9::OutputFlush flush, bool thread) {
+  b9::Config cfg = bench.b9;
+  cfg.outputFlush = flush;
+  cfg.outputThread = thread;
+
+  b9::VirtualMachine vm{runtime, cfg};
+  std::ofstream out(bench.outName);
+  vm.setOutput(out);
+
+  std::ifstream file(bench.moduleName,
+                     std::ios_base::in | std::ios_base::binary);
+  vm.load(b9::deserialize(file));
+  if (cfg.jit) {
+    vm.generateAllCode();
+  }
+  auto function = vm.module()->getFunctionIndex("printNumbers");
+
+  // The context is destroyed inside run(), so the time includes writing out
+  // everything that was buffered.
+  auto start = std::chrono::steady_clock::now();
+  vm.run(function, {{Om::AS_INT48, bench.count}});
+  auto end = std::chrono::steady_clock::now();
+
+  std::chrono::duration<double> seconds = end - start;
+  return bench.count / seconds.count();
+}
+
+int main(int argc, char* argv[]) {
+  Om::ProcessRuntime runtime;
+  BenchConfig cfg;
+
+  if (!parseArguments(cfg, argc, argv)) {
+    std::cerr << usage << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  // Flushing every line is how the print primitives used to behave.
+  const b9::OutputFlush policies[] = {b9::OutputFlush::LINE,
+                                      b9::OutputFlush::SIZE,
+                                      b9::OutputFlush::EXPLICIT};
+
+  std::cout << "flush     thread  lines/s      speedup" << std::endl;
+  double baseline = 0;
+  for (auto policy : policies) {
+    for (bool thread : {false, true}) {
+      double rate = measure(runtime, cfg, policy, thread);
+      if (baseline == 0) {
+        baseline = rate;
+      }
+      std::stringstream name;
+      name << policy;
+      std::printf("%-9s %-7s %-12.0f %.2fx\n", name.str().c_str(),
+                  thread ? "yes" : "no", rate, rate / baseline);
+    }
+  }
+
+  exit(EXIT_SUCCESS);
+}
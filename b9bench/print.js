@@ -0,0 +1,7 @@
+// The work function for the print benchmark.
+function printNumbers(n) {
+    for (var i = 0; i < n; i++) {
+        b9PrintNumber(i);
+    }
+    return 0;
+}
@@ -1,6 +1,8 @@
 #include <b9/ExecutionContext.hpp>
 #include <b9/compiler/Compiler.hpp>
 #include <b9/deserialize.hpp>
+#include <b9/snapshot.hpp>
+#include <b9/Trace.hpp>
 
 #include <OMR/Om/Context.inl.hpp>
 #include <OMR/Om/MemorySystem.hpp>
@@ -13,6 +15,7 @@
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <sstream>
 
 /// B9run's usage string. Printed when run with -help.
 static const char* usage =
@@ -23,8 +26,19 @@ static const char* usage =
     "  -directcall:   make direct jit to jit calls\n"
     "  -passparam:    Pass arguments in CPU registers\n"
     "  -lazyvmstate:  Only update the VM state as needed\n"
+    "  -perfmap:      Write /tmp/perf-<pid>.map, naming JIT code for perf\n"
+    "  -jitdump:      Also write jit-<pid>.dump, with the code\n"
     "Run Options:\n"
     "  -inline <n>:   Set the jit's max inline depth (default: 0)\n"
+    "  -snapshot <f>: Write a startup snapshot to <f> and exit\n"
+    "  -restore:      <module> is a snapshot written by -snapshot\n"
+    "  -output <p>:   Flush output by line, size or explicit (default: size)\n"
+    "  -outputthread: Write output on a background thread\n"
+    "  -gcstats:      Print allocation and GC statistics after the run\n"
+    "  -profile:      Print the interpreter's hot spots after the run\n"
+    "  -trace <f>:    Write a Chrome trace of the run's phases to <f>\n"
+    "  -barrier <b>:  Write barrier: none, remember or snapshot (default: "
+    "none)\n"
     "  -debug:        Enable debug code\n"
     "  -verbose:      Run with verbose printing\n"
     "  -help:         Print this help message";
@@ -34,7 +48,11 @@ struct RunConfig {
   b9::Config b9;
   const char* moduleName = "";
   const char* mainFunction = "<script>";
+  const char* snapshotName = nullptr;
+  const char* traceName = nullptr;
+  bool restore = false;
   bool verbose = false;
+  bool gcStats = false;
   std::vector<b9::StackElement> usrArgs;
 };
 
@@ -51,9 +69,19 @@ std::ostream& operator<<(std::ostream& out, const RunConfig& cfg) {
   return out;
 }
 
+/// Take the value of the option at argv[i], moving i on to it. Null if it is
+/// missing.
+static const char* optionValue(int& i, const int argc, char* argv[]) {
+  if (i + 1 >= argc) {
+    std::cerr << "Missing argument to " << argv[i] << std::endl;
+    return nullptr;
+  }
+  return argv[++i];
+}
+
 /// Parse CLI arguments and set up the config.
 static bool parseArguments(RunConfig& cfg, const int argc, char* argv[]) {
-  std::size_t i = 1;
+  int i = 1;
 
   for (; i < argc; i++) {
     const char* arg = argv[i];
@@ -62,7 +90,57 @@ static bool parseArguments(RunConfig& cfg, const int argc, char* argv[]) {
       std::cout << usage << std::endl;
       exit(EXIT_SUCCESS);
     } else if (strcasecmp(arg, "-inline") == 0) {
-      cfg.b9.maxInlineDepth = atoi(argv[++i]);
+      const char* depth = optionValue(i, argc, argv);
+      if (depth == nullptr) {
+        return false;
+      }
+      cfg.b9.maxInlineDepth = atoi(depth);
+    } else if (strcasecmp(arg, "-snapshot") == 0) {
+      cfg.snapshotName = optionValue(i, argc, argv);
+      if (cfg.snapshotName == nullptr) {
+        return false;
+      }
+    } else if (strcasecmp(arg, "-restore") == 0) {
+      cfg.restore = true;
+    } else if (strcasecmp(arg, "-output") == 0) {
+      const char* policy = optionValue(i, argc, argv);
+      if (policy == nullptr) {
+        return false;
+      } else if (strcasecmp(policy, "line") == 0) {
+        cfg.b9.outputFlush = b9::OutputFlush::LINE;
+      } else if (strcasecmp(policy, "size") == 0) {
+        cfg.b9.outputFlush = b9::OutputFlush::SIZE;
+      } else if (strcasecmp(policy, "explicit") == 0) {
+        cfg.b9.outputFlush = b9::OutputFlush::EXPLICIT;
+      } else {
+        std::cerr << "Unrecognized output policy: " << policy << std::endl;
+        return false;
+      }
+    } else if (strcasecmp(arg, "-outputthread") == 0) {
+      cfg.b9.outputThread = true;
+    } else if (strcasecmp(arg, "-gcstats") == 0) {
+      cfg.gcStats = true;
+    } else if (strcasecmp(arg, "-trace") == 0) {
+      cfg.traceName = optionValue(i, argc, argv);
+      if (cfg.traceName == nullptr) {
+        return false;
+      }
+    } else if (strcasecmp(arg, "-profile") == 0) {
+      cfg.b9.profile = true;
+    } else if (strcasecmp(arg, "-barrier") == 0) {
+      const char* barrier = optionValue(i, argc, argv);
+      if (barrier == nullptr) {
+        return false;
+      } else if (strcasecmp(barrier, "none") == 0) {
+        cfg.b9.writeBarrier = b9::WriteBarrier::NONE;
+      } else if (strcasecmp(barrier, "remember") == 0) {
+        cfg.b9.writeBarrier = b9::WriteBarrier::REMEMBER;
+      } else if (strcasecmp(barrier, "snapshot") == 0) {
+        cfg.b9.writeBarrier = b9::WriteBarrier::SNAPSHOT;
+      } else {
+        std::cerr << "Unrecognized write barrier: " << barrier << std::endl;
+        return false;
+      }
     } else if (strcasecmp(arg, "-verbose") == 0) {
       cfg.verbose = true;
       cfg.b9.verbose = true;
@@ -76,6 +154,10 @@ static bool parseArguments(RunConfig& cfg, const int argc, char* argv[]) {
       cfg.b9.passParam = true;
     } else if (strcasecmp(arg, "-lazyvmstate") == 0) {
       cfg.b9.lazyVmState = true;
+    } else if (strcasecmp(arg, "-perfmap") == 0) {
+      cfg.b9.perfMap = true;
+    } else if (strcasecmp(arg, "-jitdump") == 0) {
+      cfg.b9.jitDump = true;
     } else if (strcmp(arg, "--") == 0) {
       i++;
       break;
@@ -109,6 +191,10 @@ static bool parseArguments(RunConfig& cfg, const int argc, char* argv[]) {
     std::cerr << "-passparam requires -directcall" << std::endl;
     return false;
   }
+  if ((cfg.b9.perfMap || cfg.b9.jitDump) && !cfg.b9.jit) {
+    std::cerr << "-perfmap and -jitdump require -jit" << std::endl;
+    return false;
+  }
   if (cfg.b9.lazyVmState && !cfg.b9.passParam) {
     std::cerr << "-lazyvmstate requires -passparam" << std::endl;
     return false;
@@ -120,17 +206,55 @@ static bool parseArguments(RunConfig& cfg, const int argc, char* argv[]) {
 static void run(Om::ProcessRuntime& runtime, const RunConfig& cfg) {
   b9::VirtualMachine vm{runtime, cfg.b9};
 
-  std::ifstream file(cfg.moduleName, std::ios_base::in | std::ios_base::binary);
-  auto module = b9::deserialize(file);
-  vm.load(module);
+  if (cfg.restore) {
+    vm.load(b9::mapSnapshot(cfg.moduleName));
+  } else {
+    std::ifstream file(cfg.moduleName,
+                       std::ios_base::in | std::ios_base::binary);
+    std::shared_ptr<b9::Module> module;
+    {
+      b9::TraceScope trace("vm", "deserialize");
+      module = b9::deserialize(file);
+    }
+    vm.load(module);
+  }
+
+  if (cfg.snapshotName != nullptr) {
+    std::ofstream out(cfg.snapshotName,
+                      std::ios_base::out | std::ios_base::binary);
+    b9::writeSnapshot(out, vm.snapshot());
+    return;
+  }
 
   if (cfg.b9.jit) {
     vm.generateAllCode();
   }
 
-  size_t functionIndex = module->getFunctionIndex(cfg.mainFunction);
-  auto result = vm.run(functionIndex, cfg.usrArgs);
+  size_t functionIndex = vm.module()->getFunctionIndex(cfg.mainFunction);
+  b9::StackElement result;
+  std::size_t collections;
+  // The context writes out the program's output when it is destroyed, so the
+  // report waits until then.
+  std::stringstream profile;
+  {
+    b9::ExecutionContext context{vm, cfg.b9};
+    result = vm.run(context, functionIndex, cfg.usrArgs);
+    collections = context.collections();
+    if (cfg.b9.profile) {
+      context.profile()->report(profile);
+    }
+  }
   std::cout << std::endl << "=> " << result << std::endl;
+
+  if (cfg.b9.profile) {
+    std::cout << std::endl << profile.str();
+  }
+
+  if (cfg.gcStats) {
+    std::cout << std::endl
+              << vm.gcStats().snapshot() << std::endl
+              << "all GCs:      " << collections << std::endl;
+  }
 }
 
 int main(int argc, char* argv[]) {
@@ -146,8 +270,15 @@ int main(int argc, char* argv[]) {
     std::cout << cfg << std::endl << std::endl;
   }
 
+  if (cfg.traceName != nullptr) {
+    b9::Tracer::instance().enable();
+  }
+
   try {
     run(runtime, cfg);
+  } catch (const b9::SnapshotException& e) {
+    std::cerr << "Failed to load snapshot: " << e.what() << std::endl;
+    exit(EXIT_FAILURE);
   } catch (const b9::DeserializeException& e) {
     std::cerr << "Failed to load module: " << e.what() << std::endl;
     exit(EXIT_FAILURE);
@@ -160,6 +291,17 @@ int main(int argc, char* argv[]) {
   } catch (const b9::CompilationException& e) {
     std::cerr << "Failed to compile function: " << e.what() << std::endl;
     exit(EXIT_FAILURE);
+  } catch (const b9::StackOverflowException& e) {
+    std::cerr << "Operand stack overflow in " << e.what() << std::endl;
+    exit(EXIT_FAILURE);
+  } catch (const b9::RuntimeCheckException& e) {
+    std::cerr << "Runtime check failed: " << e.what() << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  if (cfg.traceName != nullptr) {
+    std::ofstream trace(cfg.traceName);
+    b9::Tracer::instance().write(trace);
   }
 
   exit(EXIT_SUCCESS);
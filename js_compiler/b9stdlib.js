@@ -9,3 +9,7 @@ function b9PrintNumber(a) {
 function b9PrintStack(a) {
     b9_primitive("print_stack", a);
 }
+
+function b9Yield() {
+    return b9_primitive("yield");
+}
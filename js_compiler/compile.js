@@ -28,7 +28,8 @@ function outputString(out, string) {
 var PrimitiveCode = Object.freeze({
 	"print_string": 0,
 	"print_number": 1,
-	"print_stack": 2
+	"print_stack": 2,
+	"yield": 3
 });
 
 var OperatorCode = Object.freeze({
@@ -56,8 +57,47 @@ var OperatorCode = Object.freeze({
 	"JMP_LT": 21,
 	"JMP_LE": 22,
 	"STR_PUSH_CONSTANT": 23,
+	"INT_PUSH_CONSTANT_WIDE": 37,
 });
 
+/// Operators that take no immediate. Their immediate is omitted from the compact encoding.
+var NoImmediate = Object.freeze({
+	"END_SECTION": true,
+	"FUNCTION_RETURN": true,
+	"DUPLICATE": true,
+	"DROP": true,
+	"INT_ADD": true,
+	"INT_SUB": true,
+	"INT_MUL": true,
+	"INT_DIV": true,
+	"INT_NOT": true
+});
+
+/// The range of an immediate that fits in a single instruction.
+var IMMEDIATE_MIN = -0x800000;
+var IMMEDIATE_MAX = 0x7FFFFF;
+
+/// The range of an Int48, which a wide instruction holds.
+var WIDE_IMMEDIATE_MIN = -0x800000000000;
+var WIDE_IMMEDIATE_MAX = 0x7FFFFFFFFFFF;
+
+/// Output an unsigned LEB128 varint. Uses arithmetic rather than bit operations, which are limited to 32 bits.
+function outputVarint(out, value) {
+	var bytes = [];
+	while (value >= 0x80) {
+		bytes.push((value % 0x80) | 0x80);
+		value = Math.floor(value / 0x80);
+	}
+	bytes.push(value);
+	var buf = Buffer.from(bytes);
+	fs.writeSync(out, buf, 0, buf.length);
+}
+
+/// Map a signed integer to an unsigned one, so small negative numbers get short varints.
+function zigzag(value) {
+	return value >= 0 ? value * 2 : -value * 2 - 1;
+}
+
 /// Binary comparison operators converted to jump instructions
 JumpOperator = Object.freeze({
 	"==": "JMP_EQ",
@@ -100,6 +140,16 @@ var Instruction = function (operator, operand) {
 		encoded &= 0xFFFFFFFF;
 		outputUInt32(out, encoded);
 	}
+
+	/// Output this instruction as an opcode byte and a varint immediate.
+	this.outputCompact = function (out, immediate) {
+		var buf = Buffer.alloc(1);
+		buf.writeUInt8(OperatorCode[this.operator], 0);
+		fs.writeSync(out, buf, 0, 1);
+		if (!NoImmediate[this.operator]) {
+			outputVarint(out, zigzag(immediate));
+		}
+	}
 };
 
 var SymbolTable = function () {
@@ -272,13 +322,22 @@ function FunctionDefinition(outer, name) {
 		}
 	}
 
-	this.output = function (out) {
+	this.output = function (out, compact) {
 		// note that name and index are output by the module.
 		outputUInt32(out, this.params.next);
 		outputUInt32(out, this.locals.next);
-		this.instructions.forEach(function (instruction) {
-			instruction.output(out);
-		})
+		for (var index = 0; index < this.instructions.length; index++) {
+			var instruction = this.instructions[index];
+			if (!compact) {
+				instruction.output(out);
+			} else if (instruction.operator == "INT_PUSH_CONSTANT_WIDE") {
+				// The pair of wide slots is written once, with the full 48 bit constant.
+				var high = this.instructions[++index];
+				instruction.outputCompact(out, high.operand * 0x1000000 + instruction.operand);
+			} else {
+				instruction.outputCompact(out, instruction.operand || 0);
+			}
+		}
 	};
 
 	this.pushInstruction = function (instruction) {
@@ -325,12 +384,13 @@ function Module() {
 	}
 
 	/// Output this module, in binary format. The Module must have been resolved.
-	this.output = function (out) {
+	/// In compact mode, instructions are written as an opcode byte and a varint immediate.
+	this.output = function (out, compact) {
 		if (!this.resolved) {
 			throw "Module must be resolved before output."
 		}
 		this.outputHeader(out);
-		this.outputFunctionSection(out);
+		this.outputFunctionSection(out, compact);
 		this.outputStringSection(out);
 	}
 
@@ -344,14 +404,14 @@ function Module() {
 	};
 
 	/// internal
-	this.outputFunctionSection = function (out) {
+	this.outputFunctionSection = function (out, compact) {
 		var me = this;
-		outputUInt32(out, 1); // the section code.
+		outputUInt32(out, compact ? 3 : 1); // the section code.
 		outputUInt32(out, this.functions.length);
 		for (var i = 0; i < this.functions.length; ++i) {
 			var func = this.functions[i];
 			outputString(out, func.name);
-			func.output(out);
+			func.output(out, compact);
 		}
 	}
 
@@ -483,9 +543,24 @@ function FirstPassCodeGen() {
 
 	/* STACK OPERATIONS */
 
+	/// Integers that don't fit in a 24 bit immediate are split over the two slots of a wide instruction.
+	this.emitIntConstant = function (func, constant) {
+		if (!Number.isSafeInteger(constant) || constant < WIDE_IMMEDIATE_MIN || WIDE_IMMEDIATE_MAX < constant) {
+			throw new Error("Integer literal is not an Int48: " + constant);
+		}
+		if (IMMEDIATE_MIN <= constant && constant <= IMMEDIATE_MAX) {
+			func.instructions.push(new Instruction("INT_PUSH_CONSTANT", constant));
+			return;
+		}
+		var low = ((constant % 0x1000000) + 0x1000000) % 0x1000000;
+		var high = (constant - low) / 0x1000000;
+		func.instructions.push(new Instruction("INT_PUSH_CONSTANT_WIDE", low));
+		func.instructions.push(new Instruction("INT_PUSH_CONSTANT_WIDE", high));
+	}
+
 	this.emitPushConstant = function (func, constant) {
 		if (this.isNumber(constant)) {
-			func.instructions.push(new Instruction("INT_PUSH_CONSTANT", constant));
+			this.emitIntConstant(func, constant);
 		}
 		else if (this.isString(constant)) {
 			var id = this.module.strings.get(constant);
@@ -616,7 +691,7 @@ function FirstPassCodeGen() {
 
 	this.handleUnaryExpression = function (func, decl) {
 		if (decl.operator == "-" && decl.argument.type == "Literal") {
-			func.instructions.push(new Instruction("INT_PUSH_CONSTANT", - decl.argument.value));
+			this.emitIntConstant(func, - decl.argument.value);
 			// this.currentFunction.updateStackCount(1);
 			return;
 		}
@@ -838,30 +913,37 @@ function FirstPassCodeGen() {
 ///  1. Parse -- translate a JS program to a syntax tree.
 ///  2. Compile -- first pass compilation of the program to a module.
 ///  3. resolve -- final stage of linking up unresolved reference in the input program.
-function compile(code, output) {
+function compile(code, output, compact) {
 	var syntax = esprima.parse(code);
 	var compiler = new FirstPassCodeGen();
 	var module = compiler.compile(syntax);
 	module.resolve();
-	module.output(output);
+	module.output(output, compact);
 	return true;
 };
 
 function main() {
-	if (process.argv.length != 4) {
-		console.error("Usage: node.js compile.js <infile> <outfile>");
+	var args = process.argv.slice(2);
+	var compact = false;
+	if (args[0] == "--compact") {
+		compact = true;
+		args.shift();
+	}
+
+	if (args.length != 2) {
+		console.error("Usage: node.js compile.js [--compact] <infile> <outfile>");
 		process.exit(1);
 	}
 
-	inputPath = process.argv[2];
-	outputPath = process.argv[3];
+	inputPath = args[0];
+	outputPath = args[1];
 
 	var code = fs.readFileSync(__dirname + "/b9stdlib.js", 'utf-8');
 	code += fs.readFileSync(inputPath, 'utf-8');
 
 
 	output = fs.openSync(outputPath, "w");
-	compile(code, output);
+	compile(code, output, compact);
 };
 
 main();
@@ -1,10 +1,23 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/time.h>
+#include <unistd.h>
+#include <b9/ArrayKernels.hpp>
+#include <b9/BatchRunner.hpp>
 #include <b9/ExecutionContext.hpp>
+#include <b9/PerfMap.hpp>
+#include <b9/Scheduler.hpp>
+#include <b9/Trace.hpp>
+#include <b9/TransitionCache.hpp>
 #include <b9/deserialize.hpp>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <thread>
 #include <vector>
 
 #include <gtest/gtest.h>
@@ -129,6 +142,152 @@ TEST_F(InterpreterTest, jit_lvms) {
   }
 }
 
+TEST_F(InterpreterTest, threads) {
+  Config cfg;
+  cfg.jit = true;
+  cfg.multithreaded = true;
+
+  VirtualMachine vm{runtime, cfg};
+  vm.load(module_);
+
+  // Compile while the workers are already running.
+  std::vector<std::thread> workers;
+  for (int i = 0; i < 4; i++) {
+    workers.emplace_back([&] {
+      ExecutionContext context(vm, cfg);
+      for (int j = 0; j < 10; j++) {
+        for (auto test : TEST_NAMES) {
+          EXPECT_TRUE(vm.run(context, vm.module()->getFunctionIndex(test), {})
+                          .getInt48())
+              << "Test Failed: " << test;
+        }
+      }
+    });
+  }
+  vm.generateAllCode();
+
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
+
+TEST(ThreadTest, allocationCollectsSafely) {
+  // chain(n) { list = 0; while (n > 0) { o = new object; o.0 = list;
+  //   o.1 = n; new array 16; list = o; n = n - 1; } return list; }
+  std::vector<Instruction> chain = {
+      {OpCode::INT_PUSH_CONSTANT, 0}, {OpCode::POP_INTO_LOCAL, 0},
+      {OpCode::PUSH_FROM_PARAM, 0},   {OpCode::INT_PUSH_CONSTANT, 0},
+      {OpCode::JMP_LE, 18},           {OpCode::NEW_OBJECT},
+      {OpCode::POP_INTO_LOCAL, 1},    {OpCode::PUSH_FROM_LOCAL, 0},
+      {OpCode::PUSH_FROM_LOCAL, 1},   {OpCode::POP_INTO_OBJECT, 0},
+      {OpCode::PUSH_FROM_PARAM, 0},   {OpCode::PUSH_FROM_LOCAL, 1},
+      {OpCode::POP_INTO_OBJECT, 1},   {OpCode::INT_PUSH_CONSTANT, 16},
+      {OpCode::NEW_ARRAY},            {OpCode::DROP},
+      {OpCode::PUSH_FROM_LOCAL, 1},   {OpCode::POP_INTO_LOCAL, 0},
+      {OpCode::PUSH_FROM_PARAM, 0},   {OpCode::INT_PUSH_CONSTANT, 1},
+      {OpCode::INT_SUB},              {OpCode::POP_INTO_PARAM, 0},
+      {OpCode::JMP, -21},             {OpCode::PUSH_FROM_LOCAL, 0},
+      {OpCode::FUNCTION_RETURN},      END_SECTION};
+  // sum(list) { s = 0; while (list != 0) { s = s + list.1; list = list.0; }
+  //   return s; }
+  std::vector<Instruction> sum = {
+      {OpCode::INT_PUSH_CONSTANT, 0}, {OpCode::POP_INTO_LOCAL, 0},
+      {OpCode::PUSH_FROM_PARAM, 0},   {OpCode::INT_PUSH_CONSTANT, 0},
+      {OpCode::JMP_EQ, 9},            {OpCode::PUSH_FROM_LOCAL, 0},
+      {OpCode::PUSH_FROM_PARAM, 0},   {OpCode::PUSH_FROM_OBJECT, 1},
+      {OpCode::INT_ADD},              {OpCode::POP_INTO_LOCAL, 0},
+      {OpCode::PUSH_FROM_PARAM, 0},   {OpCode::PUSH_FROM_OBJECT, 0},
+      {OpCode::POP_INTO_PARAM, 0},    {OpCode::JMP, -12},
+      {OpCode::PUSH_FROM_LOCAL, 0},   {OpCode::FUNCTION_RETURN},
+      END_SECTION};
+  // main(n) { return sum(chain(n)); }
+  std::vector<Instruction> main = {
+      {OpCode::PUSH_FROM_PARAM, 0}, {OpCode::FUNCTION_CALL, 1},
+      {OpCode::FUNCTION_CALL, 2},   {OpCode::FUNCTION_RETURN},
+      END_SECTION};
+  auto m = std::make_shared<Module>();
+  m->functions.push_back(b9::FunctionDef{"main", main, 1, 0});
+  m->functions.push_back(b9::FunctionDef{"chain", chain, 1, 2});
+  m->functions.push_back(b9::FunctionDef{"sum", sum, 1, 1});
+
+  // Collections started by one thread's allocations move the objects the
+  // others are linking up.
+  const std::int64_t n = 2000;
+  for (bool jit : {false, true}) {
+    Config cfg;
+    cfg.jit = jit;
+    cfg.multithreaded = true;
+    VirtualMachine vm{runtime, cfg};
+    vm.load(m);
+    if (jit) vm.generateAllCode();
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < 4; i++) {
+      workers.emplace_back([&] {
+        ExecutionContext context(vm, cfg);
+        for (int j = 0; j < 20; j++) {
+          EXPECT_EQ(Value(AS_INT48, n * (n + 1) / 2),
+                    vm.run(context, 0, {{AS_INT48, n}}));
+        }
+      });
+    }
+    for (auto &worker : workers) {
+      worker.join();
+    }
+  }
+}
+
+TEST_F(InterpreterTest, isolates) {
+  Config cfg;
+  cfg.jit = true;
+
+  VirtualMachine first{runtime, cfg};
+  first.load(module_);
+  first.generateAllCode();
+
+  // The second isolate reuses the first's verified and compiled program.
+  VirtualMachine second{runtime, cfg};
+  second.load(first.program());
+  for (std::size_t i = 0; i < module_->functions.size(); i++) {
+    EXPECT_EQ(first.getJitAddress(i), second.getJitAddress(i));
+  }
+  for (auto test : TEST_NAMES) {
+    EXPECT_TRUE(second.run(test, {}).getInt48()) << "Test Failed: " << test;
+  }
+
+  // Code can't be compiled under different JIT options.
+  Config other = cfg;
+  other.directCall = true;
+  VirtualMachine third{runtime, other};
+  third.load(first.program());
+  EXPECT_THROW(third.generateAllCode(), CompilationException);
+
+  // Nor reused against other primitives.
+  VirtualMachine fourth{runtime, cfg};
+  fourth.registerPrimitive({"extra", b9_prim_print_stack, {0}});
+  EXPECT_THROW(fourth.load(first.program()), std::runtime_error);
+}
+
+TEST_F(InterpreterTest, isolatesNeedTheSamePrimitiveEntryPoints) {
+  Config cfg;
+  cfg.jit = true;
+
+  VirtualMachine first{runtime, cfg};
+  first.registerPrimitive({"extra", b9_prim_print_stack, {0}});
+  first.load(module_);
+  first.generateAllCode();
+
+  // Same stack effects, but compiled code would call the wrong function.
+  VirtualMachine second{runtime, cfg};
+  second.registerPrimitive({"extra", b9_prim_yield, {0}});
+  EXPECT_THROW(second.load(first.program()), std::runtime_error);
+
+  VirtualMachine third{runtime, cfg};
+  third.registerPrimitive({"extra", b9_prim_print_stack, {0}});
+  third.load(first.program());
+  EXPECT_EQ(first.getJitAddress(0), third.getJitAddress(0));
+}
+
 TEST(MyTest, arguments) {
   Config cfg;
   cfg.jit = true;
@@ -145,6 +304,333 @@ TEST(MyTest, arguments) {
   EXPECT_EQ(r, Value(AS_INT48, 3));
 }
 
+TEST(BatchTest, runBatch) {
+  Config cfg;
+  cfg.jit = true;
+  cfg.multithreaded = true;
+  b9::VirtualMachine vm{runtime, cfg};
+  auto m = std::make_shared<Module>();
+  std::vector<Instruction> i = {{OpCode::PUSH_FROM_PARAM, 0},
+                                {OpCode::PUSH_FROM_PARAM, 1},
+                                {OpCode::INT_SUB},
+                                {OpCode::FUNCTION_RETURN},
+                                END_SECTION};
+  m->functions.push_back(b9::FunctionDef{"sub_args", i, 2, 0});
+  vm.load(m);
+  vm.generateAllCode();
+
+  std::vector<StackElement> args;
+  for (int n = 0; n < 1000; n++) {
+    args.push_back({AS_INT48, n});
+    args.push_back({AS_INT48, 2 * n});
+  }
+
+  BatchRunner batch(vm, 4);
+  auto results = batch.run(0, args);
+  ASSERT_EQ(1000, results.size());
+  for (int n = 0; n < 1000; n++) {
+    EXPECT_EQ(vm.run(0, {args[2 * n], args[2 * n + 1]}), results[n]);
+  }
+}
+
+TEST(BatchTest, jitNeedsPolling) {
+  Config cfg;
+  cfg.jit = true;
+  b9::VirtualMachine vm{runtime, cfg};
+  // Compiled code that doesn't poll would hold up other workers' collections.
+  EXPECT_THROW(BatchRunner(vm, 2), std::runtime_error);
+}
+
+TEST(BatchTest, collectBetweenCalls) {
+  // collect() { collect; return new object; }
+  Config cfg;
+  b9::VirtualMachine vm{runtime, cfg};
+  auto m = std::make_shared<Module>();
+  std::vector<Instruction> i = {{OpCode::SYSTEM_COLLECT},
+                                {OpCode::NEW_OBJECT},
+                                {OpCode::FUNCTION_RETURN},
+                                END_SECTION};
+  m->functions.push_back(b9::FunctionDef{"collect", i, 0, 0});
+  vm.load(m);
+
+  // Each worker's collections stop the others between their calls.
+  BatchRunner batch(vm, 4);
+  auto results = batch.run(0, 200);
+  ASSERT_EQ(200, results.size());
+  EXPECT_EQ(200, vm.gcStats().snapshot().systemCollections);
+}
+
+TEST(BatchTest, failedCall) {
+  Config cfg;
+  b9::VirtualMachine vm{runtime, cfg};
+  auto m = std::make_shared<Module>();
+  std::vector<Instruction> i = {{OpCode::PUSH_FROM_PARAM, 0},
+                                {OpCode::PUSH_FROM_OBJECT, 0},
+                                {OpCode::FUNCTION_RETURN},
+                                END_SECTION};
+  m->functions.push_back(b9::FunctionDef{"not_an_object", i, 1, 0});
+  vm.load(m);
+
+  BatchRunner batch(vm, 2);
+  std::vector<StackElement> args(100, {AS_INT48, 1});
+  EXPECT_THROW(batch.run(0, args), std::runtime_error);
+  // The workers are still usable after a failed batch.
+  EXPECT_THROW(batch.run(0, args), std::runtime_error);
+}
+
+TEST(BatchTest, noParameters) {
+  Config cfg;
+  b9::VirtualMachine vm{runtime, cfg};
+  auto m = std::make_shared<Module>();
+  std::vector<Instruction> i = {{OpCode::INT_PUSH_CONSTANT, 7},
+                                {OpCode::FUNCTION_RETURN},
+                                END_SECTION};
+  m->functions.push_back(b9::FunctionDef{"seven", i, 0, 0});
+  vm.load(m);
+
+  BatchRunner batch(vm, 2);
+  auto results = batch.run(0, 100);
+  ASSERT_EQ(100, results.size());
+  for (auto result : results) {
+    EXPECT_EQ(Value(AS_INT48, 7), result);
+  }
+  // Without a count, there is no telling how many calls to make.
+  EXPECT_THROW(batch.run(0, std::vector<StackElement>{}),
+               BadFunctionCallException);
+  EXPECT_THROW(batch.run(0, 2, {Value(AS_INT48, 1)}),
+               BadFunctionCallException);
+}
+
+// yields() yields once. add_yields(a) returns a + yields() + yields().
+static std::shared_ptr<Module> yieldModule() {
+  auto m = std::make_shared<Module>();
+  std::vector<Instruction> yields = {{OpCode::PRIMITIVE_CALL, 3},
+                                     {OpCode::FUNCTION_RETURN},
+                                     END_SECTION};
+  std::vector<Instruction> addYields = {{OpCode::PUSH_FROM_PARAM, 0},
+                                        {OpCode::FUNCTION_CALL, 0},
+                                        {OpCode::INT_ADD},
+                                        {OpCode::PRIMITIVE_CALL, 3},
+                                        {OpCode::INT_ADD},
+                                        {OpCode::FUNCTION_RETURN},
+                                        END_SECTION};
+  m->functions.push_back(b9::FunctionDef{"yields", yields, 0, 0});
+  m->functions.push_back(b9::FunctionDef{"add_yields", addYields, 1, 0});
+  return m;
+}
+
+TEST(SuspendTest, suspendAndResume) {
+  b9::VirtualMachine vm{runtime, {}};
+  vm.load(yieldModule());
+  ExecutionContext context(vm, vm.config());
+
+  StackElement arg{AS_INT48, 1};
+  EXPECT_FALSE(context.start(1, &arg));
+  EXPECT_TRUE(context.suspended());
+  EXPECT_FALSE(context.resume({AS_INT48, 10}));
+  EXPECT_TRUE(context.resume({AS_INT48, 100}));
+  EXPECT_FALSE(context.suspended());
+  EXPECT_EQ(context.result(), Value(AS_INT48, 111));
+}
+
+TEST(SuspendTest, multiplex) {
+  b9::VirtualMachine vm{runtime, {}};
+  vm.load(yieldModule());
+
+  std::vector<std::unique_ptr<ExecutionContext>> contexts;
+  for (int n = 0; n < 100; n++) {
+    contexts.emplace_back(new ExecutionContext(vm, vm.config()));
+    StackElement arg{AS_INT48, n};
+    EXPECT_FALSE(contexts.back()->start(1, &arg));
+  }
+  for (auto &context : contexts) {
+    EXPECT_FALSE(context->resume({AS_INT48, 1}));
+  }
+  for (auto &context : contexts) {
+    EXPECT_TRUE(context->resume({AS_INT48, 2}));
+  }
+  for (int n = 0; n < 100; n++) {
+    EXPECT_EQ(contexts[n]->result(), Value(AS_INT48, n + 3));
+  }
+}
+
+TEST(SuspendTest, refuseSuspension) {
+  b9::VirtualMachine vm{runtime, {}};
+  vm.load(yieldModule());
+  // Calls that weren't started by start() can't be suspended.
+  EXPECT_THROW(vm.run(1, {{AS_INT48, 1}}), SuspendException);
+
+  Config cfg;
+  cfg.jit = true;
+  b9::VirtualMachine jitVm{runtime, cfg};
+  jitVm.load(yieldModule());
+  jitVm.generateAllCode();
+  ExecutionContext context(jitVm, jitVm.config());
+  StackElement arg{AS_INT48, 1};
+  // Nor can compiled code.
+  EXPECT_THROW(context.start(1, &arg), SuspendException);
+}
+
+// ( a -- a + 1 ), completed by another thread.
+extern "C" PrimitiveStatus test_prim_async_inc(ExecutionContext *context) {
+  auto a = context->pop().getInt48();
+  auto completion = context->completion();
+  std::thread([completion, a] {
+    completion.complete({AS_INT48, a + 1});
+  }).detach();
+  return PrimitiveStatus::PENDING;
+}
+
+// inc_twice(a) returns a + 2, using the async primitive.
+static std::shared_ptr<Module> asyncModule(std::size_t primitive) {
+  auto m = std::make_shared<Module>();
+  std::vector<Instruction> i = {
+      {OpCode::PUSH_FROM_PARAM, 0},
+      {OpCode::PRIMITIVE_CALL, static_cast<Immediate>(primitive)},
+      {OpCode::PRIMITIVE_CALL, static_cast<Immediate>(primitive)},
+      {OpCode::FUNCTION_RETURN},
+      END_SECTION};
+  m->functions.push_back(b9::FunctionDef{"inc_twice", i, 1, 0});
+  return m;
+}
+
+TEST(SchedulerTest, registerPrimitive) {
+  b9::VirtualMachine vm{runtime, {}};
+  auto index = vm.registerPrimitive(
+      {"async_inc", test_prim_async_inc, {1}, Primitive::ASYNC});
+  EXPECT_EQ(index, vm.primitives().index("async_inc"));
+  EXPECT_THROW(vm.registerPrimitive({"async_inc", test_prim_async_inc, {1}}),
+               PrimitiveException);
+  EXPECT_THROW(vm.primitives().index("no_such_primitive"), PrimitiveException);
+}
+
+TEST(SchedulerTest, completions) {
+  b9::VirtualMachine vm{runtime, {}};
+  auto primitive = vm.registerPrimitive(
+      {"async_inc", test_prim_async_inc, {1}, Primitive::ASYNC});
+  vm.load(asyncModule(primitive));
+
+  Scheduler scheduler(vm);
+  std::vector<StackElement> results(100);
+  for (int n = 0; n < 100; n++) {
+    scheduler.spawn(0, {{AS_INT48, n}}, [&results, n](StackElement result) {
+      results[n] = result;
+    });
+  }
+  EXPECT_EQ(scheduler.inFlight(), 100);
+  scheduler.run();
+  EXPECT_EQ(scheduler.inFlight(), 0);
+  for (int n = 0; n < 100; n++) {
+    EXPECT_EQ(results[n], Value(AS_INT48, n + 2));
+  }
+}
+
+TEST(SchedulerTest, yield) {
+  b9::VirtualMachine vm{runtime, {}};
+  vm.load(yieldModule());
+  Scheduler scheduler(vm);
+  std::vector<StackElement> results;
+  for (int n = 0; n < 3; n++) {
+    scheduler.spawn(1, {{AS_INT48, n}},
+                    [&results](StackElement r) { results.push_back(r); });
+  }
+  scheduler.run();
+  // The calls take turns, so they finish in the order they started.
+  ASSERT_EQ(results.size(), 3);
+  for (int n = 0; n < 3; n++) {
+    EXPECT_EQ(results[n], Value(AS_INT48, n));
+  }
+}
+
+TEST(SchedulerTest, blockingCompletions) {
+  // Without a scheduler, or in compiled code, async primitives block.
+  for (bool jit : {false, true}) {
+    Config cfg;
+    cfg.jit = jit;
+    b9::VirtualMachine vm{runtime, cfg};
+    auto primitive = vm.registerPrimitive(
+        {"async_inc", test_prim_async_inc, {1}, Primitive::ASYNC});
+    vm.load(asyncModule(primitive));
+    if (jit) vm.generateAllCode();
+    EXPECT_EQ(vm.run(0, {{AS_INT48, 1}}), Value(AS_INT48, 3));
+  }
+}
+
+static int directCalls = 0;
+
+// ( a b -- a - b )
+extern "C" Om::RawValue test_prim_sub_direct(ExecutionContext *context,
+                                             Om::RawValue a, Om::RawValue b) {
+  directCalls++;
+  return Value(AS_INT48, Value(AS_RAW, a).getInt48() -
+                             Value(AS_RAW, b).getInt48())
+      .raw();
+}
+
+extern "C" PrimitiveStatus test_prim_sub(ExecutionContext *context) {
+  auto b = context->pop();
+  auto a = context->pop();
+  context->push({AS_INT48, a.getInt48() - b.getInt48()});
+  return PrimitiveStatus::DONE;
+}
+
+TEST(PrimitiveTest, directCall) {
+  for (bool jit : {false, true}) {
+    Config cfg;
+    cfg.jit = jit;
+    b9::VirtualMachine vm{runtime, cfg};
+    auto primitive = vm.registerPrimitive(
+        {"sub", test_prim_sub, {2}, Primitive::PURE | Primitive::NOGC,
+         (void *)&test_prim_sub_direct});
+    auto m = std::make_shared<Module>();
+    std::vector<Instruction> i = {
+        {OpCode::PUSH_FROM_PARAM, 0},
+        {OpCode::INT_PUSH_CONSTANT, 3},
+        {OpCode::PRIMITIVE_CALL, static_cast<Immediate>(primitive)},
+        {OpCode::FUNCTION_RETURN},
+        END_SECTION};
+    m->functions.push_back(b9::FunctionDef{"sub3", i, 1, 0});
+    vm.load(m);
+    if (jit) vm.generateAllCode();
+
+    directCalls = 0;
+    EXPECT_EQ(vm.run(0, {{AS_INT48, 10}}), Value(AS_INT48, 7));
+    // Only compiled code uses the direct entry point.
+    EXPECT_EQ(directCalls, jit ? 1 : 0);
+  }
+}
+
+TEST(OutputTest, flushPolicy) {
+  Config cfg;
+  cfg.outputFlush = OutputFlush::EXPLICIT;
+  b9::VirtualMachine vm{runtime, cfg};
+  std::stringstream out;
+  vm.setOutput(out);
+  auto m = std::make_shared<Module>();
+  std::vector<Instruction> i = {{OpCode::PUSH_FROM_PARAM, 0},
+                                {OpCode::PRIMITIVE_CALL, 1},  // print_number
+                                {OpCode::FUNCTION_RETURN},
+                                END_SECTION};
+  m->functions.push_back(b9::FunctionDef{"print_arg", i, 1, 0});
+  vm.load(m);
+
+  std::stringstream expected;
+  expected << Value(AS_INT48, 1) << '\n' << Value(AS_INT48, 2) << '\n';
+  {
+    ExecutionContext context(vm, vm.config());
+    vm.run(context, 0, {{AS_INT48, 1}});
+    vm.run(context, 0, {{AS_INT48, 2}});
+    EXPECT_EQ(out.str(), "");
+    context.output().flush();
+    EXPECT_EQ(out.str(), expected.str());
+  }
+
+  // Output is written out when the context is destroyed.
+  vm.run(0, {{AS_INT48, 3}});
+  expected << Value(AS_INT48, 3) << '\n';
+  EXPECT_EQ(out.str(), expected.str());
+}
+
 TEST(MyTest, jitSimpleProgram) {
   Config cfg;
   cfg.jit = true;
@@ -175,6 +661,24 @@ TEST(MyTest, haveAVariable) {
   EXPECT_EQ(r, Value(AS_INT48, 0xdead));
 }
 
+TEST(MyTest, wideConstant) {
+  for (bool jit : {false, true}) {
+    Config cfg;
+    cfg.jit = jit;
+    b9::VirtualMachine vm{runtime, cfg};
+    auto m = std::make_shared<Module>();
+    std::vector<Instruction> i = {
+        {}, {}, {OpCode::FUNCTION_RETURN}, END_SECTION};
+    setWideImmediate(OpCode::INT_PUSH_CONSTANT_WIDE, -0x1234'5678'9abc, i[0],
+                     i[1]);
+    m->functions.push_back(b9::FunctionDef{"wide", i, 0, 0});
+    vm.load(m);
+    if (jit) vm.generateAllCode();
+    auto r = vm.run("wide", {});
+    EXPECT_EQ(r, Value(AS_INT48, -0x1234'5678'9abc));
+  }
+}
+
 TEST(ObjectTest, allocateSomething) {
   b9::VirtualMachine vm{runtime, {}};
   auto m = std::make_shared<Module>();
@@ -195,6 +699,1012 @@ TEST(ObjectTest, allocateSomething) {
   vm.load(m);
   Value r = vm.run("allocate_object", {});
   EXPECT_EQ(r, Value(AS_INT48, 0));
+  EXPECT_LE(1, vm.gcStats().pauses());
+  EXPECT_EQ(1, vm.gcStats().snapshot().systemCollections);
+}
+
+TEST(ObjectTest, rememberStores) {
+  // o = new object; o.0 = 1; o.1 = new object; o.2 = o; return o;
+  std::vector<Instruction> i = {
+      {OpCode::NEW_OBJECT},          {OpCode::POP_INTO_LOCAL, 0},
+      {OpCode::INT_PUSH_CONSTANT, 1}, {OpCode::PUSH_FROM_LOCAL, 0},
+      {OpCode::POP_INTO_OBJECT, 0},  {OpCode::NEW_OBJECT},
+      {OpCode::PUSH_FROM_LOCAL, 0},  {OpCode::POP_INTO_OBJECT, 1},
+      {OpCode::PUSH_FROM_LOCAL, 0},  {OpCode::PUSH_FROM_LOCAL, 0},
+      {OpCode::POP_INTO_OBJECT, 2},  {OpCode::PUSH_FROM_LOCAL, 0},
+      {OpCode::FUNCTION_RETURN},     END_SECTION};
+  auto m = std::make_shared<Module>();
+  m->functions.push_back(b9::FunctionDef{"store", i, 0, 1});
+
+  Config cfg;
+  cfg.writeBarrier = WriteBarrier::REMEMBER;
+  b9::VirtualMachine vm{runtime, cfg};
+  vm.load(m);
+  ExecutionContext context{vm, cfg};
+  Value object = vm.run(context, 0, {});
+
+  // Only the stores of references are remembered, and the object only once.
+  std::vector<Om::Object *> expected(1, object.getRef<Om::Object>());
+  EXPECT_EQ(expected, context.storeBuffer());
+  EXPECT_FALSE(context.storeBufferOverflowed());
+  EXPECT_EQ(3, context.allocationStats().transitions);
+}
+
+TEST(ObjectTest, storeBufferOverflows) {
+  // link(n) { o = new object; while (n > 0) { p = new object; p.0 = o;
+  //   o = p; n = n - 1; } return o; }
+  std::vector<Instruction> i = {{OpCode::NEW_OBJECT},
+                                {OpCode::POP_INTO_LOCAL, 0},
+                                {OpCode::PUSH_FROM_PARAM, 0},
+                                {OpCode::INT_PUSH_CONSTANT, 0},
+                                {OpCode::JMP_LE, 12},
+                                {OpCode::NEW_OBJECT},
+                                {OpCode::POP_INTO_LOCAL, 1},
+                                {OpCode::PUSH_FROM_LOCAL, 0},
+                                {OpCode::PUSH_FROM_LOCAL, 1},
+                                {OpCode::POP_INTO_OBJECT, 0},
+                                {OpCode::PUSH_FROM_LOCAL, 1},
+                                {OpCode::POP_INTO_LOCAL, 0},
+                                {OpCode::PUSH_FROM_PARAM, 0},
+                                {OpCode::INT_PUSH_CONSTANT, 1},
+                                {OpCode::INT_SUB},
+                                {OpCode::POP_INTO_PARAM, 0},
+                                {OpCode::JMP, -15},
+                                {OpCode::PUSH_FROM_LOCAL, 0},
+                                {OpCode::FUNCTION_RETURN},
+                                END_SECTION};
+  auto m = std::make_shared<Module>();
+  m->functions.push_back(b9::FunctionDef{"link", i, 1, 2});
+
+  Config cfg;
+  cfg.writeBarrier = WriteBarrier::REMEMBER;
+  b9::VirtualMachine vm{runtime, cfg};
+  vm.load(m);
+  ExecutionContext context{vm, cfg};
+  // A collection empties the buffer, so only check runs that had none.
+  const std::int64_t n = ExecutionContext::STORE_BUFFER_SIZE;
+  std::size_t collections = context.collections();
+  vm.run(context, 0, {{AS_INT48, n}});
+  if (context.collections() == collections) {
+    EXPECT_EQ(n, context.storeBuffer().size());
+    EXPECT_FALSE(context.storeBufferOverflowed());
+  }
+
+  // The next object doesn't fit.
+  vm.run(context, 0, {{AS_INT48, 1}});
+  if (context.collections() == collections) {
+    EXPECT_TRUE(context.storeBufferOverflowed());
+    EXPECT_TRUE(context.storeBuffer().empty());
+  }
+}
+
+TEST(ObjectTest, snapshotStores) {
+  // o = new object; o.0 = new object; o.0 = 1; return o;
+  std::vector<Instruction> i = {
+      {OpCode::NEW_OBJECT},          {OpCode::POP_INTO_LOCAL, 0},
+      {OpCode::NEW_OBJECT},          {OpCode::PUSH_FROM_LOCAL, 0},
+      {OpCode::POP_INTO_OBJECT, 0},  {OpCode::INT_PUSH_CONSTANT, 1},
+      {OpCode::PUSH_FROM_LOCAL, 0},  {OpCode::POP_INTO_OBJECT, 0},
+      {OpCode::PUSH_FROM_LOCAL, 0},  {OpCode::FUNCTION_RETURN},
+      END_SECTION};
+  auto m = std::make_shared<Module>();
+  m->functions.push_back(b9::FunctionDef{"overwrite", i, 0, 1});
+
+  Config cfg;
+  cfg.writeBarrier = WriteBarrier::SNAPSHOT;
+  b9::VirtualMachine vm{runtime, cfg};
+  vm.load(m);
+  ExecutionContext context{vm, cfg};
+  Value object = vm.run(context, 0, {});
+
+  // Only the overwritten inner object is recorded.
+  ASSERT_EQ(1, context.storeBuffer().size());
+  EXPECT_NE(object.getRef<Om::Object>(), context.storeBuffer()[0]);
+}
+
+TEST(GcStatsTest, pausePercentiles) {
+  GcStats stats;
+  EXPECT_EQ(GcStats::Duration::zero(), stats.pausePercentile(50));
+  for (int i = 100; i >= 1; i--) {
+    stats.recordPause(GcStats::Duration(i), GcStats::Cause::ALLOCATION);
+  }
+  EXPECT_EQ(100, stats.pauses());
+  EXPECT_EQ(GcStats::Duration(50), stats.pausePercentile(50));
+  EXPECT_EQ(GcStats::Duration(99), stats.pausePercentile(99));
+  EXPECT_EQ(GcStats::Duration(1), stats.pausePercentile(0));
+  EXPECT_EQ(GcStats::Duration(100), stats.maxPause());
+  EXPECT_EQ(GcStats::Duration(5050), stats.totalPause());
+}
+
+TEST(GcStatsTest, allocationPauses) {
+  // churn(n) { while (n > 0) { new array(1000); n = n - 1; } return 0; }
+  std::vector<Instruction> i = {{OpCode::PUSH_FROM_PARAM, 0},
+                                {OpCode::INT_PUSH_CONSTANT, 0},
+                                {OpCode::JMP_LE, 8},
+                                {OpCode::INT_PUSH_CONSTANT, 1000},
+                                {OpCode::NEW_ARRAY},
+                                {OpCode::DROP},
+                                {OpCode::PUSH_FROM_PARAM, 0},
+                                {OpCode::INT_PUSH_CONSTANT, 1},
+                                {OpCode::INT_SUB},
+                                {OpCode::POP_INTO_PARAM, 0},
+                                {OpCode::JMP, -11},
+                                {OpCode::INT_PUSH_CONSTANT, 0},
+                                {OpCode::FUNCTION_RETURN},
+                                END_SECTION};
+  auto m = std::make_shared<Module>();
+  m->functions.push_back(b9::FunctionDef{"churn", i, 1, 0});
+
+  Config cfg;
+  b9::VirtualMachine vm{runtime, cfg};
+  vm.load(m);
+  ExecutionContext context{vm, cfg};
+  vm.run(context, 0, {{AS_INT48, 20000}});
+
+  // About 160MB of arrays, so allocations had to collect, and their pauses
+  // were timed although nothing ran SYSTEM_COLLECT.
+  ASSERT_LT(0, context.collections());
+  auto stats = vm.gcStats().snapshot();
+  EXPECT_LT(0, stats.collections);
+  EXPECT_EQ(0, stats.systemCollections);
+  EXPECT_LT(GcStats::Duration::zero(), stats.maxPause);
+}
+
+TEST(ObjectTest, allocationBuffer) {
+  // allocate(n) { while (n > 0) { new object; n = n - 1; } return new object; }
+  std::vector<Instruction> i = {{OpCode::PUSH_FROM_PARAM, 0},
+                                {OpCode::INT_PUSH_CONSTANT, 0},
+                                {OpCode::JMP_LE, 7},
+                                {OpCode::NEW_OBJECT},
+                                {OpCode::DROP},
+                                {OpCode::PUSH_FROM_PARAM, 0},
+                                {OpCode::INT_PUSH_CONSTANT, 1},
+                                {OpCode::INT_SUB},
+                                {OpCode::POP_INTO_PARAM, 0},
+                                {OpCode::JMP, -10},
+                                {OpCode::NEW_OBJECT},
+                                {OpCode::FUNCTION_RETURN},
+                                END_SECTION};
+  auto m = std::make_shared<Module>();
+  m->functions.push_back(b9::FunctionDef{"allocate", i, 1, 0});
+
+  // Enough objects to refill the buffer a few times.
+  const std::int64_t n = 3 * ExecutionContext::ALLOCATION_BUFFER_SIZE + 1;
+  for (bool jit : {false, true}) {
+    Config cfg;
+    cfg.jit = jit;
+    b9::VirtualMachine vm{runtime, cfg};
+    vm.load(m);
+    if (jit) vm.generateAllCode();
+    {
+      ExecutionContext context{vm, cfg};
+      EXPECT_TRUE(vm.run(context, 0, {{AS_INT48, n}}).isRef());
+      EXPECT_EQ(n + 1, context.allocationStats().objects);
+      // One call out of line per batch, unless a collection emptied one.
+      if (context.collections() == 0) {
+        EXPECT_EQ(4, context.allocationStats().refills);
+      }
+    }
+    EXPECT_EQ(n + 1, vm.gcStats().snapshot().allocation.objects);
+  }
+}
+
+TEST(ObjectTest, collectionDropsAllocationBuffer) {
+  // f() { new object; collect; return new object; }
+  std::vector<Instruction> i = {{OpCode::NEW_OBJECT},
+                                {OpCode::DROP},
+                                {OpCode::SYSTEM_COLLECT},
+                                {OpCode::NEW_OBJECT},
+                                {OpCode::FUNCTION_RETURN},
+                                END_SECTION};
+  auto m = std::make_shared<Module>();
+  m->functions.push_back(b9::FunctionDef{"f", i, 0, 0});
+
+  for (bool jit : {false, true}) {
+    Config cfg;
+    cfg.jit = jit;
+    b9::VirtualMachine vm{runtime, cfg};
+    vm.load(m);
+    if (jit) vm.generateAllCode();
+    ExecutionContext context{vm, cfg};
+    EXPECT_TRUE(vm.run(context, 0, {}).isRef());
+    // The collection didn't keep the rest of the first batch, so the second
+    // object came from a new one.
+    EXPECT_EQ(2, context.allocationStats().refills);
+  }
+}
+
+TEST(ArrayTest, sumArray) {
+  // sum(n) { a = new array(n); for (i = 0; i < a.length; i = i + 1) {
+  //   a[i] = i; total = total + a[i]; } return total; }
+  std::vector<Instruction> sum = {{OpCode::PUSH_FROM_PARAM, 0},
+                                  {OpCode::NEW_ARRAY},
+                                  {OpCode::POP_INTO_LOCAL, 0},
+                                  {OpCode::PUSH_FROM_LOCAL, 1},
+                                  {OpCode::PUSH_FROM_LOCAL, 0},
+                                  {OpCode::ARRAY_LENGTH},
+                                  {OpCode::JMP_GE, 15},
+                                  {OpCode::PUSH_FROM_LOCAL, 0},
+                                  {OpCode::PUSH_FROM_LOCAL, 1},
+                                  {OpCode::PUSH_FROM_LOCAL, 1},
+                                  {OpCode::POP_INTO_ARRAY},
+                                  {OpCode::PUSH_FROM_LOCAL, 2},
+                                  {OpCode::PUSH_FROM_LOCAL, 0},
+                                  {OpCode::PUSH_FROM_LOCAL, 1},
+                                  {OpCode::PUSH_FROM_ARRAY},
+                                  {OpCode::INT_ADD},
+                                  {OpCode::POP_INTO_LOCAL, 2},
+                                  {OpCode::PUSH_FROM_LOCAL, 1},
+                                  {OpCode::INT_PUSH_CONSTANT, 1},
+                                  {OpCode::INT_ADD},
+                                  {OpCode::POP_INTO_LOCAL, 1},
+                                  {OpCode::JMP, -19},
+                                  {OpCode::PUSH_FROM_LOCAL, 2},
+                                  {OpCode::FUNCTION_RETURN},
+                                  END_SECTION};
+  // past() { a = new array(2); return a[2]; }
+  std::vector<Instruction> past = {
+      {OpCode::INT_PUSH_CONSTANT, 2}, {OpCode::NEW_ARRAY},
+      {OpCode::INT_PUSH_CONSTANT, 2}, {OpCode::PUSH_FROM_ARRAY},
+      {OpCode::FUNCTION_RETURN},      END_SECTION};
+  auto m = std::make_shared<Module>();
+  m->functions.push_back(b9::FunctionDef{"sum", sum, 1, 3});
+  m->functions.push_back(b9::FunctionDef{"past", past, 0, 0});
+
+  for (bool jit : {false, true}) {
+    Config cfg;
+    cfg.jit = jit;
+    b9::VirtualMachine vm{runtime, cfg};
+    vm.load(m);
+    if (jit) vm.generateAllCode();
+    EXPECT_EQ(Value(AS_INT48, 4950), vm.run("sum", {{AS_INT48, 100}}));
+    EXPECT_EQ(Value(AS_INT48, 0), vm.run("sum", {{AS_INT48, 0}}));
+    if (!jit) {
+      EXPECT_THROW(vm.run("past", {}), std::runtime_error);
+      EXPECT_THROW(vm.run("sum", {{AS_INT48, -1}}), std::runtime_error);
+    }
+  }
+}
+
+TEST(ArrayTest, bulkPrimitives) {
+  b9::VirtualMachine probe{runtime, {}};
+  auto index = [&](const char *name) {
+    return Immediate(probe.primitives().index(name));
+  };
+  // fill(n) { a = new array(n); array_fill(a, 3); array_add_scalar(a, 2);
+  //   array_mul(a, a); return array_sum(a) + array_count(a, 25); }
+  std::vector<Instruction> i = {
+      {OpCode::PUSH_FROM_PARAM, 0},
+      {OpCode::NEW_ARRAY},
+      {OpCode::INT_PUSH_CONSTANT, 3},
+      {OpCode::PRIMITIVE_CALL, index("array_fill")},
+      {OpCode::INT_PUSH_CONSTANT, 2},
+      {OpCode::PRIMITIVE_CALL, index("array_add_scalar")},
+      {OpCode::DUPLICATE},
+      {OpCode::PRIMITIVE_CALL, index("array_mul")},
+      {OpCode::DUPLICATE},
+      {OpCode::PRIMITIVE_CALL, index("array_sum")},
+      {OpCode::POP_INTO_LOCAL, 0},
+      {OpCode::INT_PUSH_CONSTANT, 25},
+      {OpCode::PRIMITIVE_CALL, index("array_count")},
+      {OpCode::PUSH_FROM_LOCAL, 0},
+      {OpCode::INT_ADD},
+      {OpCode::FUNCTION_RETURN},
+      END_SECTION};
+  auto m = std::make_shared<Module>();
+  m->functions.push_back(b9::FunctionDef{"fill", i, 1, 1});
+
+  for (bool jit : {false, true}) {
+    Config cfg;
+    cfg.jit = jit;
+    cfg.directCall = jit;
+    b9::VirtualMachine vm{runtime, cfg};
+    vm.load(m);
+    if (jit) vm.generateAllCode();
+    EXPECT_EQ(Value(AS_INT48, 25 * 37 + 37), vm.run("fill", {{AS_INT48, 37}}));
+  }
+}
+
+TEST(ArrayTest, kernelsMatchScalar) {
+  // Odd lengths leave a tail after the last whole vector.
+  std::vector<std::int64_t> data, other;
+  for (std::int64_t i = 0; i < 37; i++) {
+    data.push_back((i * 7919) % 101 - 50);
+    other.push_back(i % 3);
+  }
+  data[20] = (std::int64_t(1) << 47) - 1;
+  const ArrayKernels &scalar = *supportedArrayKernels().front();
+
+  for (const ArrayKernels *kernels : supportedArrayKernels()) {
+    SCOPED_TRACE(kernels->name);
+    for (std::size_t n : {1, 3, 4, 37}) {
+      EXPECT_EQ(scalar.sum(data.data(), n), kernels->sum(data.data(), n));
+      EXPECT_EQ(scalar.min(data.data(), n), kernels->min(data.data(), n));
+      EXPECT_EQ(scalar.max(data.data(), n), kernels->max(data.data(), n));
+      EXPECT_EQ(scalar.count(other.data(), n, 1),
+                kernels->count(other.data(), n, 1));
+
+      auto expected = data;
+      auto actual = data;
+      scalar.mulScalar(expected.data(), n, 1000003);
+      kernels->mulScalar(actual.data(), n, 1000003);
+      scalar.add(expected.data(), other.data(), n);
+      kernels->add(actual.data(), other.data(), n);
+      scalar.mul(expected.data(), expected.data(), n);
+      kernels->mul(actual.data(), actual.data(), n);
+      scalar.addScalar(expected.data(), n, -5);
+      kernels->addScalar(actual.data(), n, -5);
+      EXPECT_EQ(expected, actual);
+
+      kernels->fill(actual.data(), n, 9);
+      EXPECT_EQ(9 * std::int64_t(n), kernels->sum(actual.data(), n));
+    }
+  }
+}
+
+TEST(StringTest, runtimeStrings) {
+  // f() { s = "hello, " + "world"; if (s[7:12] != "world") return -1;
+  //   return s.length; }
+  std::vector<Instruction> i = {
+      {OpCode::STR_PUSH_CONSTANT, 0}, {OpCode::STR_PUSH_CONSTANT, 1},
+      {OpCode::STR_CONCAT},           {OpCode::POP_INTO_LOCAL, 0},
+      {OpCode::PUSH_FROM_LOCAL, 0},   {OpCode::INT_PUSH_CONSTANT, 7},
+      {OpCode::INT_PUSH_CONSTANT, 12}, {OpCode::STR_SLICE},
+      {OpCode::STR_PUSH_CONSTANT, 1}, {OpCode::JMP_NEQ, 3},
+      {OpCode::PUSH_FROM_LOCAL, 0},   {OpCode::STR_LENGTH},
+      {OpCode::FUNCTION_RETURN},      {OpCode::INT_PUSH_CONSTANT, -1},
+      {OpCode::FUNCTION_RETURN},      END_SECTION};
+  auto m = std::make_shared<Module>();
+  m->strings = {"hello, ", "world"};
+  m->functions.push_back(b9::FunctionDef{"f", i, 0, 1});
+  b9::VirtualMachine vm{runtime, {}};
+  vm.load(m);
+  EXPECT_EQ(Value(AS_INT48, 12), vm.run("f", {}));
+}
+
+TEST(StringTest, compiledEquality) {
+  // eq(a, b) { if (a == b) return 1; return 0; }
+  std::vector<Instruction> eq = {
+      {OpCode::PUSH_FROM_PARAM, 0},   {OpCode::PUSH_FROM_PARAM, 1},
+      {OpCode::JMP_EQ, 2},            {OpCode::INT_PUSH_CONSTANT, 0},
+      {OpCode::FUNCTION_RETURN},      {OpCode::INT_PUSH_CONSTANT, 1},
+      {OpCode::FUNCTION_RETURN},      END_SECTION};
+  // same() { return eq("hello, world", "hello, " + "world"); }
+  std::vector<Instruction> same = {
+      {OpCode::STR_PUSH_CONSTANT, 0}, {OpCode::STR_PUSH_CONSTANT, 1},
+      {OpCode::STR_PUSH_CONSTANT, 2}, {OpCode::STR_CONCAT},
+      {OpCode::FUNCTION_CALL, 0},     {OpCode::FUNCTION_RETURN},
+      END_SECTION};
+  // different() { return eq("hello, world", "hello, " + "world!"); }
+  std::vector<Instruction> different = {
+      {OpCode::STR_PUSH_CONSTANT, 0}, {OpCode::STR_PUSH_CONSTANT, 1},
+      {OpCode::STR_PUSH_CONSTANT, 3}, {OpCode::STR_CONCAT},
+      {OpCode::FUNCTION_CALL, 0},     {OpCode::FUNCTION_RETURN},
+      END_SECTION};
+  auto m = std::make_shared<Module>();
+  m->strings = {"hello, world", "hello, ", "world", "world!"};
+  m->functions.push_back(b9::FunctionDef{"eq", eq, 2, 0});
+  m->functions.push_back(b9::FunctionDef{"same", same, 0, 0});
+  m->functions.push_back(b9::FunctionDef{"different", different, 0, 0});
+
+  // The concatenation is a string object of its own, so the compiled
+  // comparison has to look at the characters, as the interpreter does.
+  for (bool jit : {false, true}) {
+    Config cfg;
+    cfg.jit = jit;
+    b9::VirtualMachine vm{runtime, cfg};
+    vm.load(m);
+    if (jit) {
+      vm.generateAllCode();
+      EXPECT_NE(nullptr, vm.getJitAddress(0));
+    }
+    EXPECT_EQ(Value(AS_INT48, 1), vm.run("same", {}));
+    EXPECT_EQ(Value(AS_INT48, 0), vm.run("different", {}));
+    EXPECT_EQ(Value(AS_INT48, 1),
+              vm.run("eq", {{AS_INT48, 3}, {AS_INT48, 3}}));
+    EXPECT_EQ(Value(AS_INT48, 0),
+              vm.run("eq", {{AS_INT48, 3}, {AS_INT48, 4}}));
+  }
+}
+
+TEST(StringTest, compiledOrdering) {
+  // For each jump, f(a, b) { if (a <op> b) return 1; return 0; }
+  auto m = std::make_shared<Module>();
+  const std::vector<std::pair<const char *, OpCode>> jumps = {
+      {"lt", OpCode::JMP_LT},
+      {"le", OpCode::JMP_LE},
+      {"gt", OpCode::JMP_GT},
+      {"ge", OpCode::JMP_GE}};
+  for (const auto &jump : jumps) {
+    std::vector<Instruction> i = {
+        {OpCode::PUSH_FROM_PARAM, 0},   {OpCode::PUSH_FROM_PARAM, 1},
+        {jump.second, 2},               {OpCode::INT_PUSH_CONSTANT, 0},
+        {OpCode::FUNCTION_RETURN},      {OpCode::INT_PUSH_CONSTANT, 1},
+        {OpCode::FUNCTION_RETURN},      END_SECTION};
+    m->functions.push_back(b9::FunctionDef{jump.first, i, 2, 0});
+  }
+  // The constants are out of order, so comparing their indexes gets the
+  // wrong answer.
+  m->strings = {"pear", "apple", "pear"};
+  const Value pear{AS_UINT48, 0};
+  const Value apple{AS_UINT48, 1};
+  const Value pear2{AS_UINT48, 2};
+
+  const std::vector<std::pair<Value, Value>> operands = {
+      {apple, pear},
+      {pear, apple},
+      {pear, pear2},
+      {{AS_INT48, -2}, {AS_INT48, 1}},
+      {{AS_INT48, 1}, {AS_INT48, -2}},
+      {{AS_INT48, 5}, {AS_INT48, 5}}};
+
+  Config interpreterCfg;
+  b9::VirtualMachine interpreter{runtime, interpreterCfg};
+  interpreter.load(m);
+  Config jitCfg;
+  jitCfg.jit = true;
+  b9::VirtualMachine jit{runtime, jitCfg};
+  jit.load(m);
+  jit.generateAllCode();
+
+  for (const auto &jump : jumps) {
+    for (const auto &operand : operands) {
+      const std::vector<Value> args = {operand.first, operand.second};
+      EXPECT_EQ(interpreter.run(jump.first, args), jit.run(jump.first, args))
+          << jump.first << " " << operand.first << " " << operand.second;
+    }
+  }
+  EXPECT_EQ(Value(AS_INT48, 1), jit.run("lt", {apple, pear}));
+  EXPECT_EQ(Value(AS_INT48, 1), jit.run("le", {pear, pear2}));
+  EXPECT_EQ(Value(AS_INT48, 0), jit.run("gt", {apple, pear}));
+  EXPECT_EQ(Value(AS_INT48, 1), jit.run("lt", {{AS_INT48, -2}, {AS_INT48, 1}}));
+  EXPECT_THROW(interpreter.run("lt", {apple, {AS_INT48, 1}}),
+               std::runtime_error);
+}
+
+TEST(StringTest, survivesCollection) {
+  // f() { s = "hello, " + "world"; collect; m = new map; m[s] = s;
+  //   if (m["hello, world"] != "hello, world") return -1; return s.length; }
+  std::vector<Instruction> i = {
+      {OpCode::STR_PUSH_CONSTANT, 0}, {OpCode::STR_PUSH_CONSTANT, 1},
+      {OpCode::STR_CONCAT},           {OpCode::POP_INTO_LOCAL, 0},
+      {OpCode::SYSTEM_COLLECT},       {OpCode::NEW_MAP},
+      {OpCode::POP_INTO_LOCAL, 1},    {OpCode::PUSH_FROM_LOCAL, 1},
+      {OpCode::PUSH_FROM_LOCAL, 0},   {OpCode::PUSH_FROM_LOCAL, 0},
+      {OpCode::MAP_SET},              {OpCode::PUSH_FROM_LOCAL, 1},
+      {OpCode::STR_PUSH_CONSTANT, 2}, {OpCode::MAP_GET},
+      {OpCode::STR_PUSH_CONSTANT, 2}, {OpCode::JMP_NEQ, 3},
+      {OpCode::PUSH_FROM_LOCAL, 0},   {OpCode::STR_LENGTH},
+      {OpCode::FUNCTION_RETURN},      {OpCode::INT_PUSH_CONSTANT, -1},
+      {OpCode::FUNCTION_RETURN},      END_SECTION};
+  auto m = std::make_shared<Module>();
+  m->strings = {"hello, ", "world", "hello, world"};
+  m->functions.push_back(b9::FunctionDef{"f", i, 0, 2});
+  b9::VirtualMachine vm{runtime, {}};
+  vm.load(m);
+  EXPECT_EQ(Value(AS_INT48, 12), vm.run("f", {}));
+  // Only the key is interned.
+  EXPECT_EQ(1, vm.strings().symbols());
+}
+
+TEST(StringHeapTest, ropesAndBuilders) {
+  auto m = std::make_shared<Module>();
+  m->strings = {"abc", std::string(40, 'x')};
+  const std::vector<std::string> &constants = m->strings;
+  b9::VirtualMachine vm{runtime, {}};
+  vm.load(m);
+  ExecutionContext context{vm, vm.config()};
+  StringHeap &heap = vm.strings();
+  const Value abc(AS_UINT48, 0);
+  const Value xs(AS_UINT48, 1);
+
+  // Appending to the end of a builder. Strings held across allocations are
+  // rooted, since they are objects that a collection may move.
+  ExecutionContext::ValueRoot built(context, heap.slice(context, abc, 0, 0));
+  std::string expected;
+  for (int i = 0; i < 100; i++) {
+    built.set(heap.concat(context, built.get(), i % 2 ? xs : abc));
+    expected += constants[i % 2];
+  }
+  EXPECT_TRUE(built.get().isRef());
+  EXPECT_EQ(expected, heap.flatten(context, built.get()));
+  EXPECT_EQ(expected.size(), heap.length(context, built.get()));
+
+  // A rope, sliced across its halves, and compared without flattening.
+  ExecutionContext::ValueRoot left(context, heap.concat(context, xs, abc));
+  ExecutionContext::ValueRoot right(context, heap.concat(context, xs, xs));
+  ExecutionContext::ValueRoot rope(
+      context, heap.concat(context, left.get(), right.get()));
+  std::string flat = constants[1] + constants[0] + constants[1] + constants[1];
+  EXPECT_EQ(flat.substr(38, 10),
+            heap.flatten(context, heap.slice(context, rope.get(), 38, 48)));
+  right.set(heap.concat(context, abc, right.get()));
+  ExecutionContext::ValueRoot other(context,
+                                    heap.concat(context, xs, right.get()));
+  EXPECT_TRUE(heap.equal(context, rope.get(), other.get()));
+  ExecutionContext::ValueRoot prefix(context,
+                                     heap.slice(context, rope.get(), 0, 50));
+  EXPECT_LT(0, heap.compare(context, rope.get(), prefix.get()));
+  EXPECT_GT(0, heap.compare(context, abc, rope.get()));
+  EXPECT_THROW(heap.slice(context, rope.get(), 10, 1000), StringException);
+  EXPECT_THROW(heap.length(context, Value(AS_INT48, 1)), StringException);
+
+  // Interning gives equal strings the same Uint48, and constants are their
+  // own.
+  Value symbol = heap.intern(context, other.get());
+  EXPECT_TRUE(symbol.isUint48());
+  EXPECT_EQ(symbol, heap.intern(context, rope.get()));
+  EXPECT_EQ(flat, heap.flatten(context, symbol));
+  EXPECT_EQ(abc, heap.intern(context, abc));
+}
+
+TEST(MapTest, setGetHasDelete) {
+  // fill(n) { m = new map; for (i = 0; i < n; i = i + 1) m[i] = i;
+  //   return delete(m, 3) + m[n - 1] + has(m, 3) + has(m, 4); }
+  std::vector<Instruction> fill = {{OpCode::NEW_MAP},
+                                   {OpCode::POP_INTO_LOCAL, 0},
+                                   {OpCode::PUSH_FROM_LOCAL, 1},
+                                   {OpCode::PUSH_FROM_PARAM, 0},
+                                   {OpCode::JMP_GE, 9},
+                                   {OpCode::PUSH_FROM_LOCAL, 0},
+                                   {OpCode::PUSH_FROM_LOCAL, 1},
+                                   {OpCode::PUSH_FROM_LOCAL, 1},
+                                   {OpCode::MAP_SET},
+                                   {OpCode::PUSH_FROM_LOCAL, 1},
+                                   {OpCode::INT_PUSH_CONSTANT, 1},
+                                   {OpCode::INT_ADD},
+                                   {OpCode::POP_INTO_LOCAL, 1},
+                                   {OpCode::JMP, -12},
+                                   {OpCode::PUSH_FROM_LOCAL, 0},
+                                   {OpCode::INT_PUSH_CONSTANT, 3},
+                                   {OpCode::MAP_DELETE},
+                                   {OpCode::PUSH_FROM_LOCAL, 0},
+                                   {OpCode::PUSH_FROM_PARAM, 0},
+                                   {OpCode::INT_PUSH_CONSTANT, 1},
+                                   {OpCode::INT_SUB},
+                                   {OpCode::MAP_GET},
+                                   {OpCode::INT_ADD},
+                                   {OpCode::PUSH_FROM_LOCAL, 0},
+                                   {OpCode::INT_PUSH_CONSTANT, 3},
+                                   {OpCode::MAP_HAS},
+                                   {OpCode::INT_ADD},
+                                   {OpCode::PUSH_FROM_LOCAL, 0},
+                                   {OpCode::INT_PUSH_CONSTANT, 4},
+                                   {OpCode::MAP_HAS},
+                                   {OpCode::INT_ADD},
+                                   {OpCode::FUNCTION_RETURN},
+                                   END_SECTION};
+  // missing() { m = new map; return m[1]; }
+  std::vector<Instruction> missing = {
+      {OpCode::NEW_MAP}, {OpCode::INT_PUSH_CONSTANT, 1},
+      {OpCode::MAP_GET}, {OpCode::FUNCTION_RETURN},
+      END_SECTION};
+  auto m = std::make_shared<Module>();
+  m->functions.push_back(b9::FunctionDef{"fill", fill, 1, 2});
+  m->functions.push_back(b9::FunctionDef{"missing", missing, 0, 0});
+
+  for (bool jit : {false, true}) {
+    Config cfg;
+    cfg.jit = jit;
+    b9::VirtualMachine vm{runtime, cfg};
+    vm.load(m);
+    if (jit) vm.generateAllCode();
+    // Enough keys to grow the table a few times.
+    EXPECT_EQ(Value(AS_INT48, 101), vm.run("fill", {{AS_INT48, 100}}));
+    if (!jit) {
+      EXPECT_THROW(vm.run("missing", {}), std::runtime_error);
+    }
+  }
+}
+
+TEST(MapTest, growingGoesThroughTheBarrier) {
+  // fill(n) { m = new map; for (i = 0; i < n; i = i + 1) m[i] = i; return m; }
+  std::vector<Instruction> fill = {{OpCode::NEW_MAP},
+                                   {OpCode::POP_INTO_LOCAL, 0},
+                                   {OpCode::PUSH_FROM_LOCAL, 1},
+                                   {OpCode::PUSH_FROM_PARAM, 0},
+                                   {OpCode::JMP_GE, 9},
+                                   {OpCode::PUSH_FROM_LOCAL, 0},
+                                   {OpCode::PUSH_FROM_LOCAL, 1},
+                                   {OpCode::PUSH_FROM_LOCAL, 1},
+                                   {OpCode::MAP_SET},
+                                   {OpCode::PUSH_FROM_LOCAL, 1},
+                                   {OpCode::INT_PUSH_CONSTANT, 1},
+                                   {OpCode::INT_ADD},
+                                   {OpCode::POP_INTO_LOCAL, 1},
+                                   {OpCode::JMP, -12},
+                                   {OpCode::PUSH_FROM_LOCAL, 0},
+                                   {OpCode::FUNCTION_RETURN},
+                                   END_SECTION};
+  auto m = std::make_shared<Module>();
+  m->functions.push_back(b9::FunctionDef{"fill", fill, 1, 2});
+
+  Config cfg;
+  cfg.writeBarrier = WriteBarrier::SNAPSHOT;
+  b9::VirtualMachine vm{runtime, cfg};
+  vm.load(m);
+  ExecutionContext context{vm, cfg};
+  Value map = vm.run(context, 0, {{AS_INT48, 20}});
+
+  // The table grows from 8 entries to 16, then 32, and the snapshot barrier
+  // records both of the tables and both of the value trees it replaced.
+  ASSERT_EQ(4, context.storeBuffer().size());
+  for (std::size_t i = 0; i < 4; i++) {
+    EXPECT_NE(map.getRef<Om::Object>(), context.storeBuffer()[i]);
+    for (std::size_t j = 0; j < i; j++) {
+      EXPECT_NE(context.storeBuffer()[j], context.storeBuffer()[i]);
+    }
+  }
+}
+
+TEST(MapTest, referenceValues) {
+  // objects(n) { m = new map;
+  //   for (i = 0; i < n; i = i + 1) { o = new object; o.x = i; m[i] = o; }
+  //   collect; return m[n - 1].x; }
+  std::vector<Instruction> objects = {{OpCode::NEW_MAP},
+                                      {OpCode::POP_INTO_LOCAL, 0},
+                                      {OpCode::PUSH_FROM_LOCAL, 1},
+                                      {OpCode::PUSH_FROM_PARAM, 0},
+                                      {OpCode::JMP_GE, 14},
+                                      {OpCode::NEW_OBJECT},
+                                      {OpCode::POP_INTO_LOCAL, 2},
+                                      {OpCode::PUSH_FROM_LOCAL, 1},
+                                      {OpCode::PUSH_FROM_LOCAL, 2},
+                                      {OpCode::POP_INTO_OBJECT, 0},
+                                      {OpCode::PUSH_FROM_LOCAL, 0},
+                                      {OpCode::PUSH_FROM_LOCAL, 1},
+                                      {OpCode::PUSH_FROM_LOCAL, 2},
+                                      {OpCode::MAP_SET},
+                                      {OpCode::PUSH_FROM_LOCAL, 1},
+                                      {OpCode::INT_PUSH_CONSTANT, 1},
+                                      {OpCode::INT_ADD},
+                                      {OpCode::POP_INTO_LOCAL, 1},
+                                      {OpCode::JMP, -17},
+                                      {OpCode::SYSTEM_COLLECT},
+                                      {OpCode::PUSH_FROM_LOCAL, 0},
+                                      {OpCode::PUSH_FROM_PARAM, 0},
+                                      {OpCode::INT_PUSH_CONSTANT, 1},
+                                      {OpCode::INT_SUB},
+                                      {OpCode::MAP_GET},
+                                      {OpCode::PUSH_FROM_OBJECT, 0},
+                                      {OpCode::FUNCTION_RETURN},
+                                      END_SECTION};
+  // strings() { m = new map; m[1] = "ab" + "c"; collect;
+  //   if (m[1] != "abc") return -1; return 1; }
+  std::vector<Instruction> strings = {
+      {OpCode::NEW_MAP},              {OpCode::POP_INTO_LOCAL, 0},
+      {OpCode::PUSH_FROM_LOCAL, 0},   {OpCode::INT_PUSH_CONSTANT, 1},
+      {OpCode::STR_PUSH_CONSTANT, 0}, {OpCode::STR_PUSH_CONSTANT, 1},
+      {OpCode::STR_CONCAT},           {OpCode::MAP_SET},
+      {OpCode::SYSTEM_COLLECT},       {OpCode::PUSH_FROM_LOCAL, 0},
+      {OpCode::INT_PUSH_CONSTANT, 1}, {OpCode::MAP_GET},
+      {OpCode::STR_PUSH_CONSTANT, 2}, {OpCode::JMP_NEQ, 2},
+      {OpCode::INT_PUSH_CONSTANT, 1}, {OpCode::FUNCTION_RETURN},
+      {OpCode::INT_PUSH_CONSTANT, -1}, {OpCode::FUNCTION_RETURN},
+      END_SECTION};
+  auto m = std::make_shared<Module>();
+  m->strings = {"ab", "c", "abc"};
+  m->functions.push_back(b9::FunctionDef{"objects", objects, 1, 3});
+  m->functions.push_back(b9::FunctionDef{"strings", strings, 0, 1});
+
+  b9::VirtualMachine vm{runtime, {}};
+  vm.load(m);
+  // Enough values for the value tree to have more than one level.
+  EXPECT_EQ(Value(AS_INT48, 39), vm.run("objects", {{AS_INT48, 40}}));
+  for (int n = 0; n < 10; n++) {
+    EXPECT_EQ(Value(AS_INT48, 1), vm.run("strings", {}));
+  }
+  // String values are kept as they are, rather than interned.
+  EXPECT_EQ(0, vm.strings().symbols());
+}
+
+TEST(MapTest, stringKeys) {
+  // m = new map; m["ab" + "c"] = 7; return m["abc"];
+  std::vector<Instruction> i = {
+      {OpCode::NEW_MAP},              {OpCode::POP_INTO_LOCAL, 0},
+      {OpCode::PUSH_FROM_LOCAL, 0},   {OpCode::STR_PUSH_CONSTANT, 0},
+      {OpCode::STR_PUSH_CONSTANT, 1}, {OpCode::STR_CONCAT},
+      {OpCode::INT_PUSH_CONSTANT, 7}, {OpCode::MAP_SET},
+      {OpCode::PUSH_FROM_LOCAL, 0},   {OpCode::STR_PUSH_CONSTANT, 2},
+      {OpCode::MAP_GET},              {OpCode::FUNCTION_RETURN},
+      END_SECTION};
+  auto m = std::make_shared<Module>();
+  m->strings = {"ab", "c", "abc"};
+  m->functions.push_back(b9::FunctionDef{"f", i, 0, 1});
+  b9::VirtualMachine vm{runtime, {}};
+  vm.load(m);
+  EXPECT_EQ(Value(AS_INT48, 7), vm.run("f", {}));
+}
+
+TEST(MapTest, dictionaryMode) {
+  // o = new object; o.k = k for 100 slots; return the sum of o.k;
+  constexpr std::int32_t SLOTS = 100;
+  std::vector<Instruction> i = {{OpCode::NEW_OBJECT},
+                                {OpCode::POP_INTO_LOCAL, 0}};
+  for (std::int32_t k = 0; k < SLOTS; k++) {
+    i.push_back({OpCode::INT_PUSH_CONSTANT, k});
+    i.push_back({OpCode::PUSH_FROM_LOCAL, 0});
+    i.push_back({OpCode::POP_INTO_OBJECT, k});
+  }
+  i.push_back({OpCode::INT_PUSH_CONSTANT, 0});
+  for (std::int32_t k = 0; k < SLOTS; k++) {
+    i.push_back({OpCode::PUSH_FROM_LOCAL, 0});
+    i.push_back({OpCode::PUSH_FROM_OBJECT, k});
+    i.push_back({OpCode::INT_ADD});
+  }
+  i.push_back({OpCode::FUNCTION_RETURN});
+  i.push_back(END_SECTION);
+  auto m = std::make_shared<Module>();
+  m->functions.push_back(b9::FunctionDef{"f", i, 0, 1});
+
+  Config cfg;
+  b9::VirtualMachine vm{runtime, cfg};
+  vm.load(m);
+  ExecutionContext context{vm, cfg};
+  EXPECT_EQ(Value(AS_INT48, 4950), vm.run(context, 0, {}));
+  // Past the limit, slots go in the dictionary instead of new shapes.
+  EXPECT_GT(ExecutionContext::DICTIONARY_SLOT_LIMIT + 2,
+            context.allocationStats().transitions);
+}
+
+TEST(TransitionCacheTest, lookupAndFanOut) {
+  auto shape = [](std::uintptr_t n) {
+    return reinterpret_cast<Om::ObjectMap *>(n * 16);
+  };
+  TransitionCache cache;
+  EXPECT_EQ(nullptr, cache.lookup(shape(1), 0));
+  for (Om::Id slot = 0; slot < 3; slot++) {
+    cache.insert(shape(1), slot, shape(2 + slot), {});
+  }
+  cache.insert(shape(2), 7, shape(5), {});
+  // Inserting a transition again changes nothing.
+  cache.insert(shape(1), 0, shape(2), {});
+
+  auto transition = cache.lookup(shape(1), 1);
+  ASSERT_NE(nullptr, transition);
+  EXPECT_EQ(shape(3), transition->child.getRef<Om::ObjectMap>());
+  EXPECT_EQ(nullptr, cache.lookup(shape(2), 0));
+  EXPECT_EQ(3, cache.fanOut(shape(1)));
+  EXPECT_EQ(1, cache.fanOut(shape(2)));
+  EXPECT_EQ(3, cache.maxFanOut());
+  EXPECT_EQ(4, cache.size());
+  EXPECT_FALSE(cache.isChild(shape(1)));
+  EXPECT_TRUE(cache.isChild(shape(5)));
+}
+
+TEST(ObjectTest, fanOutGoesToDictionary) {
+  // For k in 1..12: o = new object; o.0 = 1; o.k = k; total += o.k;
+  // The objects share the shape {0}, which gets a child for every k.
+  constexpr std::int32_t KEYS = 12;
+  std::vector<Instruction> i = {{OpCode::INT_PUSH_CONSTANT, 0}};
+  for (std::int32_t k = 1; k <= KEYS; k++) {
+    i.push_back({OpCode::NEW_OBJECT});
+    i.push_back({OpCode::POP_INTO_LOCAL, 0});
+    i.push_back({OpCode::INT_PUSH_CONSTANT, 1});
+    i.push_back({OpCode::PUSH_FROM_LOCAL, 0});
+    i.push_back({OpCode::POP_INTO_OBJECT, 0});
+    i.push_back({OpCode::INT_PUSH_CONSTANT, k});
+    i.push_back({OpCode::PUSH_FROM_LOCAL, 0});
+    i.push_back({OpCode::POP_INTO_OBJECT, k});
+    i.push_back({OpCode::PUSH_FROM_LOCAL, 0});
+    i.push_back({OpCode::PUSH_FROM_OBJECT, k});
+    i.push_back({OpCode::INT_ADD});
+  }
+  i.push_back({OpCode::FUNCTION_RETURN});
+  i.push_back(END_SECTION);
+  auto m = std::make_shared<Module>();
+  m->functions.push_back(b9::FunctionDef{"f", i, 0, 1});
+
+  Config cfg;
+  b9::VirtualMachine vm{runtime, cfg};
+  vm.load(m);
+  ExecutionContext context{vm, cfg};
+  EXPECT_EQ(Value(AS_INT48, 78), vm.run(context, 0, {}));
+  const std::size_t limit = ExecutionContext::SHAPE_FAN_OUT_LIMIT;
+  EXPECT_EQ(KEYS - limit, context.allocationStats().dictionaries);
+
+  // Building the same objects again reuses the cached transitions.
+  std::size_t shapes = context.allocationStats().shapes;
+  EXPECT_EQ(Value(AS_INT48, 78), vm.run(context, 0, {}));
+  EXPECT_EQ(shapes, context.allocationStats().shapes);
+  EXPECT_LT(0, context.allocationStats().transitionCacheHits);
+}
+
+TEST(ProfileTest, countsInstructions) {
+  // count(n) { i = 0; while (i < n) i = i + 1; return i; }
+  std::vector<Instruction> i = {
+      {OpCode::PUSH_FROM_LOCAL, 0}, {OpCode::PUSH_FROM_PARAM, 0},
+      {OpCode::JMP_GE, 5},          {OpCode::PUSH_FROM_LOCAL, 0},
+      {OpCode::INT_PUSH_CONSTANT, 1}, {OpCode::INT_ADD},
+      {OpCode::POP_INTO_LOCAL, 0},  {OpCode::JMP, -8},
+      {OpCode::PUSH_FROM_LOCAL, 0}, {OpCode::FUNCTION_RETURN},
+      END_SECTION};
+  auto m = std::make_shared<Module>();
+  m->functions.push_back(b9::FunctionDef{"count", i, 1, 1});
+
+  Config cfg;
+  b9::VirtualMachine vm{runtime, cfg};
+  vm.load(m);
+  {
+    ExecutionContext context{vm, cfg};
+    vm.run(context, 0, {{AS_INT48, 10}});
+    EXPECT_EQ(nullptr, context.profile());
+  }
+
+  cfg.profile = true;
+  ExecutionContext context{vm, cfg};
+  const std::int64_t n = 3000;
+  EXPECT_EQ(Value(AS_INT48, n), vm.run(context, 0, {{AS_INT48, n}}));
+  const Profile &profile = *context.profile();
+  const FunctionDef *function = vm.getFunction(0);
+  EXPECT_EQ(n, profile.count(function, 5));
+  EXPECT_EQ(n + 1, profile.count(function, 2));
+  EXPECT_EQ(1, profile.count(function, 9));
+  EXPECT_EQ(n, profile.count(OpCode::INT_ADD));
+  EXPECT_EQ(2 * n + 2, profile.count(OpCode::PUSH_FROM_LOCAL));
+  // Eight instructions per iteration, and five more to return.
+  EXPECT_EQ((8 * n + 5) / Profile::SAMPLE_INTERVAL, profile.samples());
+
+  std::stringstream report;
+  profile.report(report);
+  EXPECT_NE(std::string::npos, report.str().find("int_add"));
+}
+
+TEST(TraceTest, recordsPhases) {
+  // collect() { collect; return 0; }
+  std::vector<Instruction> i = {{OpCode::SYSTEM_COLLECT},
+                                {OpCode::INT_PUSH_CONSTANT, 0},
+                                {OpCode::FUNCTION_RETURN},
+                                END_SECTION};
+  auto m = std::make_shared<Module>();
+  m->functions.push_back(b9::FunctionDef{"collect", i, 0, 0});
+
+  Tracer &tracer = Tracer::instance();
+  tracer.clear();
+  tracer.enable();
+  Config cfg;
+  b9::VirtualMachine vm{runtime, cfg};
+  vm.load(m);
+  EXPECT_EQ(Value(AS_INT48, 0), vm.run("collect", {}));
+  tracer.disable();
+
+  std::stringstream trace;
+  tracer.write(trace);
+  tracer.clear();
+  EXPECT_NE(std::string::npos, trace.str().find("\"traceEvents\""));
+  EXPECT_NE(std::string::npos, trace.str().find("\"name\":\"load\""));
+  EXPECT_NE(std::string::npos, trace.str().find("\"name\":\"collect\""));
+  EXPECT_NE(std::string::npos,
+            trace.str().find("\"name\":\"system_collect\""));
+}
+
+TEST(PerfMapTest, mapAndJitDump) {
+  std::vector<Instruction> i = {{OpCode::INT_PUSH_CONSTANT, 7},
+                                {OpCode::FUNCTION_RETURN},
+                                END_SECTION};
+  auto m = std::make_shared<Module>();
+  m->functions.push_back(b9::FunctionDef{"perf_map_first", i, 0, 0});
+  m->functions.push_back(b9::FunctionDef{"perf_map_second", i, 0, 0});
+
+  Config cfg;
+  cfg.jit = true;
+  cfg.perfMap = true;
+  cfg.jitDump = true;
+  b9::VirtualMachine vm{runtime, cfg};
+  vm.load(m);
+  vm.generateAllCode();
+  const auto first = std::uintptr_t(vm.getJitAddress(0));
+  const auto second = std::uintptr_t(vm.getJitAddress(1));
+
+  // Each function has a line, "<start> <size> <name>", as soon as it is
+  // compiled, without waiting for the JIT to shut down.
+  std::map<std::string, std::pair<std::uintptr_t, std::size_t>> lines;
+  std::ifstream map(PerfMap::mapPath());
+  std::string line;
+  while (std::getline(map, line)) {
+    std::istringstream fields(line);
+    std::uintptr_t start;
+    std::size_t size;
+    std::string name;
+    ASSERT_TRUE(fields >> std::hex >> start >> size >> name) << line;
+    lines[name] = {start, size};
+  }
+  ASSERT_EQ(1u, lines.count("perf_map_first"));
+  ASSERT_EQ(1u, lines.count("perf_map_second"));
+  EXPECT_EQ(first, lines["perf_map_first"].first);
+  EXPECT_EQ(second, lines["perf_map_second"].first);
+  for (const auto &function : {lines["perf_map_first"],
+                               lines["perf_map_second"]}) {
+    EXPECT_LT(0u, function.second);
+    EXPECT_GE(PerfMap::MAX_CODE_SIZE, function.second);
+  }
+  if (first < second) {
+    EXPECT_LE(first + lines["perf_map_first"].second, second);
+  }
+
+  std::ifstream dumpFile(PerfMap::jitDumpPath(), std::ios::binary);
+  std::string dump{std::istreambuf_iterator<char>(dumpFile),
+                   std::istreambuf_iterator<char>()};
+  auto read32 = [&](std::size_t at) {
+    std::uint32_t value;
+    std::memcpy(&value, dump.data() + at, sizeof(value));
+    return value;
+  };
+  auto read64 = [&](std::size_t at) {
+    std::uint64_t value;
+    std::memcpy(&value, dump.data() + at, sizeof(value));
+    return value;
+  };
+
+  // The header: magic, version, header size, ELF machine, padding, pid,
+  // timestamp and flags.
+  constexpr std::size_t HEADER_SIZE = 40;
+  ASSERT_LE(HEADER_SIZE, dump.size());
+  EXPECT_EQ(0x4A695444u, read32(0));
+  EXPECT_EQ(1u, read32(4));
+  EXPECT_EQ(HEADER_SIZE, read32(8));
+  EXPECT_EQ(std::uint32_t(getpid()), read32(20));
+
+  // A code load record: id, total size, timestamp, pid, tid, vma, code
+  // address, code size and code index, then the name and the code.
+  constexpr std::size_t CODE_LOAD_SIZE = 56;
+  std::vector<std::string> names;
+  for (std::size_t at = HEADER_SIZE; at < dump.size();) {
+    ASSERT_LE(at + CODE_LOAD_SIZE, dump.size());
+    EXPECT_EQ(0u, read32(at));
+    const std::uint32_t totalSize = read32(at + 4);
+    ASSERT_LE(at + totalSize, dump.size());
+    const std::uint64_t code = read64(at + 32);
+    const std::uint64_t size = read64(at + 40);
+    EXPECT_EQ(code, read64(at + 24));
+    EXPECT_EQ(names.size(), read64(at + 48));
+    const std::string name = dump.c_str() + at + CODE_LOAD_SIZE;
+    EXPECT_EQ(CODE_LOAD_SIZE + name.size() + 1 + size, totalSize);
+    ASSERT_EQ(1u, lines.count(name));
+    EXPECT_EQ(lines[name].first, code);
+    EXPECT_EQ(lines[name].second, size);
+    EXPECT_EQ(0, std::memcmp(dump.data() + at + totalSize - size,
+                             reinterpret_cast<const void *>(code), size));
+    names.push_back(name);
+    at += totalSize;
+  }
+  EXPECT_EQ(std::vector<std::string>({"perf_map_first", "perf_map_second"}),
+            names);
+
+  std::remove(PerfMap::mapPath().c_str());
+  std::remove(PerfMap::jitDumpPath().c_str());
+}
+
+TEST(ObjectTest, collectInCompiledCode) {
+  auto m = std::make_shared<Module>();
+  // keep(o) { var0 = o; collect; return var0; }
+  std::vector<Instruction> keep = {
+      {OpCode::PUSH_FROM_PARAM, 0}, {OpCode::POP_INTO_LOCAL, 0},
+      {OpCode::SYSTEM_COLLECT},     {OpCode::PUSH_FROM_LOCAL, 0},
+      {OpCode::FUNCTION_RETURN},    END_SECTION};
+  // main() { o = new object; o.0 = "Hello, World"; return keep(o).0; }
+  std::vector<Instruction> main = {
+      {OpCode::NEW_OBJECT},          {OpCode::POP_INTO_LOCAL, 0},
+      {OpCode::STR_PUSH_CONSTANT, 0}, {OpCode::PUSH_FROM_LOCAL, 0},
+      {OpCode::POP_INTO_OBJECT, 0},  {OpCode::PUSH_FROM_LOCAL, 0},
+      {OpCode::FUNCTION_CALL, 1},    {OpCode::PUSH_FROM_OBJECT, 0},
+      {OpCode::FUNCTION_RETURN},     END_SECTION};
+  m->strings.push_back("Hello, World");
+  m->functions.push_back(b9::FunctionDef{"main", main, 0, 1});
+  m->functions.push_back(b9::FunctionDef{"keep", keep, 1, 1});
+
+  for (bool passParam : {false, true}) {
+    Config cfg;
+    cfg.jit = true;
+    cfg.directCall = true;
+    cfg.passParam = passParam;
+    b9::VirtualMachine vm{runtime, cfg};
+    vm.load(m);
+    // Compiled code can't use object slots, so only keep is compiled.
+    vm.setJitAddress(1, vm.generateCode(1));
+    ASSERT_NE(nullptr, vm.getJitAddress(1));
+    EXPECT_EQ(Value(AS_UINT48, 0), vm.run("main", {}));
+  }
 }
 
 }  // namespace test
@@ -3,6 +3,7 @@
 #include <b9/VirtualMachine.hpp>
 #include <b9/deserialize.hpp>
 #include <b9/serialize.hpp>
+#include <b9/snapshot.hpp>
 
 #include <gtest/gtest.h>
 #include <stdlib.h>
@@ -270,6 +271,178 @@ TEST(ReadBinaryTest, testCorruptModule) {
   EXPECT_THROW(deserialize(buffer2), DeserializeException);
 }
 
+void parseInChunks(std::shared_ptr<Module> module, std::size_t chunkSize) {
+  std::stringstream buffer(std::ios::in | std::ios::out | std::ios::binary);
+  serialize(buffer, *module);
+  std::string bytes = buffer.str();
+
+  std::vector<std::string> names;
+  ModuleParser parser([&](std::size_t index, const FunctionDef& function) {
+    EXPECT_EQ(index, names.size());
+    EXPECT_EQ(function.instructions.back(), END_SECTION);
+    names.push_back(function.name);
+  });
+  for (std::size_t i = 0; i < bytes.size(); i += chunkSize) {
+    parser.feed(&bytes[i], std::min(chunkSize, bytes.size() - i));
+  }
+  auto module2 = parser.finish();
+
+  EXPECT_EQ(*module, *module2);
+  EXPECT_EQ(module->strings, module2->strings);
+  EXPECT_EQ(module->functions.size(), names.size());
+  for (std::size_t i = 0; i < module->functions.size(); i++) {
+    EXPECT_EQ(module->functions[i].name, names[i]);
+    EXPECT_EQ(module->functions[i].instructions,
+              module2->functions[i].instructions);
+  }
+}
+
+TEST(ModuleParserTest, testChunkedInput) {
+  for (std::size_t chunkSize : {1, 3, 7, 4096}) {
+    parseInChunks(makeSimpleModule(), chunkSize);
+    parseInChunks(makeComplexModule(), chunkSize);
+  }
+  auto m = std::make_shared<Module>();
+  m->strings = {"", "a", ""};
+  parseInChunks(m, 1);
+}
+
+TEST(ModuleParserTest, testTruncatedInput) {
+  std::stringstream buffer(std::ios::in | std::ios::out | std::ios::binary);
+  serialize(buffer, *makeComplexModule());
+  std::string bytes = buffer.str();
+
+  ModuleParser parser;
+  parser.feed(bytes.data(), bytes.size() - 3);
+  EXPECT_FALSE(parser.atBoundary());
+  EXPECT_THROW(parser.finish(), DeserializeException);
+}
+
+std::shared_ptr<Module> makeWideModule() {
+  auto m = std::make_shared<Module>();
+  std::vector<Instruction> i = {{OpCode::INT_PUSH_CONSTANT, -5},
+                                {},
+                                {},
+                                {OpCode::INT_ADD},
+                                {OpCode::FUNCTION_RETURN},
+                                END_SECTION};
+  setWideImmediate(OpCode::INT_PUSH_CONSTANT_WIDE, WIDE_IMMEDIATE_MIN, i[1],
+                   i[2]);
+  m->functions.push_back(b9::FunctionDef{"wide", i, 0, 0});
+  return m;
+}
+
+TEST(CompactEncodingTest, testWideImmediate) {
+  for (std::int64_t value : {WIDE_IMMEDIATE_MIN, WIDE_IMMEDIATE_MAX,
+                             IMMEDIATE_MAX + 1, IMMEDIATE_MIN - 1,
+                             std::int64_t(-1), std::int64_t(0)}) {
+    Instruction low, high;
+    setWideImmediate(OpCode::INT_PUSH_CONSTANT_WIDE, value, low, high);
+    EXPECT_EQ(value, wideImmediate(low, high));
+    EXPECT_NE(low, END_SECTION);
+    EXPECT_NE(high, END_SECTION);
+  }
+}
+
+TEST(CompactEncodingTest, testRoundTrip) {
+  for (auto module : {makeSimpleModule(), makeComplexModule(),
+                      makeWideModule()}) {
+    std::stringstream fixed(std::ios::in | std::ios::out | std::ios::binary);
+    serialize(fixed, *module);
+    std::stringstream compact(std::ios::in | std::ios::out | std::ios::binary);
+    serialize(compact, *module, InstructionEncoding::COMPACT);
+    EXPECT_LT(compact.str().size(), fixed.str().size());
+
+    auto module2 = deserialize(compact);
+    EXPECT_EQ(*module, *module2);
+    for (std::size_t i = 0; i < module->functions.size(); i++) {
+      EXPECT_EQ(module->functions[i].instructions,
+                module2->functions[i].instructions);
+    }
+
+    // Read the function section back through the std::istream reader.
+    std::stringstream in(compact.str());
+    in.seekg(8);
+    std::uint32_t sectionCode;
+    ASSERT_TRUE(readNumber(in, sectionCode));
+    ASSERT_EQ(std::uint32_t(SectionCode::COMPACT_FUNCTION), sectionCode);
+    std::vector<FunctionDef> functions3;
+    readFunctionSection(in, functions3, true);
+    EXPECT_EQ(module->functions, functions3);
+  }
+}
+
+TEST(CompactEncodingTest, testChunkedInput) {
+  std::stringstream buffer(std::ios::in | std::ios::out | std::ios::binary);
+  serialize(buffer, *makeWideModule(), InstructionEncoding::COMPACT);
+  std::string bytes = buffer.str();
+
+  ModuleParser parser;
+  for (char byte : bytes) {
+    parser.feed(&byte, 1);
+  }
+  auto module = parser.finish();
+  EXPECT_EQ(makeWideModule()->functions[0].instructions,
+            module->functions[0].instructions);
+}
+
+TEST(ChecksumTest, testChecksumVerified) {
+  std::stringstream buffer(std::ios::in | std::ios::out | std::ios::binary);
+  serialize(buffer, *makeComplexModule());
+  std::string bytes = buffer.str();
+
+  ModuleParser parser;
+  parser.feed(bytes.data(), bytes.size());
+  EXPECT_TRUE(parser.checksumVerified());
+  EXPECT_EQ(*makeComplexModule(), *parser.finish());
+}
+
+TEST(ChecksumTest, testCorruptByte) {
+  std::stringstream buffer(std::ios::in | std::ios::out | std::ios::binary);
+  serialize(buffer, *makeComplexModule());
+  std::string bytes = buffer.str();
+
+  // Flip a bit in the last string, which still parses as a valid module.
+  bytes[bytes.size() - 13] ^= 0x20;
+  std::stringstream corrupt(bytes);
+  EXPECT_THROW(deserialize(corrupt), DeserializeException);
+}
+
+Snapshot makeSnapshot() {
+  Snapshot snapshot;
+  snapshot.module = makeComplexModule();
+  snapshot.primitives = {{1}, {1}, {0}};
+  snapshot.summaries.resize(snapshot.module->functions.size());
+  snapshot.summaries[1].verified = true;
+  snapshot.summaries[1].maxStackDepth = 7;
+  return snapshot;
+}
+
+TEST(SnapshotTest, testRoundTrip) {
+  std::stringstream buffer(std::ios::in | std::ios::out | std::ios::binary);
+  writeSnapshot(buffer, makeSnapshot());
+  std::string bytes = buffer.str();
+
+  auto snapshot = readSnapshot(bytes.data(), bytes.size());
+  EXPECT_EQ(*makeComplexModule(), *snapshot.module);
+  EXPECT_EQ(3, snapshot.primitives.size());
+  EXPECT_EQ(0, snapshot.primitives[2].arity);
+  ASSERT_EQ(3, snapshot.summaries.size());
+  EXPECT_FALSE(snapshot.summaries[0].verified);
+  EXPECT_TRUE(snapshot.summaries[1].verified);
+  EXPECT_EQ(7, snapshot.summaries[1].maxStackDepth);
+}
+
+TEST(SnapshotTest, testCorruptSnapshot) {
+  std::stringstream buffer(std::ios::in | std::ios::out | std::ios::binary);
+  writeSnapshot(buffer, makeSnapshot());
+  std::string bytes = buffer.str();
+
+  EXPECT_THROW(readSnapshot(bytes.data(), bytes.size() - 1), SnapshotException);
+  bytes[20] ^= 1;
+  EXPECT_THROW(readSnapshot(bytes.data(), bytes.size()), SnapshotException);
+}
+
 TEST(ReadBinaryTest, runValidModule) {
   auto m1 = makeSimpleModule();
   std::stringstream buffer(std::ios::in | std::ios::out | std::ios::binary);
@@ -0,0 +1,65 @@
+#include <b9/Safepoint.hpp>
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace b9 {
+namespace test {
+
+TEST(SafepointTest, testStopTheWorld) {
+  Safepoint safepoint;
+  std::atomic<bool> done{false};
+  std::atomic<long> progress{0};
+
+  std::vector<std::thread> workers;
+  for (int i = 0; i < 4; i++) {
+    workers.emplace_back([&] {
+      Safepoint::Scope attached(safepoint);
+      while (!done) {
+        progress++;
+        safepoint.poll();
+      }
+    });
+  }
+
+  Safepoint::Scope attached(safepoint);
+  for (int i = 0; i < 100; i++) {
+    safepoint.stop();
+    long before = progress;
+    std::this_thread::yield();
+    EXPECT_EQ(before, progress);
+    safepoint.resume();
+  }
+
+  done = true;
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
+
+TEST(SafepointTest, testCompetingStops) {
+  Safepoint safepoint;
+  std::atomic<int> inside{0};
+
+  std::vector<std::thread> workers;
+  for (int i = 0; i < 4; i++) {
+    workers.emplace_back([&] {
+      Safepoint::Scope attached(safepoint);
+      for (int j = 0; j < 100; j++) {
+        safepoint.stop();
+        EXPECT_EQ(1, ++inside);
+        --inside;
+        safepoint.resume();
+        safepoint.poll();
+      }
+    });
+  }
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
+
+}  // namespace test
+}  // namespace b9
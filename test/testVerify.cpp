@@ -0,0 +1,201 @@
+#include <b9/Module.hpp>
+#include <b9/instructions.hpp>
+#include <b9/verify.hpp>
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <vector>
+
+namespace b9 {
+namespace test {
+
+const std::vector<PrimitiveSignature> primitives = {{1}, {1}, {0}};
+
+FunctionSummary verify(std::vector<Instruction> instructions,
+                       std::uint32_t nparams = 0, std::uint32_t nlocals = 0) {
+  Module module;
+  module.functions.push_back(FunctionDef{"f", instructions, nparams, nlocals});
+  module.strings = {"hello"};
+  return verifyFunction(module, 0, primitives);
+}
+
+TEST(VerifyTest, testStraightLine) {
+  EXPECT_TRUE(verify({{OpCode::PUSH_FROM_PARAM, 0},
+                      {OpCode::PUSH_FROM_PARAM, 1},
+                      {OpCode::INT_ADD},
+                      {OpCode::POP_INTO_LOCAL, 0},
+                      {OpCode::STR_PUSH_CONSTANT, 0},
+                      {OpCode::PRIMITIVE_CALL, 0},
+                      {OpCode::FUNCTION_RETURN},
+                      END_SECTION},
+                     2, 1)
+                  .verified);
+}
+
+TEST(VerifyTest, testLoop) {
+  // while (i < 10) { i = i + 1; } return i;
+  EXPECT_TRUE(verify({{OpCode::INT_PUSH_CONSTANT, 0},
+                      {OpCode::POP_INTO_LOCAL, 0},
+                      {OpCode::JMP, 4},
+                      {OpCode::PUSH_FROM_LOCAL, 0},
+                      {OpCode::INT_PUSH_CONSTANT, 1},
+                      {OpCode::INT_ADD},
+                      {OpCode::POP_INTO_LOCAL, 0},
+                      {OpCode::PUSH_FROM_LOCAL, 0},
+                      {OpCode::INT_PUSH_CONSTANT, 10},
+                      {OpCode::JMP_LT, -7},
+                      {OpCode::PUSH_FROM_LOCAL, 0},
+                      {OpCode::FUNCTION_RETURN},
+                      END_SECTION},
+                     0, 1)
+                  .verified);
+}
+
+TEST(VerifyTest, testMaxStackDepth) {
+  EXPECT_EQ(0, verify({{OpCode::JMP, -1}, END_SECTION}).maxStackDepth);
+  EXPECT_EQ(3, verify({{OpCode::INT_PUSH_CONSTANT, 1},
+                       {OpCode::INT_PUSH_CONSTANT, 2},
+                       {OpCode::INT_PUSH_CONSTANT, 3},
+                       {OpCode::INT_ADD},
+                       {OpCode::INT_ADD},
+                       {OpCode::DUPLICATE},
+                       {OpCode::INT_ADD},
+                       {OpCode::FUNCTION_RETURN},
+                       END_SECTION})
+                   .maxStackDepth);
+}
+
+TEST(VerifyTest, testUnderflow) {
+  EXPECT_THROW(verify({{OpCode::INT_PUSH_CONSTANT, 1},
+                       {OpCode::INT_ADD},
+                       {OpCode::FUNCTION_RETURN},
+                       END_SECTION}),
+               VerifyException);
+}
+
+TEST(VerifyTest, testBadOperands) {
+  EXPECT_THROW(verify({{OpCode::PUSH_FROM_LOCAL, 0},
+                       {OpCode::FUNCTION_RETURN},
+                       END_SECTION}),
+               VerifyException);
+  EXPECT_THROW(verify({{OpCode::STR_PUSH_CONSTANT, 1},
+                       {OpCode::FUNCTION_RETURN},
+                       END_SECTION}),
+               VerifyException);
+  EXPECT_THROW(verify({{OpCode::FUNCTION_CALL, 1},
+                       {OpCode::FUNCTION_RETURN},
+                       END_SECTION}),
+               VerifyException);
+  EXPECT_THROW(verify({{OpCode::PRIMITIVE_CALL, 3},
+                       {OpCode::FUNCTION_RETURN},
+                       END_SECTION}),
+               VerifyException);
+}
+
+TEST(VerifyTest, testBadControlFlow) {
+  // Jump out of the function.
+  EXPECT_THROW(verify({{OpCode::JMP, 5}, END_SECTION}), VerifyException);
+  // Fall off the end.
+  EXPECT_THROW(verify({{OpCode::INT_PUSH_CONSTANT, 1}, END_SECTION}),
+               VerifyException);
+  // Different stack depths where the branches merge.
+  EXPECT_THROW(verify({{OpCode::INT_PUSH_CONSTANT, 1},
+                       {OpCode::INT_PUSH_CONSTANT, 1},
+                       {OpCode::JMP_EQ, 1},
+                       {OpCode::INT_PUSH_CONSTANT, 1},
+                       {OpCode::INT_PUSH_CONSTANT, 1},
+                       {OpCode::FUNCTION_RETURN},
+                       END_SECTION}),
+               VerifyException);
+}
+
+TEST(VerifyTest, testWideInstruction) {
+  std::vector<Instruction> i = {{}, {}, {OpCode::FUNCTION_RETURN}, END_SECTION};
+  setWideImmediate(OpCode::INT_PUSH_CONSTANT_WIDE, WIDE_IMMEDIATE_MAX, i[0],
+                   i[1]);
+  EXPECT_TRUE(verify(i).verified);
+
+  // Jump into the high half of the wide instruction.
+  std::vector<Instruction> j = {{OpCode::JMP, 1}, {}, {},
+                                {OpCode::FUNCTION_RETURN}, END_SECTION};
+  setWideImmediate(OpCode::INT_PUSH_CONSTANT_WIDE, WIDE_IMMEDIATE_MAX, j[1],
+                   j[2]);
+  EXPECT_THROW(verify(j), VerifyException);
+}
+
+TEST(VerifyTest, testRefMaps) {
+  // f(p) { local0 = new object; local1 = 1; collect; return p; }
+  Module module;
+  std::vector<Instruction> i = {{OpCode::NEW_OBJECT},
+                                {OpCode::POP_INTO_LOCAL, 0},
+                                {OpCode::INT_PUSH_CONSTANT, 1},
+                                {OpCode::POP_INTO_LOCAL, 1},
+                                {OpCode::SYSTEM_COLLECT},
+                                {OpCode::PUSH_FROM_PARAM, 0},
+                                {OpCode::FUNCTION_RETURN},
+                                END_SECTION};
+  module.functions.push_back(FunctionDef{"f", i, 1, 2});
+  auto maps = computeRefMaps(module, 0, primitives);
+  ASSERT_EQ(i.size(), maps.size());
+
+  EXPECT_TRUE(maps[0].present);
+  EXPECT_EQ(std::vector<bool>({true, false, false}), maps[0].slots);
+  EXPECT_FALSE(maps[2].present);
+  ASSERT_TRUE(maps[4].present);
+  EXPECT_EQ(std::vector<bool>({true, true, false}), maps[4].slots);
+
+  // Slots beyond the map may hold anything.
+  EXPECT_TRUE(maps[4].mayRef(3));
+}
+
+TEST(VerifyTest, testInBoundsAccesses) {
+  // sum(n) { a = new array(n); for (i = 0; i < a.length; i = i + 1) {
+  //   a[i] = i; total = total + a[i]; } return total; }
+  // get(a, i) { return a[i]; }
+  Module module;
+  std::vector<Instruction> sum = {{OpCode::PUSH_FROM_PARAM, 0},
+                                  {OpCode::NEW_ARRAY},
+                                  {OpCode::POP_INTO_LOCAL, 0},
+                                  {OpCode::PUSH_FROM_LOCAL, 1},
+                                  {OpCode::PUSH_FROM_LOCAL, 0},
+                                  {OpCode::ARRAY_LENGTH},
+                                  {OpCode::JMP_GE, 15},
+                                  {OpCode::PUSH_FROM_LOCAL, 0},
+                                  {OpCode::PUSH_FROM_LOCAL, 1},
+                                  {OpCode::PUSH_FROM_LOCAL, 1},
+                                  {OpCode::POP_INTO_ARRAY},
+                                  {OpCode::PUSH_FROM_LOCAL, 2},
+                                  {OpCode::PUSH_FROM_LOCAL, 0},
+                                  {OpCode::PUSH_FROM_LOCAL, 1},
+                                  {OpCode::PUSH_FROM_ARRAY},
+                                  {OpCode::INT_ADD},
+                                  {OpCode::POP_INTO_LOCAL, 2},
+                                  {OpCode::PUSH_FROM_LOCAL, 1},
+                                  {OpCode::INT_PUSH_CONSTANT, 1},
+                                  {OpCode::INT_ADD},
+                                  {OpCode::POP_INTO_LOCAL, 1},
+                                  {OpCode::JMP, -19},
+                                  {OpCode::PUSH_FROM_LOCAL, 2},
+                                  {OpCode::FUNCTION_RETURN},
+                                  END_SECTION};
+  std::vector<Instruction> get = {
+      {OpCode::PUSH_FROM_PARAM, 0}, {OpCode::PUSH_FROM_PARAM, 1},
+      {OpCode::PUSH_FROM_ARRAY},    {OpCode::FUNCTION_RETURN},
+      END_SECTION};
+  module.functions.push_back(FunctionDef{"sum", sum, 1, 3});
+  module.functions.push_back(FunctionDef{"get", get, 2, 0});
+  ASSERT_TRUE(verifyFunction(module, 0, primitives).verified);
+  ASSERT_TRUE(verifyFunction(module, 1, primitives).verified);
+
+  auto inBounds = findInBoundsAccesses(module, 0, primitives);
+  ASSERT_EQ(sum.size(), inBounds.size());
+  EXPECT_TRUE(inBounds[10]);
+  EXPECT_TRUE(inBounds[14]);
+  EXPECT_EQ(2, std::count(inBounds.begin(), inBounds.end(), true));
+
+  // Nothing is known about the params.
+  EXPECT_FALSE(findInBoundsAccesses(module, 1, primitives)[2]);
+}
+
+}  // namespace test
+}  // namespace b9